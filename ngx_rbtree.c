@@ -19,9 +19,11 @@
 static inline void ngx_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static inline void ngx_rbtree_left_rotate(ngx_rbtree_node_t **root,
-    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug);
 static inline void ngx_rbtree_right_rotate(ngx_rbtree_node_t **root,
-    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug);
 
 
 static inline ngx_rbtree_node_t *
@@ -37,59 +39,76 @@ ngx_rbtree_min(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
 }
 
 
-static inline void
+/* recompute the value of node, the leaves are passed as NULL */
+static inline int
+ngx_rbtree_augment_node(ngx_rbtree_augment_t const *aug,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    return aug->update(node,
+        node->left == sentinel ? NULL : node->left,
+        node->right == sentinel ? NULL : node->right,
+        aug->ctx);
+}
+
+
+/* returns 1 if the black height of the tree grew */
+static inline uint64_t
 ngx_rbtree_rebalance(ngx_rbtree_node_t **root, ngx_rbtree_node_t *node,
-    ngx_rbtree_node_t *sentinel)
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_augment_t const *aug)
 {
     /* re-balance tree */
     ngx_rbtree_node_t *temp;
 
-    while (node != *root && ngx_rbt_is_red(node->parent)) {
+    while (node != *root && ngx_rbt_is_red(ngx_rbt_parent(node))) {
 
-        if (node->parent == node->parent->parent->left) {
-            temp = node->parent->parent->right;
+        if (ngx_rbt_parent(node) == ngx_rbt_parent(ngx_rbt_parent(node))->left) {
+            temp = ngx_rbt_parent(ngx_rbt_parent(node))->right;
 
             if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
                 ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                node = ngx_rbt_parent(ngx_rbt_parent(node));
 
             } else {
-                if (node == node->parent->right) {
-                    node = node->parent;
-                    ngx_rbtree_left_rotate(root, sentinel, node);
+                if (node == ngx_rbt_parent(node)->right) {
+                    node = ngx_rbt_parent(node);
+                    ngx_rbtree_left_rotate(root, sentinel, node, aug);
                 }
 
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_rbtree_right_rotate(root, sentinel, node->parent->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                ngx_rbtree_right_rotate(root, sentinel, ngx_rbt_parent(ngx_rbt_parent(node)), aug);
             }
 
         } else {
-            temp = node->parent->parent->left;
+            temp = ngx_rbt_parent(ngx_rbt_parent(node))->left;
 
             if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
                 ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                node = ngx_rbt_parent(ngx_rbt_parent(node));
 
             } else {
-                if (node == node->parent->left) {
-                    node = node->parent;
-                    ngx_rbtree_right_rotate(root, sentinel, node);
+                if (node == ngx_rbt_parent(node)->left) {
+                    node = ngx_rbt_parent(node);
+                    ngx_rbtree_right_rotate(root, sentinel, node, aug);
                 }
 
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_rbtree_left_rotate(root, sentinel, node->parent->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                ngx_rbtree_left_rotate(root, sentinel, ngx_rbt_parent(ngx_rbt_parent(node)), aug);
             }
         }
     }
 
-    ngx_rbt_black(*root);
-    return;
+    if (ngx_rbt_is_red(*root)) {
+        ngx_rbt_black(*root);
+        return 1;
+    }
+
+    return 0;
 }
 
 
@@ -104,7 +123,7 @@ ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
     sentinel = tree->sentinel;
 
     if (*root == sentinel) {
-        node->parent = NULL;
+        ngx_rbt_set_parent(node, NULL);
         node->left = sentinel;
         node->right = sentinel;
         ngx_rbt_black(node);
@@ -115,11 +134,212 @@ ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 
     ngx_rbtree_insert_value(*root, node, sentinel);
 
-    ngx_rbtree_rebalance(root, node, sentinel);
+    ngx_rbtree_rebalance(root, node, sentinel, NULL);
+    return;
+}
+
+
+void
+ngx_rbtree_augment_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_insert_from(tree, node, NULL, aug);
+}
+
+
+/*
+ * hinted insert, added 2026/10/17
+ *
+ * the descent from a node gives the same position as that from the root if
+ * key is below the nearest ancestor the node is on the left of, and not
+ * below the nearest one it is on the right of. one of the two bounds holds
+ * for any ancestor of hint by the side key lies on, so the climb looks only
+ * for the other.
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_hint_start(ngx_rbtree_node_t *hint, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t  *node, *parent, *start;
+
+    start = hint;
+    node = hint;
+
+    for (parent = ngx_rbt_parent(node); parent != NULL;
+         node = parent, parent = ngx_rbt_parent(parent))
+    {
+        if (key >= hint->key && node == parent->left) {
+            if (key < parent->key) {
+                break;
+            }
+            start = parent;
+
+        } else if (key < hint->key && node == parent->right) {
+            if (key >= parent->key) {
+                break;
+            }
+            start = parent;
+        }
+    }
+
+    return start;
+}
+
+
+void
+ngx_rbtree_insert_from(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *start, ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_node_t  **root, *sentinel, *temp;
+
+    root = (ngx_rbtree_node_t **) &tree->root;
+    sentinel = tree->sentinel;
+
+    if (*root == sentinel) {
+        ngx_rbtree_insert(tree, node);
+        if (aug != NULL) {
+            ngx_rbtree_augment_node(aug, node, sentinel);
+        }
+        return;
+    }
+
+    ngx_rbtree_insert_value(start != NULL ? start : *root, node, sentinel);
+
+    if (aug != NULL) {
+        /* the value of the new leaf is undefined, so its parent is always visited */
+        ngx_rbtree_augment_node(aug, node, sentinel);
+        temp = ngx_rbt_parent(node);
+        while (temp != NULL && ngx_rbtree_augment_node(aug, temp, sentinel)) {
+            temp = ngx_rbt_parent(temp);
+        }
+    }
+
+    ngx_rbtree_rebalance(root, node, sentinel, aug);
+    return;
+}
+
+
+/*
+ * link node as the left (dir == 0) or right (dir == 1) child of parent, which
+ * the caller found by its own descent, and rebalance. parent is NULL if the
+ * tree is empty. added 2026/10/17
+ */
+void
+ngx_rbtree_insert_at(ngx_rbtree_t *tree, ngx_rbtree_node_t *parent,
+    uint64_t dir, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *sentinel;
+
+    sentinel = tree->sentinel;
+
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_set_parent(node, parent);
+
+    if (parent == NULL) {
+        ngx_rbt_black(node);
+        tree->root = node;
+        return;
+    }
+
+    if (dir) {
+        parent->right = node;
+
+    } else {
+        parent->left = node;
+    }
+
+    ngx_rbt_red(node);
+    ngx_rbtree_rebalance(&tree->root, node, sentinel, NULL);
     return;
 }
 
 
+/*
+ * insert node unless a node of the same key is on the way down, which is
+ * returned instead with the tree untouched. NULL if node was linked.
+ * added 2026/10/17
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_insert_unique(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_node_t  **p, *parent, *sentinel, *temp;
+
+    sentinel = tree->sentinel;
+    parent = NULL;
+    p = &tree->root;
+
+    while (*p != sentinel) {
+        temp = *p;
+
+        if (node->key == temp->key) {
+            return temp;
+        }
+
+        parent = temp;
+        p = (node->key < temp->key) ? &temp->left : &temp->right;
+    }
+
+    *p = node;
+    ngx_rbt_set_parent(node, parent);
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+
+    if (aug != NULL) {
+        ngx_rbtree_augment_node(aug, node, sentinel);
+        temp = parent;
+        while (temp != NULL && ngx_rbtree_augment_node(aug, temp, sentinel)) {
+            temp = ngx_rbt_parent(temp);
+        }
+    }
+
+    ngx_rbtree_rebalance(&tree->root, node, sentinel, aug);
+    return NULL;
+}
+
+
+/*
+ * put node in the place of old, taking over its links and color. the key
+ * of node must fit in between the neighbors of old. added 2026/10/17
+ */
+void
+ngx_rbtree_replace(ngx_rbtree_t *tree, ngx_rbtree_node_t *old,
+    ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *parent, *sentinel;
+
+    sentinel = tree->sentinel;
+    parent = ngx_rbt_parent(old);
+
+    node->left = old->left;
+    node->right = old->right;
+    ngx_rbt_set_parent(node, parent);
+    ngx_rbt_copy_color(node, old);
+#ifndef RBTREE_COMPACT_NODE
+    node->size = old->size;
+#endif
+
+    if (parent == NULL) {
+        tree->root = node;
+
+    } else if (parent->left == old) {
+        parent->left = node;
+
+    } else {
+        parent->right = node;
+    }
+
+    if (node->left != sentinel) {
+        ngx_rbt_set_parent(node->left, node);
+    }
+
+    if (node->right != sentinel) {
+        ngx_rbt_set_parent(node->right, node);
+    }
+}
+
+
 static inline void
 ngx_rbtree_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
     ngx_rbtree_node_t *sentinel)
@@ -138,7 +358,7 @@ ngx_rbtree_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
     }
 
     *p = node;
-    node->parent = temp;
+    ngx_rbt_set_parent(node, temp);
     node->left = sentinel;
     node->right = sentinel;
     ngx_rbt_red(node);
@@ -146,11 +366,13 @@ ngx_rbtree_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
 }
 
 
-void
-ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+/* inlined into both, so that the plain delete has no trace of aug */
+static inline __attribute__((always_inline)) void
+ngx_rbtree_delete_intl(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug)
 {
     uint8_t           red;
-    ngx_rbtree_node_t  **root, *sentinel, *subst, *temp, *w;
+    ngx_rbtree_node_t  **root, *sentinel, *subst, *temp, *parent, *w;
 
     /* a binary tree delete */
 
@@ -159,7 +381,7 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 
     debug("root(%p), root->parent(%p), root->left(%p), root->right(%p), sentinel(%p)",
         *root,
-        (*root)->parent,
+        ngx_rbt_parent(*root),
         (*root)->left,
         (*root)->right,
         sentinel);
@@ -193,14 +415,16 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
         debug("subst == root, temp(%p), subst(%p), node(%p)", temp, subst, node);
 
         *root = temp;
-        temp->parent = NULL;
-        ngx_rbt_black(temp);
+
+        if (temp != sentinel) {
+            ngx_rbt_set_parent(temp, NULL);
+            ngx_rbt_black(temp);
+        }
 
         /* DEBUG stuff */
         node->left = NULL;
         node->right = NULL;
-        node->parent = NULL;
-        node->key = 0;
+        ngx_rbt_set_parent(node, NULL);
 
         return;
     }
@@ -209,59 +433,74 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 
     red = ngx_rbt_is_red(subst);
 
-    if (subst == subst->parent->left) {
+    if (subst == ngx_rbt_parent(subst)->left) {
         debug("subst == parent->left");
-        subst->parent->left = temp;
+        ngx_rbt_parent(subst)->left = temp;
 
     } else {
         debug("subst == parent->right");
-        subst->parent->right = temp;
+        ngx_rbt_parent(subst)->right = temp;
     }
 
     if (subst == node) {
         debug("subst == node, temp(%p), subst(%p)", temp, subst);
 
-        temp->parent = subst->parent;
+        parent = ngx_rbt_parent(subst);
 
     } else {
 
-        if (subst->parent == node) {
-            temp->parent = subst;
+        if (ngx_rbt_parent(subst) == node) {
+            parent = subst;
 
         } else {
-            temp->parent = subst->parent;
+            parent = ngx_rbt_parent(subst);
         }
 
         subst->left = node->left;
         subst->right = node->right;
-        subst->parent = node->parent;
+        ngx_rbt_set_parent(subst, ngx_rbt_parent(node));
         ngx_rbt_copy_color(subst, node);
 
         if (node == *root) {
             *root = subst;
 
         } else {
-            if (node == node->parent->left) {
-                node->parent->left = subst;
+            if (node == ngx_rbt_parent(node)->left) {
+                ngx_rbt_parent(node)->left = subst;
             } else {
-                node->parent->right = subst;
+                ngx_rbt_parent(node)->right = subst;
             }
         }
 
         if (subst->left != sentinel) {
-            subst->left->parent = subst;
+            ngx_rbt_set_parent(subst->left, subst);
         }
 
         if (subst->right != sentinel) {
-            subst->right->parent = subst;
+            ngx_rbt_set_parent(subst->right, subst);
+        }
+    }
+
+    /* the sentinel is shared, its parent is tracked in parent instead */
+    if (temp != sentinel) {
+        ngx_rbt_set_parent(temp, parent);
+    }
+
+    if (aug != NULL) {
+        /*
+         * the subtrees changed from the parent of temp up to the root, which
+         * include the new position of subst. subst holds a stale value, so
+         * the propagation does not stop early.
+         */
+        for (w = parent; w != NULL; w = ngx_rbt_parent(w)) {
+            ngx_rbtree_augment_node(aug, w, sentinel);
         }
     }
 
     /* DEBUG stuff */
     node->left = NULL;
     node->right = NULL;
-    node->parent = NULL;
-    node->key = 0;
+    ngx_rbt_set_parent(node, NULL);
 
     if (red) {
         return;
@@ -271,65 +510,67 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 
     while (temp != *root && ngx_rbt_is_black(temp)) {
 
-        if (temp == temp->parent->left) {
-            w = temp->parent->right;
-            debug("temp(%p), parent(%p), w(%p)", temp, temp->parent, w);
+        if (temp == parent->left) {
+            w = parent->right;
+            debug("temp(%p), parent(%p), w(%p)", temp, parent, w);
 
             if (ngx_rbt_is_red(w)) {
                 ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
-                w = temp->parent->right;
+                ngx_rbt_red(parent);
+                ngx_rbtree_left_rotate(root, sentinel, parent, aug);
+                w = parent->right;
             }
-            debug("temp(%p), parent(%p), w(%p)", temp, temp->parent, w);
+            debug("temp(%p), parent(%p), w(%p)", temp, parent, w);
 
             if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
                 ngx_rbt_red(w);
-                temp = temp->parent;
+                temp = parent;
+                parent = ngx_rbt_parent(temp);
 
             } else {
                 if (ngx_rbt_is_black(w->right)) {
                     ngx_rbt_black(w->left);
                     ngx_rbt_red(w);
-                    ngx_rbtree_right_rotate(root, sentinel, w);
-                    w = temp->parent->right;
+                    ngx_rbtree_right_rotate(root, sentinel, w, aug);
+                    w = parent->right;
                 }
 
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
+                ngx_rbt_copy_color(w, parent);
+                ngx_rbt_black(parent);
                 ngx_rbt_black(w->right);
-                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
+                ngx_rbtree_left_rotate(root, sentinel, parent, aug);
                 temp = *root;
             }
 
         } else {
-            w = temp->parent->left;
-            debug("temp(%p), parent(%p), w(%p)", temp, temp->parent, w);
+            w = parent->left;
+            debug("temp(%p), parent(%p), w(%p)", temp, parent, w);
 
             if (ngx_rbt_is_red(w)) {
                 ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
-                w = temp->parent->left;
+                ngx_rbt_red(parent);
+                ngx_rbtree_right_rotate(root, sentinel, parent, aug);
+                w = parent->left;
             }
-            debug("temp(%p), parent(%p), w(%p)", temp, temp->parent, w);
+            debug("temp(%p), parent(%p), w(%p)", temp, parent, w);
 
             if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
                 ngx_rbt_red(w);
-                temp = temp->parent;
+                temp = parent;
+                parent = ngx_rbt_parent(temp);
 
             } else {
                 if (ngx_rbt_is_black(w->left)) {
                     ngx_rbt_black(w->right);
                     ngx_rbt_red(w);
-                    ngx_rbtree_left_rotate(root, sentinel, w);
-                    w = temp->parent->left;
+                    ngx_rbtree_left_rotate(root, sentinel, w, aug);
+                    w = parent->left;
                 }
 
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
+                ngx_rbt_copy_color(w, parent);
+                ngx_rbt_black(parent);
                 ngx_rbt_black(w->left);
-                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
+                ngx_rbtree_right_rotate(root, sentinel, parent, aug);
                 temp = *root;
             }
         }
@@ -339,90 +580,84 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 }
 
 
-ngx_rbtree_node_t *
-ngx_rbtree_find_key(ngx_rbtree_t *tree, int64_t key)
+void
+ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_delete_intl(tree, node, NULL);
+}
+
+
+void
+ngx_rbtree_augment_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_delete_intl(tree, node, aug);
+}
+
+
+void
+ngx_rbtree_augment_update(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_augment_t const *aug)
+{
+    while (node != NULL && ngx_rbtree_augment_node(aug, node, tree->sentinel)) {
+        node = ngx_rbt_parent(node);
+    }
+}
+
+
+/*
+ * lower-bound descent to the bottom, as the equal keys may lie on both
+ * sides of a node after rotations. *lt is the last node below key on the
+ * path, which is the predecessor of the result. fixed 2026/10/17
+ */
+static inline ngx_rbtree_node_t *
+ngx_rbtree_lower_bound(ngx_rbtree_t *tree, ngx_rbtree_key_t key,
+    ngx_rbtree_node_t **lt)
 {
     ngx_rbtree_node_t *node = tree->root;
     ngx_rbtree_node_t *sentinel = tree->sentinel;
+    ngx_rbtree_node_t *ge = NULL;
 
+    *lt = NULL;
     while(node != sentinel) {
-        if(key < node->key) {
-            node = node->left;
-        } else if(key > node->key) {
+        if(node->key < key) {
+            *lt = node;
             node = node->right;
         } else {
-            /* key == node->key */
-            while(node->left != sentinel && key == node->left->key) {
-                node = node->left;
-            }
-            return(node);
+            ge = node;
+            node = node->left;
         }
     }
-    return(NULL);
+    return(ge);
 }
 
 
 ngx_rbtree_node_t *
-ngx_rbtree_find_key_right(ngx_rbtree_t *tree, int64_t key)
+ngx_rbtree_find_key(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
 {
-    ngx_rbtree_node_t *node = tree->root;
-    ngx_rbtree_node_t *sentinel = tree->sentinel;
+    ngx_rbtree_node_t *ge, *lt;
 
-    if(node == sentinel) {
-        return(NULL);
-    }
-    for(;;) {
-        if(key < node->key) {
-            if(node->left == sentinel) {
-                return(node);
-            }
-            node = node->left;
-        } else if(key > node->key) {
-            if(node->right == sentinel) {
-                return(ngx_rbtree_find_right(tree, node));
-            }
-            node = node->right;
-        } else {
-            /* key == node->key */
-            while(node->left != sentinel && key == node->left->key) {
-                node = node->left;
-            }
-            return(node);
-        }
-    }
-    return(NULL);
+    ge = ngx_rbtree_lower_bound(tree, key, &lt);
+    return((ge != NULL && ge->key == key) ? ge : NULL);
 }
 
 
 ngx_rbtree_node_t *
-ngx_rbtree_find_key_left(ngx_rbtree_t *tree, int64_t key)
+ngx_rbtree_find_key_right(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
 {
-    ngx_rbtree_node_t *node = tree->root;
-    ngx_rbtree_node_t *sentinel = tree->sentinel;
+    ngx_rbtree_node_t *lt;
 
-    if(node == sentinel) {
-        return(NULL);
-    }
-    for(;;) {
-        if(key < node->key) {
-            if(node->left == sentinel) {
-                return(ngx_rbtree_find_left(tree, node));
-            }
-            node = node->left;
-        } else if(key > node->key) {
-            if(node->right == sentinel) {
-                return(node);
-            }
-            node = node->right;
-        } else {
-            /* key == node->key */
-            while(node->left != sentinel && key == node->left->key) {
-                node = node->left;
-            }
-            return(node);
-        }
-    }
-    return(NULL);
+    return(ngx_rbtree_lower_bound(tree, key, &lt));
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_find_key_left(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t *ge, *lt;
+
+    ge = ngx_rbtree_lower_bound(tree, key, &lt);
+    return((ge != NULL && ge->key == key) ? ge : lt);
 }
 
 
@@ -444,10 +679,10 @@ ngx_rbtree_find_right(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
     }
 
     /* when the node has no right child */
-    while(node->parent != NULL && node == node->parent->right) {
-        node = node->parent;
+    while(ngx_rbt_parent(node) != NULL && node == ngx_rbt_parent(node)->right) {
+        node = ngx_rbt_parent(node);
     }
-    return(node->parent);
+    return(ngx_rbt_parent(node));
 }
 
 
@@ -469,96 +704,521 @@ ngx_rbtree_find_left(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
     }
 
     /* when the node has no left child */
-    while(node->parent != NULL && node == node->parent->left) {
-        node = node->parent;
+    while(ngx_rbt_parent(node) != NULL && node == ngx_rbt_parent(node)->left) {
+        node = ngx_rbt_parent(node);
     }
-    return(node->parent);
+    return(ngx_rbt_parent(node));
 }
 
-static void
-ngx_rbtree_walk_intl(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel, ngx_rbtree_walk_pt walk, void *ctx)
+/*
+ * lanes of lower-bound descents interleaved round by round. each lane
+ * prefetches its next node, which is then loaded after the other lanes
+ * have taken their step.
+ */
+#define NGX_RBTREE_FIND_LANES       16
+#define NGX_RBTREE_FIND_EXACT       0
+#define NGX_RBTREE_FIND_LEFT        1
+#define NGX_RBTREE_FIND_RIGHT       2
+
+static inline void
+ngx_rbtree_find_keys_intl(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt,
+    ngx_rbtree_node_t **out, int mode)
 {
+    uint64_t            i, j, n, active;
+    ngx_rbtree_node_t  *sentinel, *node, *curr[NGX_RBTREE_FIND_LANES],
+                       *ge[NGX_RBTREE_FIND_LANES], *lt[NGX_RBTREE_FIND_LANES];
 
-    if(node->left != sentinel) {
-        ngx_rbtree_walk_intl(node->left, sentinel, walk, ctx);
-    }
-    if(node->right != sentinel) {
-        ngx_rbtree_walk_intl(node->right, sentinel, walk, ctx);
-    }
-    walk(&node, sentinel, ctx);
-}
+    sentinel = tree->sentinel;
 
-void
-ngx_rbtree_walk(ngx_rbtree_t *tree, ngx_rbtree_walk_pt walk, void *ctx)
-{
-    ngx_rbtree_node_t *node = tree->root;
-    ngx_rbtree_node_t *sentinel = tree->sentinel;
+    for (i = 0; i < cnt; i += NGX_RBTREE_FIND_LANES) {
 
-    if(node != sentinel) {
-        ngx_rbtree_walk_intl(node, sentinel, walk, ctx);
-    }
+        n = cnt - i < NGX_RBTREE_FIND_LANES ? cnt - i : NGX_RBTREE_FIND_LANES;
 
-    return;
-}
+        for (j = 0; j < n; j++) {
+            curr[j] = tree->root;
+            ge[j] = NULL;       /* leftmost node with key >= keys[i + j] */
+            lt[j] = NULL;       /* rightmost node with key < keys[i + j] */
+        }
 
+        active = (tree->root != sentinel) ? n : 0;
 
-static inline void
-ngx_rbtree_left_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
-    ngx_rbtree_node_t *node)
-{
-    ngx_rbtree_node_t  *temp;
+        while (active != 0) {
+            for (j = 0; j < n; j++) {
+                node = curr[j];
+                if (node == sentinel) {
+                    continue;
+                }
 
-    temp = node->right;
-    node->right = temp->left;
+                if (keys[i + j] <= node->key) {
+                    ge[j] = node;
+                    node = node->left;
+                } else {
+                    lt[j] = node;
+                    node = node->right;
+                }
 
-    if (temp->left != sentinel) {
-        temp->left->parent = node;
-    }
+                __builtin_prefetch(node);
+                curr[j] = node;
+                active -= (node == sentinel);
+            }
+        }
 
-    temp->parent = node->parent;
+        for (j = 0; j < n; j++) {
+            node = ge[j];
+            if (node != NULL && node->key == keys[i + j]) {
+                out[i + j] = node;
 
-    if (node == *root) {
-        *root = temp;
+            } else if (mode == NGX_RBTREE_FIND_LEFT) {
+                out[i + j] = lt[j];
 
-    } else if (node == node->parent->left) {
-        node->parent->left = temp;
+            } else if (mode == NGX_RBTREE_FIND_RIGHT) {
+                out[i + j] = node;
 
-    } else {
-        node->parent->right = temp;
+            } else {
+                out[i + j] = NULL;
+            }
+        }
     }
 
-    temp->left = node;
-    node->parent = temp;
+    return;
 }
 
 
-static inline void
-ngx_rbtree_right_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
-    ngx_rbtree_node_t *node)
+void
+ngx_rbtree_find_keys(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt,
+    ngx_rbtree_node_t **out)
 {
-    ngx_rbtree_node_t  *temp;
+    ngx_rbtree_find_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_EXACT);
+}
 
-    temp = node->left;
-    node->left = temp->right;
 
-    if (temp->right != sentinel) {
-        temp->right->parent = node;
-    }
+void
+ngx_rbtree_find_keys_left(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt,
+    ngx_rbtree_node_t **out)
+{
+    ngx_rbtree_find_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_LEFT);
+}
 
-    temp->parent = node->parent;
 
-    if (node == *root) {
-        *root = temp;
+void
+ngx_rbtree_find_keys_right(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt,
+    ngx_rbtree_node_t **out)
+{
+    ngx_rbtree_find_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_RIGHT);
+}
 
-    } else if (node == node->parent->right) {
-        node->parent->right = temp;
+/*
+ * finger is the leftmost node with node->key >= k for some k <= key.
+ * climb until the lower bound of key is known to be in the subtree (or its
+ * parent), then descend. k sorted queries cost O(k log(n/k)) in total.
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_find_key_from(ngx_rbtree_t *tree, ngx_rbtree_node_t *finger,
+    ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t  *node, *ge, *sentinel;
+
+    sentinel = tree->sentinel;
+
+    if (finger == NULL) {
+        node = tree->root;
+        ge = NULL;
+
+    } else if (key <= finger->key) {
+        return finger;
+
+    } else {
+        node = finger;
+        ge = NULL;
+
+        while (ngx_rbt_parent(node) != NULL) {
+            if (node == ngx_rbt_parent(node)->left && key <= ngx_rbt_parent(node)->key) {
+                ge = ngx_rbt_parent(node);
+                break;
+            }
+            node = ngx_rbt_parent(node);
+        }
+    }
+
+    while (node != sentinel) {
+        if (key <= node->key) {
+            ge = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return ge;
+}
+
+
+static inline ngx_rbtree_node_t *
+ngx_rbtree_max(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    if (node == sentinel) {
+        return NULL;
+    }
+
+    while (node->right != sentinel) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+
+static inline void
+ngx_rbtree_find_sorted_keys_intl(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys,
+    uint64_t cnt, ngx_rbtree_node_t **out, int mode)
+{
+    uint64_t            i;
+    ngx_rbtree_node_t  *ge;
+
+    ge = NULL;
+
+    for (i = 0; i < cnt; i++) {
+
+        /* restart from the root if the keys are not sorted */
+        if (i == 0 || keys[i] < keys[i - 1]) {
+            ge = ngx_rbtree_find_key_from(tree, NULL, keys[i]);
+
+        } else if (ge != NULL) {
+            ge = ngx_rbtree_find_key_from(tree, ge, keys[i]);
+        }
+
+        if (ge != NULL && ge->key == keys[i]) {
+            out[i] = ge;
+
+        } else if (mode == NGX_RBTREE_FIND_LEFT) {
+            out[i] = (ge != NULL)
+                ? ngx_rbtree_find_left(tree, ge)
+                : ngx_rbtree_max(tree->root, tree->sentinel);
+
+        } else if (mode == NGX_RBTREE_FIND_RIGHT) {
+            out[i] = ge;
+
+        } else {
+            out[i] = NULL;
+        }
+    }
+
+    return;
+}
+
+
+void
+ngx_rbtree_find_sorted_keys(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys,
+    uint64_t cnt, ngx_rbtree_node_t **out)
+{
+    ngx_rbtree_find_sorted_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_EXACT);
+}
+
+
+void
+ngx_rbtree_find_sorted_keys_left(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys,
+    uint64_t cnt, ngx_rbtree_node_t **out)
+{
+    ngx_rbtree_find_sorted_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_LEFT);
+}
+
+
+void
+ngx_rbtree_find_sorted_keys_right(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys,
+    uint64_t cnt, ngx_rbtree_node_t **out)
+{
+    ngx_rbtree_find_sorted_keys_intl(tree, keys, cnt, out, NGX_RBTREE_FIND_RIGHT);
+}
+
+static void
+ngx_rbtree_walk_intl(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel, ngx_rbtree_walk_pt walk, void *ctx)
+{
+
+    if(node->left != sentinel) {
+        ngx_rbtree_walk_intl(node->left, sentinel, walk, ctx);
+    }
+    if(node->right != sentinel) {
+        ngx_rbtree_walk_intl(node->right, sentinel, walk, ctx);
+    }
+    walk(&node, sentinel, ctx);
+}
+
+void
+ngx_rbtree_walk(ngx_rbtree_t *tree, ngx_rbtree_walk_pt walk, void *ctx)
+{
+    ngx_rbtree_node_t *node = tree->root;
+    ngx_rbtree_node_t *sentinel = tree->sentinel;
+
+    if(node != sentinel) {
+        ngx_rbtree_walk_intl(node, sentinel, walk, ctx);
+    }
+
+    return;
+}
+
+
+/*
+ * bulk build: the subtrees are split evenly, so the leaves lie on the two
+ * lowest levels. painting the nodes on the incomplete lowest level red
+ * keeps the black height equal on every path.
+ * added 2026/10/17
+ */
+static ngx_rbtree_node_t *
+ngx_rbtree_build_intl(uint64_t cnt, uint64_t depth, uint64_t red_depth,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_next_pt next, void *ctx)
+{
+    ngx_rbtree_node_t  *node, *left, *right;
+
+    if (cnt == 0) {
+        return sentinel;
+    }
+
+    left = ngx_rbtree_build_intl((cnt - 1) / 2, depth + 1, red_depth,
+        sentinel, next, ctx);
+    node = next(ctx);
+    right = ngx_rbtree_build_intl(cnt - 1 - (cnt - 1) / 2, depth + 1, red_depth,
+        sentinel, next, ctx);
+
+    node->left = left;
+    node->right = right;
+
+    if (left != sentinel) {
+        ngx_rbt_set_parent(left, node);
+    }
+
+    if (right != sentinel) {
+        ngx_rbt_set_parent(right, node);
+    }
+
+    if (depth == red_depth) {
+        ngx_rbt_red(node);
+    } else {
+        ngx_rbt_black(node);
+    }
+
+    return node;
+}
+
+
+static inline uint64_t
+ngx_rbtree_build_red_depth(uint64_t cnt)
+{
+    /* floor(log2(cnt + 1)) */
+    return 63 - __builtin_clzll(cnt + 1);
+}
+
+
+void
+ngx_rbtree_build(ngx_rbtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next,
+    void *ctx)
+{
+    ngx_rbtree_node_t  *root, *sentinel;
+
+    sentinel = tree->sentinel;
+    root = ngx_rbtree_build_intl(cnt, 0, ngx_rbtree_build_red_depth(cnt),
+        sentinel, next, ctx);
+
+    if (root != sentinel) {
+        ngx_rbt_set_parent(root, NULL);
+        ngx_rbt_black(root);
+    }
+
+    tree->root = root;
+    return;
+}
+
+
+/*
+ * a node with a left child is rotated right until its left subtree is empty,
+ * then appended to the list and left behind through its right link, so the
+ * traversal is a single loop in O(n) without a stack (tree-to-vine of
+ * Day, Stout and Warren). the left links are left undefined.
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_flatten(ngx_rbtree_t *tree)
+{
+    ngx_rbtree_node_t  *head, **tail, *node, *left, *sentinel;
+
+    head = NULL;
+    tail = &head;
+    sentinel = tree->sentinel;
+    node = tree->root;
+
+    while (node != sentinel) {
+
+        if (node->left != sentinel) {
+            left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+            continue;
+        }
+
+        *tail = node;
+        tail = &node->right;
+        node = node->right;
+    }
+
+    *tail = NULL;
+
+    tree->root = sentinel;
+    return head;
+}
+
+
+static void
+ngx_rbtree_augment_build_intl(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_augment_t const *aug)
+{
+    if (node == sentinel) {
+        return;
+    }
+
+    ngx_rbtree_augment_build_intl(node->left, sentinel, aug);
+    ngx_rbtree_augment_build_intl(node->right, sentinel, aug);
+    ngx_rbtree_augment_node(aug, node, sentinel);
+}
+
+
+void
+ngx_rbtree_augment_build(ngx_rbtree_t *tree, uint64_t cnt,
+    ngx_rbtree_next_pt next, void *ctx, ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_build(tree, cnt, next, ctx);
+    ngx_rbtree_augment_build_intl(tree->root, tree->sentinel, aug);
+    return;
+}
+
+
+/*
+ * the node where the paths to lkey and rkey diverge is the first one in
+ * [lkey, rkey). below it, every left turn on the lkey path leaves a right
+ * subtree inside the range, and every right turn on the rkey path a left one.
+ */
+void
+ngx_rbtree_cover(ngx_rbtree_t *tree, ngx_rbtree_key_t lkey, ngx_rbtree_key_t rkey,
+    ngx_rbtree_cover_pt cover, void *ctx)
+{
+    ngx_rbtree_node_t  *node, *split, *sentinel;
+
+    sentinel = tree->sentinel;
+    split = tree->root;
+
+    while (split != sentinel) {
+        if (split->key < lkey) {
+            split = split->right;
+
+        } else if (split->key >= rkey) {
+            split = split->left;
+
+        } else {
+            break;
+        }
+    }
+
+    if (split == sentinel) {
+        return;
+    }
+
+    cover(split, 0, ctx);
+
+    for (node = split->left; node != sentinel; /* void */) {
+        if (node->key >= lkey) {
+            cover(node, 0, ctx);
+            if (node->right != sentinel) {
+                cover(node->right, 1, ctx);
+            }
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    for (node = split->right; node != sentinel; /* void */) {
+        if (node->key < rkey) {
+            cover(node, 0, ctx);
+            if (node->left != sentinel) {
+                cover(node->left, 1, ctx);
+            }
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+    }
+
+    return;
+}
+
+
+static inline void
+ngx_rbtree_left_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_node_t  *temp;
+
+    temp = node->right;
+    node->right = temp->left;
+
+    if (temp->left != sentinel) {
+        ngx_rbt_set_parent(temp->left, node);
+    }
+
+    ngx_rbt_set_parent(temp, ngx_rbt_parent(node));
+
+    if (node == *root) {
+        *root = temp;
+
+    } else if (node == ngx_rbt_parent(node)->left) {
+        ngx_rbt_parent(node)->left = temp;
+
+    } else {
+        ngx_rbt_parent(node)->right = temp;
+    }
+
+    temp->left = node;
+    ngx_rbt_set_parent(node, temp);
+
+    if (aug != NULL) {
+        ngx_rbtree_augment_node(aug, node, sentinel);
+        ngx_rbtree_augment_node(aug, temp, sentinel);
+    }
+}
+
+
+static inline void
+ngx_rbtree_right_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug)
+{
+    ngx_rbtree_node_t  *temp;
+
+    temp = node->left;
+    node->left = temp->right;
+
+    if (temp->right != sentinel) {
+        ngx_rbt_set_parent(temp->right, node);
+    }
+
+    ngx_rbt_set_parent(temp, ngx_rbt_parent(node));
+
+    if (node == *root) {
+        *root = temp;
+
+    } else if (node == ngx_rbt_parent(node)->right) {
+        ngx_rbt_parent(node)->right = temp;
 
     } else {
-        node->parent->left = temp;
+        ngx_rbt_parent(node)->left = temp;
     }
 
     temp->right = node;
-    node->parent = temp;
+    ngx_rbt_set_parent(node, temp);
+
+    if (aug != NULL) {
+        ngx_rbtree_augment_node(aug, node, sentinel);
+        ngx_rbtree_augment_node(aug, temp, sentinel);
+    }
 }
 
 
@@ -579,15 +1239,15 @@ static inline void ngx_ivtree_right_rotate(ngx_ivtree_node_t **root,
 void
 ngx_ivtree_update_key(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
 {
-    while(node->parent != NULL) {
+    while(ngx_rbt_parent(node) != NULL) {
         debug("parent(%p, %lld, %lld, %lld), node(%p, %lld, %lld, %lld)",
-            node->parent, node->parent->lkey, node->parent->rkey, node->parent->rkey_max,
+            ngx_rbt_parent(node), ngx_rbt_parent(node)->lkey, ngx_rbt_parent(node)->rkey, ngx_rbt_parent(node)->rkey_max,
             node, node->lkey, node->rkey, node->rkey_max);
-        if(node->parent->rkey_max < node->rkey_max) {
-            node->parent->rkey_max = node->rkey_max;
+        if(ngx_rbt_parent(node)->rkey_max >= node->rkey_max) {
             break;
         }
-        node = node->parent;
+        ngx_rbt_parent(node)->rkey_max = node->rkey_max;
+        node = ngx_rbt_parent(node);
     }
     return;
 }
@@ -600,46 +1260,46 @@ ngx_ivtree_rebalance(ngx_ivtree_node_t **root, ngx_ivtree_node_t *node,
     ngx_ivtree_node_t *temp;
 
 
-    while (node != *root && ngx_rbt_is_red(node->parent)) {
+    while (node != *root && ngx_rbt_is_red(ngx_rbt_parent(node))) {
 
-        if (node->parent == node->parent->parent->left) {
-            temp = node->parent->parent->right;
+        if (ngx_rbt_parent(node) == ngx_rbt_parent(ngx_rbt_parent(node))->left) {
+            temp = ngx_rbt_parent(ngx_rbt_parent(node))->right;
 
             if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
                 ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                node = ngx_rbt_parent(ngx_rbt_parent(node));
 
             } else {
-                if (node == node->parent->right) {
-                    node = node->parent;
+                if (node == ngx_rbt_parent(node)->right) {
+                    node = ngx_rbt_parent(node);
                     ngx_ivtree_left_rotate(root, sentinel, node);
                 }
 
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_ivtree_right_rotate(root, sentinel, node->parent->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                ngx_ivtree_right_rotate(root, sentinel, ngx_rbt_parent(ngx_rbt_parent(node)));
             }
 
         } else {
-            temp = node->parent->parent->left;
+            temp = ngx_rbt_parent(ngx_rbt_parent(node))->left;
 
             if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
                 ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                node = ngx_rbt_parent(ngx_rbt_parent(node));
 
             } else {
-                if (node == node->parent->left) {
-                    node = node->parent;
+                if (node == ngx_rbt_parent(node)->left) {
+                    node = ngx_rbt_parent(node);
                     ngx_ivtree_right_rotate(root, sentinel, node);
                 }
 
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_ivtree_left_rotate(root, sentinel, node->parent->parent);
+                ngx_rbt_black(ngx_rbt_parent(node));
+                ngx_rbt_red(ngx_rbt_parent(ngx_rbt_parent(node)));
+                ngx_ivtree_left_rotate(root, sentinel, ngx_rbt_parent(ngx_rbt_parent(node)));
             }
         }
     }
@@ -660,7 +1320,7 @@ ngx_ivtree_insert(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
     sentinel = tree->sentinel;
 
     if (*root == sentinel) {
-        node->parent = NULL;
+        ngx_rbt_set_parent(node, NULL);
         node->left = sentinel;
         node->right = sentinel;
         node->rkey_max = node->rkey;
@@ -687,7 +1347,7 @@ void
 ngx_ivtree_delete(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
 {
     uint8_t           red;
-    ngx_ivtree_node_t  **root, *sentinel, *subst, *temp, *w;
+    ngx_ivtree_node_t  **root, *sentinel, *subst, *temp, *parent, *w;
 
     /* a binary tree delete */
 
@@ -717,84 +1377,81 @@ ngx_ivtree_delete(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
 
     if (subst == *root) {
         *root = temp;
-        ngx_rbt_black(temp);
+
+        if (temp != sentinel) {
+            ngx_rbt_set_parent(temp, NULL);
+            ngx_rbt_black(temp);
+        }
 
         /* DEBUG stuff */
         node->left = NULL;
         node->right = NULL;
-        node->parent = NULL;
-        node->lkey = 0;
-        node->rkey = 0;
+        ngx_rbt_set_parent(node, NULL);
 
         return;
     }
 
     red = ngx_rbt_is_red(subst);
 
-    if (subst == subst->parent->left) {
-        subst->parent->left = temp;
+    if (subst == ngx_rbt_parent(subst)->left) {
+        ngx_rbt_parent(subst)->left = temp;
 
     } else {
-        subst->parent->right = temp;
+        ngx_rbt_parent(subst)->right = temp;
     }
-    subst->parent->rkey_max = MAX3(
-        subst->parent->rkey,
-        subst->parent->left->rkey_max,
-        subst->parent->right->rkey_max);
 
     if (subst == node) {
 
-        temp->parent = subst->parent;
+        parent = ngx_rbt_parent(subst);
 
     } else {
 
-        if (subst->parent == node) {
-            temp->parent = subst;
+        if (ngx_rbt_parent(subst) == node) {
+            parent = subst;
 
         } else {
-            temp->parent = subst->parent;
+            parent = ngx_rbt_parent(subst);
         }
 
         subst->left = node->left;
         subst->right = node->right;
-        subst->parent = node->parent;
+        ngx_rbt_set_parent(subst, ngx_rbt_parent(node));
         ngx_rbt_copy_color(subst, node);
-        subst->rkey_max = MAX3(
-            subst->rkey,
-            subst->left->rkey_max,
-            subst->right->rkey_max);
 
         if (node == *root) {
             *root = subst;
 
         } else {
-            if (node == node->parent->left) {
-                node->parent->left = subst;
+            if (node == ngx_rbt_parent(node)->left) {
+                ngx_rbt_parent(node)->left = subst;
             } else {
-                node->parent->right = subst;
+                ngx_rbt_parent(node)->right = subst;
             }
-            node->parent->rkey_max = MAX3(
-                node->parent->rkey,
-                node->parent->left->rkey_max,
-                node->parent->right->rkey_max);
-
         }
 
         if (subst->left != sentinel) {
-            subst->left->parent = subst;
+            ngx_rbt_set_parent(subst->left, subst);
         }
 
         if (subst->right != sentinel) {
-            subst->right->parent = subst;
+            ngx_rbt_set_parent(subst->right, subst);
         }
     }
 
+    /* the sentinel is shared, its parent is tracked in parent instead */
+    if (temp != sentinel) {
+        ngx_rbt_set_parent(temp, parent);
+    }
+
+    /* the max may have come from node, recompute up to the root */
+    for (w = parent; w != NULL; w = ngx_rbt_parent(w)) {
+        w->rkey_max = MAX3(w->rkey, w->left->rkey_max, w->right->rkey_max);
+    }
+
     /* DEBUG stuff */
     node->left = NULL;
     node->right = NULL;
-    node->parent = NULL;
-    node->lkey = 0;
-    node->rkey = 0;
+    ngx_rbt_set_parent(node, NULL);
 
     if (red) {
         return;
@@ -803,61 +1460,63 @@ ngx_ivtree_delete(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
     /* a delete fixup */
     while (temp != *root && ngx_rbt_is_black(temp)) {
 
-        if (temp == temp->parent->left) {
-            w = temp->parent->right;
+        if (temp == parent->left) {
+            w = parent->right;
 
             if (ngx_rbt_is_red(w)) {
                 ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_ivtree_left_rotate(root, sentinel, temp->parent);
-                w = temp->parent->right;
+                ngx_rbt_red(parent);
+                ngx_ivtree_left_rotate(root, sentinel, parent);
+                w = parent->right;
             }
 
             if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
                 ngx_rbt_red(w);
-                temp = temp->parent;
+                temp = parent;
+                parent = ngx_rbt_parent(temp);
 
             } else {
                 if (ngx_rbt_is_black(w->right)) {
                     ngx_rbt_black(w->left);
                     ngx_rbt_red(w);
                     ngx_ivtree_right_rotate(root, sentinel, w);
-                    w = temp->parent->right;
+                    w = parent->right;
                 }
 
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
+                ngx_rbt_copy_color(w, parent);
+                ngx_rbt_black(parent);
                 ngx_rbt_black(w->right);
-                ngx_ivtree_left_rotate(root, sentinel, temp->parent);
+                ngx_ivtree_left_rotate(root, sentinel, parent);
                 temp = *root;
             }
 
         } else {
-            w = temp->parent->left;
+            w = parent->left;
 
             if (ngx_rbt_is_red(w)) {
                 ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_ivtree_right_rotate(root, sentinel, temp->parent);
-                w = temp->parent->left;
+                ngx_rbt_red(parent);
+                ngx_ivtree_right_rotate(root, sentinel, parent);
+                w = parent->left;
             }
 
             if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
                 ngx_rbt_red(w);
-                temp = temp->parent;
+                temp = parent;
+                parent = ngx_rbt_parent(temp);
 
             } else {
                 if (ngx_rbt_is_black(w->left)) {
                     ngx_rbt_black(w->right);
                     ngx_rbt_red(w);
                     ngx_ivtree_left_rotate(root, sentinel, w);
-                    w = temp->parent->left;
+                    w = parent->left;
                 }
 
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
+                ngx_rbt_copy_color(w, parent);
+                ngx_rbt_black(parent);
                 ngx_rbt_black(w->left);
-                ngx_ivtree_right_rotate(root, sentinel, temp->parent);
+                ngx_ivtree_right_rotate(root, sentinel, parent);
                 temp = *root;
             }
         }
@@ -867,42 +1526,168 @@ ngx_ivtree_delete(ngx_ivtree_t *tree, ngx_ivtree_node_t *node)
 }
 
 
-static inline void
-ngx_ivtree_left_rotate(ngx_ivtree_node_t **root, ngx_ivtree_node_t *sentinel,
-    ngx_ivtree_node_t *node)
+static ngx_ivtree_node_t *
+ngx_ivtree_build_intl(uint64_t cnt, uint64_t depth, uint64_t red_depth,
+    ngx_ivtree_node_t *sentinel, ngx_rbtree_next_pt next, void *ctx)
 {
-    ngx_ivtree_node_t  *temp;
-
-    temp = node->right;
-    node->right = temp->left;
+    ngx_ivtree_node_t  *node, *left, *right;
 
-    if (temp->left != sentinel) {
-        temp->left->parent = node;
+    if (cnt == 0) {
+        return sentinel;
     }
 
-    temp->parent = node->parent;
+    left = ngx_ivtree_build_intl((cnt - 1) / 2, depth + 1, red_depth,
+        sentinel, next, ctx);
+    node = (ngx_ivtree_node_t *) next(ctx);
+    right = ngx_ivtree_build_intl(cnt - 1 - (cnt - 1) / 2, depth + 1, red_depth,
+        sentinel, next, ctx);
+
+    node->left = left;
+    node->right = right;
+
+    if (left != sentinel) {
+        ngx_rbt_set_parent(left, node);
+    }
+
+    if (right != sentinel) {
+        ngx_rbt_set_parent(right, node);
+    }
+
+    if (depth == red_depth) {
+        ngx_rbt_red(node);
+    } else {
+        ngx_rbt_black(node);
+    }
+
+    /* children are complete here, so rkey_max is settled bottom-up */
+    node->rkey_max = MAX3(
+        node->rkey,
+        node->left->rkey_max,
+        node->right->rkey_max);
+
+    return node;
+}
+
+
+void
+ngx_ivtree_build(ngx_ivtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next,
+    void *ctx)
+{
+    ngx_ivtree_node_t  *root, *sentinel;
+
+    sentinel = tree->sentinel;
+    root = ngx_ivtree_build_intl(cnt, 0, ngx_rbtree_build_red_depth(cnt),
+        sentinel, next, ctx);
+
+    if (root != sentinel) {
+        ngx_rbt_set_parent(root, NULL);
+        ngx_rbt_black(root);
+    }
+
+    tree->root = root;
+    return;
+}
+
+
+static inline ngx_ivtree_node_t *
+ngx_ivtree_min_rkey(ngx_ivtree_node_t *node, ngx_rbtree_key_t key)
+{
+    /* node->rkey_max > key is assumed */
+    for ( ;; ) {
+        if (node->left->rkey_max > key) {
+            node = node->left;
+
+        } else if (node->rkey > key) {
+            return node;
+
+        } else {
+            node = node->right;
+        }
+    }
+}
+
+
+/*
+ * the leftmost node with rkey > key is monotone in key, so a sorted batch
+ * of queries can continue from the previous answer. climb until a parent
+ * or a right subtree has rkey > key, then descend.
+ */
+ngx_ivtree_node_t *
+ngx_ivtree_find_rkey_from(ngx_ivtree_t *tree, ngx_ivtree_node_t *finger,
+    ngx_rbtree_key_t key)
+{
+    ngx_ivtree_node_t  *node;
+
+    if (finger == NULL) {
+        if (tree->root->rkey_max <= key) {
+            return NULL;
+        }
+        return ngx_ivtree_min_rkey(tree->root, key);
+    }
+
+    if (finger->rkey > key) {
+        return finger;
+    }
+
+    if (finger->right->rkey_max > key) {
+        return ngx_ivtree_min_rkey(finger->right, key);
+    }
+
+    node = finger;
+
+    while (ngx_rbt_parent(node) != NULL) {
+        if (node == ngx_rbt_parent(node)->left) {
+            if (ngx_rbt_parent(node)->rkey > key) {
+                return ngx_rbt_parent(node);
+            }
+
+            if (ngx_rbt_parent(node)->right->rkey_max > key) {
+                return ngx_ivtree_min_rkey(ngx_rbt_parent(node)->right, key);
+            }
+        }
+        node = ngx_rbt_parent(node);
+    }
+
+    return NULL;
+}
+
+
+static inline void
+ngx_ivtree_left_rotate(ngx_ivtree_node_t **root, ngx_ivtree_node_t *sentinel,
+    ngx_ivtree_node_t *node)
+{
+    ngx_ivtree_node_t  *temp;
+
+    temp = node->right;
+    node->right = temp->left;
+
+    if (temp->left != sentinel) {
+        ngx_rbt_set_parent(temp->left, node);
+    }
+
+    ngx_rbt_set_parent(temp, ngx_rbt_parent(node));
 
     if (node == *root) {
         *root = temp;
 
-    } else if (node == node->parent->left) {
-        node->parent->left = temp;
+    } else if (node == ngx_rbt_parent(node)->left) {
+        ngx_rbt_parent(node)->left = temp;
 
     } else {
-        node->parent->right = temp;
+        ngx_rbt_parent(node)->right = temp;
     }
 
     temp->left = node;
-    node->parent = temp;
+    ngx_rbt_set_parent(node, temp);
 
     node->rkey_max = MAX3(
         node->rkey,
         node->left->rkey_max,
         node->right->rkey_max);
-    node->parent->rkey_max = MAX3(
-        node->parent->rkey,
-        node->parent->left->rkey_max,
-        node->parent->right->rkey_max);
+    ngx_rbt_parent(node)->rkey_max = MAX3(
+        ngx_rbt_parent(node)->rkey,
+        ngx_rbt_parent(node)->left->rkey_max,
+        ngx_rbt_parent(node)->right->rkey_max);
 
 }
 
@@ -917,33 +1702,1569 @@ ngx_ivtree_right_rotate(ngx_ivtree_node_t **root, ngx_ivtree_node_t *sentinel,
     node->left = temp->right;
 
     if (temp->right != sentinel) {
-        temp->right->parent = node;
+        ngx_rbt_set_parent(temp->right, node);
     }
 
-    temp->parent = node->parent;
+    ngx_rbt_set_parent(temp, ngx_rbt_parent(node));
 
     if (node == *root) {
         *root = temp;
 
-    } else if (node == node->parent->right) {
-        node->parent->right = temp;
+    } else if (node == ngx_rbt_parent(node)->right) {
+        ngx_rbt_parent(node)->right = temp;
 
     } else {
-        node->parent->left = temp;
+        ngx_rbt_parent(node)->left = temp;
     }
 
     temp->right = node;
-    node->parent = temp;
+    ngx_rbt_set_parent(node, temp);
 
     node->rkey_max = MAX3(
         node->rkey,
         node->left->rkey_max,
         node->right->rkey_max);
-    node->parent->rkey_max = MAX3(
-        node->parent->rkey,
-        node->parent->left->rkey_max,
-        node->parent->right->rkey_max);
+    ngx_rbt_parent(node)->rkey_max = MAX3(
+        ngx_rbt_parent(node)->rkey,
+        ngx_rbt_parent(node)->left->rkey_max,
+        ngx_rbt_parent(node)->right->rkey_max);
+
+}
+
+
+/*
+ * order-statistic tree, added 2026/10/17
+ */
+#ifndef RBTREE_COMPACT_NODE
+
+/* subtree size as an augmented value */
+static int
+ngx_ostree_augment_size(ngx_rbtree_node_t *node, ngx_rbtree_node_t *left,
+    ngx_rbtree_node_t *right, void *ctx)
+{
+    node->size = (left == NULL ? 0 : left->size)
+                 + (right == NULL ? 0 : right->size) + 1;
+    return 1;
+}
+
+
+static ngx_rbtree_augment_t const  ngx_ostree_augment = {
+    .update = ngx_ostree_augment_size,
+    .ctx = NULL
+};
+
+
+void
+ngx_ostree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_augment_insert(tree, node, &ngx_ostree_augment);
+}
+
+
+ngx_rbtree_node_t *
+ngx_ostree_insert_unique(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    return ngx_rbtree_insert_unique(tree, node, &ngx_ostree_augment);
+}
+
+
+void
+ngx_ostree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_augment_delete(tree, node, &ngx_ostree_augment);
+}
+
+
+void
+ngx_ostree_build(ngx_rbtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next,
+    void *ctx)
+{
+    ngx_rbtree_augment_build(tree, cnt, next, ctx, &ngx_ostree_augment);
+}
+
+
+uint64_t
+ngx_ostree_rank(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    uint64_t           rank;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    rank = 0;
+    node = tree->root;
+    sentinel = tree->sentinel;
+
+    while (node != sentinel) {
+        if (node->key < key) {
+            rank += node->left->size + 1;
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+    }
+
+    return rank;
+}
+
+
+ngx_rbtree_node_t *
+ngx_ostree_select(ngx_rbtree_t *tree, uint64_t k)
+{
+    ngx_rbtree_node_t  *node;
+
+    /* the sentinel has size 0 */
+    node = tree->root;
+
+    if (k >= node->size) {
+        return NULL;
+    }
+
+    for ( ;; ) {
+        if (k < node->left->size) {
+            node = node->left;
+
+        } else if (k == node->left->size) {
+            return node;
+
+        } else {
+            k -= node->left->size + 1;
+            node = node->right;
+        }
+    }
+}
+
+#endif
+
+
+/*
+ * split and join, added 2026/10/17
+ *
+ * a join descends the spine of the higher tree to the black node as high
+ * as the lower one and links the middle node there as red, which the
+ * insert fixup repairs. the cost is O(difference of the black heights), so
+ * a split that joins the subtrees hanging off the search path bottom-up
+ * telescopes to O(log n).
+ */
+
+#define NGX_RBTREE_MAX_DEPTH    ( 128 )
+
+
+/* l and r are black (or the sentinel) and unlinked, bh is the black height */
+static ngx_rbtree_node_t *
+ngx_rbtree_join_intl(ngx_rbtree_node_t *l, uint64_t lbh,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *r, uint64_t rbh,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_augment_t const *aug,
+    uint64_t *bh)
+{
+    uint64_t            h;
+    ngx_rbtree_node_t  *root, *temp, *parent;
+
+    if (lbh == rbh) {
+        node->left = l;
+        node->right = r;
+        ngx_rbt_set_parent(node, NULL);
+        ngx_rbt_black(node);
+
+        if (l != sentinel) {
+            ngx_rbt_set_parent(l, node);
+        }
+
+        if (r != sentinel) {
+            ngx_rbt_set_parent(r, node);
+        }
+
+        if (aug != NULL) {
+            ngx_rbtree_augment_node(aug, node, sentinel);
+        }
+
+        *bh = lbh + 1;
+        return node;
+    }
+
+    parent = NULL;
+
+    if (lbh > rbh) {
+        root = l;
+        h = lbh;
+
+        for (temp = l; ngx_rbt_is_red(temp) || h > rbh; temp = temp->right) {
+            h -= ngx_rbt_is_black(temp);
+            parent = temp;
+        }
+
+        node->left = temp;
+        node->right = r;
+        parent->right = node;
+
+    } else {
+        root = r;
+        h = rbh;
+
+        for (temp = r; ngx_rbt_is_red(temp) || h > lbh; temp = temp->left) {
+            h -= ngx_rbt_is_black(temp);
+            parent = temp;
+        }
+
+        node->left = l;
+        node->right = temp;
+        parent->left = node;
+    }
+
+    ngx_rbt_set_parent(node, parent);
+    ngx_rbt_red(node);
+
+    if (node->left != sentinel) {
+        ngx_rbt_set_parent(node->left, node);
+    }
+
+    if (node->right != sentinel) {
+        ngx_rbt_set_parent(node->right, node);
+    }
+
+    if (aug != NULL) {
+        /* the ancestors gained the lower tree */
+        ngx_rbtree_augment_node(aug, node, sentinel);
+        temp = parent;
+        while (temp != NULL && ngx_rbtree_augment_node(aug, temp, sentinel)) {
+            temp = ngx_rbt_parent(temp);
+        }
+    }
+
+    h = lbh > rbh ? lbh : rbh;
+    *bh = h + ngx_rbtree_rebalance(&root, node, sentinel, aug);
+    return root;
+}
+
+
+/* the black height of a tree, its root is turned black */
+static inline uint64_t
+ngx_rbtree_black_height(ngx_rbtree_node_t *root, ngx_rbtree_node_t *sentinel)
+{
+    uint64_t            h;
+    ngx_rbtree_node_t  *temp;
+
+    if (root == sentinel) {
+        return 0;
+    }
+
+    ngx_rbt_set_parent(root, NULL);
+    ngx_rbt_black(root);
+
+    h = 0;
+    for (temp = root; temp != sentinel; temp = temp->left) {
+        h += ngx_rbt_is_black(temp);
+    }
+
+    return h;
+}
+
+
+void
+ngx_rbtree_join(ngx_rbtree_t *left, ngx_rbtree_node_t *node,
+    ngx_rbtree_t *right, ngx_rbtree_augment_t const *aug)
+{
+    uint64_t            lbh, rbh, bh;
+    ngx_rbtree_node_t  *sentinel;
+
+    sentinel = left->sentinel;
+
+    lbh = ngx_rbtree_black_height(left->root, sentinel);
+    rbh = ngx_rbtree_black_height(right->root, sentinel);
+
+    left->root = ngx_rbtree_join_intl(left->root, lbh, node, right->root, rbh,
+                                      sentinel, aug, &bh);
+    right->root = sentinel;
+}
+
+
+void
+ngx_rbtree_split(ngx_rbtree_t *tree, ngx_rbtree_key_t key, ngx_rbtree_t *right,
+    ngx_rbtree_augment_t const *aug)
+{
+    uint64_t            n, h, lbh, rbh, sbh, hs[NGX_RBTREE_MAX_DEPTH];
+    ngx_rbtree_node_t  *sentinel, *node, *l, *r, *sub;
+    ngx_rbtree_node_t  *path[NGX_RBTREE_MAX_DEPTH];
+
+    sentinel = tree->sentinel;
+
+    /* record the search path with the black height of each node */
+
+    h = ngx_rbtree_black_height(tree->root, sentinel);
+    n = 0;
+
+    for (node = tree->root; node != sentinel; n++) {
+        path[n] = node;
+        hs[n] = h;
+        h -= ngx_rbt_is_black(node);
+        node = (key <= node->key) ? node->left : node->right;
+    }
+
+    /* the subtrees off the path go to the side of their parent */
+
+    l = sentinel;
+    r = sentinel;
+    lbh = 0;
+    rbh = 0;
+
+    while (n-- > 0) {
+        node = path[n];
+        h = hs[n] - ngx_rbt_is_black(node);
+
+        if (key <= node->key) {
+            sub = node->right;
+            sbh = h + (sub != sentinel && ngx_rbt_is_red(sub));
+            if (sub != sentinel) {
+                ngx_rbt_set_parent(sub, NULL);
+                ngx_rbt_black(sub);
+            }
+
+            r = ngx_rbtree_join_intl(r, rbh, node, sub, sbh, sentinel, aug,
+                                     &rbh);
+
+        } else {
+            sub = node->left;
+            sbh = h + (sub != sentinel && ngx_rbt_is_red(sub));
+            if (sub != sentinel) {
+                ngx_rbt_set_parent(sub, NULL);
+                ngx_rbt_black(sub);
+            }
+
+            l = ngx_rbtree_join_intl(sub, sbh, node, l, lbh, sentinel, aug,
+                                     &lbh);
+        }
+    }
+
+    tree->root = l;
+    right->root = r;
+}
+
+
+/* rkey_max as an augmented value, for the interval tree */
+static int
+ngx_ivtree_augment_max(ngx_rbtree_node_t *node, ngx_rbtree_node_t *left,
+    ngx_rbtree_node_t *right, void *ctx)
+{
+    ngx_rbtree_key_t    max;
+    ngx_ivtree_node_t  *n;
+
+    n = (ngx_ivtree_node_t *) node;
+    max = MAX3(n->rkey,
+               left == NULL ? NGX_RBTREE_KEY_MIN : ((ngx_ivtree_node_t *) left)->rkey_max,
+               right == NULL ? NGX_RBTREE_KEY_MIN : ((ngx_ivtree_node_t *) right)->rkey_max);
+
+    if (n->rkey_max == max) {
+        return 0;
+    }
+
+    n->rkey_max = max;
+    return 1;
+}
+
+
+static ngx_rbtree_augment_t const  ngx_ivtree_augment = {
+    .update = ngx_ivtree_augment_max,
+    .ctx = NULL
+};
+
+
+void
+ngx_ivtree_join(ngx_ivtree_t *left, ngx_ivtree_node_t *node,
+    ngx_ivtree_t *right)
+{
+    ngx_rbtree_join((ngx_rbtree_t *) left, (ngx_rbtree_node_t *) node,
+                    (ngx_rbtree_t *) right, &ngx_ivtree_augment);
+}
+
+
+void
+ngx_ivtree_split(ngx_ivtree_t *tree, ngx_rbtree_key_t key, ngx_ivtree_t *right)
+{
+    ngx_rbtree_split((ngx_rbtree_t *) tree, key, (ngx_rbtree_t *) right,
+                     &ngx_ivtree_augment);
+}
+
+
+#ifndef RBTREE_COMPACT_NODE
+
+void
+ngx_ostree_join(ngx_rbtree_t *left, ngx_rbtree_node_t *node,
+    ngx_rbtree_t *right)
+{
+    ngx_rbtree_join(left, node, right, &ngx_ostree_augment);
+}
+
+
+void
+ngx_ostree_split(ngx_rbtree_t *tree, ngx_rbtree_key_t key, ngx_rbtree_t *right)
+{
+    ngx_rbtree_split(tree, key, right, &ngx_ostree_augment);
+}
+
+#endif
+
+
+/* index-linked tree, added 2026/10/17 */
 
+static inline void
+ngx_rbtree32_update_max(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    node->rkey_max = MAX3(
+        node->rkey,
+        ngx_rbt32_node(tree, node->left)->rkey_max,
+        ngx_rbt32_node(tree, node->right)->rkey_max);
+}
+
+
+static inline void
+ngx_rbtree32_left_rotate(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    uint32_t              i, t;
+    ngx_rbtree32_node_t  *temp, *parent;
+
+    i = ngx_rbt32_index(node);
+    t = node->right;
+    temp = ngx_rbt32_node(tree, t);
+
+    node->right = temp->left;
+
+    if (temp->left != 0) {
+        ngx_rbt32_node(tree, temp->left)->parent = i;
+    }
+
+    temp->parent = node->parent;
+
+    if (i == tree->root) {
+        tree->root = t;
+
+    } else {
+        parent = ngx_rbt32_node(tree, node->parent);
+
+        if (i == parent->left) {
+            parent->left = t;
+        } else {
+            parent->right = t;
+        }
+    }
+
+    temp->left = i;
+    node->parent = t;
+
+    if (tree->iv) {
+        temp->rkey_max = node->rkey_max;
+        ngx_rbtree32_update_max(tree, node);
+    }
+}
+
+
+static inline void
+ngx_rbtree32_right_rotate(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    uint32_t              i, t;
+    ngx_rbtree32_node_t  *temp, *parent;
+
+    i = ngx_rbt32_index(node);
+    t = node->left;
+    temp = ngx_rbt32_node(tree, t);
+
+    node->left = temp->right;
+
+    if (temp->right != 0) {
+        ngx_rbt32_node(tree, temp->right)->parent = i;
+    }
+
+    temp->parent = node->parent;
+
+    if (i == tree->root) {
+        tree->root = t;
+
+    } else {
+        parent = ngx_rbt32_node(tree, node->parent);
+
+        if (i == parent->right) {
+            parent->right = t;
+        } else {
+            parent->left = t;
+        }
+    }
+
+    temp->right = i;
+    node->parent = t;
+
+    if (tree->iv) {
+        temp->rkey_max = node->rkey_max;
+        ngx_rbtree32_update_max(tree, node);
+    }
+}
+
+
+/* returns the node of the same key if unique and found, NULL if linked */
+
+static inline ngx_rbtree32_node_t *
+ngx_rbtree32_insert_intl(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node,
+    uint64_t unique)
+{
+    uint32_t              i, *p;
+    ngx_rbtree32_node_t  *temp, *parent, *gparent;
+
+    i = ngx_rbt32_index(node);
+
+    node->left = 0;
+    node->right = 0;
+
+    if (tree->iv) {
+        node->rkey_max = node->rkey;
+    }
+
+    if (tree->root == 0) {
+        node->parent = 0;
+        ngx_rbt32_black(node);
+        tree->root = i;
+
+        return NULL;
+    }
+
+    /* a binary tree insert, raising rkey_max on the way down */
+
+    temp = ngx_rbt32_node(tree, tree->root);
+
+    for ( ;; ) {
+
+        if (unique && node->key == temp->key) {
+            return temp;
+        }
+
+        if (tree->iv && temp->rkey_max < node->rkey) {
+            temp->rkey_max = node->rkey;
+        }
+
+        p = (node->key < temp->key) ? &temp->left : &temp->right;
+
+        if (*p == 0) {
+            break;
+        }
+
+        temp = ngx_rbt32_node(tree, *p);
+    }
+
+    *p = i;
+    node->parent = ngx_rbt32_index(temp);
+    ngx_rbt32_red(node);
+
+    /* re-balance tree */
+
+    while (i != tree->root) {
+        parent = ngx_rbt32_node(tree, node->parent);
+
+        if (ngx_rbt32_is_black(parent)) {
+            break;
+        }
+
+        gparent = ngx_rbt32_node(tree, parent->parent);
+
+        if (node->parent == gparent->left) {
+            temp = ngx_rbt32_node(tree, gparent->right);
+
+            if (ngx_rbt32_is_red(temp)) {
+                ngx_rbt32_black(parent);
+                ngx_rbt32_black(temp);
+                ngx_rbt32_red(gparent);
+                node = gparent;
+
+            } else {
+                if (i == parent->right) {
+                    node = parent;
+                    ngx_rbtree32_left_rotate(tree, node);
+                    parent = ngx_rbt32_node(tree, node->parent);
+                }
+
+                ngx_rbt32_black(parent);
+                ngx_rbt32_red(gparent);
+                ngx_rbtree32_right_rotate(tree, gparent);
+            }
+
+        } else {
+            temp = ngx_rbt32_node(tree, gparent->left);
+
+            if (ngx_rbt32_is_red(temp)) {
+                ngx_rbt32_black(parent);
+                ngx_rbt32_black(temp);
+                ngx_rbt32_red(gparent);
+                node = gparent;
+
+            } else {
+                if (i == parent->left) {
+                    node = parent;
+                    ngx_rbtree32_right_rotate(tree, node);
+                    parent = ngx_rbt32_node(tree, node->parent);
+                }
+
+                ngx_rbt32_black(parent);
+                ngx_rbt32_red(gparent);
+                ngx_rbtree32_left_rotate(tree, gparent);
+            }
+        }
+
+        i = ngx_rbt32_index(node);
+    }
+
+    ngx_rbt32_black(ngx_rbt32_node(tree, tree->root));
+    return NULL;
+}
+
+
+void
+ngx_rbtree32_insert(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    ngx_rbtree32_insert_intl(tree, node, 0);
+}
+
+
+/*
+ * the interval tree raises rkey_max on the way down, so the duplicate is
+ * searched for before the path is touched
+ */
+ngx_rbtree32_node_t *
+ngx_rbtree32_insert_unique(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    ngx_rbtree32_node_t  *temp;
+
+    if (tree->iv) {
+        temp = ngx_rbtree32_find_key(tree, node->key);
+
+        if (temp != NULL) {
+            return temp;
+        }
+
+        return ngx_rbtree32_insert_intl(tree, node, 0);
+    }
+
+    return ngx_rbtree32_insert_intl(tree, node, 1);
+}
+
+
+void
+ngx_rbtree32_delete(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    uint32_t              n, s, t;
+    uint32_t              red;
+    ngx_rbtree32_node_t  *subst, *temp, *parent, *w;
+
+    /* a binary tree delete */
+
+    n = ngx_rbt32_index(node);
+
+    if (node->left == 0) {
+        s = n;
+        t = node->right;
+
+    } else if (node->right == 0) {
+        s = n;
+        t = node->left;
+
+    } else {
+        s = node->right;
+
+        while (ngx_rbt32_node(tree, s)->left != 0) {
+            s = ngx_rbt32_node(tree, s)->left;
+        }
+
+        t = ngx_rbt32_node(tree, s)->right;
+    }
+
+    subst = ngx_rbt32_node(tree, s);
+    temp = ngx_rbt32_node(tree, t);
+
+    if (s == tree->root) {
+        tree->root = t;
+        temp->parent = 0;
+        ngx_rbt32_black(temp);
+
+        return;
+    }
+
+    red = ngx_rbt32_is_red(subst);
+
+    parent = ngx_rbt32_node(tree, subst->parent);
+
+    if (s == parent->left) {
+        parent->left = t;
+
+    } else {
+        parent->right = t;
+    }
+
+    if (s == n) {
+
+        temp->parent = subst->parent;
+
+    } else {
+
+        if (subst->parent == n) {
+            temp->parent = s;
+
+        } else {
+            temp->parent = subst->parent;
+        }
+
+        subst->left = node->left;
+        subst->right = node->right;
+        subst->parent = node->parent;
+        ngx_rbt32_copy_color(subst, node);
+
+        if (n == tree->root) {
+            tree->root = s;
+
+        } else {
+            parent = ngx_rbt32_node(tree, node->parent);
+
+            if (n == parent->left) {
+                parent->left = s;
+            } else {
+                parent->right = s;
+            }
+        }
+
+        if (subst->left != 0) {
+            ngx_rbt32_node(tree, subst->left)->parent = s;
+        }
+
+        if (subst->right != 0) {
+            ngx_rbt32_node(tree, subst->right)->parent = s;
+        }
+    }
+
+    /* the whole path from the spliced position may have lost the max */
+
+    if (tree->iv) {
+        for (w = ngx_rbt32_node(tree, temp->parent); ; w = ngx_rbt32_node(tree, w->parent)) {
+            ngx_rbtree32_update_max(tree, w);
+
+            if (w->parent == 0) {
+                break;
+            }
+        }
+    }
+
+    if (red) {
+        return;
+    }
+
+    /* a delete fixup */
+
+    while (t != tree->root && ngx_rbt32_is_black(temp)) {
+        parent = ngx_rbt32_node(tree, temp->parent);
+
+        if (t == parent->left) {
+            w = ngx_rbt32_node(tree, parent->right);
+
+            if (ngx_rbt32_is_red(w)) {
+                ngx_rbt32_black(w);
+                ngx_rbt32_red(parent);
+                ngx_rbtree32_left_rotate(tree, parent);
+                w = ngx_rbt32_node(tree, parent->right);
+            }
+
+            if (ngx_rbt32_is_black(ngx_rbt32_node(tree, w->left))
+                && ngx_rbt32_is_black(ngx_rbt32_node(tree, w->right)))
+            {
+                ngx_rbt32_red(w);
+                t = temp->parent;
+                temp = parent;
+
+            } else {
+                if (ngx_rbt32_is_black(ngx_rbt32_node(tree, w->right))) {
+                    ngx_rbt32_black(ngx_rbt32_node(tree, w->left));
+                    ngx_rbt32_red(w);
+                    ngx_rbtree32_right_rotate(tree, w);
+                    w = ngx_rbt32_node(tree, parent->right);
+                }
+
+                ngx_rbt32_copy_color(w, parent);
+                ngx_rbt32_black(parent);
+                ngx_rbt32_black(ngx_rbt32_node(tree, w->right));
+                ngx_rbtree32_left_rotate(tree, parent);
+                t = tree->root;
+                temp = ngx_rbt32_node(tree, t);
+            }
+
+        } else {
+            w = ngx_rbt32_node(tree, parent->left);
+
+            if (ngx_rbt32_is_red(w)) {
+                ngx_rbt32_black(w);
+                ngx_rbt32_red(parent);
+                ngx_rbtree32_right_rotate(tree, parent);
+                w = ngx_rbt32_node(tree, parent->left);
+            }
+
+            if (ngx_rbt32_is_black(ngx_rbt32_node(tree, w->left))
+                && ngx_rbt32_is_black(ngx_rbt32_node(tree, w->right)))
+            {
+                ngx_rbt32_red(w);
+                t = temp->parent;
+                temp = parent;
+
+            } else {
+                if (ngx_rbt32_is_black(ngx_rbt32_node(tree, w->left))) {
+                    ngx_rbt32_black(ngx_rbt32_node(tree, w->right));
+                    ngx_rbt32_red(w);
+                    ngx_rbtree32_left_rotate(tree, w);
+                    w = ngx_rbt32_node(tree, parent->left);
+                }
+
+                ngx_rbt32_copy_color(w, parent);
+                ngx_rbt32_black(parent);
+                ngx_rbt32_black(ngx_rbt32_node(tree, w->left));
+                ngx_rbtree32_right_rotate(tree, parent);
+                t = tree->root;
+                temp = ngx_rbt32_node(tree, t);
+            }
+        }
+    }
+
+    ngx_rbt32_black(temp);
+}
+
+
+/* the leftmost node with node->key >= key, 0 if none */
+
+static inline uint32_t
+ngx_rbtree32_lower_bound(ngx_rbtree32_t *tree, ngx_rbtree_key_t key)
+{
+    uint32_t              i, ge;
+    ngx_rbtree32_node_t  *node;
+
+    ge = 0;
+    i = tree->root;
+
+    while (i != 0) {
+        node = ngx_rbt32_node(tree, i);
+
+        if (key <= node->key) {
+            ge = i;
+            i = node->left;
+        } else {
+            i = node->right;
+        }
+    }
+
+    return ge;
+}
+
+
+ngx_rbtree32_node_t *
+ngx_rbtree32_find_key(ngx_rbtree32_t *tree, ngx_rbtree_key_t key)
+{
+    uint32_t              ge;
+    ngx_rbtree32_node_t  *node;
+
+    ge = ngx_rbtree32_lower_bound(tree, key);
+
+    if (ge == 0) {
+        return NULL;
+    }
+
+    node = ngx_rbt32_node(tree, ge);
+
+    return (node->key == key) ? node : NULL;
+}
+
+
+ngx_rbtree32_node_t *
+ngx_rbtree32_find_key_left(ngx_rbtree32_t *tree, ngx_rbtree_key_t key)
+{
+    uint32_t              ge, i;
+    ngx_rbtree32_node_t  *node;
+
+    ge = ngx_rbtree32_lower_bound(tree, key);
+
+    if (ge != 0) {
+        node = ngx_rbt32_node(tree, ge);
+
+        return (node->key == key) ? node : ngx_rbtree32_find_left(tree, node);
+    }
+
+    /* all keys are smaller, the rightmost one */
+
+    if (tree->root == 0) {
+        return NULL;
+    }
+
+    node = ngx_rbt32_node(tree, tree->root);
+
+    for (i = node->right; i != 0; i = node->right) {
+        node = ngx_rbt32_node(tree, i);
+    }
+
+    return node;
+}
+
+
+ngx_rbtree32_node_t *
+ngx_rbtree32_find_key_right(ngx_rbtree32_t *tree, ngx_rbtree_key_t key)
+{
+    uint32_t  ge;
+
+    ge = ngx_rbtree32_lower_bound(tree, key);
+
+    return (ge != 0) ? ngx_rbt32_node(tree, ge) : NULL;
+}
+
+
+ngx_rbtree32_node_t *
+ngx_rbtree32_find_right(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    uint32_t              i;
+    ngx_rbtree32_node_t  *parent;
+
+    if (node->right != 0) {
+        node = ngx_rbt32_node(tree, node->right);
+
+        while (node->left != 0) {
+            node = ngx_rbt32_node(tree, node->left);
+        }
+
+        return node;
+    }
+
+    /* when the node has no right child */
+
+    i = ngx_rbt32_index(node);
+
+    while (node->parent != 0) {
+        parent = ngx_rbt32_node(tree, node->parent);
+
+        if (i != parent->right) {
+            return parent;
+        }
+
+        i = node->parent;
+        node = parent;
+    }
+
+    return NULL;
+}
+
+
+ngx_rbtree32_node_t *
+ngx_rbtree32_find_left(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node)
+{
+    uint32_t              i;
+    ngx_rbtree32_node_t  *parent;
+
+    if (node->left != 0) {
+        node = ngx_rbt32_node(tree, node->left);
+
+        while (node->right != 0) {
+            node = ngx_rbt32_node(tree, node->right);
+        }
+
+        return node;
+    }
+
+    /* when the node has no left child */
+
+    i = ngx_rbt32_index(node);
+
+    while (node->parent != 0) {
+        parent = ngx_rbt32_node(tree, node->parent);
+
+        if (i != parent->left) {
+            return parent;
+        }
+
+        i = node->parent;
+        node = parent;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_rbtree32_walk_intl(ngx_rbtree32_t *tree, uint32_t i,
+    ngx_rbtree32_walk_pt walk, void *ctx)
+{
+    ngx_rbtree32_node_t  *node;
+
+    node = ngx_rbt32_node(tree, i);
+
+    if (node->left != 0) {
+        ngx_rbtree32_walk_intl(tree, node->left, walk, ctx);
+    }
+
+    if (node->right != 0) {
+        ngx_rbtree32_walk_intl(tree, node->right, walk, ctx);
+    }
+
+    walk(node, ctx);
+}
+
+
+void
+ngx_rbtree32_walk(ngx_rbtree32_t *tree, ngx_rbtree32_walk_pt walk, void *ctx)
+{
+    if (tree->root != 0) {
+        ngx_rbtree32_walk_intl(tree, tree->root, walk, ctx);
+    }
+}
+
+
+/* top-down tree, added 2026/10/17 */
+
+static inline uint64_t
+ngx_rbtree_td_less(ngx_rbtree_td_node_t *a, ngx_rbtree_td_node_t *b)
+{
+    return a->key < b->key || (a->key == b->key && a < b);
+}
+
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_single(ngx_rbtree_td_node_t *root, uint64_t dir)
+{
+    ngx_rbtree_td_node_t  *save;
+
+    save = root->link[!dir];
+
+    root->link[!dir] = save->link[dir];
+    save->link[dir] = root;
+
+    root->color = 1;
+    save->color = 0;
+
+    return save;
+}
+
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_double(ngx_rbtree_td_node_t *root, uint64_t dir)
+{
+    root->link[!dir] = ngx_rbtree_td_single(root->link[!dir], !dir);
+
+    return ngx_rbtree_td_single(root, dir);
+}
+
+
+/*
+ * the child in *link made writable, copied if shared with another tree. the
+ * parent holding link must be writable. a no-op without cow.
+ */
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_own(ngx_rbtree_td_node_t **link, ngx_rbtree_td_cow_t *cow)
+{
+    ngx_rbtree_td_node_t  *node, *copy;
+
+    node = *link;
+
+    if (cow == NULL || node == NULL || node->refs == 1) {
+        return node;
+    }
+
+    copy = cow->copy(node, cow->ctx);
+    copy->refs = 1;
+    node->refs--;
+
+    /* the children are shared by the two */
+
+    if (copy->link[0] != NULL) {
+        copy->link[0]->refs++;
+    }
+
+    if (copy->link[1] != NULL) {
+        copy->link[1]->refs++;
+    }
+
+    *link = copy;
+
+    return copy;
+}
+
+
+/*
+ * returns the node of the same key if unique and found, NULL if linked. the
+ * flips and rotations done on the way down keep the tree valid either way.
+ * with cow, the nodes are made writable as the descent reaches them.
+ */
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_insert_intl(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node,
+    uint64_t unique, ngx_rbtree_td_cow_t *cow)
+{
+    uint64_t               dir, last, dir2;
+    ngx_rbtree_td_node_t   head, *t, *g, *p, *q, *found;
+
+    node->link[0] = NULL;
+    node->link[1] = NULL;
+    node->color = 1;
+
+    if (cow != NULL) {
+        node->refs = 1;
+    }
+
+    if (tree->root == NULL) {
+        node->color = 0;
+        tree->root = node;
+
+        return NULL;
+    }
+
+    /* a false root above the real one */
+
+    head.link[0] = NULL;
+    head.link[1] = tree->root;
+
+    t = &head;
+    g = p = found = NULL;
+    q = ngx_rbtree_td_own(&head.link[1], cow);
+    dir = last = 0;
+
+    for ( ;; ) {
+
+        if (q == NULL) {
+            /* attach at the bottom */
+            p->link[dir] = q = node;
+
+        } else if (ngx_rbt_td_is_red(q->link[0])
+                   && ngx_rbt_td_is_red(q->link[1]))
+        {
+            /* color flip */
+            q->color = 1;
+            ngx_rbtree_td_own(&q->link[0], cow)->color = 0;
+            ngx_rbtree_td_own(&q->link[1], cow)->color = 0;
+        }
+
+        /* fix a red violation */
+
+        if (ngx_rbt_td_is_red(q) && ngx_rbt_td_is_red(p)) {
+            dir2 = (t->link[1] == g);
+
+            if (q == p->link[last]) {
+                t->link[dir2] = ngx_rbtree_td_single(g, !last);
+            } else {
+                t->link[dir2] = ngx_rbtree_td_double(g, !last);
+            }
+        }
+
+        if (q == node) {
+            break;
+        }
+
+        if (unique && q->key == node->key) {
+            found = q;
+            break;
+        }
+
+        last = dir;
+        dir = ngx_rbtree_td_less(q, node);
+
+        if (g != NULL) {
+            t = g;
+        }
+
+        g = p;
+        p = q;
+        q = ngx_rbtree_td_own(&q->link[dir], cow);
+    }
+
+    tree->root = head.link[1];
+    tree->root->color = 0;
+
+    return found;
+}
+
+
+void
+ngx_rbtree_td_insert(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node)
+{
+    ngx_rbtree_td_insert_intl(tree, node, 0, NULL);
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_insert_unique(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node)
+{
+    return ngx_rbtree_td_insert_intl(tree, node, 1, NULL);
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_insert_cow(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node,
+    ngx_rbtree_td_cow_t *cow)
+{
+    return ngx_rbtree_td_insert_intl(tree, node, 1, cow);
+}
+
+
+/*
+ * removes node, or the leftmost node of key if node is NULL, in the same
+ * descent. returns the node removed. with cow, the node removed is the
+ * writable one, whose links are taken over by the tree.
+ */
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_delete_intl(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node,
+    ngx_rbtree_key_t key, ngx_rbtree_td_cow_t *cow)
+{
+    uint64_t               dir, last, dir2;
+    ngx_rbtree_td_node_t   head, *q, *p, *g, *f, *s;
+
+    if (tree->root == NULL) {
+        return NULL;
+    }
+
+    head.link[0] = NULL;
+    head.link[1] = tree->root;
+    head.color = 0;
+
+    q = &head;
+    g = p = f = NULL;
+    dir = 1;
+
+    /* search, pushing a red node down */
+
+    while (q->link[dir] != NULL) {
+        last = dir;
+
+        g = p;
+        p = q;
+        q = ngx_rbtree_td_own(&q->link[dir], cow);
+
+        if (node != NULL ? q == node : q->key == key) {
+            /* the last one of key on the path is the leftmost */
+            f = q;
+            dir = 0;
+
+        } else {
+            dir = (node != NULL) ? ngx_rbtree_td_less(q, node) : q->key < key;
+        }
+
+        if (ngx_rbt_td_is_red(q) || ngx_rbt_td_is_red(q->link[dir])) {
+            continue;
+        }
+
+        if (ngx_rbt_td_is_red(q->link[!dir])) {
+            ngx_rbtree_td_own(&q->link[!dir], cow);
+            p = p->link[last] = ngx_rbtree_td_single(q, dir);
+            continue;
+        }
+
+        s = ngx_rbtree_td_own(&p->link[!last], cow);
+
+        if (s == NULL) {
+            continue;
+        }
+
+        if (!ngx_rbt_td_is_red(s->link[!last])
+            && !ngx_rbt_td_is_red(s->link[last]))
+        {
+            /* color flip */
+            p->color = 0;
+            s->color = 1;
+            q->color = 1;
+
+        } else {
+            dir2 = (g->link[1] == p);
+
+            /* the red child of s is rotated or recolored */
+
+            if (ngx_rbt_td_is_red(s->link[last])) {
+                ngx_rbtree_td_own(&s->link[last], cow);
+                g->link[dir2] = ngx_rbtree_td_double(p, last);
+
+            } else {
+                ngx_rbtree_td_own(&s->link[!last], cow);
+                g->link[dir2] = ngx_rbtree_td_single(p, last);
+            }
+
+            /* ensure correct coloring */
+            q->color = g->link[dir2]->color = 1;
+            g->link[dir2]->link[0]->color = 0;
+            g->link[dir2]->link[1]->color = 0;
+        }
+    }
+
+    if (f != NULL) {
+
+        /* unlink q, the in-order predecessor of f (or f itself) */
+
+        p->link[p->link[1] == q] = q->link[q->link[0] == NULL];
+
+        if (q != f) {
+
+            /*
+             * put q at the position of f instead of copying the payload.
+             * the path to f is still in cache.
+             */
+
+            p = &head;
+            dir = 1;
+
+            while (p->link[dir] != f) {
+                p = p->link[dir];
+                dir = ngx_rbtree_td_less(p, f);
+            }
+
+            q->link[0] = f->link[0];
+            q->link[1] = f->link[1];
+            q->color = f->color;
+            p->link[dir] = q;
+        }
+    }
+
+    tree->root = head.link[1];
+
+    if (tree->root != NULL) {
+        tree->root->color = 0;
+    }
+
+    return f;
+}
+
+
+void
+ngx_rbtree_td_delete(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node)
+{
+    ngx_rbtree_td_delete_intl(tree, node, 0, NULL);
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_delete_key(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key)
+{
+    return ngx_rbtree_td_delete_intl(tree, NULL, key, NULL);
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_delete_cow(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key,
+    ngx_rbtree_td_cow_t *cow)
+{
+    return ngx_rbtree_td_delete_intl(tree, NULL, key, cow);
+}
+
+
+/* the leftmost node with node->key >= key */
+
+static inline ngx_rbtree_td_node_t *
+ngx_rbtree_td_lower_bound(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_td_node_t  *node, *ge;
+
+    ge = NULL;
+    node = tree->root;
+
+    while (node != NULL) {
+        if (key <= node->key) {
+            ge = node;
+            node = node->link[0];
+        } else {
+            node = node->link[1];
+        }
+    }
+
+    return ge;
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_find_key(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_td_node_t  *ge;
+
+    ge = ngx_rbtree_td_lower_bound(tree, key);
+
+    return (ge != NULL && ge->key == key) ? ge : NULL;
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_find_key_left(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_td_node_t  *node, *lt;
+
+    /* the leftmost equal node, or the rightmost node with node->key < key */
+
+    node = ngx_rbtree_td_lower_bound(tree, key);
+
+    if (node != NULL && node->key == key) {
+        return node;
+    }
+
+    lt = NULL;
+    node = tree->root;
+
+    while (node != NULL) {
+        if (node->key < key) {
+            lt = node;
+            node = node->link[1];
+        } else {
+            node = node->link[0];
+        }
+    }
+
+    return lt;
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_find_key_right(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key)
+{
+    return ngx_rbtree_td_lower_bound(tree, key);
+}
+
+
+/* neighbors are found by descending from the root to the node */
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_find_right(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node)
+{
+    ngx_rbtree_td_node_t  *temp, *succ;
+
+    succ = NULL;
+    temp = tree->root;
+
+    while (temp != node) {
+        if (temp == NULL) {
+            return NULL;
+        }
+
+        if (ngx_rbtree_td_less(node, temp)) {
+            succ = temp;
+            temp = temp->link[0];
+        } else {
+            temp = temp->link[1];
+        }
+    }
+
+    if (node->link[1] != NULL) {
+        node = node->link[1];
+
+        while (node->link[0] != NULL) {
+            node = node->link[0];
+        }
+
+        return node;
+    }
+
+    return succ;
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_find_left(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node)
+{
+    ngx_rbtree_td_node_t  *temp, *pred;
+
+    pred = NULL;
+    temp = tree->root;
+
+    while (temp != node) {
+        if (temp == NULL) {
+            return NULL;
+        }
+
+        if (ngx_rbtree_td_less(temp, node)) {
+            pred = temp;
+            temp = temp->link[1];
+        } else {
+            temp = temp->link[0];
+        }
+    }
+
+    if (node->link[0] != NULL) {
+        node = node->link[0];
+
+        while (node->link[1] != NULL) {
+            node = node->link[1];
+        }
+
+        return node;
+    }
+
+    return pred;
+}
+
+
+/* post-order over an explicit stack, walk may free the node */
+
+void
+ngx_rbtree_td_walk(ngx_rbtree_td_t *tree, ngx_rbtree_td_walk_pt walk, void *ctx)
+{
+    uint64_t               top;
+    ngx_rbtree_td_node_t  *stack[NGX_RBTREE_TD_STACK], *node, *last;
+
+    top = 0;
+    node = tree->root;
+    last = NULL;
+
+    while (top > 0 || node != NULL) {
+
+        if (node != NULL) {
+            stack[top++] = node;
+            node = node->link[0];
+            continue;
+        }
+
+        node = stack[top - 1];
+
+        if (node->link[1] != NULL && node->link[1] != last) {
+            node = node->link[1];
+            continue;
+        }
+
+        top--;
+        last = node;
+        walk(node, ctx);
+        node = NULL;
+    }
+}
+
+
+void
+ngx_rbtree_td_path_init(ngx_rbtree_td_t *tree, ngx_rbtree_td_path_t *path,
+    ngx_rbtree_key_t key, uint64_t dir)
+{
+    ngx_rbtree_td_node_t  *node;
+
+    path->top = 0;
+    path->dir = dir;
+    node = tree->root;
+
+    /* the ancestors passed on the search path are the successors of the first */
+
+    while (node != NULL) {
+        if (dir ? node->key < key : node->key >= key) {
+            path->stack[path->top++] = node;
+            node = node->link[dir];
+        } else {
+            node = node->link[!dir];
+        }
+    }
+}
+
+
+ngx_rbtree_td_node_t *
+ngx_rbtree_td_path_next(ngx_rbtree_td_path_t *path)
+{
+    ngx_rbtree_td_node_t  *node, *temp;
+
+    if (path->top == 0) {
+        return NULL;
+    }
+
+    node = path->stack[--path->top];
+
+    /* the subtree on the far side, down to its near end */
+
+    temp = node->link[!path->dir];
+
+    while (temp != NULL) {
+        path->stack[path->top++] = temp;
+        temp = temp->link[path->dir];
+    }
+
+    return node;
 }
 
 /**
@@ -18,23 +18,52 @@
 // typedef ngx_int_t   ngx_rbtree_key_int_t;
 
 /**
- * modified to hold 64bit key-value pairs
+ * modified to hold 64bit key-value pairs. RBTREE_KEY128 widens the key to
+ * 128 bits, ordered as (high word signed, low word unsigned) for composite
+ * keys such as (contig, position). added 2026/10/17
  */
-// typedef int64_t ngx_rbtree_key_t;
+#ifdef RBTREE_KEY128
+__extension__ typedef __int128 ngx_rbtree_key_t;
+#define NGX_RBTREE_KEY_MAX                                                    \
+    ((ngx_rbtree_key_t) (~(unsigned __int128) 0 >> 1))
+#else
+typedef int64_t ngx_rbtree_key_t;
+#define NGX_RBTREE_KEY_MAX  INT64_MAX
+#endif
+#define NGX_RBTREE_KEY_MIN  (-NGX_RBTREE_KEY_MAX - 1)
 
 
 typedef struct ngx_rbtree_node_s  ngx_rbtree_node_t;
 
+/*
+ * RBTREE_COMPACT_NODE packs color (bit 0) and the pool-owned marker (bit 1)
+ * into the parent pointer, shrinking the node header from 40 to 32 bytes.
+ * nodes must be at least 4-byte aligned. added 2026/10/17
+ */
+#ifdef RBTREE_COMPACT_NODE
+
+struct ngx_rbtree_node_s {
+    uintptr_t               parent_color;
+    ngx_rbtree_node_t       *left;
+    ngx_rbtree_node_t       *right;
+    ngx_rbtree_key_t        key;
+};
+
+#else
+
 struct ngx_rbtree_node_s {
     ngx_rbtree_node_t       *parent;
     ngx_rbtree_node_t       *left;
     ngx_rbtree_node_t       *right;
     uint8_t                 color;
     uint8_t                 data;
-    uint8_t                 pad[6];
-    int64_t                 key;
+    uint8_t                 pad[2];
+    uint32_t                size;       /* subtree size, order-statistic tree only */
+    ngx_rbtree_key_t        key;
 };
 
+#endif
+
 
 typedef struct ngx_rbtree_s  ngx_rbtree_t;
 
@@ -60,23 +89,143 @@ void ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
 /*
  * search functions
  * find_key return the leftmost node
- * added 2015/11/06
+ * added 2015/11/06, lower-bound descents since 2026/10/17
  */
-ngx_rbtree_node_t *ngx_rbtree_find_key(ngx_rbtree_t *tree, int64_t key);
-ngx_rbtree_node_t *ngx_rbtree_find_key_left(ngx_rbtree_t *tree, int64_t key);
-ngx_rbtree_node_t *ngx_rbtree_find_key_right(ngx_rbtree_t *tree, int64_t key);
+ngx_rbtree_node_t *ngx_rbtree_find_key(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree_node_t *ngx_rbtree_find_key_left(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree_node_t *ngx_rbtree_find_key_right(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
 ngx_rbtree_node_t *ngx_rbtree_find_left(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
 ngx_rbtree_node_t *ngx_rbtree_find_right(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
 
+/*
+ * batched search, lookups advance in lock-step to overlap cache misses
+ * added 2026/10/17
+ */
+void ngx_rbtree_find_keys(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+void ngx_rbtree_find_keys_left(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+void ngx_rbtree_find_keys_right(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+
+/*
+ * finger search over ascending keys, each search starts from the previous result
+ */
+ngx_rbtree_node_t *ngx_rbtree_find_key_from(ngx_rbtree_t *tree, ngx_rbtree_node_t *finger, ngx_rbtree_key_t key);
+void ngx_rbtree_find_sorted_keys(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+void ngx_rbtree_find_sorted_keys_left(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+void ngx_rbtree_find_sorted_keys_right(ngx_rbtree_t *tree, ngx_rbtree_key_t const *keys, uint64_t cnt, ngx_rbtree_node_t **out);
+
 typedef void (*ngx_rbtree_walk_pt) (ngx_rbtree_node_t **node, ngx_rbtree_node_t *sentinel, void *ctx);
 void ngx_rbtree_walk(ngx_rbtree_t *tree, ngx_rbtree_walk_pt walk, void *ctx);
 
+/*
+ * bulk build, cnt nodes are pulled in ascending order from next
+ */
+typedef ngx_rbtree_node_t *(*ngx_rbtree_next_pt) (void *ctx);
+void ngx_rbtree_build(ngx_rbtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next, void *ctx);
+
+/*
+ * unlink all nodes into an ascending list chained by node->right,
+ * the tree is left empty
+ */
+ngx_rbtree_node_t *ngx_rbtree_flatten(ngx_rbtree_t *tree);
+
+/*
+ * generic augmentation, added 2026/10/17
+ *
+ * update recomputes the augmented value of node from its children (NULL for
+ * the leaves) and returns non-zero if the value changed. the core calls it
+ * on the nodes whose subtree changed, bottom-up, through insert, delete and
+ * the rotations. ngx_rbtree_augment_update must be called when the payload
+ * the value depends on is modified.
+ */
+typedef int (*ngx_rbtree_update_pt) (ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *left, ngx_rbtree_node_t *right, void *ctx);
+
+typedef struct ngx_rbtree_augment_s  ngx_rbtree_augment_t;
+
+struct ngx_rbtree_augment_s {
+    ngx_rbtree_update_pt    update;
+    void                    *ctx;
+};
+
+void ngx_rbtree_augment_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug);
+void ngx_rbtree_augment_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug);
+void ngx_rbtree_augment_update(ngx_rbtree_t *tree, ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug);
+void ngx_rbtree_augment_build(ngx_rbtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next, void *ctx, ngx_rbtree_augment_t const *aug);
+
+/*
+ * hinted insert. ngx_rbtree_hint_start climbs from hint to the lowest node
+ * the descent for key can start from, and ngx_rbtree_insert_from descends
+ * from start (the root if NULL). aug may be NULL.
+ */
+ngx_rbtree_node_t *ngx_rbtree_hint_start(ngx_rbtree_node_t *hint, ngx_rbtree_key_t key);
+void ngx_rbtree_insert_from(ngx_rbtree_t *tree, ngx_rbtree_node_t *node, ngx_rbtree_node_t *start, ngx_rbtree_augment_t const *aug);
+
+/*
+ * link node below parent (NULL for an empty tree) on the side of dir and
+ * rebalance, for the descents done by the caller (rbtree_gen.h)
+ */
+void ngx_rbtree_insert_at(ngx_rbtree_t *tree, ngx_rbtree_node_t *parent, uint64_t dir, ngx_rbtree_node_t *node);
+
+/*
+ * insert node in a single descent unless the key is found on the way, which
+ * returns the node found (NULL if linked). aug may be NULL.
+ */
+ngx_rbtree_node_t *ngx_rbtree_insert_unique(ngx_rbtree_t *tree, ngx_rbtree_node_t *node, ngx_rbtree_augment_t const *aug);
+
+/*
+ * put node in the place of old without rebalancing, for the nodes of equal keys
+ */
+void ngx_rbtree_replace(ngx_rbtree_t *tree, ngx_rbtree_node_t *old, ngx_rbtree_node_t *node);
+
+/*
+ * decompose [lkey, rkey) into O(log n) pieces, each of which is a single
+ * node (subtree == 0) or a whole subtree (subtree != 0), for range
+ * aggregates over the augmented values. the order of the pieces is unspecified.
+ */
+typedef void (*ngx_rbtree_cover_pt) (ngx_rbtree_node_t *node, uint64_t subtree, void *ctx);
+void ngx_rbtree_cover(ngx_rbtree_t *tree, ngx_rbtree_key_t lkey, ngx_rbtree_key_t rkey, ngx_rbtree_cover_pt cover, void *ctx);
+
+#ifdef RBTREE_COMPACT_NODE
+
+#define NGX_RBT_COLOR                   ((uintptr_t)0x01)
+#define NGX_RBT_POOLED                  ((uintptr_t)0x02)
+#define NGX_RBT_FLAGS                   (NGX_RBT_COLOR | NGX_RBT_POOLED)
+
+#define ngx_rbt_parent(node)                                                  \
+    ((__typeof__(node)) ((node)->parent_color & ~NGX_RBT_FLAGS))
+#define ngx_rbt_set_parent(node, p)                                           \
+    ((node)->parent_color = ((node)->parent_color & NGX_RBT_FLAGS)            \
+                            | (uintptr_t) (p))
+
+#define ngx_rbt_red(node)               ((node)->parent_color |= NGX_RBT_COLOR)
+#define ngx_rbt_black(node)             ((node)->parent_color &= ~NGX_RBT_COLOR)
+#define ngx_rbt_is_red(node)            ((node)->parent_color & NGX_RBT_COLOR)
+#define ngx_rbt_is_black(node)          (!ngx_rbt_is_red(node))
+#define ngx_rbt_copy_color(n1, n2)                                            \
+    ((n1)->parent_color = ((n1)->parent_color & ~NGX_RBT_COLOR)               \
+                          | ((n2)->parent_color & NGX_RBT_COLOR))
+
+/* marks a node allocated from the pool of the wrapper (tree.c) */
+#define ngx_rbt_set_pooled(node)        ((node)->parent_color = NGX_RBT_POOLED)
+#define ngx_rbt_is_pooled(node)         ((node)->parent_color & NGX_RBT_POOLED)
+
+#else
+
+#define ngx_rbt_parent(node)            ((node)->parent)
+#define ngx_rbt_set_parent(node, p)     ((node)->parent = (p))
+
 #define ngx_rbt_red(node)               ((node)->color = 1)
 #define ngx_rbt_black(node)             ((node)->color = 0)
 #define ngx_rbt_is_red(node)            ((node)->color)
 #define ngx_rbt_is_black(node)          (!ngx_rbt_is_red(node))
 #define ngx_rbt_copy_color(n1, n2)      (n1->color = n2->color)
 
+/* marks a node allocated from the pool of the wrapper (tree.c) */
+#define ngx_rbt_set_pooled(node)        ((node)->data = 0xff)
+#define ngx_rbt_is_pooled(node)         ((node)->data == 0xff)
+
+#endif
+
 
 /* a sentinel must be black */
 
@@ -87,6 +236,19 @@ void ngx_rbtree_walk(ngx_rbtree_t *tree, ngx_rbtree_walk_pt walk, void *ctx);
 
 typedef struct ngx_ivtree_node_s ngx_ivtree_node_t;
 
+#ifdef RBTREE_COMPACT_NODE
+
+struct ngx_ivtree_node_s {
+    uintptr_t               parent_color;
+    ngx_ivtree_node_t       *left;
+    ngx_ivtree_node_t       *right;
+    ngx_rbtree_key_t        lkey;
+    ngx_rbtree_key_t        rkey;
+    ngx_rbtree_key_t        rkey_max;
+};
+
+#else
+
 struct ngx_ivtree_node_s {
     ngx_ivtree_node_t       *parent;
     ngx_ivtree_node_t       *left;
@@ -94,11 +256,13 @@ struct ngx_ivtree_node_s {
     uint8_t                 color;
     uint8_t                 data;
     uint8_t                 pad[6];
-    int64_t                 lkey;
-    int64_t                 rkey;
-    int64_t                 rkey_max;
+    ngx_rbtree_key_t        lkey;
+    ngx_rbtree_key_t        rkey;
+    ngx_rbtree_key_t        rkey_max;
 };
 
+#endif
+
 
 typedef struct ngx_ivtree_s  ngx_ivtree_t;
 
@@ -115,6 +279,226 @@ struct ngx_ivtree_s {
 
 void ngx_ivtree_insert(ngx_ivtree_t *tree, ngx_ivtree_node_t *node);
 void ngx_ivtree_delete(ngx_ivtree_t *tree, ngx_ivtree_node_t *node);
+void ngx_ivtree_build(ngx_ivtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next, void *ctx);
+
+/*
+ * the leftmost node with rkey > key, searched from finger (NULL for the root)
+ */
+ngx_ivtree_node_t *ngx_ivtree_find_rkey_from(ngx_ivtree_t *tree, ngx_ivtree_node_t *finger, ngx_rbtree_key_t key);
+
+
+
+/*
+ * order-statistic tree, added 2026/10/17
+ *
+ * node->size holds the number of nodes in the subtree, maintained as an
+ * augmented value through ngx_rbtree_augment_*. the sentinel must have
+ * size 0. not available with RBTREE_COMPACT_NODE, which has no room for
+ * the size.
+ */
+
+#ifndef RBTREE_COMPACT_NODE
+
+void ngx_ostree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+ngx_rbtree_node_t *ngx_ostree_insert_unique(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+void ngx_ostree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+void ngx_ostree_build(ngx_rbtree_t *tree, uint64_t cnt, ngx_rbtree_next_pt next, void *ctx);
+
+/* the number of nodes with keys less than key */
+uint64_t ngx_ostree_rank(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
+
+/* the k-th (0-origin) node in the ascending order, NULL if k >= size */
+ngx_rbtree_node_t *ngx_ostree_select(ngx_rbtree_t *tree, uint64_t k);
+
+void ngx_ostree_join(ngx_rbtree_t *left, ngx_rbtree_node_t *node, ngx_rbtree_t *right);
+void ngx_ostree_split(ngx_rbtree_t *tree, ngx_rbtree_key_t key, ngx_rbtree_t *right);
+
+#endif
+
+
+
+/*
+ * split and join in O(log n), added 2026/10/17
+ *
+ * ngx_rbtree_join links left, node and right into left, where no key in left
+ * is above node->key and none in right is below. right is left empty.
+ * ngx_rbtree_split moves the nodes with keys not below key into right, which
+ * must be empty. the trees must share the sentinel, and the delete leaves the
+ * sentinel untouched so that unrelated trees can share one. aug may be NULL.
+ */
+void ngx_rbtree_join(ngx_rbtree_t *left, ngx_rbtree_node_t *node, ngx_rbtree_t *right, ngx_rbtree_augment_t const *aug);
+void ngx_rbtree_split(ngx_rbtree_t *tree, ngx_rbtree_key_t key, ngx_rbtree_t *right, ngx_rbtree_augment_t const *aug);
+void ngx_ivtree_join(ngx_ivtree_t *left, ngx_ivtree_node_t *node, ngx_ivtree_t *right);
+void ngx_ivtree_split(ngx_ivtree_t *tree, ngx_rbtree_key_t key, ngx_ivtree_t *right);
+
+
+
+/*
+ * index-linked tree, added 2026/10/17
+ *
+ * links are 32-bit indices into a table of geometrically growing blocks
+ * (NGX_RBTREE32_BLOCK_CNT << b objects in the b-th block), so a node must
+ * live in the blocks of its tree. index 0 is the sentinel. a node keeps
+ * its own index in self, whose msb holds the color. rkey and rkey_max
+ * exist only in interval trees (iv != 0).
+ */
+
+typedef struct ngx_rbtree32_node_s  ngx_rbtree32_node_t;
+
+struct ngx_rbtree32_node_s {
+    uint32_t                parent;
+    uint32_t                left;
+    uint32_t                right;
+    uint32_t                self;
+    ngx_rbtree_key_t        key;        /* lkey in interval trees */
+    ngx_rbtree_key_t        rkey;
+    ngx_rbtree_key_t        rkey_max;
+};
+
+
+typedef struct ngx_rbtree32_s  ngx_rbtree32_t;
+
+struct ngx_rbtree32_s {
+    uint32_t                root;
+    uint32_t                iv;
+    uint64_t                size;       /* object size */
+    uint8_t                 *base[32];
+};
+
+
+#define NGX_RBTREE32_BLOCK_CNT          64
+#define NGX_RBTREE32_RED                0x80000000
+#define NGX_RBTREE32_MAX_CNT            NGX_RBTREE32_RED
+
+#define ngx_rbt32_index(node)           ((node)->self & ~NGX_RBTREE32_RED)
+#define ngx_rbt32_red(node)             ((node)->self |= NGX_RBTREE32_RED)
+#define ngx_rbt32_black(node)           ((node)->self &= ~NGX_RBTREE32_RED)
+#define ngx_rbt32_is_red(node)          ((node)->self & NGX_RBTREE32_RED)
+#define ngx_rbt32_is_black(node)        (!ngx_rbt32_is_red(node))
+#define ngx_rbt32_copy_color(n1, n2)                                          \
+    ((n1)->self = ngx_rbt32_index(n1) | ((n2)->self & NGX_RBTREE32_RED))
+
+
+static inline uint64_t
+ngx_rbt32_block(uint32_t i)
+{
+    return 63 - __builtin_clzll((uint64_t) i / NGX_RBTREE32_BLOCK_CNT + 1);
+}
+
+
+static inline ngx_rbtree32_node_t *
+ngx_rbt32_node(ngx_rbtree32_t *tree, uint32_t i)
+{
+    uint64_t  b, ofs;
+
+    b = ngx_rbt32_block(i);
+    ofs = i - (((uint64_t) NGX_RBTREE32_BLOCK_CNT << b) - NGX_RBTREE32_BLOCK_CNT);
+
+    return (ngx_rbtree32_node_t *) (tree->base[b] + ofs * tree->size);
+}
+
+
+void ngx_rbtree32_insert(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node);
+ngx_rbtree32_node_t *ngx_rbtree32_insert_unique(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node);
+void ngx_rbtree32_delete(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node);
+
+ngx_rbtree32_node_t *ngx_rbtree32_find_key(ngx_rbtree32_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree32_node_t *ngx_rbtree32_find_key_left(ngx_rbtree32_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree32_node_t *ngx_rbtree32_find_key_right(ngx_rbtree32_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree32_node_t *ngx_rbtree32_find_left(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node);
+ngx_rbtree32_node_t *ngx_rbtree32_find_right(ngx_rbtree32_t *tree, ngx_rbtree32_node_t *node);
+
+typedef void (*ngx_rbtree32_walk_pt) (ngx_rbtree32_node_t *node, void *ctx);
+void ngx_rbtree32_walk(ngx_rbtree32_t *tree, ngx_rbtree32_walk_pt walk, void *ctx);
+
+
+
+/*
+ * top-down tree without parent links, added 2026/10/17
+ *
+ * insert and delete rebalance on the way down in a single pass (Guibas and
+ * Sedgewick, as described by Julienne Walker). nodes are ordered by (key,
+ * address) so that every node has a unique position to search for. leaves
+ * are NULL.
+ */
+
+typedef struct ngx_rbtree_td_node_s  ngx_rbtree_td_node_t;
+
+struct ngx_rbtree_td_node_s {
+    ngx_rbtree_td_node_t    *link[2];   /* left, right */
+    uint8_t                 color;
+    uint8_t                 data;
+    uint8_t                 pad[2];
+    uint32_t                refs;       /* parents and roots sharing it, cow only */
+    ngx_rbtree_key_t        key;
+};
+
+
+typedef struct ngx_rbtree_td_s  ngx_rbtree_td_t;
+
+struct ngx_rbtree_td_s {
+    ngx_rbtree_td_node_t    *root;
+};
+
+
+/* the height of a red-black tree is at most 2 log2(n + 1) */
+#define NGX_RBTREE_TD_STACK             128
+
+#define ngx_rbt_td_is_red(node)         ((node) != NULL && (node)->color)
+
+
+void ngx_rbtree_td_insert(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node);
+void ngx_rbtree_td_delete(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node);
+
+/* unique insert and delete by key (the leftmost), in the single top-down pass */
+ngx_rbtree_td_node_t *ngx_rbtree_td_insert_unique(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node);
+ngx_rbtree_td_node_t *ngx_rbtree_td_delete_key(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key);
+
+ngx_rbtree_td_node_t *ngx_rbtree_td_find_key(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree_td_node_t *ngx_rbtree_td_find_key_left(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree_td_node_t *ngx_rbtree_td_find_key_right(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key);
+ngx_rbtree_td_node_t *ngx_rbtree_td_find_left(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node);
+ngx_rbtree_td_node_t *ngx_rbtree_td_find_right(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node);
+
+typedef void (*ngx_rbtree_td_walk_pt) (ngx_rbtree_td_node_t *node, void *ctx);
+void ngx_rbtree_td_walk(ngx_rbtree_td_t *tree, ngx_rbtree_td_walk_pt walk, void *ctx);
+
+/*
+ * in-order cursor over an explicit path stack, the nodes yet to be returned
+ * whose right (left if descending) subtrees are not visited, the next one on
+ * top. it starts at the leftmost node with node->key >= key, or at the
+ * rightmost node with node->key < key if descending, and each step costs
+ * O(1) amortized. the tree must not be modified while iterating.
+ */
+
+typedef struct {
+    uint64_t                top;
+    uint64_t                dir;        /* 0: ascending, 1: descending */
+    ngx_rbtree_td_node_t   *stack[NGX_RBTREE_TD_STACK];
+} ngx_rbtree_td_path_t;
+
+void ngx_rbtree_td_path_init(ngx_rbtree_td_t *tree, ngx_rbtree_td_path_t *path, ngx_rbtree_key_t key, uint64_t dir);
+ngx_rbtree_td_node_t *ngx_rbtree_td_path_next(ngx_rbtree_td_path_t *path);
+
+
+/*
+ * path copying, added 2026/10/17
+ *
+ * the trees may share subtrees. a node referred from more than one parent or
+ * root (refs > 1) is never written; it is replaced by a copy on the way down,
+ * so that only the O(log n) nodes on the path are copied. copy returns a new
+ * node with the contents of node. keys must be unique.
+ */
+
+typedef ngx_rbtree_td_node_t *(*ngx_rbtree_td_copy_pt) (ngx_rbtree_td_node_t *node, void *ctx);
+
+typedef struct {
+    ngx_rbtree_td_copy_pt   copy;
+    void                   *ctx;
+} ngx_rbtree_td_cow_t;
+
+ngx_rbtree_td_node_t *ngx_rbtree_td_insert_cow(ngx_rbtree_td_t *tree, ngx_rbtree_td_node_t *node, ngx_rbtree_td_cow_t *cow);
+ngx_rbtree_td_node_t *ngx_rbtree_td_delete_cow(ngx_rbtree_td_t *tree, ngx_rbtree_key_t key, ngx_rbtree_td_cow_t *cow);
 
 
 #endif /* _NGX_RBTREE_H_INCLUDED_ */
@@ -0,0 +1,190 @@
+/**
+ * @file rbtree_gen.h
+ *
+ * @brief type-specialized red-black trees in the style of BSD sys/tree.h.
+ * RBTREE_GENERATE instantiates the insert, remove, search and iteration with the
+ * comparator inlined for a key of any type. the rebalancing is shared with
+ * ngx_rbtree.c, which never reads the key.
+ *
+ *	struct node_s {
+ *		rbtree_link_t link;			(must be at the head)
+ *		double key;
+ *	};
+ *	RBTREE_GENERATE(dtree, struct node_s, key, RBTREE_CMP)
+ *
+ *	dtree_t tree;
+ *	dtree_init(&tree);
+ *	dtree_insert(&tree, node);
+ *	for(struct node_s *n = dtree_lower_bound(&tree, 0.5); n != NULL; n = dtree_next(&tree, n)) { ... }
+ */
+#ifndef _RBTREE_GEN_H_INCLUDED
+#define _RBTREE_GEN_H_INCLUDED
+
+#include <stdint.h>
+#include "ngx_rbtree.h"
+
+
+/**
+ * @struct rbtree_link_s
+ * @brief the head of ngx_rbtree_node_t without the key, which is held by the object.
+ * aligned as the node, whose key is 16-byte aligned with RBTREE_KEY128.
+ */
+struct rbtree_link_s {
+#ifdef RBTREE_COMPACT_NODE
+	uintptr_t parent_color;
+	void *left, *right;
+#else
+	void *parent, *left, *right;
+	uint8_t color, data, pad[2];
+	uint32_t size;
+#endif
+} __attribute__(( aligned(__alignof__(ngx_rbtree_node_t)) ));
+typedef struct rbtree_link_s rbtree_link_t;
+
+/**
+ * @macro RBTREE_CMP
+ * @brief three-way comparison of scalar keys (int, unsigned, double)
+ */
+#define RBTREE_CMP(a, b)			( ((a) > (b)) - ((a) < (b)) )
+
+/**
+ * @macro RBTREE_GENERATE
+ *
+ * @brief define name_t and the functions below for node_t, ordered by cmp(a, b) on
+ * key_field, which returns negative, zero or positive as a is below, equal to or
+ * above b. equal keys are kept in the insertion order.
+ *
+ *	void name_init(name_t *tree);
+ *	void name_insert(name_t *tree, node_t *node);
+ *	void name_remove(name_t *tree, node_t *node);
+ *	node_t *name_find(name_t *tree, key);			the leftmost node equal to key, or NULL
+ *	node_t *name_lower_bound(name_t *tree, key);		the leftmost node not below key
+ *	node_t *name_upper_bound(name_t *tree, key);		the leftmost node above key
+ *	node_t *name_first(name_t *tree), *name_last(name_t *tree);
+ *	node_t *name_next(name_t *tree, node_t *node), *name_prev(name_t *tree, node_t *node);
+ *	uint64_t name_count(name_t *tree);
+ *
+ * the functions are static inline, so that it can be placed in headers. the tree holds
+ * its own sentinel and must not be moved while it has nodes.
+ */
+#define RBTREE_GENERATE(name, node_t, key_field, cmp) \
+	typedef __typeof__(((node_t *)0)->key_field) name##_key_t; \
+	typedef struct { \
+		ngx_rbtree_t t; \
+		ngx_rbtree_node_t sentinel; \
+		uint64_t cnt; \
+	} name##_t; \
+	\
+	static inline __attribute__((unused)) \
+	void name##_init(name##_t *tree) \
+	{ \
+		tree->sentinel = (ngx_rbtree_node_t){ 0 };		/* black */ \
+		tree->t.root = tree->t.sentinel = &tree->sentinel; \
+		tree->cnt = 0; \
+		return; \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	void name##_insert(name##_t *tree, node_t *node) \
+	{ \
+		ngx_rbtree_node_t *parent = NULL, *temp = tree->t.root; \
+		uint64_t dir = 0; \
+		while(temp != &tree->sentinel) { \
+			parent = temp; \
+			dir = cmp(node->key_field, ((node_t *)temp)->key_field) >= 0; \
+			temp = dir ? temp->right : temp->left; \
+		} \
+		ngx_rbtree_insert_at(&tree->t, parent, dir, (ngx_rbtree_node_t *)node); \
+		tree->cnt++; \
+		return; \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	void name##_remove(name##_t *tree, node_t *node) \
+	{ \
+		ngx_rbtree_delete(&tree->t, (ngx_rbtree_node_t *)node); \
+		tree->cnt--; \
+		return; \
+	} \
+	\
+	/* the leftmost node with key above (upper != 0) or not below (upper == 0) key */ \
+	static inline __attribute__((unused)) \
+	node_t *name##_bound(name##_t *tree, name##_key_t key, int upper) \
+	{ \
+		ngx_rbtree_node_t *node = tree->t.root, *found = NULL; \
+		while(node != &tree->sentinel) { \
+			int c = cmp(key, ((node_t *)node)->key_field); \
+			if(c < 0 || (c == 0 && !upper)) { \
+				found = node; \
+				node = node->left; \
+			} else { \
+				node = node->right; \
+			} \
+		} \
+		return((node_t *)found); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_lower_bound(name##_t *tree, name##_key_t key) \
+	{ \
+		return(name##_bound(tree, key, 0)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_upper_bound(name##_t *tree, name##_key_t key) \
+	{ \
+		return(name##_bound(tree, key, 1)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_find(name##_t *tree, name##_key_t key) \
+	{ \
+		node_t *node = name##_bound(tree, key, 0); \
+		return((node != NULL && cmp(key, node->key_field) == 0) ? node : NULL); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_extreme(name##_t *tree, uint64_t dir) \
+	{ \
+		ngx_rbtree_node_t *node = tree->t.root; \
+		if(node == &tree->sentinel) { return(NULL); } \
+		while((dir ? node->right : node->left) != &tree->sentinel) { \
+			node = dir ? node->right : node->left; \
+		} \
+		return((node_t *)node); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_first(name##_t *tree) \
+	{ \
+		return(name##_extreme(tree, 0)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_last(name##_t *tree) \
+	{ \
+		return(name##_extreme(tree, 1)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_next(name##_t *tree, node_t *node) \
+	{ \
+		return((node_t *)ngx_rbtree_find_right(&tree->t, (ngx_rbtree_node_t *)node)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	node_t *name##_prev(name##_t *tree, node_t *node) \
+	{ \
+		return((node_t *)ngx_rbtree_find_left(&tree->t, (ngx_rbtree_node_t *)node)); \
+	} \
+	\
+	static inline __attribute__((unused)) \
+	uint64_t name##_count(name##_t *tree) \
+	{ \
+		return(tree->cnt); \
+	}
+
+#endif /* #ifndef _RBTREE_GEN_H_INCLUDED */
+/**
+ * end of rbtree_gen.h
+ */
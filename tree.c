@@ -11,11 +11,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 #include "ngx_rbtree.h"
 #include "lmm.h"
 #include "log.h"
 #include "sassert.h"
 #include "tree.h"
+#include "rbtree_gen.h"
 
 
 /* constants */
@@ -24,6 +26,85 @@
 /* roundup */
 #define _roundup(x, base)			( ((x) + (base) - 1) & ~((base) - 1) )
 
+/* range cursor, deeper than any tree of 2^64 nodes */
+#define RBTREE_ITER_DEPTH			( 128 )
+
+/* successors prefetched ahead of use */
+#define RBTREE_ITER_PREFETCH		( 4 )
+
+/* batch sort */
+#define RBTREE_SORT_THRESH			( 64 )
+
+/* keys sort as unsigned with the sign bit flipped, a byte per radix digit */
+#ifdef RBTREE_KEY128
+__extension__ typedef unsigned __int128 rbtree_ukey_t;
+#else
+typedef uint64_t rbtree_ukey_t;
+#endif
+#define RBTREE_KEY_DIGITS			( sizeof(rbtree_key_t) )
+#define RBTREE_KEY_SIGN				( (rbtree_ukey_t)1<<(8 * RBTREE_KEY_DIGITS - 1) )
+
+/* order statistics, the subtree size lives in the pad of the non-compact header */
+#define rbtree_is_ostat(tree)		( ((tree)->params.flags & RBTREE_ORDER_STAT) != 0 )
+
+/* user-defined augmentation */
+#define rbtree_is_augmented(tree)	( (tree)->aug.update != NULL )
+
+/* nodes of a key already in the tree are chained off the node holding it (RBTREE_BAG) */
+#define rbtree_is_bag(tree)			( ((tree)->params.flags & RBTREE_BAG) != 0 )
+
+/* versions share subtrees, written by path copying (RBTREE_PERSISTENT) */
+#define rbtree_is_persistent(tree)	( ((tree)->params.flags & (RBTREE_PERSISTENT | RBTREE_CONCURRENT)) != 0 )
+
+/* every write is published to the lock-free readers (RBTREE_CONCURRENT) */
+#define rbtree_is_concurrent(tree)	( ((tree)->params.flags & RBTREE_CONCURRENT) != 0 )
+#ifdef RBTREE_COMPACT_NODE
+#  define RBTREE_OSTAT_AVAIL		( 0 )
+#  define ngx_ostree_insert(t, n)	ngx_rbtree_insert(t, n)
+#  define ngx_ostree_insert_unique(t, n)	ngx_rbtree_insert_unique(t, n, NULL)
+#  define ngx_ostree_delete(t, n)	ngx_rbtree_delete(t, n)
+#  define ngx_ostree_build(t, c, n, x)	ngx_rbtree_build(t, c, n, x)
+#  define ngx_ostree_rank(t, k)		( 0 )
+#  define ngx_ostree_select(t, k)	( NULL )
+#  define ngx_ostree_join(l, n, r)	ngx_rbtree_join(l, n, r, NULL)
+#  define ngx_ostree_split(t, k, r)	ngx_rbtree_split(t, k, r, NULL)
+#else
+#  define RBTREE_OSTAT_AVAIL		( 1 )
+#endif
+
+/**
+ * @struct rbtree_pool_s
+ * @brief node pool shared by the trees whose nodes were moved by split / join. the
+ * pools of the trees joined are merged into a group, any node of which may be freed
+ * into any pool of it. the group is freed with the last reference.
+ */
+struct rbtree_pool_s {
+	uint64_t refs;					/* of the group, counted at the root */
+	struct rbtree_pool_s *link;		/* the pool merged into, NULL at the root */
+	struct rbtree_pool_s *next;		/* the pools of the group, chained from the root */
+	lmm_pool_t *pool;
+};
+
+/**
+ * @struct rbtree_version_s
+ * @brief the tree as published to the readers of a RBTREE_CONCURRENT tree, allocated
+ * from the node pool
+ */
+struct rbtree_version_s {
+	ngx_rbtree_td_node_t *root;
+	uint64_t cnt;
+	RBTREE_NODE_T *leftmost, *rightmost;
+};
+
+/**
+ * @struct rbtree_retired_s
+ * @brief a node or a version no longer published, freed once the readers of the epoch are gone
+ */
+struct rbtree_retired_s {
+	void *obj;
+	uint64_t epoch;
+};
+
 /**
  * @struct rbtree_s
  */
@@ -31,23 +112,60 @@ struct rbtree_s {
 	lmm_t *lmm;
 	lmm_t *lmm_iter;
 	uint32_t object_size;
-	uint32_t pad;
+	uint32_t layout;
 	struct rbtree_params_s params;
+	ngx_rbtree_augment_t aug;		/* update is NULL if not augmented */
 
 	/* vector pointers */
-	lmm_pool_t *pool;
-
-	/* working buffer */
-	rbtree_walk_t fn;
-	void *ctx;
+	lmm_pool_t *pool;						/* nodes are allocated from, NULL until the first */
+	struct rbtree_pool_s *group;			/* the pools the nodes may come from */
 
 	/* tree */
+	uint64_t cnt, stale;					/* cnt is recounted if stale (after split) */
+	RBTREE_NODE_T *leftmost, *rightmost;	/* rbtree only, NULL if empty */
 	ngx_rbtree_t t;
-	ngx_rbtree_node_t sentinel;
 
-	/* reserved */
-	uint8_t reserved[sizeof(struct ngx_ivtree_node_s)
-		- sizeof(ngx_rbtree_node_t)];
+	/* index-linked tree (RBTREE_LAYOUT_IDX32), freed nodes are chained by left */
+	uint32_t free32, next32;
+	ngx_rbtree32_t t32;
+
+	/* parent-free tree (RBTREE_LAYOUT_TOPDOWN) */
+	ngx_rbtree_td_t td;
+
+	/* the version the readers see and the epochs (RBTREE_CONCURRENT) */
+	struct rbtree_version_s *version;
+	uint64_t epoch, retired_head;
+	lmm_kvec_t(struct rbtree_reader_s *) readers;
+	lmm_kvec_t(struct rbtree_retired_s) retired;	/* in the ascending order of epoch */
+};
+
+/**
+ * @struct rbtree_reader_s
+ * @brief epoch slot of a reader thread, padded so that the slots do not share a cache line
+ */
+struct rbtree_reader_s {
+	uint8_t pad0[64];
+	uint64_t epoch;					/* the epoch entered at, RBTREE_QUIESCENT if not reading */
+	struct rbtree_s *tree;
+	struct rbtree_s *view;			/* the version read, with the iterators of the reader */
+	uint8_t pad1[64];
+};
+#define RBTREE_QUIESCENT			( UINT64_MAX )
+
+/**
+ * @struct rbtree_iter_s
+ * @brief range cursor. on RBTREE_LAYOUT_PTR the nodes yet to be returned whose right
+ * (left if reverse) subtrees are not visited are kept on the stack, the next one on top.
+ * RBTREE_LAYOUT_TOPDOWN keeps them on the path of ngx_rbtree_td_path_t likewise.
+ */
+struct rbtree_iter_s {
+	lmm_t *lmm;
+	struct rbtree_s *tree;
+	rbtree_key_t lkey, rkey;
+	uint64_t rev, sp;
+	RBTREE_NODE_T *node;				/* RBTREE_LAYOUT_IDX32 and the bag trees */
+	ngx_rbtree_node_t *stack[RBTREE_ITER_DEPTH];
+	ngx_rbtree_td_path_t td;
 };
 
 /**
@@ -56,882 +174,6688 @@ struct rbtree_s {
 struct ivtree_iter_s {
 	lmm_t *lmm;
 	ngx_rbtree_t *t;
-	int64_t llim, rlim, tlim;
+	rbtree_key_t llim, rlim, tlim;
 	ngx_ivtree_node_t *node;
+	ngx_ivtree_node_t *start;	/* finger for ivtree_intersect_sorted */
+
+	/* RBTREE_LAYOUT_IDX32 */
+	ngx_rbtree32_t *t32;
+	ngx_rbtree32_node_t *node32;
+};
+
+/**
+ * @struct rbtree_bag_s
+ * @brief rbtree_bag_node_t. the nodes of a key form a circular list through the one
+ * in the tree, in the insertion order. the chained ones are marked by left == NULL.
+ */
+struct rbtree_bag_s {
+	ngx_rbtree_node_t h;
+	struct rbtree_bag_s *next, *prev;
 };
+#define rbtree_bag_is_chained(node)	( (node)->h.left == NULL )
 
 
 /* assertions */
+#if defined(RBTREE_KEY128)
+_static_assert(sizeof(struct rbtree_node_s) == 48);
+_static_assert(sizeof(ngx_rbtree_node_t) == 48);
+_static_assert(sizeof(struct strtree_node_s) == 64);
+#elif defined(RBTREE_COMPACT_NODE)
+_static_assert(sizeof(struct rbtree_node_s) == 32);
+_static_assert(sizeof(ngx_rbtree_node_t) == 32);
+_static_assert(sizeof(struct strtree_node_s) == 48);
+#else
 _static_assert(sizeof(struct rbtree_node_s) == 40);
 _static_assert(sizeof(ngx_rbtree_node_t) == 40);
+_static_assert(sizeof(struct strtree_node_s) == 56);
+#endif
+_static_assert(sizeof(struct ivtree_node_s) == sizeof(ngx_ivtree_node_t));
+_static_assert_offset(struct rbtree_node_s, key, struct ngx_rbtree_node_s, key, 0);
+_static_assert_offset(struct rbtree_node32_s, key, struct ngx_rbtree32_node_s, key, 0);
+_static_assert_offset(struct ivtree_node32_s, rkey, struct ngx_rbtree32_node_s, rkey, 0);
+_static_assert(sizeof(struct rbtree_node_td_s) == sizeof(ngx_rbtree_td_node_t));
+_static_assert_offset(struct rbtree_node_td_s, key, struct ngx_rbtree_td_node_s, key, 0);
+_static_assert_offset(struct ngx_rbtree_node_s, key, struct ngx_ivtree_node_s, lkey, 0);
+_static_assert_offset(struct strtree_node_s, prefix, struct ngx_rbtree_node_s, key, 0);
+_static_assert(sizeof(struct rbtree_link_s) == offsetof(struct ngx_rbtree_node_s, key));
+_static_assert(sizeof(struct rbtree_bag_node_s) == sizeof(struct rbtree_bag_s));
+_static_assert(sizeof(struct rbtree_version_s) <= sizeof(ngx_rbtree_td_node_t));
 
 
 /**
- * @fn rbtree_clean
+ * @val rbtree_sentinel, ivtree_sentinel
+ * @brief shared by all the trees, so that split and join can move nodes between them.
+ * never written. left and right are poisoned, and the pool-owned mark is set.
  */
-void rbtree_clean(
-	rbtree_t *_tree)
-{
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	if(tree == NULL) { return; }
+#ifdef RBTREE_COMPACT_NODE
+#  define RBTREE_SENTINEL_MARK		.parent_color = NGX_RBT_POOLED
+#else
+#  define RBTREE_SENTINEL_MARK		.data = 0xff
+#endif
+static ngx_rbtree_node_t rbtree_sentinel = {
+	RBTREE_SENTINEL_MARK,
+	.left = (ngx_rbtree_node_t *)0x01,
+	.right = (ngx_rbtree_node_t *)0x02
+};
+static ngx_ivtree_node_t ivtree_sentinel = {
+	RBTREE_SENTINEL_MARK,
+	.left = (ngx_ivtree_node_t *)0x01,
+	.right = (ngx_ivtree_node_t *)0x02,
+	.lkey = RBTREE_KEY_MIN,
+	.rkey = RBTREE_KEY_MIN,
+	.rkey_max = RBTREE_KEY_MIN
+};
+#define rbtree_is_iv(tree)			( (tree)->t.sentinel == (ngx_rbtree_node_t *)&ivtree_sentinel )
 
-	/* cleanup object pool */
-	lmm_pool_clean(tree->pool);
 
-	/* cleanup tree object */
-	lmm_t *lmm = tree->lmm;
-	lmm_free(lmm, tree->lmm_iter);
-	lmm_free(lmm, tree);
-	return;
+/**
+ * @fn rbtree_key_ptr
+ * @brief key field of a node, whose offset depends on the layout
+ */
+static inline
+rbtree_key_t *rbtree_key_ptr(
+	struct rbtree_s const *tree,
+	void *node)
+{
+	uint64_t ofs = offsetof(ngx_rbtree_node_t, key);
+	if(tree->layout == RBTREE_LAYOUT_IDX32) { ofs = offsetof(ngx_rbtree32_node_t, key); }
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) { ofs = offsetof(ngx_rbtree_td_node_t, key); }
+	return((rbtree_key_t *)((uint8_t *)node + ofs));
 }
 
 /**
- * @fn rbtree_init
+ * @fn rbtree_extreme
+ * @brief the leftmost (dir == 0) or the rightmost (dir == 1) node, searched from the root
  */
-rbtree_t *rbtree_init(
-	uint64_t object_size,
-	rbtree_params_t const *params)
+static
+RBTREE_NODE_T *rbtree_extreme(
+	struct rbtree_s *tree,
+	uint64_t dir)
 {
-	struct rbtree_params_s const default_params = { 0 };
-	params = (params == NULL) ? &default_params : params;
-
-	/* malloc mem */
-	lmm_t *lmm = (lmm_t *)params->lmm;
-	struct rbtree_s *tree = (struct rbtree_s *)lmm_malloc(lmm, sizeof(struct rbtree_s));
-	if(tree == NULL) {
-		return(NULL);
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		uint32_t i = tree->t32.root, next = i;
+		while(next != 0) {
+			i = next;
+			ngx_rbtree32_node_t *node = ngx_rbt32_node(&tree->t32, i);
+			next = dir ? node->right : node->left;
+		}
+		return(i == 0 ? NULL : (RBTREE_NODE_T *)ngx_rbt32_node(&tree->t32, i));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_node_t *node = tree->td.root;
+		while(node != NULL && node->link[dir] != NULL) { node = node->link[dir]; }
+		return((RBTREE_NODE_T *)node);
 	}
-	memset(tree, 0, sizeof(struct rbtree_s));
-	lmm_t *lmm_iter = lmm_init(
-		lmm_malloc(lmm, 3 * sizeof(struct ivtree_iter_s)),
-		3 * sizeof(struct ivtree_iter_s));
-
-	/* set params */
-	tree->lmm = lmm;
-	tree->lmm_iter = lmm_iter;
-	tree->object_size = _roundup(object_size, 16);
-	tree->params = *params;
-
-	/* init node pool */
-	tree->pool = lmm_pool_init(lmm, tree->object_size, RBTREE_INIT_ELEM_CNT);
 
-	/* init tree */
-	ngx_rbtree_init(&tree->t, &tree->sentinel, ngx_rbtree_insert_value);
-	tree->sentinel.left = (void *)0x01;
-	tree->sentinel.right = (void *)0x02;
-	tree->sentinel.data = 0xff;
-	return((rbtree_t *)tree);
+	ngx_rbtree_node_t *node = tree->t.root;
+	if(node == tree->t.sentinel) { return(NULL); }
+	while((dir ? node->right : node->left) != tree->t.sentinel) {
+		node = dir ? node->right : node->left;
+	}
+	return((RBTREE_NODE_T *)node);
 }
 
 /**
- * @fn rbtree_flush
+ * @fn rbtree_count
+ * @brief the number of nodes, counted by a traversal once after a split left cnt stale
  */
-void rbtree_flush(
-	rbtree_t *_tree)
+static
+uint64_t rbtree_count(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	if(tree == NULL) { return; }
-
-	/* flush object pool */
-	lmm_pool_flush(tree->pool);
+	if(tree->stale == 0) { return(tree->cnt); }
 
-	/* flush tree */
-	ngx_rbtree_init(&tree->t, &tree->sentinel, ngx_rbtree_insert_value);
-	tree->sentinel.data = 0xff;
-	return;
+	uint64_t cnt = 0;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)rbtree_extreme(tree, 0);
+	while(node != NULL) {
+		node = ngx_rbtree_find_right(&tree->t, node);
+		cnt++;
+	}
+	tree->cnt = cnt;
+	tree->stale = 0;
+	return(cnt);
 }
 
 /**
- * @fn rbtree_create_node
+ * @fn rbtree_create_node32
  *
- * @brief create a new node (not inserted in the tree)
+ * @brief allocate a node of an index-linked tree. blocks grow geometrically
+ * so that an index is decoded without a table walk (ngx_rbt32_node).
  */
-RBTREE_NODE_T *rbtree_create_node(
-	rbtree_t *_tree)
+static
+ngx_rbtree32_node_t *rbtree_create_node32(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)lmm_pool_create_object(
-		tree->pool);
-
-	/* mark node */
-	node->data = 0xff;
-	return((RBTREE_NODE_T *)node);
+	ngx_rbtree32_node_t *node = NULL;
+	uint32_t i = tree->free32;
+
+	if(i != 0) {
+		node = ngx_rbt32_node(&tree->t32, i);
+		tree->free32 = node->left;
+	} else {
+		if(tree->next32 >= NGX_RBTREE32_MAX_CNT) { return(NULL); }
+		i = tree->next32++;
+
+		uint64_t b = ngx_rbt32_block(i);
+		if(tree->t32.base[b] == NULL) {
+			tree->t32.base[b] = (uint8_t *)lmm_malloc(tree->lmm,
+				((uint64_t)NGX_RBTREE32_BLOCK_CNT<<b) * tree->object_size);
+		}
+		node = ngx_rbt32_node(&tree->t32, i);
+	}
+	node->self = i;
+	return(node);
 }
 
 /**
- * @fn rbtree_insert
- *
- * @brief insert a node
+ * @fn rbtree_delete_node32
  */
-void rbtree_insert(
-	rbtree_t *_tree,
-	RBTREE_NODE_T *_node)
+static inline
+void rbtree_delete_node32(
+	struct rbtree_s *tree,
+	ngx_rbtree32_node_t *node)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
-	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
-	ngx_rbtree_insert(&tree->t, node);
+	node->left = tree->free32;
+	tree->free32 = ngx_rbt32_index(node);
 	return;
 }
 
 /**
- * @fn rbtree_remove
+ * @fn rbtree_flush32
  *
- * @brief remove a node, automatically freed if malloc'd with rbtree_reserve_node
+ * @brief drop all the nodes, keeping the blocks. index 0 is the sentinel.
  */
-void rbtree_remove(
-	rbtree_t *_tree,
-	RBTREE_NODE_T *_node)
+static
+void rbtree_flush32(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
-	ngx_rbtree_delete(&tree->t, node);
-
-	if(node->data == 0xff) {
-		/* append node to the head of freed list */
-		lmm_pool_delete_object(tree->pool, node);
+	tree->free32 = 0;
+	tree->next32 = 0;
+
+	ngx_rbtree32_node_t *sentinel = rbtree_create_node32(tree);
+	sentinel->parent = sentinel->left = sentinel->right = 0;
+	ngx_rbt32_black(sentinel);
+	if(tree->t32.iv) {
+		sentinel->key = RBTREE_KEY_MIN;
+		sentinel->rkey = RBTREE_KEY_MIN;
+		sentinel->rkey_max = RBTREE_KEY_MIN;
 	}
+	tree->t32.root = 0;
 	return;
 }
 
 /**
- * @fn rbtree_search_key
+ * @fn rbtree_pool_root
  *
- * @brief search a node by key, returning the leftmost node
+ * @brief the pool a group is merged into
  */
-RBTREE_NODE_T *rbtree_search_key(
-	rbtree_t *_tree,
-	int64_t key)
+static inline
+struct rbtree_pool_s *rbtree_pool_root(
+	struct rbtree_pool_s *pool)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	return((RBTREE_NODE_T *)ngx_rbtree_find_key(&tree->t, key));
+	while(pool->link != NULL) { pool = pool->link; }
+	return(pool);
 }
 
 /**
- * @fn rbtree_search_key_left
+ * @fn rbtree_pool_share
  *
- * @brief search a node by key. returns the nearest node in the left half of the tree if key was not found.
+ * @brief make tree refer to the pools of src. the groups are merged if tree has its
+ * own, so that the nodes of both can be freed into the pool of tree.
  */
-RBTREE_NODE_T *rbtree_search_key_left(
-	rbtree_t *_tree,
-	int64_t key)
+static
+void rbtree_pool_share(
+	struct rbtree_s *tree,
+	struct rbtree_s *src)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	return((RBTREE_NODE_T *)ngx_rbtree_find_key_left(&tree->t, key));
+	if(src->group == NULL) { return; }
+
+	struct rbtree_pool_s *root = rbtree_pool_root(src->group);
+	if(tree->group == NULL) {
+		__sync_fetch_and_add(&root->refs, 1);
+		tree->group = root;
+		tree->pool = src->pool;
+		return;
+	}
+
+	/* chain the pools of src after the root of tree */
+	struct rbtree_pool_s *dst = rbtree_pool_root(tree->group);
+	if(dst == root) { return; }
+	struct rbtree_pool_s *tail = root;
+	while(tail->next != NULL) { tail = tail->next; }
+	tail->next = dst->next;
+	dst->next = root;
+	root->link = dst;
+	__sync_fetch_and_add(&dst->refs, root->refs);
+	return;
 }
 
 /**
- * @fn rbtree_search_key_right
+ * @fn rbtree_pool_release
  *
- * @brief search a node by key. returns the nearest node in the right half of the tree if key was not found.
+ * @brief drop the reference to the group
  */
-RBTREE_NODE_T *rbtree_search_key_right(
-	rbtree_t *_tree,
-	int64_t key)
+static
+void rbtree_pool_release(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	return((RBTREE_NODE_T *)ngx_rbtree_find_key_right(&tree->t, key));
+	if(tree->group == NULL) { return; }
+
+	struct rbtree_pool_s *pool = rbtree_pool_root(tree->group);
+	if(__sync_sub_and_fetch(&pool->refs, 1) == 0) {
+		while(pool != NULL) {
+			struct rbtree_pool_s *next = pool->next;
+			lmm_pool_clean(pool->pool);
+			lmm_free(tree->lmm, pool);
+			pool = next;
+		}
+	}
+	tree->group = NULL;
+	tree->pool = NULL;
+	return;
 }
 
 /**
- * @fn rbtree_left
+ * @fn rbtree_pool_open
  *
- * @brief returns the left next node
+ * @brief open the pool the nodes are allocated from. it is deferred to the first
+ * allocation, so that an empty tree holds no pool.
  */
-RBTREE_NODE_T *rbtree_left(
-	rbtree_t *_tree,
-	RBTREE_NODE_T const *node)
+static
+void rbtree_pool_open(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	return((RBTREE_NODE_T *)ngx_rbtree_find_left(&tree->t, (ngx_rbtree_node_t *)node));
+	struct rbtree_pool_s *pool = (struct rbtree_pool_s *)lmm_malloc(tree->lmm,
+		sizeof(struct rbtree_pool_s));
+	*pool = (struct rbtree_pool_s){
+		.refs = 1,
+		.link = NULL,
+		.next = NULL,
+		.pool = lmm_pool_init(tree->lmm, tree->object_size, RBTREE_INIT_ELEM_CNT)
+	};
+	tree->group = pool;
+	tree->pool = pool->pool;
+	return;
 }
 
 /**
- * @fn rbtree_right
+ * @fn rbtree_pool_free
  *
- * @brief returns the right next node
+ * @brief return a node to the pool. the node may come from any pool of the group,
+ * which is kept until all the trees sharing it are cleaned.
  */
-RBTREE_NODE_T *rbtree_right(
-	rbtree_t *_tree,
-	RBTREE_NODE_T const *node)
+static inline
+void rbtree_pool_free(
+	struct rbtree_s *tree,
+	void *node)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	return((RBTREE_NODE_T *)ngx_rbtree_find_right(&tree->t, (ngx_rbtree_node_t *)node));
+	if(tree->pool != NULL) {
+		/* append node to the head of freed list */
+		lmm_pool_delete_object(tree->pool, node);
+	}
+	return;
 }
 
 /**
- * @fn rbtree_walk
+ * @fn rbtree_pool_is_shared
  *
- * @brief walk over the tree
+ * @brief 1 if the pools the nodes are allocated from are referred by another tree
  */
-void rbtree_walk_intl(
-	ngx_rbtree_node_t **node,
-	ngx_rbtree_node_t *sentinel,
-	void *_ctx)
-{
-	rbtree_t *tree = (rbtree_t *)_ctx;
-	tree->fn((RBTREE_NODE_T *)(*node), tree->ctx);
-	return;
-}
-void rbtree_walk(
-	rbtree_t *_tree,
-	rbtree_walk_t _fn,
-	void *_ctx)
+static inline
+uint64_t rbtree_pool_is_shared(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-
-	tree->fn = _fn;
-	tree->ctx = _ctx;
-	ngx_rbtree_walk(&tree->t, (ngx_rbtree_walk_pt)rbtree_walk_intl, (void *)tree);
-	return;
+	return(tree->group != NULL && rbtree_pool_root(tree->group)->refs > 1);
 }
 
-
-/* interval tree implementation */
 /**
- * @fn ivtree_clean
+ * @fn rbtree_td_release
+ *
+ * @brief drop a reference to a subtree of a RBTREE_PERSISTENT tree. the nodes no
+ * version refers to are freed to the pool, which all the versions share.
  */
-void ivtree_clean(
-	ivtree_t *tree)
+static
+void rbtree_td_release(
+	struct rbtree_s *tree,
+	ngx_rbtree_td_node_t *node)
 {
-	rbtree_clean((struct rbtree_s *)tree);
+	while(node != NULL && --node->refs == 0) {
+		ngx_rbtree_td_node_t *right = node->link[1];
+		rbtree_td_release(tree, node->link[0]);
+		rbtree_pool_free(tree, node);
+		node = right;
+	}
 	return;
 }
 
 /**
- * @fn ivtree_init
+ * @fn rbtree_td_copy
+ *
+ * @brief ngx_rbtree_td_copy_pt of the persistent trees
  */
-ivtree_t *ivtree_init(
-	uint64_t object_size,
-	ivtree_params_t const *params)
+static
+ngx_rbtree_td_node_t *rbtree_td_copy(
+	ngx_rbtree_td_node_t *node,
+	void *ctx)
 {
-	struct rbtree_s *tree = rbtree_init(object_size, (rbtree_params_t const *)params);
-	struct ngx_ivtree_node_s *sentinel = (struct ngx_ivtree_node_s *)(&tree->sentinel);
-
-	sentinel->lkey = INT64_MIN;
-	sentinel->rkey = INT64_MIN;
-	sentinel->rkey_max = INT64_MIN;
-	return((ivtree_t *)tree);
+	struct rbtree_s *tree = (struct rbtree_s *)ctx;
+	ngx_rbtree_td_node_t *copy = (ngx_rbtree_td_node_t *)lmm_pool_create_object(tree->pool);
+	memcpy(copy, node, tree->object_size);
+	return(copy);
 }
 
 /**
- * @fn ivtree_flush
+ * @fn rbtree_td_retire
+ *
+ * @brief rbtree_td_release for the version replaced in a RBTREE_CONCURRENT tree. the
+ * nodes no version refers to are retired in the current epoch instead of freed, as the
+ * readers may be on them.
  */
-void ivtree_flush(
-	ivtree_t *tree)
+static
+void rbtree_td_retire(
+	struct rbtree_s *tree,
+	ngx_rbtree_td_node_t *node)
 {
-	rbtree_flush((rbtree_t *)tree);
+	while(node != NULL && --node->refs == 0) {
+		rbtree_td_retire(tree, node->link[0]);
+		lmm_kv_push(tree->lmm, tree->retired,
+			((struct rbtree_retired_s){ .obj = (void *)node, .epoch = tree->epoch }));
+		node = node->link[1];
+	}
 	return;
 }
 
 /**
- * @fn ivtree_create_node
+ * @fn rbtree_reclaim
  *
- * @brief create a new node (not inserted in the tree)
+ * @brief free the objects retired before the oldest epoch a reader is in
  */
-IVTREE_NODE_T *ivtree_create_node(
-	ivtree_t *tree)
+static
+void rbtree_reclaim(
+	struct rbtree_s *tree)
 {
-	return((ivtree_node_t *)rbtree_create_node((rbtree_t *)tree));
+	uint64_t min = RBTREE_QUIESCENT;
+	for(uint64_t i = 0; i < lmm_kv_size(tree->readers); i++) {
+		uint64_t epoch = __atomic_load_n(&lmm_kv_at(tree->readers, i)->epoch, __ATOMIC_SEQ_CST);
+		min = (epoch < min) ? epoch : min;
+	}
+
+	uint64_t i = tree->retired_head, size = lmm_kv_size(tree->retired);
+	while(i < size && lmm_kv_at(tree->retired, i).epoch < min) {
+		rbtree_pool_free(tree, lmm_kv_at(tree->retired, i).obj);
+		i++;
+	}
+
+	/* the rest is moved to the head once it is less than half */
+	if(i > size / 2) {
+		memmove(lmm_kv_ptr(tree->retired), lmm_kv_ptr(tree->retired) + i,
+			sizeof(struct rbtree_retired_s) * (size - i));
+		lmm_kv_size(tree->retired) = size - i;
+		i = 0;
+	}
+	tree->retired_head = i;
+	return;
 }
 
 /**
- * @fn ivtree_insert
+ * @fn rbtree_publish
  *
- * @brief insert a node
+ * @brief make the tree after a write the version the readers of a RBTREE_CONCURRENT tree
+ * see. the nodes published are never written again, as the version holds a reference
+ * to them. the epoch is advanced after the version is replaced, so that the readers
+ * entering the new epoch never reach the objects retired in the old one.
  */
-void ivtree_insert(
-	ivtree_t *_tree,
-	IVTREE_NODE_T *_node)
+static
+void rbtree_publish(
+	struct rbtree_s *tree)
 {
-	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	struct ngx_ivtree_node_s *node = (struct ngx_ivtree_node_s *)_node;
-	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
-	ngx_ivtree_insert((ngx_ivtree_t *)&tree->t, node);
+	if(!rbtree_is_concurrent(tree)) { return; }
+
+	if(tree->pool == NULL) { rbtree_pool_open(tree); }
+	struct rbtree_version_s *ver = (struct rbtree_version_s *)lmm_pool_create_object(tree->pool);
+	*ver = (struct rbtree_version_s){
+		.root = tree->td.root,
+		.cnt = tree->cnt,
+		.leftmost = tree->leftmost,
+		.rightmost = tree->rightmost
+	};
+	if(ver->root != NULL) { ver->root->refs++; }
+
+	struct rbtree_version_s *prev = tree->version;
+	__atomic_store_n(&tree->version, ver, __ATOMIC_SEQ_CST);
+	if(prev != NULL) {
+		rbtree_td_retire(tree, prev->root);
+		lmm_kv_push(tree->lmm, tree->retired,
+			((struct rbtree_retired_s){ .obj = (void *)prev, .epoch = tree->epoch }));
+	}
+	__atomic_store_n(&tree->epoch, tree->epoch + 1, __ATOMIC_SEQ_CST);
+	rbtree_reclaim(tree);
 	return;
 }
 
 /**
- * @fn ivtree_remove
- *
- * @brief remove a node, automatically freed if malloc'd with ivtree_reserve_node
+ * @fn rbtree_clean
  */
-void ivtree_remove(
-	ivtree_t *_tree,
-	IVTREE_NODE_T *_node)
+void rbtree_clean(
+	rbtree_t *_tree)
 {
 	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
-	ngx_ivtree_delete(
-		(ngx_ivtree_t *)&tree->t,
-		(ngx_ivtree_node_t *)node);
+	if(tree == NULL) { return; }
 
-	if(node->data == 0xff) {
-		/* append node to the head of freed list */
-		lmm_pool_delete_object(tree->pool, node);
+	/* the nodes the other versions refer to are left. no reader is left. */
+	if(rbtree_is_persistent(tree) && rbtree_pool_is_shared(tree)) {
+		rbtree_td_release(tree, tree->td.root);
+		if(tree->version != NULL) {
+			rbtree_td_release(tree, tree->version->root);
+			rbtree_pool_free(tree, tree->version);
+		}
+		rbtree_reclaim(tree);
+	}
+	if(lmm_kv_max(tree->readers) != 0) { lmm_kv_destroy(tree->lmm, tree->readers); }
+	if(lmm_kv_max(tree->retired) != 0) { lmm_kv_destroy(tree->lmm, tree->retired); }
+
+	/* cleanup object pool */
+	rbtree_pool_release(tree);
+	for(uint64_t b = 0; b < 32; b++) {
+		if(tree->t32.base[b] != NULL) { lmm_free(tree->lmm, tree->t32.base[b]); }
 	}
+
+	/* cleanup tree object */
+	lmm_t *lmm = tree->lmm;
+	lmm_free(lmm, tree->lmm_iter);
+	lmm_free(lmm, tree);
 	return;
 }
 
 /**
- * @fn ivtree_next_node
+ * @fn rbtree_init
  */
-static inline
-ngx_ivtree_node_t *ivtree_next_node(
-	ngx_rbtree_t *t,
-	ngx_ivtree_node_t *node,
-	int64_t llim,
-	int64_t rlim,
-	int64_t tlim)
+rbtree_t *rbtree_init(
+	uint64_t object_size,
+	rbtree_params_t const *params)
 {
-	debug("ivtree_next_node, llim(%lld), rlim(%lld), tlim(%lld)", llim, rlim, tlim);
+	struct rbtree_params_s const default_params = { 0 };
+	params = (params == NULL) ? &default_params : params;
+	if((params->flags & RBTREE_ORDER_STAT) != 0
+	&& (!RBTREE_OSTAT_AVAIL || params->layout != RBTREE_LAYOUT_PTR)) {
+		return(NULL);
+	}
+	if(params->update != NULL
+	&& (params->layout != RBTREE_LAYOUT_PTR || (params->flags & RBTREE_ORDER_STAT) != 0)) {
+		return(NULL);
+	}
+	if((params->flags & RBTREE_BAG) != 0
+	&& (params->layout != RBTREE_LAYOUT_PTR || (params->flags & RBTREE_ORDER_STAT) != 0
+	|| params->update != NULL)) {
+		return(NULL);
+	}
+	if((params->flags & (RBTREE_PERSISTENT | RBTREE_CONCURRENT)) != 0
+	&& params->layout != RBTREE_LAYOUT_TOPDOWN) {
+		return(NULL);
+	}
 
-	while(node != NULL) {
-        debug("check node(%p, %lld, %lld, %lld)",
-            node, node->lkey, node->rkey, node->rkey_max);
+	/* malloc mem */
+	lmm_t *lmm = (lmm_t *)params->lmm;
+	struct rbtree_s *tree = (struct rbtree_s *)lmm_malloc(lmm, sizeof(struct rbtree_s));
+	if(tree == NULL) {
+		return(NULL);
+	}
+	memset(tree, 0, sizeof(struct rbtree_s));
+	lmm_t *lmm_iter = lmm_init(
+		lmm_malloc(lmm, 3 * sizeof(struct ivtree_iter_s)),
+		3 * sizeof(struct ivtree_iter_s));
 
-		if(node->lkey >= tlim) { node = NULL; break; }
-		if((uint64_t)(node->rkey - llim) < (uint64_t)(rlim - llim)) { break; }
+	/* set params */
+	tree->lmm = lmm;
+	tree->lmm_iter = lmm_iter;
+	tree->object_size = _roundup(object_size, 16);
+	tree->layout = params->layout;
+	tree->params = *params;
+	tree->aug = (ngx_rbtree_augment_t){
+		.update = (ngx_rbtree_update_pt)params->update,
+		.ctx = params->update_ctx
+	};
 
-		/* not found, get next */
-		node = (ngx_ivtree_node_t *)ngx_rbtree_find_right(
-			t, (ngx_rbtree_node_t *)node);
+	/* index-linked tree allocates nodes by itself */
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		tree->t32.size = tree->object_size;
+		rbtree_flush32(tree);
+		return((rbtree_t *)tree);
 	}
-	return(node);
+
+	/* init tree, the node pool is opened on the first allocation */
+	tree->t.root = tree->t.sentinel = &rbtree_sentinel;
+	if(rbtree_is_concurrent(tree)) {
+		tree->epoch = 1;
+		lmm_kv_init(lmm, tree->readers);
+		lmm_kv_init(lmm, tree->retired);
+	}
+	return((rbtree_t *)tree);
 }
 
 /**
- * @fn ivtree_contained
- * @brief return a set of sections contained in [lkey, rkey)
+ * @fn rbtree_flush
  */
-ivtree_iter_t *ivtree_contained(
-	ivtree_t *_tree,
-	int64_t lkey,
-	int64_t rkey)
+void rbtree_flush(
+	rbtree_t *_tree)
 {
 	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
-		tree->lmm_iter, sizeof(struct ivtree_iter_s));
-	*iter = (struct ivtree_iter_s){
-		.t = &tree->t,
-		.lmm = tree->lmm_iter,
-		.llim = INT64_MIN,
-		.rlim = rkey,
-		.tlim = rkey,
-		.node = (ngx_ivtree_node_t *)ngx_rbtree_find_key_right(&tree->t, lkey)
-	};
-	return(iter);
+	if(tree == NULL) { return; }
+
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		rbtree_flush32(tree);
+		tree->leftmost = tree->rightmost = NULL;
+		tree->cnt = 0;
+		return;
+	}
+
+	/* flush object pool, unless the blocks hold nodes of the other trees */
+	if(rbtree_is_concurrent(tree) || (rbtree_is_persistent(tree) && rbtree_pool_is_shared(tree))) {
+		/* the versions keep allocating from the pool, the readers may be on the nodes */
+		rbtree_td_release(tree, tree->td.root);
+	} else if(tree->group != NULL && !rbtree_pool_is_shared(tree)
+	&& rbtree_pool_root(tree->group)->next == NULL) {
+		lmm_pool_flush(tree->pool);
+	} else {
+		rbtree_pool_release(tree);
+	}
+
+	/* flush tree */
+	tree->t.root = tree->t.sentinel;
+	tree->td.root = NULL;
+	tree->leftmost = tree->rightmost = NULL;
+	tree->cnt = tree->stale = 0;
+	rbtree_publish(tree);
+	return;
 }
 
 /**
- * @fn ivtree_containing
- * @brief return a set of sections containing [lkey, rkey)
+ * @fn rbtree_snapshot
+ *
+ * @brief a version of a RBTREE_PERSISTENT tree in O(1), sharing all the nodes. a write
+ * to either copies the nodes on its path instead of modifying them, so that the other
+ * is left as it was. released with rbtree_clean. NULL if the tree is not persistent.
  */
-ivtree_iter_t *ivtree_containing(
-	ivtree_t *_tree,
-	int64_t lkey,
-	int64_t rkey)
+rbtree_t *rbtree_snapshot(
+	rbtree_t *_tree)
 {
 	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
-		tree->lmm_iter, sizeof(struct ivtree_iter_s));
+	if(!rbtree_is_persistent(tree)) { return(NULL); }
 
-	ngx_ivtree_node_t *node = (ngx_ivtree_node_t *)tree->t.root;
-	ngx_ivtree_node_t *sentinel = (ngx_ivtree_node_t *)tree->t.sentinel;
-	while(node != sentinel && node->left->rkey_max >= rkey) {
-		node = node->left;
-	}
-	*iter = (struct ivtree_iter_s){
-		.t = &tree->t,
-		.lmm = tree->lmm_iter,
-		.llim = rkey,
-		.rlim = INT64_MAX,
-		.tlim = lkey + 1,
-		.node = node
-	};
-	return(iter);
+	struct rbtree_s *snap = (struct rbtree_s *)rbtree_init(tree->object_size, &tree->params);
+	if(snap == NULL) { return(NULL); }
+
+	/* the versions allocate from a single pool, so that any of them can free a node */
+	if(tree->pool == NULL) { rbtree_pool_open(tree); }
+	rbtree_pool_share(snap, tree);
+
+	if(tree->td.root != NULL) { tree->td.root->refs++; }
+	snap->td.root = tree->td.root;
+	snap->cnt = tree->cnt;
+	snap->leftmost = tree->leftmost;
+	snap->rightmost = tree->rightmost;
+	return((rbtree_t *)snap);
 }
 
 /**
- * @fn ivtree_intersect
- * @brief return a set of sections intersect with [lkey, rkey)
+ * @fn rbtree_reader_init
+ *
+ * @brief register a reader thread of a RBTREE_CONCURRENT tree. NULL if not concurrent.
  */
-ivtree_iter_t *ivtree_intersect(
-	ivtree_t *_tree,
-	int64_t lkey,
-	int64_t rkey)
+rbtree_reader_t *rbtree_reader_init(
+	rbtree_t *_tree)
 {
 	struct rbtree_s *tree = (struct rbtree_s *)_tree;
-	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
-		tree->lmm_iter, sizeof(struct ivtree_iter_s));
-
-	ngx_ivtree_node_t *node = (ngx_ivtree_node_t *)tree->t.root;
-	ngx_ivtree_node_t *sentinel = (ngx_ivtree_node_t *)tree->t.sentinel;
-	while(node != sentinel && node->left->rkey_max > lkey) {
-		node = node->left;
-	}
-	*iter = (struct ivtree_iter_s){
-		.t = &tree->t,
-		.lmm = tree->lmm_iter,
-		.llim = lkey + 1,
-		.rlim = INT64_MAX,
-		.tlim = rkey,
-		.node = node
+	if(!rbtree_is_concurrent(tree)) { return(NULL); }
+
+	struct rbtree_reader_s *reader = (struct rbtree_reader_s *)lmm_malloc(tree->lmm,
+		sizeof(struct rbtree_reader_s));
+	*reader = (struct rbtree_reader_s){
+		.epoch = RBTREE_QUIESCENT,
+		.tree = tree,
+		.view = (struct rbtree_s *)rbtree_init(tree->object_size, &tree->params)
 	};
-	return(iter);
+	lmm_kv_push(tree->lmm, tree->readers, reader);
+	return((rbtree_reader_t *)reader);
 }
 
 /**
- * @fn ivtree_next
+ * @fn rbtree_reader_clean
  */
-IVTREE_NODE_T *ivtree_next(
-	ivtree_iter_t *_iter)
+void rbtree_reader_clean(
+	rbtree_reader_t *_reader)
 {
-	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)_iter;
-	ngx_ivtree_node_t *node = ivtree_next_node(iter->t,
-		iter->node, iter->llim, iter->rlim, iter->tlim);
-	if(node == NULL) { return(NULL); }
+	struct rbtree_reader_s *reader = (struct rbtree_reader_s *)_reader;
+	if(reader == NULL) { return; }
+
+	struct rbtree_s *tree = reader->tree;
+	for(uint64_t i = 0; i < lmm_kv_size(tree->readers); i++) {
+		if(lmm_kv_at(tree->readers, i) != reader) { continue; }
+		lmm_kv_at(tree->readers, i) = lmm_kv_pop(tree->lmm, tree->readers);
+		break;
+	}
+	rbtree_clean((rbtree_t *)reader->view);
+	lmm_free(tree->lmm, reader);
+	return;
+}
 
-	iter->node = (ngx_ivtree_node_t *)ngx_rbtree_find_right(
-		iter->t, (ngx_rbtree_node_t *)node);
-	return((IVTREE_NODE_T *)node);
+/**
+ * @fn rbtree_read_lock
+ *
+ * @brief enter the current epoch and return the version published last, as a read-only
+ * tree valid until rbtree_read_unlock. no lock is taken and nothing is shared but the
+ * loads of the epoch and the version; the epoch is announced before the version is
+ * loaded, so that the writer frees nothing the reader may reach.
+ */
+rbtree_t *rbtree_read_lock(
+	rbtree_reader_t *_reader)
+{
+	struct rbtree_reader_s *reader = (struct rbtree_reader_s *)_reader;
+	struct rbtree_s *tree = reader->tree, *view = reader->view;
+	__atomic_store_n(&reader->epoch, __atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+
+	struct rbtree_version_s *ver = __atomic_load_n(&tree->version, __ATOMIC_SEQ_CST);
+	if(ver == NULL) {
+		view->td.root = NULL;
+		view->cnt = 0;
+		view->leftmost = view->rightmost = NULL;
+	} else {
+		view->td.root = ver->root;
+		view->cnt = ver->cnt;
+		view->leftmost = ver->leftmost;
+		view->rightmost = ver->rightmost;
+	}
+	return((rbtree_t *)view);
 }
 
 /**
- * @fn ivtree_iter_clean
+ * @fn rbtree_read_unlock
  */
-void ivtree_iter_clean(
-	ivtree_iter_t *_iter)
+void rbtree_read_unlock(
+	rbtree_reader_t *_reader)
 {
-	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)_iter;
-	if(iter == NULL) { return; }
-	lmm_t *lmm_iter = iter->lmm;
-	lmm_free(lmm_iter, iter);
+	struct rbtree_reader_s *reader = (struct rbtree_reader_s *)_reader;
+	__atomic_store_n(&reader->epoch, RBTREE_QUIESCENT, __ATOMIC_RELEASE);
 	return;
 }
 
 /**
- * @fn ivtree_walk
+ * @fn rbtree_create_node
  *
- * @brief walk over the tree
+ * @brief create a new node (not inserted in the tree)
  */
-void ivtree_walk(
-	ivtree_t *_tree,
-	ivtree_walk_t _fn,
-	void *_ctx)
+RBTREE_NODE_T *rbtree_create_node(
+	rbtree_t *_tree)
 {
 	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)rbtree_create_node32(tree));
+	}
 
-	tree->fn = (rbtree_walk_t)_fn;
-	tree->ctx = _ctx;
-	ngx_rbtree_walk(&tree->t, (ngx_rbtree_walk_pt)rbtree_walk_intl, (void *)tree);
-	return;
-}
-
+	if(tree->pool == NULL) { rbtree_pool_open(tree); }
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)lmm_pool_create_object(
+		tree->pool);
 
-/* unittests */
-unittest_config(
-	.name = "tree"
-);
+	/* mark node */
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		((ngx_rbtree_td_node_t *)node)->data = 0xff;
+	} else {
+		ngx_rbt_set_pooled(node);
+	}
+	return((RBTREE_NODE_T *)node);
+}
 
 /**
- * @struct ut_rbnode_s
+ * @fn rbtree_update_extremes
+ *
+ * @brief update the leftmost and the rightmost nodes with a node just inserted
  */
-struct ut_rbnode_s {
-	rbtree_node_t h;
-	int64_t val;
-};
-
-/* create tree object */
-unittest()
+static inline
+void rbtree_update_extremes(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *node)
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
-
-	assert(tree != NULL);
+	if(tree->leftmost == NULL) {
+		tree->leftmost = tree->rightmost = node;
+		return;
+	}
 
-	rbtree_clean(tree);
+	/* equal keys go right, except the top-down layout ordering them by address */
+	rbtree_key_t key = *rbtree_key_ptr(tree, node);
+	rbtree_key_t lkey = *rbtree_key_ptr(tree, tree->leftmost);
+	rbtree_key_t rkey = *rbtree_key_ptr(tree, tree->rightmost);
+	if(key < lkey || (tree->layout == RBTREE_LAYOUT_TOPDOWN && key == lkey && node < tree->leftmost)) {
+		tree->leftmost = node;
+	}
+	if(key > rkey || (key == rkey && (tree->layout != RBTREE_LAYOUT_TOPDOWN || node > tree->rightmost))) {
+		tree->rightmost = node;
+	}
+	return;
 }
 
-/* create node */
-unittest()
+/**
+ * @fn rbtree_bag_insert
+ *
+ * @brief link the node into the tree, or append it to the chain of its key found on the way
+ */
+static
+void rbtree_bag_insert(
+	struct rbtree_s *tree,
+	struct rbtree_bag_s *node)
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
-	struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-		rbtree_create_node(tree);
-	assert(n != NULL);
-
-	n->h.key = 0xcafebabe;
-	n->val = 0x12345678;
+	ngx_rbtree_node_t *parent = NULL, *temp = tree->t.root;
+	uint64_t dir = 0;
+	while(temp != tree->t.sentinel) {
+		if(node->h.key == temp->key) {
+			struct rbtree_bag_s *head = (struct rbtree_bag_s *)temp;
+			node->h.left = node->h.right = NULL;
+			node->next = head;
+			node->prev = head->prev;
+			head->prev->next = node;
+			head->prev = node;
+			return;
+		}
+		parent = temp;
+		dir = node->h.key > temp->key;
+		temp = dir ? temp->right : temp->left;
+	}
+	node->next = node->prev = node;
+	ngx_rbtree_insert_at(&tree->t, parent, dir, &node->h);
+	return;
+}
 
-	/* insert and search */
-	rbtree_insert(tree, (RBTREE_NODE_T *)n);
-	struct ut_rbnode_s *found = (struct ut_rbnode_s *)
-		 rbtree_search_key(tree, 0xcafebabe);
-	assert(found == n, "found(%p), n(%p)", found, n);
-	assert(n->h.key == 0xcafebabe, "n->h.key(%lld)", n->h.key);
-	assert(n->val == 0x12345678, "n->val(%lld)", n->val);
+/**
+ * @fn rbtree_bag_unlink
+ *
+ * @brief remove the node from its chain. the next one takes over its place if it was in the tree.
+ */
+static
+void rbtree_bag_unlink(
+	struct rbtree_s *tree,
+	struct rbtree_bag_s *node)
+{
+	if(node->next == node) {
+		ngx_rbtree_delete(&tree->t, &node->h);
+		return;
+	}
 
-	/* remove */
-	rbtree_remove(tree, (RBTREE_NODE_T *)n);
-	found = (struct ut_rbnode_s *)rbtree_search_key(tree, 0xcafebabe);
-	assert(found == NULL, "found(%p), n(%p)", found, n);
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	if(!rbtree_bag_is_chained(node)) {
+		ngx_rbtree_replace(&tree->t, &node->h, &node->next->h);
+	}
+	return;
+}
 
-	rbtree_clean(tree);
+/**
+ * @fn rbtree_bag_next
+ *
+ * @brief the next node of the same key chained after node, NULL if none or not a bag tree
+ */
+static inline
+RBTREE_NODE_T *rbtree_bag_next(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *_node)
+{
+	if(!rbtree_is_bag(tree)) { return(NULL); }
+	struct rbtree_bag_s *next = ((struct rbtree_bag_s *)_node)->next;
+	return(rbtree_bag_is_chained(next) ? (RBTREE_NODE_T *)next : NULL);
 }
 
-/* create multiple nodes */
-unittest()
+/**
+ * @fn rbtree_persistent_insert
+ *
+ * @brief link node into a RBTREE_PERSISTENT tree unless its key is found, copying the
+ * shared nodes on the path. returns the node found, NULL if linked.
+ */
+static
+RBTREE_NODE_T *rbtree_persistent_insert(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *node)
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	/* searched first, so that nothing is copied for a key in the tree */
+	ngx_rbtree_td_node_t *found = ngx_rbtree_td_find_key(&tree->td, *rbtree_key_ptr(tree, node));
+	if(found != NULL) { return((RBTREE_NODE_T *)found); }
+
+	ngx_rbtree_td_cow_t cow = { .copy = rbtree_td_copy, .ctx = (void *)tree };
+	ngx_rbtree_td_insert_cow(&tree->td, (ngx_rbtree_td_node_t *)node, &cow);
+	tree->cnt++;
+
+	/* the extremes may have been replaced by copies */
+	tree->leftmost = rbtree_extreme(tree, 0);
+	tree->rightmost = rbtree_extreme(tree, 1);
+	return(NULL);
+}
 
-	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+/**
+ * @fn rbtree_persistent_remove
+ *
+ * @brief unlink the node of key from a RBTREE_PERSISTENT tree and return it, NULL if
+ * none. the node returned is the copy owned by the tree alone, not the one shared.
+ */
+static
+RBTREE_NODE_T *rbtree_persistent_remove(
+	struct rbtree_s *tree,
+	rbtree_key_t key)
+{
+	/* searched first as rbtree_persistent_insert, so that nothing is copied for a key not in the tree */
+	if(ngx_rbtree_td_find_key(&tree->td, key) == NULL) { return(NULL); }
+
+	ngx_rbtree_td_cow_t cow = { .copy = rbtree_td_copy, .ctx = (void *)tree };
+	RBTREE_NODE_T *node = (RBTREE_NODE_T *)ngx_rbtree_td_delete_cow(&tree->td, key, &cow);
+	tree->cnt--;
+	tree->leftmost = rbtree_extreme(tree, 0);
+	tree->rightmost = rbtree_extreme(tree, 1);
+	return(node);
+}
 
+/**
+ * @fn rbtree_insert
+ *
+ * @brief insert a node
+ */
+void rbtree_insert(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *_node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
 	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+	if(rbtree_is_persistent(tree)) {
+		/* keys are unique, the node of the key is replaced */
+		if(rbtree_persistent_insert(tree, _node) != NULL) {
+			rbtree_free_node(_tree, rbtree_persistent_remove(tree, *rbtree_key_ptr(tree, _node)));
+			rbtree_persistent_insert(tree, _node);
+		}
+		rbtree_publish(tree);
+		return;
+	}
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		ngx_rbtree32_insert(&tree->t32, (ngx_rbtree32_node_t *)node);
+	} else if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_insert(&tree->td, (ngx_rbtree_td_node_t *)node);
+	} else if(rbtree_is_ostat(tree)) {
+		ngx_ostree_insert(&tree->t, node);
+	} else if(rbtree_is_augmented(tree)) {
+		ngx_rbtree_augment_insert(&tree->t, node, &tree->aug);
+	} else if(rbtree_is_bag(tree)) {
+		rbtree_bag_insert(tree, (struct rbtree_bag_s *)node);
+	} else {
+		ngx_rbtree_insert(&tree->t, node);
+	}
+	tree->cnt++;
+	rbtree_update_extremes(tree, _node);
+	return;
+}
 
-	/* insert */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+/**
+ * @fn rbtree_insert_hint
+ *
+ * @brief insert a node, starting the descent from hint (any node in the tree, or NULL)
+ * instead of the root. keys beyond the leftmost or the rightmost node are linked there
+ * without climbing, so that sorted streams are appended in amortized O(1).
+ */
+void rbtree_insert_hint(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *_node,
+	RBTREE_NODE_T const *hint)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
+
+	/* the sizes of the order-statistic tree are updated up to the root anyway */
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_ostat(tree) || rbtree_is_bag(tree)
+	|| tree->leftmost == NULL) {
+		rbtree_insert(_tree, _node);
+		return;
+	}
+
+	ngx_rbtree_node_t *start = NULL;
+	if(node->key >= ((ngx_rbtree_node_t *)tree->rightmost)->key) {
+		start = (ngx_rbtree_node_t *)tree->rightmost;
+	} else if(node->key < ((ngx_rbtree_node_t *)tree->leftmost)->key) {
+		start = (ngx_rbtree_node_t *)tree->leftmost;
+	} else if(hint != NULL) {
+		start = ngx_rbtree_hint_start((ngx_rbtree_node_t *)hint, node->key);
+	}
+	ngx_rbtree_insert_from(&tree->t, node, start,
+		rbtree_is_augmented(tree) ? &tree->aug : NULL);
+	tree->cnt++;
+	rbtree_update_extremes(tree, _node);
+	return;
+}
+
+/**
+ * @fn rbtree_insert_unique
+ *
+ * @brief insert a node unless the tree has a node of its key, in a single descent.
+ * returns 0 if inserted, or 1 with the node found in *existing (if not NULL) and
+ * node left unlinked. *existing is NULL if inserted.
+ */
+int rbtree_insert_unique(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *_node,
+	RBTREE_NODE_T **existing)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
+	RBTREE_NODE_T *found;
+	if(rbtree_is_persistent(tree)) {
+		found = rbtree_persistent_insert(tree, _node);
+		if(found == NULL) { rbtree_publish(tree); }
+		if(existing != NULL) { *existing = found; }
+		return(found != NULL);
+	}
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		found = ngx_rbtree32_insert_unique(&tree->t32, (ngx_rbtree32_node_t *)node);
+	} else if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		found = ngx_rbtree_td_insert_unique(&tree->td, (ngx_rbtree_td_node_t *)node);
+	} else if(rbtree_is_ostat(tree)) {
+		found = ngx_ostree_insert_unique(&tree->t, node);
+	} else {
+		found = ngx_rbtree_insert_unique(&tree->t, node,
+			rbtree_is_augmented(tree) ? &tree->aug : NULL);
+		if(found == NULL && rbtree_is_bag(tree)) {
+			struct rbtree_bag_s *b = (struct rbtree_bag_s *)node;
+			b->next = b->prev = b;
+		}
+	}
+
+	if(existing != NULL) { *existing = found; }
+	if(found != NULL) { return(1); }
+	tree->cnt++;
+	rbtree_update_extremes(tree, _node);
+	return(0);
+}
+
+/**
+ * @fn rbtree_unlink
+ *
+ * @brief remove a node from the tree without freeing it. returns the node removed,
+ * which is a copy of the one passed if it was shared by the versions of a persistent tree.
+ */
+static
+RBTREE_NODE_T *rbtree_unlink(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *_node)
+{
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
+	if(rbtree_is_persistent(tree)) {
+		RBTREE_NODE_T *removed = rbtree_persistent_remove(tree, *rbtree_key_ptr(tree, _node));
+		if(removed != NULL) { rbtree_publish(tree); }
+		return(removed);
+	}
+
+	/* the neighbors are searched while the node is still linked */
+	if(_node == tree->leftmost) {
+		tree->leftmost = rbtree_right((rbtree_t *)tree, _node);
+	}
+	if(_node == tree->rightmost) {
+		tree->rightmost = rbtree_left((rbtree_t *)tree, _node);
+	}
+
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		ngx_rbtree32_delete(&tree->t32, (ngx_rbtree32_node_t *)node);
+	} else if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_delete(&tree->td, (ngx_rbtree_td_node_t *)node);
+	} else if(rbtree_is_ostat(tree)) {
+		ngx_ostree_delete(&tree->t, node);
+	} else if(rbtree_is_augmented(tree)) {
+		ngx_rbtree_augment_delete(&tree->t, node, &tree->aug);
+	} else if(rbtree_is_bag(tree)) {
+		rbtree_bag_unlink(tree, (struct rbtree_bag_s *)node);
+	} else {
+		ngx_rbtree_delete(&tree->t, node);
+	}
+	tree->cnt--;
+	return(_node);
+}
+
+/**
+ * @fn rbtree_is_pooled
+ *
+ * @brief 1 if the node is malloc'd with rbtree_create_node
+ */
+static inline
+uint64_t rbtree_is_pooled(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *node)
+{
+	if(tree->layout == RBTREE_LAYOUT_IDX32) { return(1); }
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return(((ngx_rbtree_td_node_t *)node)->data == 0xff);
+	}
+	return(ngx_rbt_is_pooled((ngx_rbtree_node_t *)node) != 0);
+}
+
+/**
+ * @fn rbtree_free_node
+ *
+ * @brief free a node not in the tree if malloc'd with rbtree_create_node
+ */
+void rbtree_free_node(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(!rbtree_is_pooled(tree, node)) { return; }
+
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		rbtree_delete_node32(tree, (ngx_rbtree32_node_t *)node);
+	} else {
+		rbtree_pool_free(tree, node);
+	}
+	return;
+}
+
+/**
+ * @fn rbtree_remove
+ *
+ * @brief remove a node, automatically freed if malloc'd with rbtree_reserve_node
+ */
+void rbtree_remove(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	rbtree_free_node(_tree, rbtree_unlink(tree, node));
+	return;
+}
+
+/**
+ * @fn rbtree_remove_key
+ *
+ * @brief unlink the leftmost node of key and return it, NULL if none. the node is not
+ * freed as rbtree_pop_first. the delete climbs from the node on the parent-linked
+ * layouts and searches by itself on the top-down one, so either takes a single descent.
+ */
+RBTREE_NODE_T *rbtree_remove_key(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(rbtree_is_persistent(tree)) {
+		RBTREE_NODE_T *node = rbtree_persistent_remove(tree, key);
+		if(node != NULL) { rbtree_publish(tree); }
+		return(node);
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN && tree->leftmost != NULL
+	&& key != *rbtree_key_ptr(tree, tree->leftmost) && key != *rbtree_key_ptr(tree, tree->rightmost)) {
+		/* the extremes stay */
+		RBTREE_NODE_T *node = (RBTREE_NODE_T *)ngx_rbtree_td_delete_key(&tree->td, key);
+		if(node != NULL) { tree->cnt--; }
+		return(node);
+	}
+
+	RBTREE_NODE_T *node = rbtree_search_key(_tree, key);
+	if(node != NULL) { node = rbtree_unlink(tree, node); }
+	return(node);
+}
+
+/**
+ * @fn rbtree_key_fits
+ *
+ * @brief 1 if node stays between its neighbors prev and next (NULL if none) with key
+ */
+static inline
+uint64_t rbtree_key_fits(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *prev,
+	RBTREE_NODE_T *node,
+	RBTREE_NODE_T *next,
+	rbtree_key_t key)
+{
+	rbtree_key_t lkey = (prev == NULL) ? RBTREE_KEY_MIN : *rbtree_key_ptr(tree, prev);
+	rbtree_key_t rkey = (next == NULL) ? RBTREE_KEY_MAX : *rbtree_key_ptr(tree, next);
+	if(rbtree_is_bag(tree)) {
+		/* alone on its key, and not joining the chain of a neighbor */
+		return(((struct rbtree_bag_s *)node)->next == node
+			&& (prev == NULL || lkey < key) && (next == NULL || key < rkey));
+	}
+
+	/* equal keys are ordered by address on the top-down layout */
+	uint64_t td = (tree->layout == RBTREE_LAYOUT_TOPDOWN);
+	return((prev == NULL || lkey < key || (lkey == key && (!td || prev < node)))
+		&& (next == NULL || key < rkey || (key == rkey && (!td || node < next))));
+}
+
+/**
+ * @fn rbtree_update_key
+ *
+ * @brief change the key of a node in the tree. the key is rewritten in place if the
+ * node stays between its neighbors, in O(1) on the parent-linked layouts. otherwise
+ * the node is relinked, the descent starting from the neighbor on the side it moves
+ * to and climbing only as far as the new key needs (as rbtree_insert_hint).
+ */
+void rbtree_update_key(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *node,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	rbtree_key_t *ptr = rbtree_key_ptr(tree, node);
+	if(*ptr == key) { return; }
+	if(rbtree_is_persistent(tree)) {
+		/* the node may be shared by the versions, its copy is relinked and published at once */
+		node = rbtree_persistent_remove(tree, *ptr);
+		if(node == NULL) { return; }
+		*rbtree_key_ptr(tree, node) = key;
+		rbtree_insert(_tree, node);
+		return;
+	}
+
+	RBTREE_NODE_T *prev = rbtree_left(_tree, node), *next = rbtree_right(_tree, node);
+	if(rbtree_key_fits(tree, prev, node, next, key)) {
+		*ptr = key;
+		rbtree_update_node(_tree, node);
+		return;
+	}
+
+	RBTREE_NODE_T *hint = (next != NULL && key > *rbtree_key_ptr(tree, next)) ? next : prev;
+	rbtree_unlink(tree, node);
+	*ptr = key;
+	rbtree_insert_hint(_tree, node, hint);
+	return;
+}
+
+/**
+ * @fn rbtree_first
+ *
+ * @brief the leftmost node in O(1), NULL if the tree is empty
+ */
+RBTREE_NODE_T *rbtree_first(
+	rbtree_t *tree)
+{
+	return(((struct rbtree_s *)tree)->leftmost);
+}
+
+/**
+ * @fn rbtree_last
+ *
+ * @brief the rightmost node in O(1), NULL if the tree is empty
+ */
+RBTREE_NODE_T *rbtree_last(
+	rbtree_t *tree)
+{
+	return(((struct rbtree_s *)tree)->rightmost);
+}
+
+/**
+ * @fn rbtree_pop_first
+ *
+ * @brief unlink the leftmost node and return it. the node is not freed, so that it
+ * can be read and inserted again; pass it to rbtree_free_node to release it.
+ */
+RBTREE_NODE_T *rbtree_pop_first(
+	rbtree_t *_tree)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	RBTREE_NODE_T *node = tree->leftmost;
+	if(node != NULL) { node = rbtree_unlink(tree, node); }
+	return(node);
+}
+
+/**
+ * @fn rbtree_pop_last
+ *
+ * @brief unlink the rightmost node and return it, not freed as rbtree_pop_first
+ */
+RBTREE_NODE_T *rbtree_pop_last(
+	rbtree_t *_tree)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	RBTREE_NODE_T *node = tree->rightmost;
+	if(node != NULL) { node = rbtree_unlink(tree, node); }
+	return(node);
+}
+
+/**
+ * @struct rbtree_build_ctx_s
+ * @brief node supplier for ngx_rbtree_build / ngx_ivtree_build
+ */
+struct rbtree_build_ctx_s {
+	struct rbtree_s *tree;
+	rbtree_key_t const *keys;
+	ngx_rbtree_node_t *head;
+};
+
+/**
+ * @fn rbtree_build_next
+ */
+static
+ngx_rbtree_node_t *rbtree_build_next(
+	void *_ctx)
+{
+	struct rbtree_build_ctx_s *ctx = (struct rbtree_build_ctx_s *)_ctx;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)rbtree_create_node(
+		(rbtree_t *)ctx->tree);
+	node->key = *ctx->keys++;
+
+	if(ctx->head == NULL) { ctx->head = node; }
+	return(node);
+}
+
+/**
+ * @fn rbtree_build_sorted
+ *
+ * @brief flush the tree and build a balanced tree from keys sorted in ascending order.
+ * nodes are allocated from the pool in key order. returns the leftmost node.
+ */
+RBTREE_NODE_T *rbtree_build_sorted(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct rbtree_build_ctx_s ctx = {
+		.tree = tree,
+		.keys = keys,
+		.head = NULL
+	};
+
+	rbtree_flush((rbtree_t *)tree);
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		/* ascending insertion, the rebalancing stays on the right spine */
+		for(uint64_t i = 0; i < cnt; i++) {
+			void *node = rbtree_create_node((rbtree_t *)tree);
+			*rbtree_key_ptr(tree, node) = keys[i];
+			rbtree_insert((rbtree_t *)tree, (RBTREE_NODE_T *)node);
+			if(i == 0) { ctx.head = (ngx_rbtree_node_t *)node; }
+		}
+		return((RBTREE_NODE_T *)ctx.head);
+	}
+
+	if(rbtree_is_ostat(tree)) {
+		ngx_ostree_build(&tree->t, cnt, rbtree_build_next, (void *)&ctx);
+	} else if(rbtree_is_augmented(tree)) {
+		ngx_rbtree_augment_build(&tree->t, cnt, rbtree_build_next, (void *)&ctx, &tree->aug);
+	} else {
+		ngx_rbtree_build(&tree->t, cnt, rbtree_build_next, (void *)&ctx);
+	}
+	tree->cnt = cnt;
+	tree->leftmost = rbtree_extreme(tree, 0);
+	tree->rightmost = rbtree_extreme(tree, 1);
+	return((RBTREE_NODE_T *)ctx.head);
+}
+
+/**
+ * @struct rbtree_sort_elem_s
+ */
+struct rbtree_sort_elem_s {
+	rbtree_ukey_t key;			/* sign-flipped to sort as unsigned */
+	ngx_rbtree_node_t *node;
+};
+
+/**
+ * @fn rbtree_sort_nodes
+ *
+ * @brief stable LSD radix sort of nodes by key. keys are gathered once into a
+ * (key, node) array so that the passes run over contiguous memory.
+ */
+static
+void rbtree_sort_nodes(
+	struct rbtree_s *tree,
+	ngx_rbtree_node_t **nodes,
+	uint64_t cnt)
+{
+	lmm_t *lmm = tree->lmm;
+
+	struct rbtree_sort_elem_s *src = (struct rbtree_sort_elem_s *)lmm_malloc(lmm,
+		2 * cnt * sizeof(struct rbtree_sort_elem_s));
+	struct rbtree_sort_elem_s *dst = src + cnt;
+
+	for(uint64_t i = 0; i < cnt; i++) {
+		src[i] = (struct rbtree_sort_elem_s){
+			.key = (rbtree_ukey_t)*rbtree_key_ptr(tree, nodes[i]) ^ RBTREE_KEY_SIGN,
+			.node = nodes[i]
+		};
+	}
+
+	if(cnt < RBTREE_SORT_THRESH) {
+		/* insertion sort */
+		for(uint64_t i = 1; i < cnt; i++) {
+			struct rbtree_sort_elem_s e = src[i];
+			uint64_t j = i;
+			for(; j > 0 && src[j - 1].key > e.key; j--) { src[j] = src[j - 1]; }
+			src[j] = e;
+		}
+	} else {
+		/* histograms of all digits in a single pass */
+		uint64_t (*hist)[256] = (uint64_t (*)[256])lmm_malloc(lmm, RBTREE_KEY_DIGITS * 256 * sizeof(uint64_t));
+		memset(hist, 0, RBTREE_KEY_DIGITS * 256 * sizeof(uint64_t));
+		for(uint64_t i = 0; i < cnt; i++) {
+			for(uint64_t d = 0; d < RBTREE_KEY_DIGITS; d++) {
+				hist[d][0xff & (src[i].key>>(8 * d))]++;
+			}
+		}
+
+		for(uint64_t d = 0; d < RBTREE_KEY_DIGITS; d++) {
+			/* skip the digit if all keys fall into a single bucket */
+			if(hist[d][0xff & (src[0].key>>(8 * d))] == cnt) { continue; }
+
+			uint64_t ofs = 0;
+			for(uint64_t b = 0; b < 256; b++) {
+				uint64_t c = hist[d][b];
+				hist[d][b] = ofs;
+				ofs += c;
+			}
+			for(uint64_t i = 0; i < cnt; i++) {
+				dst[hist[d][0xff & (src[i].key>>(8 * d))]++] = src[i];
+			}
+
+			struct rbtree_sort_elem_s *tmp = src;
+			src = dst; dst = tmp;
+		}
+		lmm_free(lmm, hist);
+	}
+
+	for(uint64_t i = 0; i < cnt; i++) {
+		nodes[i] = src[i].node;
+	}
+	lmm_free(lmm, (src < dst) ? src : dst);
+	return;
+}
+
+/**
+ * @fn rbtree_batch_rebuild
+ *
+ * @brief decide between merge-and-rebuild (touches every node once) and sorted
+ * insertion (touches the lower part of the paths, the upper part stays in cache).
+ * the rebuild is taken while n + m stays below m log2 n, i.e. n / m below log2 n.
+ */
+static inline
+int rbtree_batch_rebuild(
+	uint64_t tree_cnt,
+	uint64_t batch_cnt)
+{
+	uint64_t ratio = tree_cnt / batch_cnt;
+	return(ratio < (uint64_t)(64 - __builtin_clzll(tree_cnt + 1)));
+}
+
+/**
+ * @struct rbtree_merge_ctx_s
+ * @brief node supplier merging a flattened tree and a sorted array
+ */
+struct rbtree_merge_ctx_s {
+	ngx_rbtree_node_t *list;
+	ngx_rbtree_node_t **nodes;
+	ngx_rbtree_node_t **lim;
+};
+
+/**
+ * @fn rbtree_merge_next
+ */
+static
+ngx_rbtree_node_t *rbtree_merge_next(
+	void *_ctx)
+{
+	struct rbtree_merge_ctx_s *ctx = (struct rbtree_merge_ctx_s *)_ctx;
+
+	/* nodes already in the tree come first among equal keys */
+	if(ctx->nodes == ctx->lim
+	|| (ctx->list != NULL && ctx->list->key <= (*ctx->nodes)->key)) {
+		ngx_rbtree_node_t *node = ctx->list;
+		ctx->list = node->right;
+		return(node);
+	}
+	return(*ctx->nodes++);
+}
+
+/**
+ * @fn rbtree_insert_batch
+ *
+ * @brief insert nodes at once. the array is sorted by key on return.
+ */
+void rbtree_insert_batch(
+	rbtree_t *_tree,
+	RBTREE_NODE_T **_nodes,
+	uint64_t cnt)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t **nodes = (ngx_rbtree_node_t **)_nodes;
+	if(cnt == 0) { return; }
+
+	rbtree_sort_nodes(tree, nodes, cnt);
+
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		for(uint64_t i = 0; i < cnt; i++) {
+			rbtree_insert((rbtree_t *)tree, (RBTREE_NODE_T *)nodes[i]);
+		}
+		return;
+	}
+
+	if(rbtree_batch_rebuild(rbtree_count(tree), cnt)) {
+		struct rbtree_merge_ctx_s ctx = {
+			.list = ngx_rbtree_flatten(&tree->t),
+			.nodes = nodes,
+			.lim = nodes + cnt
+		};
+		if(rbtree_is_ostat(tree)) {
+			ngx_ostree_build(&tree->t, tree->cnt + cnt, rbtree_merge_next, (void *)&ctx);
+		} else if(rbtree_is_augmented(tree)) {
+			ngx_rbtree_augment_build(&tree->t, tree->cnt + cnt, rbtree_merge_next, (void *)&ctx, &tree->aug);
+		} else {
+			ngx_rbtree_build(&tree->t, tree->cnt + cnt, rbtree_merge_next, (void *)&ctx);
+		}
+		tree->leftmost = rbtree_extreme(tree, 0);
+		tree->rightmost = rbtree_extreme(tree, 1);
+	} else {
+		/* ascending, so that each descent starts from the previous node */
+		for(uint64_t i = 0; i < cnt; i++) {
+			rbtree_insert_hint((rbtree_t *)tree, (RBTREE_NODE_T *)nodes[i],
+				(RBTREE_NODE_T *)(i == 0 ? NULL : nodes[i - 1]));
+		}
+		return;
+	}
+	tree->cnt += cnt;
+	return;
+}
+
+/**
+ * @fn rbtree_search_keys_each
+ *
+ * @brief batched searches on the layouts other than RBTREE_LAYOUT_PTR and on the bag
+ * trees, one lookup per key
+ */
+static
+void rbtree_search_keys_each(
+	rbtree_t *tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out,
+	RBTREE_NODE_T *(*search)(rbtree_t *, rbtree_key_t))
+{
+	for(uint64_t i = 0; i < cnt; i++) {
+		out[i] = search(tree, keys[i]);
+	}
+	return;
+}
+
+/**
+ * @fn rbtree_search_key
+ *
+ * @brief search a node by key, returning the leftmost node
+ */
+RBTREE_NODE_T *rbtree_search_key(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)ngx_rbtree32_find_key(&tree->t32, key));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return((RBTREE_NODE_T *)ngx_rbtree_td_find_key(&tree->td, key));
+	}
+	return((RBTREE_NODE_T *)ngx_rbtree_find_key(&tree->t, key));
+}
+
+/**
+ * @fn rbtree_search_key_left
+ *
+ * @brief search a node by key. returns the nearest node in the left half of the tree if key was not found.
+ */
+RBTREE_NODE_T *rbtree_search_key_left(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)ngx_rbtree32_find_key_left(&tree->t32, key));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return((RBTREE_NODE_T *)ngx_rbtree_td_find_key_left(&tree->td, key));
+	}
+	ngx_rbtree_node_t *node = ngx_rbtree_find_key_left(&tree->t, key);
+	if(rbtree_is_bag(tree) && node != NULL && node->key != key) {
+		/* the last one of the chain */
+		return((RBTREE_NODE_T *)((struct rbtree_bag_s *)node)->prev);
+	}
+	return((RBTREE_NODE_T *)node);
+}
+
+/**
+ * @fn rbtree_search_key_right
+ *
+ * @brief search a node by key. returns the nearest node in the right half of the tree if key was not found.
+ */
+RBTREE_NODE_T *rbtree_search_key_right(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)ngx_rbtree32_find_key_right(&tree->t32, key));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return((RBTREE_NODE_T *)ngx_rbtree_td_find_key_right(&tree->td, key));
+	}
+	return((RBTREE_NODE_T *)ngx_rbtree_find_key_right(&tree->t, key));
+}
+
+/**
+ * @fn rbtree_equal_range
+ *
+ * @brief the leftmost and the rightmost (in *last) nodes of key in O(log n), NULL if
+ * none. the nodes in between are visited by rbtree_right from the leftmost one.
+ */
+RBTREE_NODE_T *rbtree_equal_range(
+	rbtree_t *_tree,
+	rbtree_key_t key,
+	RBTREE_NODE_T **last)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	RBTREE_NODE_T *first = rbtree_search_key(_tree, key);
+	if(first == NULL) {
+		*last = NULL;
+		return(NULL);
+	}
+	if(rbtree_is_bag(tree)) {
+		*last = (RBTREE_NODE_T *)((struct rbtree_bag_s *)first)->prev;
+		return(first);
+	}
+
+	/* the predecessor of the leftmost node above key */
+	RBTREE_NODE_T *above = (key == RBTREE_KEY_MAX) ? NULL : rbtree_search_key_right(_tree, key + 1);
+	*last = (above == NULL) ? tree->rightmost : rbtree_left(_tree, above);
+	return(first);
+}
+
+/**
+ * @fn rbtree_count_key
+ *
+ * @brief the number of nodes of key, in O(log n) with RBTREE_ORDER_STAT and in
+ * O(log n + k) otherwise
+ */
+uint64_t rbtree_count_key(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(rbtree_is_ostat(tree)) {
+		uint64_t above = (key == RBTREE_KEY_MAX) ? rbtree_count(tree) : rbtree_rank(_tree, key + 1);
+		return(above - rbtree_rank(_tree, key));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_path_t path;
+		ngx_rbtree_td_path_init(&tree->td, &path, key, 0);
+		uint64_t cnt = 0;
+		for(ngx_rbtree_td_node_t *node = ngx_rbtree_td_path_next(&path);
+			node != NULL && node->key == key;
+			node = ngx_rbtree_td_path_next(&path)) {
+			cnt++;
+		}
+		return(cnt);
+	}
+
+	RBTREE_NODE_T *last, *node = rbtree_equal_range(_tree, key, &last);
+	uint64_t cnt = 0;
+	while(node != NULL) {
+		cnt++;
+		node = (node == last) ? NULL : rbtree_right(_tree, node);
+	}
+	return(cnt);
+}
+
+/**
+ * @fn rbtree_search_keys
+ *
+ * @brief search cnt keys at once, out[i] is the leftmost node of keys[i] or NULL.
+ * lookups are interleaved so that their cache misses overlap.
+ */
+void rbtree_search_keys(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key);
+		return;
+	}
+	ngx_rbtree_find_keys(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_search_keys_left
+ *
+ * @brief batched rbtree_search_key_left
+ */
+void rbtree_search_keys_left(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key_left);
+		return;
+	}
+	ngx_rbtree_find_keys_left(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_search_keys_right
+ *
+ * @brief batched rbtree_search_key_right
+ */
+void rbtree_search_keys_right(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key_right);
+		return;
+	}
+	ngx_rbtree_find_keys_right(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_search_sorted_keys
+ *
+ * @brief search ascending keys, each lookup starts from the result of the previous
+ * one (finger search). k keys cost O(k log(n/k)) instead of O(k log n).
+ * unsorted keys are still answered correctly, at the cost of restarting from the root.
+ */
+void rbtree_search_sorted_keys(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key);
+		return;
+	}
+	ngx_rbtree_find_sorted_keys(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_search_sorted_keys_left
+ *
+ * @brief finger-search version of rbtree_search_keys_left
+ */
+void rbtree_search_sorted_keys_left(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key_left);
+		return;
+	}
+	ngx_rbtree_find_sorted_keys_left(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_search_sorted_keys_right
+ *
+ * @brief finger-search version of rbtree_search_keys_right
+ */
+void rbtree_search_sorted_keys_right(
+	rbtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt,
+	RBTREE_NODE_T **out)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		rbtree_search_keys_each(_tree, keys, cnt, out, rbtree_search_key_right);
+		return;
+	}
+	ngx_rbtree_find_sorted_keys_right(&tree->t, keys, cnt, (ngx_rbtree_node_t **)out);
+	return;
+}
+
+/**
+ * @fn rbtree_left
+ *
+ * @brief returns the left next node
+ */
+RBTREE_NODE_T *rbtree_left(
+	rbtree_t *_tree,
+	RBTREE_NODE_T const *node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)ngx_rbtree32_find_left(&tree->t32, (ngx_rbtree32_node_t *)node));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return((RBTREE_NODE_T *)ngx_rbtree_td_find_left(&tree->td, (ngx_rbtree_td_node_t *)node));
+	}
+	if(rbtree_is_bag(tree)) {
+		/* the previous one in the chain, or the last one of the chain of the predecessor */
+		struct rbtree_bag_s *b = (struct rbtree_bag_s *)node;
+		if(rbtree_bag_is_chained(b)) { return((RBTREE_NODE_T *)b->prev); }
+		b = (struct rbtree_bag_s *)ngx_rbtree_find_left(&tree->t, &b->h);
+		return((RBTREE_NODE_T *)(b == NULL ? NULL : b->prev));
+	}
+	return((RBTREE_NODE_T *)ngx_rbtree_find_left(&tree->t, (ngx_rbtree_node_t *)node));
+}
+
+/**
+ * @fn rbtree_right
+ *
+ * @brief returns the right next node
+ */
+RBTREE_NODE_T *rbtree_right(
+	rbtree_t *_tree,
+	RBTREE_NODE_T const *node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return((RBTREE_NODE_T *)ngx_rbtree32_find_right(&tree->t32, (ngx_rbtree32_node_t *)node));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		return((RBTREE_NODE_T *)ngx_rbtree_td_find_right(&tree->td, (ngx_rbtree_td_node_t *)node));
+	}
+	if(rbtree_is_bag(tree)) {
+		/* the next one in the chain, or the successor of the one in the tree */
+		struct rbtree_bag_s *next = ((struct rbtree_bag_s *)node)->next;
+		if(rbtree_bag_is_chained(next)) { return((RBTREE_NODE_T *)next); }
+		return((RBTREE_NODE_T *)ngx_rbtree_find_right(&tree->t, &next->h));
+	}
+	return((RBTREE_NODE_T *)ngx_rbtree_find_right(&tree->t, (ngx_rbtree_node_t *)node));
+}
+
+/**
+ * @fn rbtree_iter_prefetch
+ *
+ * @brief prefetch the subtrees to be descended by the next few calls
+ */
+static inline
+void rbtree_iter_prefetch(
+	struct rbtree_iter_s *iter)
+{
+	for(uint64_t i = 1; i <= RBTREE_ITER_PREFETCH && i <= iter->sp; i++) {
+		ngx_rbtree_node_t *next = iter->stack[iter->sp - i];
+		__builtin_prefetch(iter->rev ? next->left : next->right);
+	}
+	return;
+}
+
+/**
+ * @fn rbtree_iter_push
+ *
+ * @brief push node and its left (right if reverse) spine
+ */
+static inline
+void rbtree_iter_push(
+	struct rbtree_iter_s *iter,
+	ngx_rbtree_node_t *node)
+{
+	ngx_rbtree_node_t *sentinel = iter->tree->t.sentinel;
+	while(node != sentinel) {
+		iter->stack[iter->sp++] = node;
+		node = iter->rev ? node->right : node->left;
+	}
+	rbtree_iter_prefetch(iter);
+	return;
+}
+
+/**
+ * @fn rbtree_iter_init
+ */
+static
+struct rbtree_iter_s *rbtree_iter_init(
+	struct rbtree_s *tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey,
+	uint64_t rev)
+{
+	struct rbtree_iter_s *iter = (struct rbtree_iter_s *)lmm_malloc(tree->lmm,
+		sizeof(struct rbtree_iter_s));
+	iter->lmm = tree->lmm;
+	iter->tree = tree;
+	iter->lkey = lkey;
+	iter->rkey = rkey;
+	iter->rev = rev;
+	iter->sp = 0;
+	iter->node = NULL;
+	iter->td.top = 0;
+	if(lkey >= rkey) { return(iter); }
+
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_path_init(&tree->td, &iter->td, rev ? rkey : lkey, rev);
+		return(iter);
+	}
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		RBTREE_NODE_T *node = rbtree_search_key_right((rbtree_t *)tree, rev ? rkey : lkey);
+		if(rev) {
+			node = (node == NULL) ? tree->rightmost : rbtree_left((rbtree_t *)tree, node);
+		}
+		iter->node = node;
+		return(iter);
+	}
+
+	/* the ancestors passed on the search path are the successors of the first node */
+	ngx_rbtree_node_t *node = tree->t.root, *sentinel = tree->t.sentinel;
+	while(node != sentinel) {
+		if(rev ? node->key < rkey : node->key >= lkey) {
+			iter->stack[iter->sp++] = node;
+			node = rev ? node->right : node->left;
+		} else {
+			node = rev ? node->left : node->right;
+		}
+	}
+	rbtree_iter_prefetch(iter);
+	return(iter);
+}
+
+/**
+ * @fn rbtree_range
+ *
+ * @brief iterate over the nodes with keys in [lkey, rkey) in the ascending order
+ */
+rbtree_iter_t *rbtree_range(
+	rbtree_t *tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	return((rbtree_iter_t *)rbtree_iter_init((struct rbtree_s *)tree, lkey, rkey, 0));
+}
+
+/**
+ * @fn rbtree_range_reverse
+ *
+ * @brief iterate over the nodes with keys in [lkey, rkey) in the descending order
+ */
+rbtree_iter_t *rbtree_range_reverse(
+	rbtree_t *tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	return((rbtree_iter_t *)rbtree_iter_init((struct rbtree_s *)tree, lkey, rkey, 1));
+}
+
+/**
+ * @fn rbtree_iter_next_node
+ */
+static inline
+RBTREE_NODE_T *rbtree_iter_next_node(
+	struct rbtree_iter_s *iter)
+{
+	if(iter->tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_node_t *node = ngx_rbtree_td_path_next(&iter->td);
+		if(node == NULL) { return(NULL); }
+		if(iter->rev ? node->key < iter->lkey : node->key >= iter->rkey) {
+			iter->td.top = 0;
+			return(NULL);
+		}
+		return((RBTREE_NODE_T *)node);
+	}
+	if(iter->tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(iter->tree)) {
+		RBTREE_NODE_T *node = iter->node;
+		if(node == NULL) { return(NULL); }
+
+		rbtree_key_t key = *rbtree_key_ptr(iter->tree, node);
+		if(iter->rev ? key < iter->lkey : key >= iter->rkey) {
+			iter->node = NULL;
+			return(NULL);
+		}
+		iter->node = iter->rev
+			? rbtree_left((rbtree_t *)iter->tree, node)
+			: rbtree_right((rbtree_t *)iter->tree, node);
+		return(node);
+	}
+
+	if(iter->sp == 0) { return(NULL); }
+	ngx_rbtree_node_t *node = iter->stack[--iter->sp];
+	if(iter->rev ? node->key < iter->lkey : node->key >= iter->rkey) {
+		iter->sp = 0;
+		return(NULL);
+	}
+	rbtree_iter_push(iter, iter->rev ? node->left : node->right);
+	return((RBTREE_NODE_T *)node);
+}
+
+/**
+ * @fn rbtree_iter_next
+ *
+ * @brief the next node in the range, NULL at the end. the tree must not be modified
+ * while iterating.
+ */
+RBTREE_NODE_T *rbtree_iter_next(
+	rbtree_iter_t *iter)
+{
+	return(rbtree_iter_next_node((struct rbtree_iter_s *)iter));
+}
+
+/**
+ * @fn rbtree_iter_next_batch
+ *
+ * @brief fill out with up to cnt next nodes, returns the number filled (less than cnt
+ * only at the end)
+ */
+uint64_t rbtree_iter_next_batch(
+	rbtree_iter_t *_iter,
+	RBTREE_NODE_T **out,
+	uint64_t cnt)
+{
+	struct rbtree_iter_s *iter = (struct rbtree_iter_s *)_iter;
+	uint64_t i = 0;
+	for(; i < cnt; i++) {
+		if((out[i] = rbtree_iter_next_node(iter)) == NULL) { break; }
+	}
+	return(i);
+}
+
+/**
+ * @fn rbtree_iter_clean
+ */
+void rbtree_iter_clean(
+	rbtree_iter_t *_iter)
+{
+	struct rbtree_iter_s *iter = (struct rbtree_iter_s *)_iter;
+	if(iter == NULL) { return; }
+	lmm_free(iter->lmm, iter);
+	return;
+}
+
+/**
+ * @struct rbtree_walk_ctx_s
+ * @brief the callback of rbtree_walk, kept on the stack of the caller so that walks
+ * on a tree can run concurrently
+ */
+struct rbtree_walk_ctx_s {
+	rbtree_walk_t fn;
+	void *ctx;
+	uint64_t bag;
+};
+
+/**
+ * @fn rbtree_walk
+ *
+ * @brief walk over the tree
+ */
+void rbtree_walk_intl(
+	ngx_rbtree_node_t **node,
+	ngx_rbtree_node_t *sentinel,
+	void *_ctx)
+{
+	struct rbtree_walk_ctx_s *ctx = (struct rbtree_walk_ctx_s *)_ctx;
+	if(ctx->bag) {
+		/* the chained nodes before the one in the tree, which holds the chain */
+		struct rbtree_bag_s *head = (struct rbtree_bag_s *)(*node);
+		for(struct rbtree_bag_s *b = head->next, *next; b != head; b = next) {
+			next = b->next;
+			ctx->fn((RBTREE_NODE_T *)b, ctx->ctx);
+		}
+	}
+	ctx->fn((RBTREE_NODE_T *)(*node), ctx->ctx);
+	return;
+}
+void rbtree_walk32_intl(
+	ngx_rbtree32_node_t *node,
+	void *_ctx)
+{
+	struct rbtree_walk_ctx_s *ctx = (struct rbtree_walk_ctx_s *)_ctx;
+	ctx->fn((RBTREE_NODE_T *)node, ctx->ctx);
+	return;
+}
+void rbtree_walk_td_intl(
+	ngx_rbtree_td_node_t *node,
+	void *_ctx)
+{
+	struct rbtree_walk_ctx_s *ctx = (struct rbtree_walk_ctx_s *)_ctx;
+	ctx->fn((RBTREE_NODE_T *)node, ctx->ctx);
+	return;
+}
+void rbtree_walk(
+	rbtree_t *_tree,
+	rbtree_walk_t _fn,
+	void *_ctx)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct rbtree_walk_ctx_s ctx = {
+		.fn = _fn,
+		.ctx = _ctx,
+		.bag = rbtree_is_bag(tree)
+	};
+
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		ngx_rbtree32_walk(&tree->t32, rbtree_walk32_intl, (void *)&ctx);
+		return;
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_walk(&tree->td, rbtree_walk_td_intl, (void *)&ctx);
+		return;
+	}
+	ngx_rbtree_walk(&tree->t, (ngx_rbtree_walk_pt)rbtree_walk_intl, (void *)&ctx);
+	return;
+}
+
+/**
+ * @fn rbtree_child
+ *
+ * @brief the left (dir == 0) or the right (dir == 1) child, or the root if node is NULL.
+ * NULL if none.
+ */
+static inline
+RBTREE_NODE_T *rbtree_child(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *_node,
+	uint64_t dir)
+{
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		ngx_rbtree32_node_t *node = (ngx_rbtree32_node_t *)_node;
+		uint32_t i = (node == NULL) ? tree->t32.root : (dir ? node->right : node->left);
+		return(i == 0 ? NULL : (RBTREE_NODE_T *)ngx_rbt32_node(&tree->t32, i));
+	}
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_node_t *node = (ngx_rbtree_td_node_t *)_node;
+		return((RBTREE_NODE_T *)(node == NULL ? tree->td.root : node->link[dir]));
+	}
+
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
+	node = (node == NULL) ? tree->t.root : (dir ? node->right : node->left);
+	return(node == tree->t.sentinel ? NULL : (RBTREE_NODE_T *)node);
+}
+
+/**
+ * @fn rbtree_visit_subtree
+ *
+ * @brief in-order walk over the subtree with an explicit stack. stops when fn returns
+ * RBTREE_WALK_STOP or *stop turns non-zero (set by the other workers of the parallel walk).
+ */
+static
+int rbtree_visit_subtree(
+	struct rbtree_s *tree,
+	RBTREE_NODE_T *root,
+	rbtree_visit_t fn,
+	void *ctx,
+	uint64_t *stop)
+{
+	uint64_t sp = 0;
+	RBTREE_NODE_T *stack[RBTREE_ITER_DEPTH];
+	for(RBTREE_NODE_T *node = root; node != NULL; node = rbtree_child(tree, node, 0)) {
+		stack[sp++] = node;
+	}
+
+	while(sp > 0) {
+		RBTREE_NODE_T *node = stack[--sp];
+		int r = fn(node, ctx);
+		for(RBTREE_NODE_T *b = rbtree_bag_next(tree, node); b != NULL && r == RBTREE_WALK_CONTINUE; b = rbtree_bag_next(tree, b)) {
+			r = fn(b, ctx);
+		}
+		if(r == RBTREE_WALK_STOP || __atomic_load_n(stop, __ATOMIC_RELAXED) != 0) {
+			__atomic_store_n(stop, 1, __ATOMIC_RELAXED);
+			return(RBTREE_WALK_STOP);
+		}
+		if(r == RBTREE_WALK_SKIP) { continue; }
+
+		for(node = rbtree_child(tree, node, 1); node != NULL; node = rbtree_child(tree, node, 0)) {
+			stack[sp++] = node;
+		}
+	}
+	return(RBTREE_WALK_CONTINUE);
+}
+
+/**
+ * @fn rbtree_walk_inorder
+ *
+ * @brief walk over the tree in the ascending order. fn returns RBTREE_WALK_CONTINUE,
+ * RBTREE_WALK_SKIP to skip the right subtree of the node (the rest of the subtree rooted
+ * at it), or RBTREE_WALK_STOP to quit. reentrant, returns RBTREE_WALK_STOP if stopped.
+ */
+int rbtree_walk_inorder(
+	rbtree_t *_tree,
+	rbtree_visit_t fn,
+	void *ctx)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	uint64_t stop = 0;
+	return(rbtree_visit_subtree(tree, rbtree_child(tree, NULL, 0), fn, ctx, &stop));
+}
+
+/* the subtrees handed to the workers, at most 2^depth */
+#define RBTREE_WALK_MAX_DEPTH		( 8 )
+
+/**
+ * @struct rbtree_walk_parallel_s
+ * @brief the subtrees are taken by the workers one by one
+ */
+struct rbtree_walk_parallel_s {
+	struct rbtree_s *tree;
+	rbtree_visit_t fn;
+	void *ctx;
+	uint64_t next, cnt, stop;
+	RBTREE_NODE_T *subtrees[1<<RBTREE_WALK_MAX_DEPTH];
+};
+
+/**
+ * @fn rbtree_walk_parallel_worker
+ */
+static
+void *rbtree_walk_parallel_worker(
+	void *_w)
+{
+	struct rbtree_walk_parallel_s *w = (struct rbtree_walk_parallel_s *)_w;
+	while(__atomic_load_n(&w->stop, __ATOMIC_RELAXED) == 0) {
+		uint64_t i = __sync_fetch_and_add(&w->next, 1);
+		if(i >= w->cnt) { break; }
+		rbtree_visit_subtree(w->tree, w->subtrees[i], w->fn, w->ctx, &w->stop);
+	}
+	return(NULL);
+}
+
+/**
+ * @fn rbtree_walk_parallel_collect
+ *
+ * @brief cut the tree at depth into subtrees, and the nodes above them
+ */
+static
+void rbtree_walk_parallel_collect(
+	struct rbtree_walk_parallel_s *w,
+	RBTREE_NODE_T *node,
+	uint64_t depth,
+	RBTREE_NODE_T **upper,
+	uint64_t *ucnt)
+{
+	if(node == NULL) { return; }
+	if(depth == 0) {
+		w->subtrees[w->cnt++] = node;
+		return;
+	}
+	upper[(*ucnt)++] = node;
+	rbtree_walk_parallel_collect(w, rbtree_child(w->tree, node, 0), depth - 1, upper, ucnt);
+	rbtree_walk_parallel_collect(w, rbtree_child(w->tree, node, 1), depth - 1, upper, ucnt);
+	return;
+}
+
+/**
+ * @fn rbtree_walk_parallel
+ *
+ * @brief walk over the tree on threads threads. the tree is cut into disjoint subtrees
+ * (about four per thread), each walked in-order as rbtree_walk_inorder by a worker. the
+ * nodes above the cut are visited last by the caller's thread. fn is called concurrently
+ * and in no particular order across the subtrees. RBTREE_WALK_STOP stops all the workers.
+ */
+int rbtree_walk_parallel(
+	rbtree_t *_tree,
+	rbtree_visit_t fn,
+	void *ctx,
+	uint64_t threads)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	threads = (threads == 0) ? 1 : threads;
+	threads = (threads > (1<<RBTREE_WALK_MAX_DEPTH)) ? (1<<RBTREE_WALK_MAX_DEPTH) : threads;
+
+	uint64_t depth = 0;
+	while(depth < RBTREE_WALK_MAX_DEPTH && (1ULL<<depth) < 4 * threads) { depth++; }
+
+	struct rbtree_walk_parallel_s *w = (struct rbtree_walk_parallel_s *)lmm_malloc(tree->lmm,
+		sizeof(struct rbtree_walk_parallel_s));
+	w->tree = tree;
+	w->fn = fn;
+	w->ctx = ctx;
+	w->next = w->cnt = 0;
+	w->stop = 0;
+
+	uint64_t ucnt = 0;
+	RBTREE_NODE_T *upper[1<<RBTREE_WALK_MAX_DEPTH];
+	rbtree_walk_parallel_collect(w, rbtree_child(tree, NULL, 0), depth, upper, &ucnt);
+
+	/* the caller works as one of the workers */
+	uint64_t spawned = 0;
+	pthread_t th[threads];
+	while(spawned + 1 < threads && spawned + 1 < w->cnt
+	&& pthread_create(&th[spawned], NULL, rbtree_walk_parallel_worker, (void *)w) == 0) {
+		spawned++;
+	}
+	rbtree_walk_parallel_worker((void *)w);
+	for(uint64_t i = 0; i < spawned; i++) {
+		pthread_join(th[i], NULL);
+	}
+
+	for(uint64_t i = 0; i < ucnt && w->stop == 0; i++) {
+		for(RBTREE_NODE_T *node = upper[i]; node != NULL && w->stop == 0; node = rbtree_bag_next(tree, node)) {
+			if(fn(node, ctx) == RBTREE_WALK_STOP) { w->stop = 1; }
+		}
+	}
+
+	int r = w->stop ? RBTREE_WALK_STOP : RBTREE_WALK_CONTINUE;
+	lmm_free(tree->lmm, w);
+	return(r);
+}
+
+/**
+ * @struct rbtree_rank_ctx_s
+ * @brief linear-scan fallback of rbtree_rank
+ */
+struct rbtree_rank_ctx_s {
+	struct rbtree_s *tree;
+	rbtree_key_t key;
+	uint64_t rank;
+};
+
+/**
+ * @fn rbtree_rank_intl
+ */
+static
+void rbtree_rank_intl(
+	RBTREE_NODE_T *node,
+	void *_ctx)
+{
+	struct rbtree_rank_ctx_s *ctx = (struct rbtree_rank_ctx_s *)_ctx;
+	ctx->rank += *rbtree_key_ptr(ctx->tree, node) < ctx->key;
+	return;
+}
+
+/**
+ * @fn rbtree_rank
+ *
+ * @brief the number of nodes with keys less than key. trees without RBTREE_ORDER_STAT
+ * are scanned in O(n).
+ */
+uint64_t rbtree_rank(
+	rbtree_t *_tree,
+	rbtree_key_t key)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(rbtree_is_ostat(tree)) {
+		return(ngx_ostree_rank(&tree->t, key));
+	}
+
+	struct rbtree_rank_ctx_s ctx = {
+		.tree = tree,
+		.key = key,
+		.rank = 0
+	};
+	rbtree_walk(_tree, rbtree_rank_intl, (void *)&ctx);
+	return(ctx.rank);
+}
+
+/**
+ * @fn rbtree_select
+ *
+ * @brief the k-th (0-origin) node in the ascending order, NULL if k >= the number of nodes.
+ * trees without RBTREE_ORDER_STAT are traversed from the leftmost node.
+ */
+RBTREE_NODE_T *rbtree_select(
+	rbtree_t *_tree,
+	uint64_t k)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(rbtree_is_ostat(tree)) {
+		return((RBTREE_NODE_T *)ngx_ostree_select(&tree->t, k));
+	}
+	if(k >= rbtree_count(tree)) { return(NULL); }
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_path_t path;
+		ngx_rbtree_td_path_init(&tree->td, &path, RBTREE_KEY_MIN, 0);
+		while(k-- > 0) { ngx_rbtree_td_path_next(&path); }
+		return((RBTREE_NODE_T *)ngx_rbtree_td_path_next(&path));
+	}
+
+	RBTREE_NODE_T *node = rbtree_search_key_right(_tree, RBTREE_KEY_MIN);
+	while(k-- > 0) {
+		node = rbtree_right(_tree, node);
+	}
+	return(node);
+}
+
+/**
+ * @fn rbtree_count_range
+ *
+ * @brief the number of nodes with keys in [lkey, rkey)
+ */
+uint64_t rbtree_count_range(
+	rbtree_t *tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	if(lkey >= rkey) { return(0); }
+	return(rbtree_rank(tree, rkey) - rbtree_rank(tree, lkey));
+}
+
+/**
+ * @fn rbtree_update_node
+ *
+ * @brief propagate the augmented value of node towards the root, must be called
+ * when the payload the value depends on is modified
+ */
+void rbtree_update_node(
+	rbtree_t *_tree,
+	RBTREE_NODE_T *node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(rbtree_is_augmented(tree)) {
+		ngx_rbtree_augment_update(&tree->t, (ngx_rbtree_node_t *)node, &tree->aug);
+	}
+	return;
+}
+
+/**
+ * @struct rbtree_cover_ctx_s
+ */
+struct rbtree_cover_ctx_s {
+	rbtree_cover_t fn;
+	void *ctx;
+};
+
+/**
+ * @fn rbtree_cover_intl
+ */
+static
+void rbtree_cover_intl(
+	ngx_rbtree_node_t *node,
+	uint64_t subtree,
+	void *_ctx)
+{
+	struct rbtree_cover_ctx_s *ctx = (struct rbtree_cover_ctx_s *)_ctx;
+	ctx->fn((RBTREE_NODE_T *)node, subtree != 0, ctx->ctx);
+	return;
+}
+
+/**
+ * @fn rbtree_cover
+ *
+ * @brief decompose [lkey, rkey) into O(log n) single nodes and whole subtrees, whose
+ * augmented values can be combined into a range aggregate. the order is unspecified.
+ * the layouts other than RBTREE_LAYOUT_PTR and the bag trees pass every node in the range
+ * as a single node.
+ */
+void rbtree_cover(
+	rbtree_t *_tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey,
+	rbtree_cover_t fn,
+	void *ctx)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN) {
+		ngx_rbtree_td_path_t path;
+		ngx_rbtree_td_path_init(&tree->td, &path, lkey, 0);
+		for(ngx_rbtree_td_node_t *node = ngx_rbtree_td_path_next(&path);
+			node != NULL && node->key < rkey;
+			node = ngx_rbtree_td_path_next(&path)) {
+			fn((RBTREE_NODE_T *)node, 0, ctx);
+		}
+		return;
+	}
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) {
+		RBTREE_NODE_T *node = rbtree_search_key_right(_tree, lkey);
+		while(node != NULL && *rbtree_key_ptr(tree, node) < rkey) {
+			fn(node, 0, ctx);
+			node = rbtree_right(_tree, node);
+		}
+		return;
+	}
+
+	struct rbtree_cover_ctx_s c = {
+		.fn = fn,
+		.ctx = ctx
+	};
+	ngx_rbtree_cover(&tree->t, lkey, rkey, rbtree_cover_intl, (void *)&c);
+	return;
+}
+
+/**
+ * @fn rbtree_split_intl
+ *
+ * @brief move the nodes with keys not below key into a new tree sharing the pools.
+ * the counts are kept by the order-statistic tree, and left stale otherwise.
+ */
+static
+struct rbtree_s *rbtree_split_intl(
+	struct rbtree_s *tree,
+	rbtree_key_t key)
+{
+	uint64_t iv = rbtree_is_iv(tree);
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_bag(tree)) { return(NULL); }
+
+	struct rbtree_s *right = iv
+		? (struct rbtree_s *)ivtree_init(tree->object_size, &tree->params)
+		: (struct rbtree_s *)rbtree_init(tree->object_size, &tree->params);
+	if(right == NULL) { return(NULL); }
+	rbtree_pool_share(right, tree);
+
+	if(iv) {
+		ngx_ivtree_split((ngx_ivtree_t *)&tree->t, key, (ngx_ivtree_t *)&right->t);
+	} else if(rbtree_is_ostat(tree)) {
+		ngx_ostree_split(&tree->t, key, &right->t);
+	} else {
+		ngx_rbtree_split(&tree->t, key, &right->t,
+			rbtree_is_augmented(tree) ? &tree->aug : NULL);
+	}
+
+	if(rbtree_is_ostat(tree)) {
+#ifndef RBTREE_COMPACT_NODE
+		tree->cnt = tree->t.root->size;
+		right->cnt = right->t.root->size;
+#endif
+	} else {
+		tree->stale = right->stale = 1;
+	}
+	if(!iv) {
+		tree->leftmost = rbtree_extreme(tree, 0);
+		tree->rightmost = rbtree_extreme(tree, 1);
+		right->leftmost = rbtree_extreme(right, 0);
+		right->rightmost = rbtree_extreme(right, 1);
+	}
+	return(right);
+}
+
+/**
+ * @fn rbtree_is_joinable
+ *
+ * @brief 1 if the nodes of b can be linked into a
+ */
+static inline
+uint64_t rbtree_is_joinable(
+	struct rbtree_s *a,
+	struct rbtree_s *b)
+{
+	return(a->layout == RBTREE_LAYOUT_PTR && b->layout == RBTREE_LAYOUT_PTR
+		&& !rbtree_is_bag(a) && a->t.sentinel == b->t.sentinel && a->object_size == b->object_size
+		&& a->params.flags == b->params.flags
+		&& a->aug.update == b->aug.update && a->aug.ctx == b->aug.ctx);
+}
+
+/**
+ * @fn rbtree_join_intl
+ *
+ * @brief move all the nodes of b into a, linking them by the leftmost node of b
+ */
+static
+int rbtree_join_intl(
+	struct rbtree_s *a,
+	struct rbtree_s *b)
+{
+	uint64_t iv = rbtree_is_iv(a);
+	if(!rbtree_is_joinable(a, b)) { return(-1); }
+
+	ngx_rbtree_node_t *amax = (ngx_rbtree_node_t *)rbtree_extreme(a, 1);
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)rbtree_extreme(b, 0);
+	if(node == NULL) { return(0); }
+	if(amax != NULL && amax->key > node->key) { return(-1); }
+
+	/* the leftmost node of b is the middle */
+	RBTREE_NODE_T *leftmost = amax == NULL ? (RBTREE_NODE_T *)node : a->leftmost;
+	RBTREE_NODE_T *rightmost = b->rightmost;
+	if(iv) {
+		ngx_ivtree_delete((ngx_ivtree_t *)&b->t, (ngx_ivtree_node_t *)node);
+		ngx_ivtree_join((ngx_ivtree_t *)&a->t, (ngx_ivtree_node_t *)node, (ngx_ivtree_t *)&b->t);
+	} else if(rbtree_is_ostat(a)) {
+		ngx_ostree_delete(&b->t, node);
+		ngx_ostree_join(&a->t, node, &b->t);
+	} else if(rbtree_is_augmented(a)) {
+		ngx_rbtree_augment_delete(&b->t, node, &b->aug);
+		ngx_rbtree_join(&a->t, node, &b->t, &a->aug);
+	} else {
+		ngx_rbtree_delete(&b->t, node);
+		ngx_rbtree_join(&a->t, node, &b->t, NULL);
+	}
+
+	/* the nodes of b may come from any pool of b */
+	rbtree_pool_share(a, b);
+	a->cnt += b->cnt;
+	a->stale |= b->stale;
+	b->cnt = b->stale = 0;
+	if(!iv) {
+		a->leftmost = leftmost;
+		a->rightmost = rightmost;
+		b->leftmost = b->rightmost = NULL;
+	}
+	return(0);
+}
+
+/**
+ * @fn rbtree_split
+ *
+ * @brief split the tree at key in O(log n). *left is the tree itself holding the keys
+ * below key, and *right a new tree holding the rest, to be cleaned separately. the nodes
+ * stay in place, so the pools are shared until both trees are cleaned, and the two are
+ * not to be modified on different threads at once. returns 0 on success, or -1 for the
+ * layouts other than RBTREE_LAYOUT_PTR.
+ */
+int rbtree_split(
+	rbtree_t *_tree,
+	rbtree_key_t key,
+	rbtree_t **left,
+	rbtree_t **right)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct rbtree_s *r = rbtree_split_intl(tree, key);
+	if(r == NULL) { return(-1); }
+
+	*left = (rbtree_t *)tree;
+	*right = (rbtree_t *)r;
+	return(0);
+}
+
+/**
+ * @fn rbtree_join
+ *
+ * @brief move all the nodes of b into a in O(log n), leaving b empty. no key in a may
+ * be above those in b. returns 0 on success, or -1 if the keys overlap or the trees
+ * differ in the layout, the node size or the augmentation.
+ */
+int rbtree_join(
+	rbtree_t *a,
+	rbtree_t *b)
+{
+	return(rbtree_join_intl((struct rbtree_s *)a, (struct rbtree_s *)b));
+}
+
+/**
+ * @struct rbtree_merge_list_ctx_s
+ * @brief node supplier merging two flattened trees
+ */
+struct rbtree_merge_list_ctx_s {
+	ngx_rbtree_node_t *l, *r;
+};
+
+/**
+ * @fn rbtree_merge_list_next
+ */
+static
+ngx_rbtree_node_t *rbtree_merge_list_next(
+	void *_ctx)
+{
+	struct rbtree_merge_list_ctx_s *ctx = (struct rbtree_merge_list_ctx_s *)_ctx;
+
+	/* nodes of dst come first among equal keys */
+	ngx_rbtree_node_t *node;
+	if(ctx->r == NULL || (ctx->l != NULL && ctx->l->key <= ctx->r->key)) {
+		node = ctx->l;
+		ctx->l = node->right;
+	} else {
+		node = ctx->r;
+		ctx->r = node->right;
+	}
+	return(node);
+}
+
+/**
+ * @fn rbtree_merge_intl
+ *
+ * @brief move all the nodes of src into dst. both are flattened into sorted lists, which
+ * are merged into a balanced tree in one pass, or joined if the keys do not interleave.
+ */
+static
+int rbtree_merge_intl(
+	struct rbtree_s *dst,
+	struct rbtree_s *src)
+{
+	uint64_t iv = rbtree_is_iv(dst);
+	if(!rbtree_is_joinable(dst, src)) { return(-1); }
+
+	ngx_rbtree_node_t *dmax = (ngx_rbtree_node_t *)rbtree_extreme(dst, 1);
+	ngx_rbtree_node_t *smin = (ngx_rbtree_node_t *)rbtree_extreme(src, 0);
+	if(smin == NULL) { return(0); }
+	if(dmax == NULL || dmax->key <= smin->key) { return(rbtree_join_intl(dst, src)); }
+
+	uint64_t cnt = rbtree_count(dst) + rbtree_count(src);
+	struct rbtree_merge_list_ctx_s ctx = {
+		.l = ngx_rbtree_flatten(&dst->t),
+		.r = ngx_rbtree_flatten(&src->t)
+	};
+	if(iv) {
+		ngx_ivtree_build((ngx_ivtree_t *)&dst->t, cnt, rbtree_merge_list_next, (void *)&ctx);
+	} else if(rbtree_is_ostat(dst)) {
+		ngx_ostree_build(&dst->t, cnt, rbtree_merge_list_next, (void *)&ctx);
+	} else if(rbtree_is_augmented(dst)) {
+		ngx_rbtree_augment_build(&dst->t, cnt, rbtree_merge_list_next, (void *)&ctx, &dst->aug);
+	} else {
+		ngx_rbtree_build(&dst->t, cnt, rbtree_merge_list_next, (void *)&ctx);
+	}
+
+	/* the nodes of src may come from any pool of src */
+	rbtree_pool_share(dst, src);
+	dst->cnt = cnt;
+	dst->stale = 0;
+	src->cnt = src->stale = 0;
+	if(!iv) {
+		dst->leftmost = rbtree_extreme(dst, 0);
+		dst->rightmost = rbtree_extreme(dst, 1);
+		src->leftmost = src->rightmost = NULL;
+	}
+	return(0);
+}
+
+/**
+ * @fn rbtree_merge
+ *
+ * @brief move all the nodes of src into dst in O(n + m), leaving src empty. the nodes
+ * are relinked into a balanced tree without copies or allocation. equal keys of dst
+ * come first. returns -1 if the trees are not joinable (see rbtree_join).
+ */
+int rbtree_merge(
+	rbtree_t *dst,
+	rbtree_t *src)
+{
+	return(rbtree_merge_intl((struct rbtree_s *)dst, (struct rbtree_s *)src));
+}
+
+/**
+ * @struct rbtree_remove_range_ctx_s
+ * @brief context of rbtree_remove_range_intl
+ */
+struct rbtree_remove_range_ctx_s {
+	struct rbtree_s *tree;
+	rbtree_walk_t fn;
+	void *ctx;
+	uint64_t cnt;
+};
+
+/**
+ * @fn rbtree_remove_range_intl
+ *
+ * @brief release a node of the detached range, children first
+ */
+static
+void rbtree_remove_range_intl(
+	ngx_rbtree_node_t **node,
+	ngx_rbtree_node_t *sentinel,
+	void *_ctx)
+{
+	struct rbtree_remove_range_ctx_s *ctx = (struct rbtree_remove_range_ctx_s *)_ctx;
+	if(ngx_rbt_is_pooled(*node)) {
+		rbtree_pool_free(ctx->tree, *node);
+	} else if(ctx->fn != NULL) {
+		ctx->fn((RBTREE_NODE_T *)*node, ctx->ctx);
+	}
+	ctx->cnt++;
+	return;
+}
+
+/**
+ * @fn rbtree_remove_range
+ *
+ * @brief remove all the nodes with keys in [lkey, rkey). the range is detached by two
+ * splits and a join, so it costs O(log n + k) without rebalancing for each node. the
+ * pooled nodes are freed, and fn (if not NULL) is called on the others. the layouts
+ * other than RBTREE_LAYOUT_PTR remove the nodes one by one. returns the number removed.
+ */
+uint64_t rbtree_remove_range(
+	rbtree_t *_tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey,
+	rbtree_walk_t fn,
+	void *ctx)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	if(lkey >= rkey) { return(0); }
+
+	struct rbtree_remove_range_ctx_s c = {
+		.tree = tree,
+		.fn = fn,
+		.ctx = ctx,
+		.cnt = 0
+	};
+	uint64_t cnt = tree->cnt, stale = tree->stale;
+	struct rbtree_s *mid = rbtree_split_intl(tree, lkey);
+	if(mid == NULL) {
+		RBTREE_NODE_T *node = rbtree_search_key_right(_tree, lkey);
+		while(node != NULL && *rbtree_key_ptr(tree, node) < rkey) {
+			RBTREE_NODE_T *next = rbtree_right(_tree, node);
+			rbtree_key_t nkey = (next == NULL) ? 0 : *rbtree_key_ptr(tree, next);
+			node = rbtree_unlink(tree, node);
+			if(rbtree_is_pooled(tree, node)) {
+				rbtree_free_node(_tree, node);
+			} else if(fn != NULL) {
+				fn(node, ctx);
+			}
+
+			/* next may have been replaced by a copy in the persistent trees */
+			node = (next != NULL && rbtree_is_persistent(tree)) ? rbtree_search_key(_tree, nkey) : next;
+			c.cnt++;
+		}
+		return(c.cnt);
+	}
+	struct rbtree_s *right = rbtree_split_intl(mid, rkey);
+
+	/* the nodes are freed into the pools of tree, which mid shares */
+	ngx_rbtree_walk(&mid->t, (ngx_rbtree_walk_pt)rbtree_remove_range_intl, (void *)&c);
+	mid->t.root = mid->t.sentinel;
+	rbtree_join_intl(tree, right);
+	rbtree_clean((rbtree_t *)right);
+	rbtree_clean((rbtree_t *)mid);
+
+	/* the split leaves the counts stale, they are known here */
+	tree->cnt = cnt - c.cnt;
+	tree->stale = stale;
+	return(c.cnt);
+}
+
+/**
+ * @enum rbtree_setop_e
+ */
+enum rbtree_setop_e {
+	RBTREE_UNION = 0,
+	RBTREE_INTERSECT,
+	RBTREE_DIFFERENCE
+};
+
+/* subtrees are not handed to another thread below the size */
+#define RBTREE_SETOP_GRAIN			( 1<<12 )
+
+/**
+ * @struct rbtree_setop_s
+ * @brief a task of the set operations, the result is left in a. the nodes dropped are
+ * chained by right to be freed after all the tasks are done.
+ */
+struct rbtree_setop_s {
+	struct rbtree_s *tree;
+	uint64_t op, threads;
+	ngx_rbtree_t a, b;
+	ngx_rbtree_node_t *head, *tail;
+};
+
+/**
+ * @fn rbtree_setop_split
+ *
+ * @brief move the nodes with keys not below key into right
+ */
+static inline
+void rbtree_setop_split(
+	struct rbtree_s *tree,
+	ngx_rbtree_t *t,
+	rbtree_key_t key,
+	ngx_rbtree_t *right)
+{
+	right->sentinel = t->sentinel;
+	right->root = t->sentinel;
+	if(rbtree_is_ostat(tree)) {
+		ngx_ostree_split(t, key, right);
+	} else {
+		ngx_rbtree_split(t, key, right, rbtree_is_augmented(tree) ? &tree->aug : NULL);
+	}
+	return;
+}
+
+/**
+ * @fn rbtree_setop_concat
+ *
+ * @brief link all the nodes of right into left, by the leftmost node of right
+ */
+static inline
+void rbtree_setop_concat(
+	struct rbtree_s *tree,
+	ngx_rbtree_t *left,
+	ngx_rbtree_t *right)
+{
+	ngx_rbtree_node_t *sentinel = right->sentinel;
+	if(right->root == sentinel) { return; }
+	if(left->root == sentinel) {
+		left->root = right->root;
+		right->root = sentinel;
+		return;
+	}
+
+	ngx_rbtree_node_t *node = right->root;
+	while(node->left != sentinel) { node = node->left; }
+	if(rbtree_is_ostat(tree)) {
+		ngx_ostree_delete(right, node);
+		ngx_ostree_join(left, node, right);
+	} else if(rbtree_is_augmented(tree)) {
+		ngx_rbtree_augment_delete(right, node, &tree->aug);
+		ngx_rbtree_join(left, node, right, &tree->aug);
+	} else {
+		ngx_rbtree_delete(right, node);
+		ngx_rbtree_join(left, node, right, NULL);
+	}
+	return;
+}
+
+/**
+ * @fn rbtree_setop_drop_intl
+ */
+static
+void rbtree_setop_drop_intl(
+	ngx_rbtree_node_t **node,
+	ngx_rbtree_node_t *sentinel,
+	void *_ctx)
+{
+	struct rbtree_setop_s *s = (struct rbtree_setop_s *)_ctx;
+	(*node)->right = NULL;
+	if(s->head == NULL) {
+		s->head = *node;
+	} else {
+		s->tail->right = *node;
+	}
+	s->tail = *node;
+	return;
+}
+
+/**
+ * @fn rbtree_setop_drop
+ *
+ * @brief chain all the nodes of t to the list of the task, leaving t empty
+ */
+static inline
+void rbtree_setop_drop(
+	struct rbtree_setop_s *s,
+	ngx_rbtree_t *t)
+{
+	ngx_rbtree_walk(t, rbtree_setop_drop_intl, (void *)s);
+	t->root = t->sentinel;
+	return;
+}
+
+/**
+ * @fn rbtree_setop_intl
+ *
+ * @brief split both trees by the key at the root of a into the keys below, equal to
+ * and above it, recurse on the lower and the upper halves, then join the results
+ * around the equal part. the upper half is handed to another thread while the
+ * thread budget lasts.
+ */
+static
+void *rbtree_setop_intl(
+	void *_s)
+{
+	struct rbtree_setop_s *s = (struct rbtree_setop_s *)_s;
+	ngx_rbtree_node_t *sentinel = s->a.sentinel;
+	if(s->a.root == sentinel || s->b.root == sentinel) {
+		if(s->op == RBTREE_UNION) {
+			rbtree_setop_concat(s->tree, &s->a, &s->b);
+		} else {
+			if(s->op == RBTREE_INTERSECT) { rbtree_setop_drop(s, &s->a); }
+			rbtree_setop_drop(s, &s->b);
+		}
+		return(NULL);
+	}
+
+	/* three-way split, a holds the keys below key */
+	rbtree_key_t key = s->a.root->key;
+	ngx_rbtree_t ae, be;
+	struct rbtree_setop_s r = {
+		.tree = s->tree,
+		.op = s->op,
+		.threads = s->threads - s->threads / 2,
+		.head = NULL,
+		.tail = NULL
+	};
+	rbtree_setop_split(s->tree, &s->a, key, &ae);
+	rbtree_setop_split(s->tree, &s->b, key, &be);
+	r.a.sentinel = r.b.sentinel = r.a.root = r.b.root = sentinel;
+	if(key != RBTREE_KEY_MAX) {
+		rbtree_setop_split(s->tree, &ae, key + 1, &r.a);
+		rbtree_setop_split(s->tree, &be, key + 1, &r.b);
+	}
+
+	/* the lower half here, the upper half on another thread if any left */
+	pthread_t th;
+	uint64_t forked = s->threads > 1
+		&& pthread_create(&th, NULL, rbtree_setop_intl, (void *)&r) == 0;
+	s->threads = forked ? s->threads / 2 : s->threads;
+	rbtree_setop_intl((void *)s);
+	if(forked) {
+		pthread_join(th, NULL);
+	} else {
+		rbtree_setop_intl((void *)&r);
+	}
+
+	/* keep the nodes equal to key from a, or from b for the union without them in a */
+	if(s->op == RBTREE_UNION || (s->op == RBTREE_INTERSECT) == (be.root != sentinel)) {
+		rbtree_setop_drop(s, &be);
+		rbtree_setop_concat(s->tree, &s->a, &ae);
+	} else {
+		rbtree_setop_drop(s, &ae);
+		rbtree_setop_drop(s, &be);
+	}
+	rbtree_setop_concat(s->tree, &s->a, &r.a);
+
+	/* append the nodes dropped by the upper half */
+	if(r.head != NULL) {
+		if(s->head == NULL) {
+			s->head = r.head;
+		} else {
+			s->tail->right = r.head;
+		}
+		s->tail = r.tail;
+	}
+	return(NULL);
+}
+
+/**
+ * @fn rbtree_setop
+ */
+static
+int rbtree_setop(
+	struct rbtree_s *a,
+	struct rbtree_s *b,
+	uint64_t op,
+	uint64_t threads,
+	rbtree_walk_t fn,
+	void *ctx)
+{
+	if(!rbtree_is_joinable(a, b) || rbtree_is_iv(a)) { return(-1); }
+
+	uint64_t cnt = rbtree_count(a) + rbtree_count(b);
+	struct rbtree_setop_s s = {
+		.tree = a,
+		.op = op,
+		.threads = (cnt < RBTREE_SETOP_GRAIN) ? 1 : threads,
+		.a = a->t,
+		.b = b->t,
+		.head = NULL,
+		.tail = NULL
+	};
+	rbtree_setop_intl((void *)&s);
+	a->t.root = s.a.root;
+	b->t.root = b->t.sentinel;
+
+	/* the nodes of b may come from any pool of b */
+	rbtree_pool_share(a, b);
+
+	/* the nodes dropped are released by the caller's thread */
+	ngx_rbtree_node_t *node = s.head;
+	while(node != NULL) {
+		ngx_rbtree_node_t *next = node->right;
+		if(ngx_rbt_is_pooled(node)) {
+			rbtree_pool_free(a, node);
+		} else if(fn != NULL) {
+			fn((RBTREE_NODE_T *)node, ctx);
+		}
+		node = next;
+		cnt--;
+	}
+
+	a->cnt = cnt;
+	b->cnt = b->stale = 0;
+	a->leftmost = rbtree_extreme(a, 0);
+	a->rightmost = rbtree_extreme(a, 1);
+	b->leftmost = b->rightmost = NULL;
+	return(0);
+}
+
+/**
+ * @fn rbtree_union
+ *
+ * @brief merge b into a, leaving b empty. the nodes of b whose keys are found in a are
+ * dropped: freed if malloc'd with rbtree_create_node, or passed to fn (if not NULL)
+ * otherwise. the trees are split and joined recursively, with the halves processed on
+ * up to threads threads. the update function of an augmented tree is then called
+ * concurrently with the same update_ctx, so it must be thread-safe if threads > 1.
+ * returns -1 if the trees are not joinable (see rbtree_join).
+ */
+int rbtree_union(
+	rbtree_t *a,
+	rbtree_t *b,
+	uint64_t threads,
+	rbtree_walk_t fn,
+	void *ctx)
+{
+	return(rbtree_setop((struct rbtree_s *)a, (struct rbtree_s *)b,
+		RBTREE_UNION, threads, fn, ctx));
+}
+
+/**
+ * @fn rbtree_intersect
+ *
+ * @brief keep the nodes of a whose keys are found in b. the others and all the nodes of
+ * b are dropped as rbtree_union.
+ */
+int rbtree_intersect(
+	rbtree_t *a,
+	rbtree_t *b,
+	uint64_t threads,
+	rbtree_walk_t fn,
+	void *ctx)
+{
+	return(rbtree_setop((struct rbtree_s *)a, (struct rbtree_s *)b,
+		RBTREE_INTERSECT, threads, fn, ctx));
+}
+
+/**
+ * @fn rbtree_difference
+ *
+ * @brief keep the nodes of a whose keys are not found in b. the others and all the nodes
+ * of b are dropped as rbtree_union.
+ */
+int rbtree_difference(
+	rbtree_t *a,
+	rbtree_t *b,
+	uint64_t threads,
+	rbtree_walk_t fn,
+	void *ctx)
+{
+	return(rbtree_setop((struct rbtree_s *)a, (struct rbtree_s *)b,
+		RBTREE_DIFFERENCE, threads, fn, ctx));
+}
+
+
+/* interval tree implementation */
+/**
+ * @fn ivtree_clean
+ */
+void ivtree_clean(
+	ivtree_t *tree)
+{
+	rbtree_clean((struct rbtree_s *)tree);
+	return;
+}
+
+/**
+ * @fn ivtree_init
+ */
+ivtree_t *ivtree_init(
+	uint64_t object_size,
+	ivtree_params_t const *params)
+{
+	struct rbtree_s *tree = rbtree_init(object_size, (rbtree_params_t const *)params);
+	if(tree == NULL) { return(NULL); }
+	if(tree->layout == RBTREE_LAYOUT_TOPDOWN || rbtree_is_ostat(tree) || rbtree_is_augmented(tree)
+	|| rbtree_is_bag(tree)) {
+		/* rkey_max needs the parent links, the other augmentations are rbtree only */
+		rbtree_clean((rbtree_t *)tree);
+		return(NULL);
+	}
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		tree->t32.iv = 1;
+		rbtree_flush32(tree);
+		return((ivtree_t *)tree);
+	}
+
+	tree->t.root = tree->t.sentinel = (ngx_rbtree_node_t *)&ivtree_sentinel;
+	return((ivtree_t *)tree);
+}
+
+/**
+ * @fn ivtree_flush
+ */
+void ivtree_flush(
+	ivtree_t *tree)
+{
+	rbtree_flush((rbtree_t *)tree);
+	return;
+}
+
+/**
+ * @fn ivtree_create_node
+ *
+ * @brief create a new node (not inserted in the tree)
+ */
+IVTREE_NODE_T *ivtree_create_node(
+	ivtree_t *tree)
+{
+	return((ivtree_node_t *)rbtree_create_node((rbtree_t *)tree));
+}
+
+/**
+ * @fn ivtree_insert
+ *
+ * @brief insert a node
+ */
+void ivtree_insert(
+	ivtree_t *_tree,
+	IVTREE_NODE_T *_node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct ngx_ivtree_node_s *node = (struct ngx_ivtree_node_s *)_node;
+	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		ngx_rbtree32_insert(&tree->t32, (ngx_rbtree32_node_t *)node);
+	} else {
+		ngx_ivtree_insert((ngx_ivtree_t *)&tree->t, node);
+	}
+	tree->cnt++;
+	return;
+}
+
+/**
+ * @fn ivtree_remove
+ *
+ * @brief remove a node, automatically freed if malloc'd with ivtree_reserve_node
+ */
+void ivtree_remove(
+	ivtree_t *_tree,
+	IVTREE_NODE_T *_node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)_node;
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		rbtree_remove((rbtree_t *)tree, (RBTREE_NODE_T *)node);
+		return;
+	}
+
+	ngx_ivtree_delete(
+		(ngx_ivtree_t *)&tree->t,
+		(ngx_ivtree_node_t *)node);
+	tree->cnt--;
+
+	if(ngx_rbt_is_pooled(node)) {
+		rbtree_pool_free(tree, node);
+	}
+	return;
+}
+
+/**
+ * @fn ivtree_build_next
+ */
+static
+ngx_rbtree_node_t *ivtree_build_next(
+	void *_ctx)
+{
+	struct rbtree_build_ctx_s *ctx = (struct rbtree_build_ctx_s *)_ctx;
+	ngx_ivtree_node_t *node = (ngx_ivtree_node_t *)rbtree_create_node(
+		(rbtree_t *)ctx->tree);
+	node->lkey = *ctx->keys++;
+	node->rkey = *ctx->keys++;
+
+	if(ctx->head == NULL) { ctx->head = (ngx_rbtree_node_t *)node; }
+	return((ngx_rbtree_node_t *)node);
+}
+
+/**
+ * @fn ivtree_build_sorted
+ *
+ * @brief flush the tree and build a balanced tree from (lkey, rkey) pairs sorted by lkey.
+ * keys has 2 * cnt elements. returns the leftmost node.
+ */
+IVTREE_NODE_T *ivtree_build_sorted(
+	ivtree_t *_tree,
+	rbtree_key_t const *keys,
+	uint64_t cnt)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct rbtree_build_ctx_s ctx = {
+		.tree = tree,
+		.keys = keys,
+		.head = NULL
+	};
+
+	ivtree_flush((ivtree_t *)tree);
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		for(uint64_t i = 0; i < cnt; i++) {
+			ngx_rbtree32_node_t *node = rbtree_create_node32(tree);
+			node->key = keys[2 * i];
+			node->rkey = keys[2 * i + 1];
+			ivtree_insert((ivtree_t *)tree, (IVTREE_NODE_T *)node);
+			if(i == 0) { ctx.head = (ngx_rbtree_node_t *)node; }
+		}
+		return((IVTREE_NODE_T *)ctx.head);
+	}
+
+	ngx_ivtree_build((ngx_ivtree_t *)&tree->t, cnt, ivtree_build_next, (void *)&ctx);
+	tree->cnt = cnt;
+	return((IVTREE_NODE_T *)ctx.head);
+}
+
+/**
+ * @fn ivtree_insert_batch
+ *
+ * @brief insert nodes at once. the array is sorted by lkey on return.
+ */
+void ivtree_insert_batch(
+	ivtree_t *_tree,
+	IVTREE_NODE_T **_nodes,
+	uint64_t cnt)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	ngx_rbtree_node_t **nodes = (ngx_rbtree_node_t **)_nodes;
+	if(cnt == 0) { return; }
+
+	/* lkey sits at the same offset as key */
+	rbtree_sort_nodes(tree, nodes, cnt);
+
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		for(uint64_t i = 0; i < cnt; i++) {
+			ngx_rbtree32_insert(&tree->t32, (ngx_rbtree32_node_t *)nodes[i]);
+		}
+	} else if(rbtree_batch_rebuild(rbtree_count(tree), cnt)) {
+		struct rbtree_merge_ctx_s ctx = {
+			.list = ngx_rbtree_flatten(&tree->t),
+			.nodes = nodes,
+			.lim = nodes + cnt
+		};
+		ngx_ivtree_build((ngx_ivtree_t *)&tree->t, tree->cnt + cnt, rbtree_merge_next, (void *)&ctx);
+	} else {
+		for(uint64_t i = 0; i < cnt; i++) {
+			ngx_ivtree_insert((ngx_ivtree_t *)&tree->t, (ngx_ivtree_node_t *)nodes[i]);
+		}
+	}
+	tree->cnt += cnt;
+	return;
+}
+
+/**
+ * @fn ivtree_next_node
+ */
+static inline
+ngx_ivtree_node_t *ivtree_next_node(
+	ngx_rbtree_t *t,
+	ngx_ivtree_node_t *node,
+	rbtree_key_t llim,
+	rbtree_key_t rlim,
+	rbtree_key_t tlim)
+{
+	debug("ivtree_next_node, llim(%lld), rlim(%lld), tlim(%lld)", llim, rlim, tlim);
+
+	while(node != NULL) {
+        debug("check node(%p, %lld, %lld, %lld)",
+            node, node->lkey, node->rkey, node->rkey_max);
+
+		if(node->lkey >= tlim) { node = NULL; break; }
+		if((rbtree_ukey_t)node->rkey - (rbtree_ukey_t)llim < (rbtree_ukey_t)rlim - (rbtree_ukey_t)llim) { break; }
+
+		/* not found, get next */
+		node = (ngx_ivtree_node_t *)ngx_rbtree_find_right(
+			t, (ngx_rbtree_node_t *)node);
+	}
+	return(node);
+}
+
+/**
+ * @fn ivtree_next_node32
+ */
+static inline
+ngx_rbtree32_node_t *ivtree_next_node32(
+	ngx_rbtree32_t *t32,
+	ngx_rbtree32_node_t *node,
+	rbtree_key_t llim,
+	rbtree_key_t rlim,
+	rbtree_key_t tlim)
+{
+	while(node != NULL) {
+		if(node->key >= tlim) { node = NULL; break; }
+		if((rbtree_ukey_t)node->rkey - (rbtree_ukey_t)llim < (rbtree_ukey_t)rlim - (rbtree_ukey_t)llim) { break; }
+		node = ngx_rbtree32_find_right(t32, node);
+	}
+	return(node);
+}
+
+/**
+ * @fn ivtree_start_node32
+ * @brief descend to the left while the left subtree has rkey_max > key
+ */
+static inline
+ngx_rbtree32_node_t *ivtree_start_node32(
+	ngx_rbtree32_t *t32,
+	rbtree_key_t key)
+{
+	if(t32->root == 0) { return(NULL); }
+
+	ngx_rbtree32_node_t *node = ngx_rbt32_node(t32, t32->root);
+	while(node->left != 0 && ngx_rbt32_node(t32, node->left)->rkey_max > key) {
+		node = ngx_rbt32_node(t32, node->left);
+	}
+	return(node);
+}
+
+/**
+ * @fn ivtree_iter_init32
+ */
+static inline
+struct ivtree_iter_s *ivtree_iter_init32(
+	struct rbtree_s *tree,
+	struct ivtree_iter_s *iter,
+	rbtree_key_t llim,
+	rbtree_key_t rlim,
+	rbtree_key_t tlim,
+	ngx_rbtree32_node_t *node)
+{
+	*iter = (struct ivtree_iter_s){
+		.lmm = tree->lmm_iter,
+		.llim = llim,
+		.rlim = rlim,
+		.tlim = tlim,
+		.t32 = &tree->t32,
+		.node32 = node
+	};
+	return(iter);
+}
+
+/**
+ * @fn ivtree_contained
+ * @brief return a set of sections contained in [lkey, rkey)
+ */
+ivtree_iter_t *ivtree_contained(
+	ivtree_t *_tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
+		tree->lmm_iter, sizeof(struct ivtree_iter_s));
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return(ivtree_iter_init32(tree, iter, RBTREE_KEY_MIN, rkey, rkey,
+			ngx_rbtree32_find_key_right(&tree->t32, lkey)));
+	}
+
+	*iter = (struct ivtree_iter_s){
+		.t = &tree->t,
+		.lmm = tree->lmm_iter,
+		.llim = RBTREE_KEY_MIN,
+		.rlim = rkey,
+		.tlim = rkey,
+		.node = (ngx_ivtree_node_t *)ngx_rbtree_find_key_right(&tree->t, lkey)
+	};
+	return(iter);
+}
+
+/**
+ * @fn ivtree_containing
+ * @brief return a set of sections containing [lkey, rkey)
+ */
+ivtree_iter_t *ivtree_containing(
+	ivtree_t *_tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
+		tree->lmm_iter, sizeof(struct ivtree_iter_s));
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return(ivtree_iter_init32(tree, iter, rkey, RBTREE_KEY_MAX, lkey + 1,
+			ivtree_start_node32(&tree->t32, rkey - 1)));
+	}
+
+	ngx_ivtree_node_t *node = (ngx_ivtree_node_t *)tree->t.root;
+	ngx_ivtree_node_t *sentinel = (ngx_ivtree_node_t *)tree->t.sentinel;
+	while(node != sentinel && node->left->rkey_max >= rkey) {
+		node = node->left;
+	}
+	*iter = (struct ivtree_iter_s){
+		.t = &tree->t,
+		.lmm = tree->lmm_iter,
+		.llim = rkey,
+		.rlim = RBTREE_KEY_MAX,
+		.tlim = lkey + 1,
+		.node = node
+	};
+	return(iter);
+}
+
+/**
+ * @fn ivtree_intersect
+ * @brief return a set of sections intersect with [lkey, rkey)
+ */
+ivtree_iter_t *ivtree_intersect(
+	ivtree_t *_tree,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)lmm_malloc(
+		tree->lmm_iter, sizeof(struct ivtree_iter_s));
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return(ivtree_iter_init32(tree, iter, lkey + 1, RBTREE_KEY_MAX, rkey,
+			ivtree_start_node32(&tree->t32, lkey)));
+	}
+
+	ngx_ivtree_node_t *node = (ngx_ivtree_node_t *)tree->t.root;
+	ngx_ivtree_node_t *sentinel = (ngx_ivtree_node_t *)tree->t.sentinel;
+	while(node != sentinel && node->left->rkey_max > lkey) {
+		node = node->left;
+	}
+	*iter = (struct ivtree_iter_s){
+		.t = &tree->t,
+		.lmm = tree->lmm_iter,
+		.llim = lkey + 1,
+		.rlim = RBTREE_KEY_MAX,
+		.tlim = rkey,
+		.node = node,
+		.start = node == sentinel ? NULL : node
+	};
+	return(iter);
+}
+
+/**
+ * @fn ivtree_intersect_sorted
+ * @brief re-target an intersect iterator to [lkey, rkey). the start node is searched
+ * from that of the previous query, so lkey should be ascending over the calls.
+ * iter may be NULL (a new one is created) or one returned by ivtree_intersect(_sorted),
+ * and the tree must not be modified in between.
+ */
+ivtree_iter_t *ivtree_intersect_sorted(
+	ivtree_t *_tree,
+	ivtree_iter_t *_iter,
+	rbtree_key_t lkey,
+	rbtree_key_t rkey)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)_iter;
+
+	ngx_ivtree_node_t *finger = NULL;
+	if(iter == NULL) {
+		iter = (struct ivtree_iter_s *)lmm_malloc(
+			tree->lmm_iter, sizeof(struct ivtree_iter_s));
+	} else if(iter->start != NULL && lkey >= iter->llim - 1) {
+		finger = iter->start;
+	}
+
+	/* no finger search on index-linked trees */
+	if(tree->layout == RBTREE_LAYOUT_IDX32) {
+		return(ivtree_iter_init32(tree, iter, lkey + 1, RBTREE_KEY_MAX, rkey,
+			ivtree_start_node32(&tree->t32, lkey)));
+	}
+
+	ngx_ivtree_node_t *node = ngx_ivtree_find_rkey_from(
+		(ngx_ivtree_t *)&tree->t, finger, lkey);
+	*iter = (struct ivtree_iter_s){
+		.t = &tree->t,
+		.lmm = tree->lmm_iter,
+		.llim = lkey + 1,
+		.rlim = RBTREE_KEY_MAX,
+		.tlim = rkey,
+		.node = node,
+		.start = node
+	};
+	return((ivtree_iter_t *)iter);
+}
+
+/**
+ * @fn ivtree_next
+ */
+IVTREE_NODE_T *ivtree_next(
+	ivtree_iter_t *_iter)
+{
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)_iter;
+	if(iter->t32 != NULL) {
+		ngx_rbtree32_node_t *node = ivtree_next_node32(iter->t32,
+			iter->node32, iter->llim, iter->rlim, iter->tlim);
+		if(node == NULL) { return(NULL); }
+
+		iter->node32 = ngx_rbtree32_find_right(iter->t32, node);
+		return((IVTREE_NODE_T *)node);
+	}
+
+	ngx_ivtree_node_t *node = ivtree_next_node(iter->t,
+		iter->node, iter->llim, iter->rlim, iter->tlim);
+	if(node == NULL) { return(NULL); }
+
+	iter->node = (ngx_ivtree_node_t *)ngx_rbtree_find_right(
+		iter->t, (ngx_rbtree_node_t *)node);
+	return((IVTREE_NODE_T *)node);
+}
+
+/**
+ * @fn ivtree_iter_clean
+ */
+void ivtree_iter_clean(
+	ivtree_iter_t *_iter)
+{
+	struct ivtree_iter_s *iter = (struct ivtree_iter_s *)_iter;
+	if(iter == NULL) { return; }
+	lmm_t *lmm_iter = iter->lmm;
+	lmm_free(lmm_iter, iter);
+	return;
+}
+
+/**
+ * @fn ivtree_walk
+ *
+ * @brief walk over the tree
+ */
+void ivtree_walk(
+	ivtree_t *_tree,
+	ivtree_walk_t _fn,
+	void *_ctx)
+{
+	rbtree_walk((rbtree_t *)_tree, (rbtree_walk_t)_fn, _ctx);
+	return;
+}
+
+/**
+ * @fn ivtree_split
+ *
+ * @brief split the tree at key (compared with lkey) in O(log n), keeping rkey_max.
+ * see rbtree_split.
+ */
+int ivtree_split(
+	ivtree_t *_tree,
+	rbtree_key_t key,
+	ivtree_t **left,
+	ivtree_t **right)
+{
+	return(rbtree_split((rbtree_t *)_tree, key, (rbtree_t **)left, (rbtree_t **)right));
+}
+
+/**
+ * @fn ivtree_join
+ *
+ * @brief move all the nodes of b into a in O(log n), keeping rkey_max. no lkey in a
+ * may be above those in b. see rbtree_join.
+ */
+int ivtree_join(
+	ivtree_t *a,
+	ivtree_t *b)
+{
+	return(rbtree_join((rbtree_t *)a, (rbtree_t *)b));
+}
+
+/**
+ * @fn ivtree_merge
+ *
+ * @brief move all the nodes of src into dst in O(n + m), rebuilding rkey_max bottom-up.
+ * see rbtree_merge.
+ */
+int ivtree_merge(
+	ivtree_t *dst,
+	ivtree_t *src)
+{
+	return(rbtree_merge_intl((struct rbtree_s *)dst, (struct rbtree_s *)src));
+}
+
+
+/* byte-string tree implementation */
+/**
+ * @fn strtree_prefix
+ *
+ * @brief the first bytes (zero-padded) of the string as a big-endian key, with the sign bit
+ * flipped so that the signed order of the key is the byte order of the strings
+ */
+static inline
+rbtree_key_t strtree_prefix(
+	uint8_t const *str,
+	uint64_t len)
+{
+	uint8_t buf[RBTREE_KEY_DIGITS] = { 0 };
+	memcpy(buf, str, len < RBTREE_KEY_DIGITS ? len : RBTREE_KEY_DIGITS);
+
+	rbtree_ukey_t x = 0;
+	for(uint64_t i = 0; i < RBTREE_KEY_DIGITS; i++) {
+		x = (x<<8) | buf[i];
+	}
+	return((rbtree_key_t)(x ^ RBTREE_KEY_SIGN));
+}
+
+/**
+ * @fn strtree_cmp
+ *
+ * @brief compare (key, str, len) to node, the string is read only when the prefixes tie.
+ * the first min(RBTREE_KEY_DIGITS, len, node->len) bytes are then equal.
+ */
+static inline
+int64_t strtree_cmp(
+	rbtree_key_t key,
+	uint8_t const *str,
+	uint64_t len,
+	struct strtree_node_s const *node)
+{
+	if(key != node->prefix) { return(key < node->prefix ? -1 : 1); }
+
+	uint64_t min = len < node->len ? len : node->len;
+	if(min > RBTREE_KEY_DIGITS) {
+		int c = memcmp(str + RBTREE_KEY_DIGITS, node->str + RBTREE_KEY_DIGITS, min - RBTREE_KEY_DIGITS);
+		if(c != 0) { return(c); }
+	}
+	return((len > node->len) - (len < node->len));
+}
+
+/**
+ * @fn strtree_init
+ */
+strtree_t *strtree_init(
+	uint64_t object_size,
+	strtree_params_t const *params)
+{
+	struct rbtree_s *tree = rbtree_init(object_size, (rbtree_params_t const *)params);
+	if(tree == NULL) { return(NULL); }
+	if(tree->layout != RBTREE_LAYOUT_PTR || rbtree_is_ostat(tree) || rbtree_is_augmented(tree)
+	|| rbtree_is_bag(tree)) {
+		/* the descent is done here and linked by ngx_rbtree_insert_at */
+		rbtree_clean((rbtree_t *)tree);
+		return(NULL);
+	}
+	return((strtree_t *)tree);
+}
+
+/**
+ * @fn strtree_clean
+ */
+void strtree_clean(
+	strtree_t *tree)
+{
+	rbtree_clean((rbtree_t *)tree);
+	return;
+}
+
+/**
+ * @fn strtree_flush
+ */
+void strtree_flush(
+	strtree_t *tree)
+{
+	rbtree_flush((rbtree_t *)tree);
+	return;
+}
+
+/**
+ * @fn strtree_create_node
+ *
+ * @brief create a new node (not inserted in the tree)
+ */
+STRTREE_NODE_T *strtree_create_node(
+	strtree_t *tree)
+{
+	return((STRTREE_NODE_T *)rbtree_create_node((rbtree_t *)tree));
+}
+
+/**
+ * @fn strtree_insert
+ *
+ * @brief insert a node by str and len, which must not be modified while it is in the tree.
+ * equal strings go right.
+ */
+void strtree_insert(
+	strtree_t *_tree,
+	STRTREE_NODE_T *_node)
+{
+	struct rbtree_s *tree = (struct rbtree_s *)_tree;
+	struct strtree_node_s *node = (struct strtree_node_s *)_node;
+	node->prefix = strtree_prefix(node->str, node->len);
+
+	ngx_rbtree_node_t *parent = NULL, *temp = tree->t.root;
+	uint64_t dir = 0;
+	while(temp != tree->t.sentinel) {
+		parent = temp;
+		dir = strtree_cmp(node->prefix, node->str, node->len, (struct strtree_node_s *)temp) >= 0;
+		temp = dir ? temp->right : temp->left;
+	}
+	ngx_rbtree_insert_at(&tree->t, parent, dir, (ngx_rbtree_node_t *)node);
+	tree->cnt++;
+
+	/* extremes by the string order */
+	if(tree->leftmost == NULL) {
+		tree->leftmost = tree->rightmost = _node;
+		return;
+	}
+	if(strtree_cmp(node->prefix, node->str, node->len, tree->leftmost) < 0) {
+		tree->leftmost = _node;
+	}
+	if(strtree_cmp(node->prefix, node->str, node->len, tree->rightmost) >= 0) {
+		tree->rightmost = _node;
+	}
+	return;
+}
+
+/**
+ * @fn strtree_remove
+ *
+ * @brief remove a node, automatically freed if malloc'd with strtree_create_node
+ */
+void strtree_remove(
+	strtree_t *tree,
+	STRTREE_NODE_T *node)
+{
+	rbtree_remove((rbtree_t *)tree, (RBTREE_NODE_T *)node);
+	return;
+}
+
+/**
+ * @fn strtree_bound
+ *
+ * @brief the leftmost node not below (str, len)
+ */
+static inline
+struct strtree_node_s *strtree_bound(
+	struct rbtree_s *tree,
+	uint8_t const *str,
+	uint64_t len)
+{
+	rbtree_key_t key = strtree_prefix(str, len);
+	ngx_rbtree_node_t *node = tree->t.root, *found = NULL;
+	while(node != tree->t.sentinel) {
+		if(strtree_cmp(key, str, len, (struct strtree_node_s *)node) <= 0) {
+			found = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return((struct strtree_node_s *)found);
+}
+
+/**
+ * @fn strtree_search_key
+ *
+ * @brief search a node by string, returning the leftmost node
+ */
+STRTREE_NODE_T *strtree_search_key(
+	strtree_t *tree,
+	void const *str,
+	uint64_t len)
+{
+	struct strtree_node_s *node = strtree_bound((struct rbtree_s *)tree, (uint8_t const *)str, len);
+	if(node == NULL || node->len != len || memcmp(node->str, str, len) != 0) {
+		return(NULL);
+	}
+	return((STRTREE_NODE_T *)node);
+}
+
+/**
+ * @fn strtree_search_key_right
+ *
+ * @brief the leftmost node not below the string, NULL if none
+ */
+STRTREE_NODE_T *strtree_search_key_right(
+	strtree_t *tree,
+	void const *str,
+	uint64_t len)
+{
+	return((STRTREE_NODE_T *)strtree_bound((struct rbtree_s *)tree, (uint8_t const *)str, len));
+}
+
+/**
+ * @fn strtree_has_prefix
+ */
+static inline
+uint64_t strtree_has_prefix(
+	struct strtree_node_s const *node,
+	uint8_t const *prefix,
+	uint64_t len)
+{
+	return(node != NULL && node->len >= len && memcmp(node->str, prefix, len) == 0);
+}
+
+/**
+ * @fn strtree_search_prefix
+ *
+ * @brief the leftmost node starting with prefix, NULL if none. the others follow in order,
+ * see strtree_next_prefix.
+ */
+STRTREE_NODE_T *strtree_search_prefix(
+	strtree_t *tree,
+	void const *prefix,
+	uint64_t len)
+{
+	struct strtree_node_s *node = strtree_bound((struct rbtree_s *)tree, (uint8_t const *)prefix, len);
+	return(strtree_has_prefix(node, (uint8_t const *)prefix, len) ? (STRTREE_NODE_T *)node : NULL);
+}
+
+/**
+ * @fn strtree_next_prefix
+ *
+ * @brief the node next to node if it still starts with prefix, NULL otherwise
+ */
+STRTREE_NODE_T *strtree_next_prefix(
+	strtree_t *tree,
+	STRTREE_NODE_T const *node,
+	void const *prefix,
+	uint64_t len)
+{
+	struct strtree_node_s *next = (struct strtree_node_s *)ngx_rbtree_find_right(
+		&((struct rbtree_s *)tree)->t, (ngx_rbtree_node_t *)node);
+	return(strtree_has_prefix(next, (uint8_t const *)prefix, len) ? (STRTREE_NODE_T *)next : NULL);
+}
+
+
+/* unittests */
+unittest_config(
+	.name = "tree"
+);
+
+/**
+ * @struct ut_rbnode_s
+ */
+struct ut_rbnode_s {
+	rbtree_node_t h;
+	int64_t val;
+};
+
+/* create tree object */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	assert(tree != NULL);
+
+	rbtree_clean(tree);
+}
+
+/* create node */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+		rbtree_create_node(tree);
+	assert(n != NULL);
+
+	n->h.key = 0xcafebabe;
+	n->val = 0x12345678;
+
+	/* insert and search */
+	rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	struct ut_rbnode_s *found = (struct ut_rbnode_s *)
+		 rbtree_search_key(tree, 0xcafebabe);
+	assert(found == n, "found(%p), n(%p)", found, n);
+	assert(n->h.key == 0xcafebabe, "n->h.key(%lld)", n->h.key);
+	assert(n->val == 0x12345678, "n->val(%lld)", n->val);
+
+	/* remove */
+	rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	found = (struct ut_rbnode_s *)rbtree_search_key(tree, 0xcafebabe);
+	assert(found == NULL, "found(%p), n(%p)", found, n);
+
+	rbtree_clean(tree);
+}
+
+/* create multiple nodes */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+
+	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+
+	/* insert */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_create_node(tree);
+		assert(n != NULL);
+
+		n->h.key = _shuf(i)<<1;
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (1) */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == i<<1, "n->h.key(%lld), key(%lld)", n->h.key, i<<1);
+		assert(n->val == _shuf(i), "n->val(%lld), val(%lld)", n->val, _shuf(i));
+	}
+
+	/* remove */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (2) */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n == NULL);
+	}
+	for(int64_t i = 128; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	}
+
+	/* add again */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_create_node(tree);
+		assert(n != NULL);
+
+		n->h.key = _shuf(i)<<1;
+		n->val = 1024 - i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (3) */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == 1024 - i, "n->val(%lld), val(%lld)", n->val, 1024 - i);
+	}
+	for(int64_t i = 128; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	}
+
+	rbtree_clean(tree);
+}
+
+unittest()
+{
+	int64_t const cnt = 32 * 1024 * 1024;
+	srand(time(NULL));
+
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	/* insert */
+	for(int64_t i = 0; i < cnt; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_create_node(tree);
+		assert(n != NULL);
+
+		n->h.key = rand();
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* remove */
+	for(int64_t i = 0; i < cnt; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i);
+		if(n != NULL) {
+			rbtree_remove(tree, (RBTREE_NODE_T *)n);
+		}
+	}
+	rbtree_clean(tree);
+}
+
+/* create multiple nodes with malloc */
+void unittest_free_node(RBTREE_NODE_T *node, void *ctx)
+{
+	free(node);
+	return;
+}
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+
+	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+
+	/* insert */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			(RBTREE_NODE_T *)malloc(sizeof(struct ut_rbnode_s));
+		assert(n != NULL);
+
+		memset(n, 0, sizeof(rbtree_node_t));
+		n->h.key = _shuf(i)<<1;
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (1) */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == i<<1, "n->h.key(%lld), key(%lld)", n->h.key, i<<1);
+		assert(n->val == _shuf(i), "n->val(%lld), val(%lld)", n->val, _shuf(i));
+	}
+
+	/* remove */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+		free(n);
+	}
+
+	/* search (2) */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n == NULL);
+	}
+	for(int64_t i = 128; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	}
+
+	/* add again */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			(RBTREE_NODE_T *)malloc(sizeof(struct ut_rbnode_s));
+		assert(n != NULL);
+
+		memset(n, 0, sizeof(rbtree_node_t));
+		n->h.key = _shuf(i)<<1;
+		n->val = 1024 - i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (3) */
+	for(int64_t i = 0; i < 128; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == 1024 - i, "n->val(%lld), val(%lld)", n->val, 1024 - i);
+	}
+	for(int64_t i = 128; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+
+		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
+		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	}
+
+	/* cleanup */
+	rbtree_walk(tree, unittest_free_node, NULL);
+	rbtree_clean(tree);
+}
+
+/* flush, duplicated key */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+
+	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+
+	/* insert */
+	for(int64_t i = 0; i < 65536; i++) {
+		debug("insert node i(%lld)", i);
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_create_node(tree);
+		assert(n != NULL);
+
+		n->h.key = _shuf(i)<<1;
+		n->val = 65536 - i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* flush and insert again */
+	rbtree_flush(tree);
+	for(int64_t i = 0; i < 65536; i++) {
+		debug("insert node again i(%lld)", i);
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_create_node(tree);
+		assert(n != NULL);
+
+		n->h.key = _shuf(i)<<1;
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (1) */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i<<1);
+		assert(n != NULL);
+	}
+	for(int64_t i = 256; i < 65536; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i<<1);
+		assert(n == NULL);
+	}
+
+	/* remove */
+	for(int64_t i = 0; i < 65536; i++) {
+		debug("remove node i(%lld)", i);
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, _shuf(i)<<1);
+		assert(n != NULL);
+		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search (2) */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_search_key(tree, i<<1);
+		assert(n == NULL);
+	}
+	rbtree_clean(tree);
+}
+
+/* search_key_left / search_key_right / left / right (NULL) */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+
+	/* search left */
+	struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+		rbtree_search_key_left(tree, 0);
+	assert(n == NULL);
+
+	n = (struct ut_rbnode_s *)rbtree_search_key_left(tree, 100);
+	assert(n == NULL);
+
+	/* search right */
+	n = (struct ut_rbnode_s *)rbtree_search_key_right(tree, 0);
+	assert(n == NULL);
+
+	n = (struct ut_rbnode_s *)rbtree_search_key_right(tree, 200);
+	assert(n == NULL);
+
+	/* left / right of sentinel */
+	n = (struct ut_rbnode_s *)rbtree_left(tree, (RBTREE_NODE_T *)tree->t.sentinel);
+	assert(n == NULL);
+
+	n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)tree->t.sentinel);
+	assert(n == NULL);
+
+	rbtree_clean(tree);
+}
+
+/* search_key_left / search_key_right / left / right (NULL) */
+unittest()
+{
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+
+	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+
+	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+
+	/* insert */
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
 			rbtree_create_node(tree);
 		assert(n != NULL);
 
-		n->h.key = _shuf(i)<<1;
-		n->val = i;
+		n->h.key = _shuf(i)<<1;
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+
+	/* search left */
+	rbtree_node_t *n1 = rbtree_search_key_left(tree, 64);
+	rbtree_node_t *n2 = rbtree_search_key_left(tree, 65);
+	assert(n1 == n2, "n1(%p), n2(%p)", n1, n2);
+	assert(n1->key == 64, "key(%lld)", n1->key);
+	assert(n2->key == 64, "key(%lld)", n2->key);
+
+	/* left and right */
+	n1 = rbtree_left(tree, n1);
+	assert(n1->key == 62, "key(%lld)", n1->key);
+	n2 = rbtree_right(tree, n2);
+	assert(n2->key == 66, "key(%lld)", n2->key);
+
+
+	/* search right */
+	n1 = rbtree_search_key_right(tree, 31);
+	n2 = rbtree_search_key_right(tree, 32);
+	assert(n1 == n2, "n1(%p), n2(%p)", n1, n2);
+	assert(n1->key == 32, "key(%lld)", n1->key);
+	assert(n2->key == 32, "key(%lld)", n2->key);
+
+	/* left and right */
+	n1 = rbtree_left(tree, n1);
+	assert(n1->key == 30, "key(%lld)", n1->key);
+	n2 = rbtree_right(tree, n2);
+	assert(n2->key == 34, "key(%lld)", n2->key);
+
+	rbtree_clean(tree);
+}
+
+/**
+ * @fn ut_rbtree_check
+ * @brief check the red-black properties and the parent links, returns the black height or -1
+ */
+static
+int64_t ut_rbtree_check_intl(
+	ngx_rbtree_node_t *node,
+	ngx_rbtree_node_t *sentinel,
+	ngx_rbtree_node_t *parent)
+{
+	if(node == sentinel) { return(0); }
+	if(ngx_rbt_parent(node) != parent) { return(-1); }
+	if(ngx_rbt_is_red(node)
+	&& (ngx_rbt_is_red(node->left) || ngx_rbt_is_red(node->right))) {
+		return(-1);
+	}
+	if(node->left != sentinel && node->left->key > node->key) { return(-1); }
+	if(node->right != sentinel && node->right->key < node->key) { return(-1); }
+
+	int64_t lh = ut_rbtree_check_intl(node->left, sentinel, node);
+	int64_t rh = ut_rbtree_check_intl(node->right, sentinel, node);
+	if(lh < 0 || lh != rh) { return(-1); }
+	return(lh + ngx_rbt_is_black(node));
+}
+static
+int64_t ut_rbtree_check(
+	rbtree_t *tree)
+{
+	if(ngx_rbt_is_red(tree->t.root)) { return(-1); }
+	return(ut_rbtree_check_intl(tree->t.root, tree->t.sentinel, NULL));
+}
+
+/**
+ * @fn ut_rbtree32_check
+ * @brief ut_rbtree_check for RBTREE_LAYOUT_IDX32, also checks rkey_max of interval trees
+ */
+static
+int64_t ut_rbtree32_check_intl(
+	ngx_rbtree32_t *t32,
+	uint32_t i,
+	uint32_t parent)
+{
+	if(i == 0) { return(0); }
+
+	ngx_rbtree32_node_t *node = ngx_rbt32_node(t32, i);
+	ngx_rbtree32_node_t *left = ngx_rbt32_node(t32, node->left);
+	ngx_rbtree32_node_t *right = ngx_rbt32_node(t32, node->right);
+	if(ngx_rbt32_index(node) != i || node->parent != parent) { return(-1); }
+	if(ngx_rbt32_is_red(node) && (ngx_rbt32_is_red(left) || ngx_rbt32_is_red(right))) {
+		return(-1);
+	}
+	if(node->left != 0 && left->key > node->key) { return(-1); }
+	if(node->right != 0 && right->key < node->key) { return(-1); }
+	if(t32->iv) {
+		int64_t rkey_max = node->rkey;
+		if(left->rkey_max > rkey_max) { rkey_max = left->rkey_max; }
+		if(right->rkey_max > rkey_max) { rkey_max = right->rkey_max; }
+		if(node->rkey_max != rkey_max) { return(-1); }
+	}
+
+	int64_t lh = ut_rbtree32_check_intl(t32, node->left, i);
+	int64_t rh = ut_rbtree32_check_intl(t32, node->right, i);
+	if(lh < 0 || lh != rh) { return(-1); }
+	return(lh + ngx_rbt32_is_black(node));
+}
+static
+int64_t ut_rbtree32_check(
+	rbtree_t *tree)
+{
+	if(ngx_rbt32_is_red(ngx_rbt32_node(&tree->t32, 0))) { return(-1); }
+	return(ut_rbtree32_check_intl(&tree->t32, tree->t32.root, 0));
+}
+
+/**
+ * @fn ut_ptr_cmp
+ */
+static
+int ut_ptr_cmp(
+	void const *a,
+	void const *b)
+{
+	uintptr_t x = *(uintptr_t const *)a, y = *(uintptr_t const *)b;
+	return((x > y) - (x < y));
+}
+
+/**
+ * @fn ut_cmp_key
+ */
+static
+int ut_cmp_key(
+	void const *a,
+	void const *b)
+{
+	rbtree_key_t x = *(rbtree_key_t const *)a, y = *(rbtree_key_t const *)b;
+	return((x > y) - (x < y));
+}
+
+/* build from sorted keys */
+unittest()
+{
+	int64_t const max_cnt = 1100;
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * max_cnt);
+	for(int64_t i = 0; i < max_cnt; i++) {
+		keys[i] = 3 * (i / 2);		/* contains duplicated keys */
+	}
+
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	for(int64_t cnt = 0; cnt < max_cnt; cnt += (cnt < 70) ? 1 : 97) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
+			rbtree_build_sorted(tree, keys, cnt);
+		assert(ut_rbtree_check(tree) >= 0, "cnt(%lld)", cnt);
+		assert(cnt != 0 || n == NULL);
+
+		/* in-order traversal */
+		for(int64_t i = 0; i < cnt; i++) {
+			assert(n != NULL, "cnt(%lld), i(%lld)", cnt, i);
+			assert(n->h.key == keys[i], "key(%lld), keys[i](%lld)", n->h.key, keys[i]);
+			n->val = i;
+			n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+		}
+		assert(n == NULL);
+
+		/* search */
+		for(int64_t i = 0; i < cnt; i += 2) {
+			n = (struct ut_rbnode_s *)rbtree_search_key(tree, keys[i]);
+			assert(n != NULL && n->h.key == keys[i], "cnt(%lld), i(%lld)", cnt, i);
+		}
+	}
+
+	/* insert and remove on the built tree */
+	rbtree_build_sorted(tree, keys, 1000);
+	for(int64_t i = 0; i < 256; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)rbtree_create_node(tree);
+		n->h.key = _shuf(i) * 7;
+		n->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(ut_rbtree_check(tree) >= 0);
+	for(int64_t i = 0; i < 1000; i += 3) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)rbtree_search_key(tree, keys[i]);
+		assert(n != NULL);
+		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(ut_rbtree_check(tree) >= 0);
+
+	rbtree_clean(tree);
+	free(keys);
+}
+
+/* batch insert */
+unittest()
+{
+	int64_t const cnt = 20000;
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	struct ut_rbnode_s **nodes = (struct ut_rbnode_s **)malloc(sizeof(void *) * cnt);
+
+	/* into the empty tree (rebuild), then small batches (sorted insertion) */
+	uint64_t const batch[5] = { 10000, 5000, 100, 17, 4883 };
+	int64_t base = 0;
+	for(int64_t b = 0; b < 5; b++) {
+		for(int64_t i = 0; i < batch[b]; i++) {
+			nodes[i] = (struct ut_rbnode_s *)rbtree_create_node(tree);
+			nodes[i]->h.key = (int64_t)((uint64_t)(base + i) * 0x9e3779b97f4a7c15) >> 20;
+			nodes[i]->val = base + i;
+		}
+		rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, batch[b]);
+		for(int64_t i = 1; i < batch[b]; i++) {
+			assert(nodes[i - 1]->h.key <= nodes[i]->h.key);
+		}
+		base += batch[b];
+		assert(ut_rbtree_check(tree) >= 0, "b(%lld)", b);
+		assert(tree->cnt == base, "cnt(%llu), base(%lld)", tree->cnt, base);
+	}
+
+	/* rebuilt while n / m is below log2 n */
+	assert(rbtree_batch_rebuild(0, 10000) && rbtree_batch_rebuild(10000, 5000) && rbtree_batch_rebuild(15117, 4883));
+	assert(!rbtree_batch_rebuild(15000, 100) && !rbtree_batch_rebuild(15100, 17));
+	assert(rbtree_batch_rebuild(1<<20, (1<<20) / 20) && !rbtree_batch_rebuild(1<<20, (1<<20) / 21));
+
+	/* all nodes are found, in order */
+	int64_t i = 0;
+	struct ut_rbnode_s *p = NULL;
+	for(struct ut_rbnode_s *n = (struct ut_rbnode_s *)rbtree_search_key_right(tree, INT64_MIN);
+		n != NULL;
+		n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)n), i++) {
+
+		assert(p == NULL || p->h.key <= n->h.key);
+		assert(rbtree_search_key(tree, n->h.key) != NULL);
+		p = n;
+	}
+	assert(i == cnt, "i(%lld)", i);
+
+	/* duplicated keys keep their insertion order */
+	rbtree_flush(tree);
+	for(int64_t b = 0; b < 2; b++) {
+		for(int64_t i = 0; i < 1000; i++) {
+			nodes[i] = (struct ut_rbnode_s *)rbtree_create_node(tree);
+			nodes[i]->h.key = i % 10;
+			nodes[i]->val = b * 1000 + i;
+		}
+		rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, 1000);
+	}
+	assert(ut_rbtree_check(tree) >= 0);
+	p = (struct ut_rbnode_s *)rbtree_search_key_right(tree, INT64_MIN);
+	for(struct ut_rbnode_s *n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)p);
+		n != NULL;
+		n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)n)) {
+
+		assert(p->h.key < n->h.key || p->val < n->val,
+			"key(%lld, %lld), val(%lld, %lld)", p->h.key, n->h.key, p->val, n->val);
+		p = n;
+	}
+
+	free(nodes);
+	rbtree_clean(tree);
+}
+
+/* batched search */
+unittest()
+{
+	int64_t const cnt = 4096, qcnt = 2 * cnt + 21;
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * qcnt);
+	rbtree_node_t **out = (rbtree_node_t **)malloc(sizeof(void *) * qcnt);
+
+	/* empty tree */
+	for(int64_t i = 0; i < qcnt; i++) { keys[i] = i; }
+	rbtree_search_keys_right(tree, keys, qcnt, (RBTREE_NODE_T **)out);
+	for(int64_t i = 0; i < qcnt; i++) { assert(out[i] == NULL); }
+
+	for(int64_t i = 0; i < cnt; i++) {
+		struct ut_rbnode_s *n = (struct ut_rbnode_s *)rbtree_create_node(tree);
+		n->h.key = 2 * ((i * 1031) % cnt);
 		rbtree_insert(tree, (RBTREE_NODE_T *)n);
 	}
 
-	/* search (1) */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i<<1);
-		assert(n != NULL);
+	/* queries in shuffled order, including out of range keys */
+	for(int64_t i = 0; i < qcnt; i++) {
+		keys[i] = ((i * 7) % qcnt) - 10;
+	}
 
-		assert(n->h.key == i<<1, "n->h.key(%lld), key(%lld)", n->h.key, i<<1);
-		assert(n->val == _shuf(i), "n->val(%lld), val(%lld)", n->val, _shuf(i));
+	rbtree_search_keys(tree, keys, qcnt, (RBTREE_NODE_T **)out);
+	for(int64_t i = 0; i < qcnt; i++) {
+		assert(out[i] == rbtree_search_key(tree, keys[i]), "key(%lld)", keys[i]);
+	}
+	rbtree_search_keys_left(tree, keys, qcnt, (RBTREE_NODE_T **)out);
+	for(int64_t i = 0; i < qcnt; i++) {
+		assert(out[i] == rbtree_search_key_left(tree, keys[i]), "key(%lld)", keys[i]);
+	}
+	rbtree_search_keys_right(tree, keys, qcnt, (RBTREE_NODE_T **)out);
+	for(int64_t i = 0; i < qcnt; i++) {
+		assert(out[i] == rbtree_search_key_right(tree, keys[i]), "key(%lld)", keys[i]);
 	}
 
-	/* remove */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
-		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	free(keys);
+	free(out);
+	rbtree_clean(tree);
+}
+
+/* pool-owned marker survives rotations (kept in the parent word under RBTREE_COMPACT_NODE) */
+unittest()
+{
+	int64_t const cnt = 1000;
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	struct ut_rbnode_s *ext = (struct ut_rbnode_s *)calloc(cnt, sizeof(struct ut_rbnode_s));
+	struct ut_rbnode_s **nodes = (struct ut_rbnode_s **)malloc(sizeof(void *) * 2 * cnt);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[2 * i] = (struct ut_rbnode_s *)rbtree_create_node(tree);
+		nodes[2 * i + 1] = &ext[i];
+		nodes[2 * i]->h.key = (i * 7) % cnt;
+		nodes[2 * i + 1]->h.key = (i * 13) % cnt;
+		rbtree_insert(tree, (RBTREE_NODE_T *)nodes[2 * i]);
+		rbtree_insert(tree, (RBTREE_NODE_T *)nodes[2 * i + 1]);
+	}
+	assert(ut_rbtree_check(tree) >= 0);
+	for(int64_t i = 0; i < 2 * cnt; i++) {
+		assert(!ngx_rbt_is_pooled((ngx_rbtree_node_t *)nodes[i]) == !!(i & 1), "i(%lld)", i);
 	}
 
-	/* search (2) */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
+	/* remove every third node, then check the rest again */
+	for(int64_t i = 0; i < 2 * cnt; i += 3) {
+		rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+	}
+	assert(ut_rbtree_check(tree) >= 0);
+	for(int64_t i = 0; i < 2 * cnt; i++) {
+		if(i % 3 == 0) { continue; }
+		assert(!ngx_rbt_is_pooled((ngx_rbtree_node_t *)nodes[i]) == !!(i & 1), "i(%lld)", i);
+	}
+
+	free(nodes);
+	free(ext);
+	rbtree_clean(tree);
+}
+
+/* finger search */
+unittest()
+{
+	int64_t const cnt = 3000, qcnt = 5000;
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * qcnt);
+	rbtree_node_t **out = (rbtree_node_t **)malloc(sizeof(void *) * qcnt);
+	rbtree_node_t **nodes = (rbtree_node_t **)malloc(sizeof(void *) * cnt);
+
+	/* keys in pairs of duplicates: 0, 0, 3, 3, 6, ... */
+	for(int64_t i = 0; i < cnt; i++) { keys[i] = 3 * (i / 2); }
+	nodes[0] = (rbtree_node_t *)rbtree_build_sorted(tree, keys, cnt);
+	for(int64_t i = 1; i < cnt; i++) {
+		nodes[i] = (rbtree_node_t *)rbtree_right(tree, (RBTREE_NODE_T *)nodes[i - 1]);
+	}
+
+	/* ascending with repeats and out of range keys, then an unsorted tail */
+	for(int64_t i = 0; i < qcnt; i++) {
+		keys[i] = (i < 4900) ? ((i * 9) / 10) - 5 : ((i * 37) % 4600) - 5;
+	}
+
+	for(int64_t mode = 0; mode < 3; mode++) {
+		if(mode == 0) { rbtree_search_sorted_keys(tree, keys, qcnt, (RBTREE_NODE_T **)out); }
+		if(mode == 1) { rbtree_search_sorted_keys_left(tree, keys, qcnt, (RBTREE_NODE_T **)out); }
+		if(mode == 2) { rbtree_search_sorted_keys_right(tree, keys, qcnt, (RBTREE_NODE_T **)out); }
+
+		for(int64_t i = 0; i < qcnt; i++) {
+			/* brute-force lower bound */
+			int64_t j = 0;
+			while(j < cnt && nodes[j]->key < keys[i]) { j++; }
+
+			rbtree_node_t *ge = (j < cnt) ? nodes[j] : NULL;
+			rbtree_node_t *expected = (ge != NULL && ge->key == keys[i]) ? ge
+				: (mode == 1) ? (j > 0 ? nodes[j - 1] : NULL)
+				: (mode == 2) ? ge : NULL;
+			assert(out[i] == expected, "mode(%lld), i(%lld), key(%lld)", mode, i, keys[i]);
+		}
+	}
+
+	free(nodes);
+	free(keys);
+	free(out);
+	rbtree_clean(tree);
+}
+
+/* index-linked layout */
+unittest()
+{
+	int64_t const cnt = 5000;
+	rbtree_t *tree = rbtree_init(sizeof(rbtree_node32_t) + sizeof(int64_t),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ));
+	rbtree_node32_t **nodes = (rbtree_node32_t **)malloc(sizeof(void *) * cnt);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	for(int64_t r = 0; r < 2; r++) {
+		for(int64_t i = 0; r > 0 && i < cnt; i += 3) {
+			rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+		}
+		assert(rbtree_search_key_right(tree, INT64_MIN) == NULL);
+
+		for(int64_t i = 0; i < cnt; i++) {
+			nodes[i] = (rbtree_node32_t *)rbtree_create_node(tree);
+			nodes[i]->key = (i * 7919) % (cnt / 2);		/* each key twice */
+			rbtree_insert(tree, (RBTREE_NODE_T *)nodes[i]);
+		}
+		assert(ut_rbtree32_check(tree) > 0, "r(%lld)", r);
+
+		/* remove two thirds, recycled by the next round */
+		int64_t rem = 0;
+		for(int64_t i = 0; i < cnt; i++) {
+			if(i % 3 != 0) {
+				rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+			} else {
+				keys[rem++] = nodes[i]->key;
+			}
+		}
+		assert(ut_rbtree32_check(tree) > 0, "r(%lld)", r);
+		qsort(keys, rem, sizeof(rbtree_key_t), ut_cmp_key);
+
+		/* in-order traversal */
+		rbtree_node32_t *n = (rbtree_node32_t *)rbtree_search_key_right(tree, INT64_MIN);
+		for(int64_t i = 0; i < rem; i++) {
+			assert(n != NULL && n->key == keys[i], "i(%lld)", i);
+			n = (rbtree_node32_t *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+		}
 		assert(n == NULL);
+
+		/* searches against the sorted array */
+		for(int64_t k = -1; k < cnt / 2 + 1; k += 5) {
+			int64_t j = 0;
+			while(j < rem && keys[j] < k) { j++; }
+
+			n = (rbtree_node32_t *)rbtree_search_key(tree, k);
+			assert((n != NULL) == (j < rem && keys[j] == k), "k(%lld)", k);
+			n = (rbtree_node32_t *)rbtree_search_key_right(tree, k);
+			assert(n == NULL ? j == rem : n->key == keys[j], "k(%lld)", k);
+			n = (rbtree_node32_t *)rbtree_search_key_left(tree, k);
+			if(j < rem && keys[j] == k) {
+				assert(n != NULL && n->key == k, "k(%lld)", k);
+				assert(rbtree_left(tree, (RBTREE_NODE_T *)n) == NULL
+					|| ((rbtree_node32_t *)rbtree_left(tree, (RBTREE_NODE_T *)n))->key < k, "k(%lld)", k);
+			} else {
+				assert(n == NULL ? j == 0 : n->key == keys[j - 1], "k(%lld)", k);
+			}
+		}
 	}
-	for(int64_t i = 128; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	/* builds into the recycled blocks */
+	for(int64_t i = 0; i < cnt; i++) { keys[i] = 3 * i; }
+	rbtree_node32_t *n = (rbtree_node32_t *)rbtree_build_sorted(tree, keys, cnt);
+	assert(ut_rbtree32_check(tree) > 0);
+	for(int64_t i = 0; i < cnt; i++) {
+		assert(n != NULL && n->key == 3 * i, "i(%lld)", i);
+		n = (rbtree_node32_t *)rbtree_right(tree, (RBTREE_NODE_T *)n);
 	}
 
-	/* add again */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_create_node(tree);
-		assert(n != NULL);
+	free(keys);
+	free(nodes);
+	rbtree_clean(tree);
+}
 
-		n->h.key = _shuf(i)<<1;
-		n->val = 1024 - i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+/**
+ * @fn ut_rbtree_td_check
+ * @brief black height of a RBTREE_LAYOUT_TOPDOWN tree, -1 if broken
+ */
+static
+int64_t ut_rbtree_td_check_intl(
+	ngx_rbtree_td_node_t *node)
+{
+	if(node == NULL) { return(0); }
+
+	ngx_rbtree_td_node_t *left = node->link[0], *right = node->link[1];
+	if(ngx_rbt_td_is_red(node) && (ngx_rbt_td_is_red(left) || ngx_rbt_td_is_red(right))) {
+		return(-1);
 	}
+	if(left != NULL && left->key > node->key) { return(-1); }
+	if(right != NULL && right->key < node->key) { return(-1); }
 
-	/* search (3) */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
+	int64_t lh = ut_rbtree_td_check_intl(left);
+	int64_t rh = ut_rbtree_td_check_intl(right);
+	if(lh < 0 || lh != rh) { return(-1); }
+	return(lh + !node->color);
+}
+static
+int64_t ut_rbtree_td_check(
+	rbtree_t *tree)
+{
+	if(ngx_rbt_td_is_red(tree->td.root)) { return(-1); }
+	return(ut_rbtree_td_check_intl(tree->td.root));
+}
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == 1024 - i, "n->val(%lld), val(%lld)", n->val, 1024 - i);
+/**
+ * @fn ut_rbtree_td_count
+ */
+static
+void ut_rbtree_td_count(
+	RBTREE_NODE_T *node,
+	void *ctx)
+{
+	*((int64_t *)ctx) += 1;
+	return;
+}
+
+/* top-down layout */
+unittest()
+{
+	int64_t const cnt = 5000;
+	rbtree_t *tree = rbtree_init(sizeof(rbtree_node_td_t) + sizeof(int64_t),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN ));
+	rbtree_node_td_t **nodes = (rbtree_node_td_t **)malloc(sizeof(void *) * cnt);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	/* interval tree is not supported */
+	assert(ivtree_init(sizeof(ivtree_node_t), IVTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN )) == NULL);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i] = (rbtree_node_td_t *)rbtree_create_node(tree);
+		nodes[i]->key = (i * 7919) % (cnt / 2);		/* each key twice */
+		rbtree_insert(tree, (RBTREE_NODE_T *)nodes[i]);
 	}
-	for(int64_t i = 128; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
+	assert(ut_rbtree_td_check(tree) > 0);
+
+	/* remove two thirds, including one of each duplicate pair */
+	int64_t rem = 0;
+	for(int64_t i = 0; i < cnt; i++) {
+		if(i % 3 != 0) {
+			rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+		} else {
+			keys[rem++] = nodes[i]->key;
+		}
+	}
+	assert(ut_rbtree_td_check(tree) > 0);
+	qsort(keys, rem, sizeof(rbtree_key_t), ut_cmp_key);
+
+	/* in-order traversal in both directions */
+	rbtree_node_td_t *n = (rbtree_node_td_t *)rbtree_search_key_right(tree, INT64_MIN);
+	for(int64_t i = 0; i < rem; i++) {
+		assert(n != NULL && n->key == keys[i], "i(%lld)", i);
+		n = (rbtree_node_td_t *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(n == NULL);
+	n = (rbtree_node_td_t *)rbtree_search_key_left(tree, INT64_MAX);
+	for(int64_t i = rem - 1; i >= 0; i--) {
+		assert(n != NULL && n->key == keys[i], "i(%lld)", i);
+		n = (rbtree_node_td_t *)rbtree_left(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(n == NULL);
+
+	/* searches against the sorted array */
+	RBTREE_NODE_T *out[3];
+	for(int64_t k = -1; k < cnt / 2 + 1; k += 5) {
+		int64_t j = 0;
+		while(j < rem && keys[j] < k) { j++; }
+
+		n = (rbtree_node_td_t *)rbtree_search_key(tree, k);
+		assert((n != NULL) == (j < rem && keys[j] == k), "k(%lld)", k);
+		if(n != NULL) {
+			assert(rbtree_left(tree, (RBTREE_NODE_T *)n) == NULL
+				|| ((rbtree_node_td_t *)rbtree_left(tree, (RBTREE_NODE_T *)n))->key < k, "k(%lld)", k);
+		}
+		n = (rbtree_node_td_t *)rbtree_search_key_right(tree, k);
+		assert(n == NULL ? j == rem : n->key == keys[j], "k(%lld)", k);
+
+		rbtree_key_t const q[3] = { k, k + 1, k + 2 };
+		rbtree_search_keys_right(tree, q, 3, out);
+		assert(out[0] == (RBTREE_NODE_T *)n, "k(%lld)", k);
+	}
+
+	/* walk visits every node once */
+	int64_t visited = 0;
+	rbtree_walk(tree, ut_rbtree_td_count, (void *)&visited);
+	assert(visited == rem, "visited(%lld), rem(%lld)", visited, rem);
+
+	/* build falls back to insertion */
+	for(int64_t i = 0; i < cnt; i++) { keys[i] = 3 * i; }
+	n = (rbtree_node_td_t *)rbtree_build_sorted(tree, keys, cnt);
+	assert(ut_rbtree_td_check(tree) > 0);
+	for(int64_t i = 0; i < cnt; i++) {
+		assert(n != NULL && n->key == 3 * i, "i(%lld)", i);
+		n = (rbtree_node_td_t *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(n == NULL);
+
+	free(keys);
+	free(nodes);
+	rbtree_clean(tree);
+}
+
+/**
+ * @fn ut_ostree_check
+ * @brief subtree sizes of an order-statistic tree, -1 if broken
+ */
+static
+int64_t ut_ostree_check_intl(
+	ngx_rbtree_node_t *node,
+	ngx_rbtree_node_t *sentinel)
+{
+	if(node == sentinel) { return(0); }
+
+	int64_t ls = ut_ostree_check_intl(node->left, sentinel);
+	int64_t rs = ut_ostree_check_intl(node->right, sentinel);
+	if(ls < 0 || rs < 0) { return(-1); }
+#ifndef RBTREE_COMPACT_NODE
+	if(node->size != ls + rs + 1) { return(-1); }
+#endif
+	return(ls + rs + 1);
+}
+static
+int64_t ut_ostree_check(
+	rbtree_t *tree)
+{
+	if(ut_rbtree_check(tree) < 0) { return(-1); }
+	return(ut_ostree_check_intl(tree->t.root, tree->t.sentinel));
+}
+
+/* order statistics */
+unittest()
+{
+	int64_t const cnt = 3000;
+	rbtree_t *tree = rbtree_init(sizeof(rbtree_node_t),
+		RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT ));
+#ifdef RBTREE_COMPACT_NODE
+	/* no room for the size, fall back to the linear scans */
+	assert(tree == NULL);
+	tree = rbtree_init(sizeof(rbtree_node_t), NULL);
+#endif
+	assert(tree != NULL);
+	assert(rbtree_init(sizeof(rbtree_node32_t),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32, .flags = RBTREE_ORDER_STAT )) == NULL);
+	assert(ivtree_init(sizeof(ivtree_node_t), IVTREE_PARAMS( .flags = RBTREE_ORDER_STAT )) == NULL);
+
+	rbtree_node_t **nodes = (rbtree_node_t **)malloc(sizeof(void *) * cnt);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	assert(rbtree_rank(tree, 0) == 0);
+	assert(rbtree_select(tree, 0) == NULL);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i] = (rbtree_node_t *)rbtree_create_node(tree);
+		nodes[i]->key = (i * 7919) % (cnt / 2);		/* each key twice */
+		rbtree_insert(tree, (RBTREE_NODE_T *)nodes[i]);
+	}
+	assert(ut_ostree_check(tree) == cnt);
+
+	int64_t rem = 0;
+	for(int64_t i = 0; i < cnt; i++) {
+		if(i % 3 != 0) {
+			rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+		} else {
+			keys[rem++] = nodes[i]->key;
+		}
+	}
+	assert(ut_ostree_check(tree) == rem);
+	qsort(keys, rem, sizeof(rbtree_key_t), ut_cmp_key);
+
+	/* against the sorted array */
+	for(int64_t i = 0; i < rem; i++) {
+		rbtree_node_t *n = (rbtree_node_t *)rbtree_select(tree, i);
+		assert(n != NULL && n->key == keys[i], "i(%lld)", i);
+	}
+	assert(rbtree_select(tree, rem) == NULL);
+	for(int64_t k = -1, j = 0; k < cnt / 2 + 1; k++) {
+		while(j < rem && keys[j] < k) { j++; }
+		assert(rbtree_rank(tree, k) == (uint64_t)j, "k(%lld)", k);
+	}
+	for(int64_t k = -1; k < cnt / 2; k += 7) {
+		int64_t c = 0;
+		for(int64_t i = 0; i < rem; i++) { c += keys[i] >= k && keys[i] < k + 100; }
+		assert(rbtree_count_range(tree, k, k + 100) == (uint64_t)c, "k(%lld)", k);
+	}
+	assert(rbtree_count_range(tree, 100, 100) == 0);
+	assert(rbtree_count_range(tree, INT64_MIN, INT64_MAX) == (uint64_t)rem);
+
+	/* sorted insertion and merge-and-rebuild paths of the batch */
+	for(int64_t i = 0; i < 10; i++) {
+		nodes[i] = (rbtree_node_t *)rbtree_create_node(tree);
+		nodes[i]->key = 3 * i;
+	}
+	rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, 10);
+	assert(ut_ostree_check(tree) == rem + 10);
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i] = (rbtree_node_t *)rbtree_create_node(tree);
+		nodes[i]->key = i;
+	}
+	rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, cnt);
+	assert(ut_ostree_check(tree) == rem + 10 + cnt);
+	assert(rbtree_rank(tree, 1) == rbtree_count_range(tree, INT64_MIN, 1));
+
+	/* build */
+	for(int64_t i = 0; i < cnt; i++) { keys[i] = 2 * i; }
+	rbtree_build_sorted(tree, keys, cnt);
+	assert(ut_ostree_check(tree) == cnt);
+	assert(((rbtree_node_t *)rbtree_select(tree, cnt / 2))->key == cnt);
+	assert(rbtree_rank(tree, cnt + 1) == (uint64_t)(cnt / 2 + 1));
+
+	free(keys);
+	free(nodes);
+	rbtree_clean(tree);
+}
+
+/**
+ * @struct ut_sum_node_s
+ * @brief augmented with the sum of val over the subtree
+ */
+struct ut_sum_node_s {
+	rbtree_node_t h;
+	int64_t val;
+	int64_t sum;
+};
+
+/**
+ * @fn ut_sum_update
+ */
+static
+int ut_sum_update(
+	RBTREE_NODE_T *_node,
+	RBTREE_NODE_T *_left,
+	RBTREE_NODE_T *_right,
+	void *ctx)
+{
+	struct ut_sum_node_s *node = (struct ut_sum_node_s *)_node;
+	struct ut_sum_node_s *left = (struct ut_sum_node_s *)_left, *right = (struct ut_sum_node_s *)_right;
+	int64_t sum = node->val + (left != NULL ? left->sum : 0) + (right != NULL ? right->sum : 0);
+
+	/* the set operations call it on several threads at once */
+	__sync_fetch_and_add((int64_t *)ctx, 1);
+	if(node->sum == sum) { return(0); }
+	node->sum = sum;
+	return(1);
+}
+
+/**
+ * @fn ut_sum_check
+ * @brief the sum over the subtree if all the augmented values are consistent, -1 otherwise
+ */
+static
+int64_t ut_sum_check_intl(
+	ngx_rbtree_node_t *node,
+	ngx_rbtree_node_t *sentinel)
+{
+	if(node == sentinel) { return(0); }
+
+	int64_t ls = ut_sum_check_intl(node->left, sentinel);
+	int64_t rs = ut_sum_check_intl(node->right, sentinel);
+	struct ut_sum_node_s *n = (struct ut_sum_node_s *)node;
+	if(ls < 0 || rs < 0 || n->sum != ls + rs + n->val) { return(-1); }
+	return(n->sum);
+}
+static
+int64_t ut_sum_check(
+	rbtree_t *tree)
+{
+	if(ut_rbtree_check(tree) < 0) { return(-1); }
+	return(ut_sum_check_intl(tree->t.root, tree->t.sentinel));
+}
+
+/**
+ * @fn ut_sum_cover
+ */
+static
+void ut_sum_cover(
+	RBTREE_NODE_T *_node,
+	int subtree,
+	void *ctx)
+{
+	struct ut_sum_node_s *node = (struct ut_sum_node_s *)_node;
+	*((int64_t *)ctx) += subtree ? node->sum : node->val;
+	return;
+}
+
+/* user-defined augmentation */
+unittest()
+{
+	int64_t const cnt = 3000;
+	int64_t updates = 0;
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_sum_node_s),
+		RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates ));
+	assert(tree != NULL);
+	assert(rbtree_init(sizeof(struct ut_sum_node_s),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32, .update = ut_sum_update )) == NULL);
+	assert(ivtree_init(sizeof(ivtree_node_t), IVTREE_PARAMS( .update = ut_sum_update )) == NULL);
+
+	struct ut_sum_node_s **nodes = (struct ut_sum_node_s **)malloc(sizeof(void *) * cnt);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+	int64_t *vals = (int64_t *)calloc(cnt, sizeof(int64_t));	/* by key */
+
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i] = (struct ut_sum_node_s *)rbtree_create_node(tree);
+		nodes[i]->h.key = (i * 7919) % (cnt / 2);		/* each key twice */
+		nodes[i]->val = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)nodes[i]);
+	}
+	assert(ut_sum_check(tree) == cnt * (cnt - 1) / 2);
+
+	/* early termination keeps the propagation within O(log n) per insert */
+	assert(updates < 64 * cnt, "updates(%lld)", updates);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		if(i % 3 != 0) {
+			rbtree_remove(tree, (RBTREE_NODE_T *)nodes[i]);
+		} else {
+			nodes[i]->val = 2 * i;
+			rbtree_update_node(tree, (RBTREE_NODE_T *)nodes[i]);
+			vals[nodes[i]->h.key] += 2 * i;
+		}
+	}
+	assert(ut_sum_check(tree) >= 0);
+
+	/* range sums against the brute force */
+	for(int64_t k = -5; k < cnt / 2; k += 11) {
+		int64_t sum = 0, expected = 0;
+		for(int64_t j = (k < 0 ? 0 : k); j < k + 200 && j < cnt / 2; j++) { expected += vals[j]; }
+		rbtree_cover(tree, k, k + 200, ut_sum_cover, (void *)&sum);
+		assert(sum == expected, "k(%lld), sum(%lld), expected(%lld)", k, sum, expected);
+	}
+
+	/* both paths of the batch */
+	for(int64_t i = 0; i < 10; i++) {
+		nodes[i] = (struct ut_sum_node_s *)rbtree_create_node(tree);
+		nodes[i]->h.key = 3 * i;
+		nodes[i]->val = 1;
+	}
+	rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, 10);
+	assert(ut_sum_check(tree) >= 0);
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i] = (struct ut_sum_node_s *)rbtree_create_node(tree);
+		nodes[i]->h.key = i;
+		nodes[i]->val = 1;
+	}
+	rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, cnt);
+	assert(ut_sum_check(tree) >= 0);
+
+	/* build, the payloads are filled in after the build */
+	for(int64_t i = 0; i < cnt; i++) { keys[i] = i; }
+	struct ut_sum_node_s *n = (struct ut_sum_node_s *)rbtree_build_sorted(tree, keys, cnt);
+	for(int64_t i = 0; i < cnt; i++) {
+		n->val = 1;
+		rbtree_update_node(tree, (RBTREE_NODE_T *)n);
+		n = (struct ut_sum_node_s *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(ut_sum_check(tree) == cnt);
+	int64_t sum = 0;
+	rbtree_cover(tree, 100, 300, ut_sum_cover, (void *)&sum);
+	assert(sum == 200, "sum(%lld)", sum);
+
+	free(vals);
+	free(keys);
+	free(nodes);
+	rbtree_clean(tree);
+}
+
+/* first, last and pops as a priority queue */
+unittest()
+{
+	int64_t const cnt = 2000;
+	uint32_t const layouts[3] = { RBTREE_LAYOUT_PTR, RBTREE_LAYOUT_IDX32, RBTREE_LAYOUT_TOPDOWN };
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	for(int64_t l = 0; l < 3; l++) {
+		rbtree_t *tree = rbtree_init(sizeof(rbtree_node_t),
+			RBTREE_PARAMS( .layout = layouts[l] ));
+		assert(rbtree_first(tree) == NULL && rbtree_last(tree) == NULL);
+		assert(rbtree_pop_first(tree) == NULL && rbtree_pop_last(tree) == NULL);
+
+		for(int64_t i = 0; i < cnt; i++) {
+			keys[i] = (i * 7919) % (cnt / 2);		/* each key twice */
+			RBTREE_NODE_T *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = keys[i];
+			rbtree_insert(tree, node);
+			assert(rbtree_first(tree) == rbtree_search_key_right(tree, INT64_MIN), "l(%lld), i(%lld)", l, i);
+			assert(rbtree_right(tree, rbtree_last(tree)) == NULL, "l(%lld), i(%lld)", l, i);
+		}
+		qsort(keys, cnt, sizeof(rbtree_key_t), ut_cmp_key);
+
+		/* pop from both ends, re-inserting every third node popped from the front */
+		int64_t lo = 0, hi = cnt;
+		while(lo < hi) {
+			RBTREE_NODE_T *node = rbtree_pop_first(tree);
+			assert(node != NULL && *rbtree_key_ptr(tree, node) == keys[lo], "l(%lld), lo(%lld)", l, lo);
+			if(lo % 3 == 0) {
+				/* equal keys may come first, except on the top-down layout */
+				rbtree_insert(tree, node);
+				assert(*rbtree_key_ptr(tree, rbtree_first(tree)) == keys[lo], "l(%lld), lo(%lld)", l, lo);
+				node = rbtree_pop_first(tree);
+			}
+			rbtree_free_node(tree, node);
+			lo++;
+			if(lo == hi) { break; }
+
+			node = rbtree_pop_last(tree);
+			assert(node != NULL && *rbtree_key_ptr(tree, node) == keys[hi - 1], "l(%lld), hi(%lld)", l, hi);
+			rbtree_free_node(tree, node);
+			hi--;
+		}
+		assert(rbtree_first(tree) == NULL && rbtree_last(tree) == NULL, "l(%lld)", l);
+
+		/* removal of the extremes through rbtree_remove, and builds */
+		for(int64_t i = 0; i < cnt; i++) { keys[i] = i; }
+		RBTREE_NODE_T *head = rbtree_build_sorted(tree, keys, cnt);
+		assert(rbtree_first(tree) == head, "l(%lld)", l);
+		assert(*rbtree_key_ptr(tree, rbtree_last(tree)) == cnt - 1, "l(%lld)", l);
+		rbtree_remove(tree, head);
+		assert(*rbtree_key_ptr(tree, rbtree_first(tree)) == 1, "l(%lld)", l);
+		rbtree_remove(tree, rbtree_last(tree));
+		assert(*rbtree_key_ptr(tree, rbtree_last(tree)) == cnt - 2, "l(%lld)", l);
+
+		RBTREE_NODE_T *nodes[2] = { rbtree_create_node(tree), rbtree_create_node(tree) };
+		*rbtree_key_ptr(tree, nodes[0]) = -1;
+		*rbtree_key_ptr(tree, nodes[1]) = cnt;
+		rbtree_insert_batch(tree, nodes, 2);
+		assert(*rbtree_key_ptr(tree, rbtree_first(tree)) == -1, "l(%lld)", l);
+		assert(*rbtree_key_ptr(tree, rbtree_last(tree)) == cnt, "l(%lld)", l);
+
+		rbtree_flush(tree);
+		assert(rbtree_first(tree) == NULL && rbtree_last(tree) == NULL, "l(%lld)", l);
+		rbtree_clean(tree);
+	}
+	free(keys);
+}
+
+/**
+ * @fn ut_hint_check
+ * @brief checks that the nodes are sorted and equal keys are in the insertion order (val)
+ */
+static
+int64_t ut_hint_check(
+	rbtree_t *tree)
+{
+	if(ut_rbtree_check(tree) < 0) { return(-1); }
+
+	int64_t n = 0;
+	struct ut_sum_node_s *prev = NULL;
+	struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_first(tree);
+	while(node != NULL) {
+		if(prev != NULL && (prev->h.key > node->h.key
+		|| (prev->h.key == node->h.key && prev->val > node->val))) {
+			return(-1);
+		}
+		prev = node;
+		node = (struct ut_sum_node_s *)rbtree_right(tree, (RBTREE_NODE_T *)node);
+		n++;
+	}
+	return(prev == rbtree_last(tree) ? n : -1);
+}
+
+/* hinted insert */
+unittest()
+{
+	int64_t const cnt = 5000;
+	int64_t updates = 0;
+	rbtree_t *trees[2] = {
+		rbtree_init(sizeof(struct ut_sum_node_s), NULL),
+		rbtree_init(sizeof(struct ut_sum_node_s),
+			RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates ))
+	};
+	struct ut_sum_node_s **nodes = (struct ut_sum_node_s **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t t = 0; t < 2; t++) {
+		rbtree_t *tree = trees[t];
+
+		/* appends and near-sequential keys, hinted by the previous node */
+		for(int64_t i = 0; i < cnt; i++) {
+			nodes[i] = (struct ut_sum_node_s *)rbtree_create_node(tree);
+			nodes[i]->h.key = (i < cnt / 2) ? i : i + (i * 7919) % 17 - 8;
+			nodes[i]->val = i;
+			rbtree_insert_hint(tree, (RBTREE_NODE_T *)nodes[i],
+				(RBTREE_NODE_T *)(i == 0 ? NULL : nodes[i - 1]));
+		}
+		assert(ut_hint_check(tree) == cnt, "t(%lld)", t);
+
+		/* random keys with random hints, including duplicates of existing keys */
+		for(int64_t i = 0; i < cnt; i++) {
+			struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_create_node(tree);
+			node->h.key = (i * 7919) % (cnt + 20) - 10;
+			node->val = cnt + i;
+			rbtree_insert_hint(tree, (RBTREE_NODE_T *)node,
+				(RBTREE_NODE_T *)nodes[(i * 104729) % cnt]);
+		}
+		assert(ut_hint_check(tree) == 2 * cnt, "t(%lld)", t);
+		if(t == 1) { assert(ut_sum_check(tree) >= 0); }
+
+		/* sorted insertion path of the batch */
+		for(int64_t i = 0; i < 100; i++) {
+			nodes[i] = (struct ut_sum_node_s *)rbtree_create_node(tree);
+			nodes[i]->h.key = (i * 7919) % 50;
+			nodes[i]->val = 2 * cnt + i;
+		}
+		rbtree_insert_batch(tree, (RBTREE_NODE_T **)nodes, 100);
+		assert(ut_hint_check(tree) == 2 * cnt + 100, "t(%lld)", t);
+		if(t == 1) { assert(ut_sum_check(tree) >= 0); }
+		rbtree_clean(tree);
+	}
+	free(nodes);
+}
+
+/* split and join */
+unittest()
+{
+	int64_t const cnt = 4000;
+	int64_t updates = 0;
+	rbtree_t *trees[3] = {
+		rbtree_init(sizeof(struct ut_sum_node_s), NULL),
+		rbtree_init(sizeof(struct ut_sum_node_s),
+			RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates )),
+		rbtree_init(sizeof(struct ut_sum_node_s), RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT ))
+	};
+
+	for(int64_t t = 0; t < 3; t++) {
+		rbtree_t *tree = trees[t];
+		if(tree == NULL) { continue; }		/* no order statistics under RBTREE_COMPACT_NODE */
+
+		for(int64_t i = 0; i < cnt; i++) {
+			struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_create_node(tree);
+			node->h.key = (i * 7919) % (cnt / 2);		/* each key twice */
+			node->val = i;
+			rbtree_insert(tree, (RBTREE_NODE_T *)node);
+		}
+
+		/* the far ends make the black heights differ the most */
+		for(int64_t k = -1; k <= cnt / 2 + 1; k += (k < 3 || k > cnt / 2 - 3) ? 1 : 97) {
+			rbtree_t *left = NULL, *right = NULL;
+			assert(rbtree_split(tree, k, &left, &right) == 0);
+			assert(left == tree && right != NULL);
+
+			int64_t lcnt = 2 * (k < 0 ? 0 : (k > cnt / 2 ? cnt / 2 : k));
+			assert(ut_hint_check(left) == lcnt, "t(%lld), k(%lld)", t, k);
+			assert(ut_hint_check(right) == cnt - lcnt, "t(%lld), k(%lld)", t, k);
+			assert(rbtree_select(left, lcnt) == NULL);
+			assert(rbtree_select(right, 0) == rbtree_first(right));
+			if(t == 1) { assert(ut_sum_check(left) + ut_sum_check(right) == cnt * (cnt - 1) / 2); }
+			if(t == 2) { assert(ut_ostree_check(right) == cnt - lcnt); }
+
+			/* the split trees are updated independently */
+			struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_pop_last(right);
+			if(node != NULL) { rbtree_insert(right, (RBTREE_NODE_T *)node); }
+			assert(ut_hint_check(right) == cnt - lcnt, "t(%lld), k(%lld)", t, k);
+
+			/* overlapping ranges are rejected, then joined back */
+			if(lcnt != 0 && lcnt != cnt) { assert(rbtree_join(right, left) == -1); }
+			assert(rbtree_join(left, right) == 0);
+			assert(rbtree_first(right) == NULL);
+			assert(ut_hint_check(tree) == cnt, "t(%lld), k(%lld)", t, k);
+			if(t == 1) { assert(ut_sum_check(tree) == cnt * (cnt - 1) / 2); }
+			if(t == 2) { assert(ut_ostree_check(tree) == cnt); }
+			rbtree_clean(right);
+		}
+
+		/* the sentinel is shared, the removal must not write it */
+		while(rbtree_first(tree) != NULL) {
+			rbtree_remove(tree, rbtree_first(tree));
+		}
+		assert(ngx_rbt_parent(tree->t.sentinel) == NULL);
+		assert(ngx_rbt_is_black(tree->t.sentinel));
+		rbtree_clean(tree);
+	}
+
+	/* join of trees built independently */
+	rbtree_t *a = rbtree_init(sizeof(rbtree_node_t), NULL);
+	rbtree_t *b = rbtree_init(sizeof(rbtree_node_t), NULL);
+	for(int64_t i = 0; i < 300; i++) {
+		rbtree_t *tree = (i < 100) ? a : b;
+		rbtree_node_t *node = (rbtree_node_t *)rbtree_create_node(tree);
+		node->key = i;
+		rbtree_insert(tree, (RBTREE_NODE_T *)node);
+	}
+	assert(rbtree_join(a, b) == 0);
+	assert(ut_rbtree_check(a) >= 0);
+	assert(rbtree_select(a, 299) == rbtree_last(a) && ((rbtree_node_t *)rbtree_last(a))->key == 299);
+	rbtree_clean(b);
+	rbtree_flush(a);
+	assert(rbtree_first(a) == NULL);
+	rbtree_node_t *n = (rbtree_node_t *)rbtree_create_node(a);
+	n->key = 1;
+	rbtree_insert(a, (RBTREE_NODE_T *)n);
+	assert(rbtree_first(a) == n);
+
+	/* incompatible trees */
+	rbtree_t *c = rbtree_init(sizeof(struct ut_sum_node_s), NULL);
+	rbtree_t *d = rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ));
+	rbtree_t *l = NULL, *r = NULL;
+	assert(rbtree_join(a, c) == -1);
+	assert(rbtree_join(a, d) == -1);
+	assert(rbtree_split(d, 0, &l, &r) == -1);
+	rbtree_clean(d);
+	rbtree_clean(c);
+	rbtree_clean(a);
+}
+
+/**
+ * @fn ut_pool_reuse
+ * @brief 1 if the slot of the node removed is the next one created, the node is put back
+ */
+static
+int64_t ut_pool_reuse(
+	rbtree_t *tree,
+	RBTREE_NODE_T *node)
+{
+	rbtree_key_t key = ((rbtree_node_t *)node)->key;
+	rbtree_remove(tree, node);
+	rbtree_node_t *n = (rbtree_node_t *)rbtree_create_node(tree);
+	n->key = key;
+	rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	return((RBTREE_NODE_T *)n == node);
+}
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+/* the nodes removed after split, join and union are reused */
+unittest()
+{
+	rbtree_t *a = rbtree_init(sizeof(rbtree_node_t), NULL);
+	rbtree_t *b = rbtree_init(sizeof(rbtree_node_t), NULL);
+	rbtree_t *c = rbtree_init(sizeof(rbtree_node_t), NULL);
+	for(int64_t i = 0; i < 300; i++) {
+		rbtree_t *tree = (i < 100) ? a : ((i < 200) ? b : c);
+		rbtree_node_t *node = (rbtree_node_t *)rbtree_create_node(tree);
+		node->key = (i < 200) ? i : i - 50;			/* c overlaps b by 50 keys */
+		rbtree_insert(tree, (RBTREE_NODE_T *)node);
 	}
 
-	rbtree_clean(tree);
+	/* the halves share the pool */
+	rbtree_t *l = NULL, *r = NULL;
+	assert(rbtree_split(a, 50, &l, &r) == 0);
+	assert(ut_pool_reuse(l, rbtree_first(l)));
+	assert(ut_pool_reuse(r, rbtree_first(r)));
+	assert(ut_pool_reuse(r, rbtree_last(r)));
+	assert(rbtree_join(a, r) == 0);
+	rbtree_clean(r);
+	assert(ut_pool_reuse(a, rbtree_first(a)));
+
+	/* the pools of b are merged into those of a, and kept after b is cleaned */
+	assert(rbtree_join(a, b) == 0);
+	rbtree_clean(b);
+	assert(ut_pool_reuse(a, rbtree_last(a)));
+	assert(ut_pool_reuse(a, rbtree_first(a)));
+	assert(ut_pool_reuse(a, rbtree_search_key(a, 150)));
+
+	/* and those of c, the nodes of c are put back to the pool of a */
+	assert(rbtree_union(a, c, 1, NULL, NULL) == 0);
+	rbtree_clean(c);
+	assert(rbtree_count(a) == 250);
+	assert(ut_pool_reuse(a, rbtree_last(a)));
+	assert(ut_pool_reuse(a, rbtree_search_key(a, 175)));
+	assert(ut_rbtree_check(a) >= 0);
+	rbtree_clean(a);
+}
+
+/**
+ * @fn ut_remove_range_free
+ * @brief frees the nodes malloc'd by the test, counting them
+ */
+static
+void ut_remove_range_free(
+	RBTREE_NODE_T *node,
+	void *ctx)
+{
+	*((int64_t *)ctx) += 1;
+	free(node);
+	return;
 }
 
+/* range removal */
 unittest()
 {
-	int64_t const cnt = 32 * 1024 * 1024;
-	srand(time(NULL));
+	int64_t const cnt = 4000;
+	int64_t updates = 0;
+	rbtree_t *trees[5] = {
+		rbtree_init(sizeof(struct ut_sum_node_s), NULL),
+		rbtree_init(sizeof(struct ut_sum_node_s),
+			RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates )),
+		rbtree_init(sizeof(struct ut_sum_node_s), RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT )),
+		rbtree_init(sizeof(rbtree_node_td_t) + sizeof(int64_t),
+			RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN )),
+		rbtree_init(sizeof(rbtree_node32_t) + sizeof(int64_t),
+			RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ))
+	};
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	for(int64_t t = 0; t < 5; t++) {
+		rbtree_t *tree = trees[t];
+		if(tree == NULL) { continue; }		/* no order statistics under RBTREE_COMPACT_NODE */
+
+		/* every fourth node is malloc'd on the default layout */
+		for(int64_t i = 0; i < cnt; i++) {
+			RBTREE_NODE_T *node = (t < 3 && i % 4 == 0)
+				? (RBTREE_NODE_T *)calloc(1, sizeof(struct ut_sum_node_s))
+				: rbtree_create_node(tree);
+			keys[i] = (i * 7919) % (cnt / 2);		/* each key twice */
+			*rbtree_key_ptr(tree, node) = keys[i];
+			if(t < 3) { ((struct ut_sum_node_s *)node)->val = i; }
+			rbtree_insert(tree, node);
+		}
 
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+		int64_t rem = cnt, sum = cnt * (cnt - 1) / 2;
+		for(int64_t r = 0; r < 20; r++) {
+			int64_t lkey = (r * 104729) % (cnt / 2) - 10, rkey = lkey + (r * 31) % 200;
+			int64_t removed = 0, external = 0, freed = 0;
+			for(int64_t i = 0; i < cnt; i++) {
+				if(keys[i] >= lkey && keys[i] < rkey) {
+					removed++;
+					external += (t < 3 && i % 4 == 0);
+					sum -= i;
+					keys[i] = INT64_MIN;
+				}
+			}
+			assert(rbtree_remove_range(tree, lkey, rkey, ut_remove_range_free, (void *)&freed) == removed,
+				"t(%lld), r(%lld)", t, r);
+			assert(rbtree_count_range(tree, lkey, rkey) == 0);
+			rem -= removed;
+
+			int64_t n = 0;
+			rbtree_walk(tree, ut_rbtree_td_count, (void *)&n);
+			assert(n == rem, "t(%lld), r(%lld)", t, r);
+			assert(rbtree_select(tree, rem) == NULL && (rem == 0 || rbtree_select(tree, rem - 1) == rbtree_last(tree)));
+			if(t < 3) { assert(ut_hint_check(tree) == rem, "t(%lld), r(%lld)", t, r); }
+			assert(freed == external, "t(%lld), r(%lld)", t, r);
+			if(t == 1) { assert(ut_sum_check(tree) == sum); }
+			if(t == 2) { assert(ut_ostree_check(tree) == rem); }
+			if(t == 3) { assert(ut_rbtree_td_check(tree) > 0 || rem == 0); }
+			if(t == 4) { assert(ut_rbtree32_check(tree) > 0 || rem == 0); }
+		}
 
-	/* insert */
-	for(int64_t i = 0; i < cnt; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_create_node(tree);
-		assert(n != NULL);
+		/* the whole tree, then the freed nodes are reused */
+		int64_t freed = 0;
+		assert(rbtree_remove_range(tree, INT64_MIN, INT64_MAX, ut_remove_range_free, (void *)&freed) == rem);
+		assert(rbtree_first(tree) == NULL && rbtree_last(tree) == NULL);
+		assert(rbtree_remove_range(tree, 0, 100, NULL, NULL) == 0);
+		for(int64_t i = 0; i < 100; i++) {
+			RBTREE_NODE_T *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = i;
+			rbtree_insert(tree, node);
+		}
+		assert(rbtree_remove_range(tree, 10, 10, NULL, NULL) == 0);
+		assert(rbtree_remove_range(tree, 10, 20, NULL, NULL) == 10);
+		assert(rbtree_count_range(tree, 0, 100) == 90);
+		rbtree_clean(tree);
+	}
+	free(keys);
+}
 
-		n->h.key = rand();
-		n->val = i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+/* set operations */
+unittest()
+{
+	int64_t const cnt = 20000, range = 30000;
+	int64_t updates = 0;
+	rbtree_params_t const *params[3] = {
+		NULL,
+		RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates ),
+		RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT )
+	};
+	int64_t *ka = (int64_t *)calloc(range, sizeof(int64_t));
+	int64_t *kb = (int64_t *)calloc(range, sizeof(int64_t));
+	int64_t *kc = (int64_t *)calloc(range, sizeof(int64_t));
+	uintptr_t *pooled = (uintptr_t *)calloc(4 * cnt, sizeof(uintptr_t)), *created = pooled + 2 * cnt;
+
+	for(int64_t p = 0; p < 3; p++) {
+		for(int64_t op = 0; op < 3; op++) {
+			for(int64_t threads = 1; threads <= 8; threads *= 8) {
+				rbtree_t *a = rbtree_init(sizeof(struct ut_sum_node_s), params[p]);
+				rbtree_t *b = rbtree_init(sizeof(struct ut_sum_node_s), params[p]);
+				if(a == NULL) { continue; }		/* no order statistics under RBTREE_COMPACT_NODE */
+				memset(ka, 0, sizeof(int64_t) * range);
+				memset(kb, 0, sizeof(int64_t) * range);
+
+				/* overlapping key sets with duplicates, every fifth node of b is malloc'd */
+				int64_t pcnt = 0;
+				for(int64_t i = 0; i < 2 * cnt; i++) {
+					rbtree_t *tree = (i < cnt) ? a : b;
+					struct ut_sum_node_s *node = (i >= cnt && i % 5 == 0)
+						? (struct ut_sum_node_s *)calloc(1, sizeof(struct ut_sum_node_s))
+						: (struct ut_sum_node_s *)rbtree_create_node(tree);
+					if(i < cnt || i % 5 != 0) { pooled[pcnt++] = (uintptr_t)node; }
+					node->h.key = (i < cnt) ? (i * 7919) % range : (i * 104729) % range;
+					node->val = i;
+					((i < cnt) ? ka : kb)[node->h.key]++;
+					rbtree_insert(tree, (RBTREE_NODE_T *)node);
+				}
+
+				int64_t freed = 0, external = 0, n = 0, sum = 0;
+				int (*fn)(rbtree_t *, rbtree_t *, uint64_t, rbtree_walk_t, void *) =
+					(op == 0) ? rbtree_union : (op == 1) ? rbtree_intersect : rbtree_difference;
+				assert(fn(a, b, threads, ut_remove_range_free, (void *)&freed) == 0);
+				assert(rbtree_first(b) == NULL && rbtree_last(b) == NULL);
+
+				/* the multiplicity of each key follows the operation, the nodes kept for a key come from a single tree */
+				memset(kc, 0, sizeof(int64_t) * range);
+				struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_first(a);
+				while(node != NULL) {
+					kc[node->h.key]++;
+					assert((node->val < cnt) == (ka[node->h.key] != 0), "p(%lld), op(%lld)", p, op);
+					external += (node->val >= cnt && node->val % 5 == 0);
+					sum += node->val;
+					n++;
+					node = (struct ut_sum_node_s *)rbtree_right(a, (RBTREE_NODE_T *)node);
+				}
+				for(int64_t k = 0; k < range; k++) {
+					int64_t e = (op == 0) ? (ka[k] ? ka[k] : kb[k]) : (op == 1) ? (kb[k] ? ka[k] : 0) : (kb[k] ? 0 : ka[k]);
+					assert(kc[k] == e, "p(%lld), op(%lld), threads(%lld), k(%lld)", p, op, threads, k);
+				}
+				assert(external + freed == cnt / 5, "p(%lld), op(%lld)", p, op);
+				assert(ut_hint_check(a) == n, "p(%lld), op(%lld), threads(%lld)", p, op, threads);
+				assert(rbtree_select(a, n) == NULL && (n == 0 || rbtree_select(a, n - 1) == rbtree_last(a)));
+				if(p == 1) { assert(ut_sum_check(a) == sum); }
+				if(p == 2) { assert(ut_ostree_check(a) == n); }
+
+				/* the pooled nodes dropped are put back to the pool of a, and reused */
+				qsort(pooled, pcnt, sizeof(uintptr_t), ut_ptr_cmp);
+				for(int64_t i = 0; i < pcnt - (n - external); i++) {
+					uintptr_t addr = (uintptr_t)rbtree_create_node(a);
+					assert(bsearch(&addr, pooled, pcnt, sizeof(uintptr_t), ut_ptr_cmp) != NULL,
+						"p(%lld), op(%lld), threads(%lld), i(%lld)", p, op, threads, i);
+					created[i] = addr;
+				}
+				for(int64_t i = 0; i < pcnt - (n - external); i++) {
+					rbtree_free_node(a, (RBTREE_NODE_T *)created[i]);
+				}
+
+				/* the external nodes kept are released here */
+				rbtree_remove_range(a, INT64_MIN, INT64_MAX, ut_remove_range_free, (void *)&freed);
+				assert(freed == cnt / 5);
+				rbtree_clean(b);
+				rbtree_clean(a);
+			}
+		}
 	}
 
-	/* remove */
-	for(int64_t i = 0; i < cnt; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i);
-		if(n != NULL) {
-			rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	/* incompatible trees */
+	rbtree_t *c = rbtree_init(sizeof(rbtree_node_t), NULL);
+	rbtree_t *d = rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ));
+	assert(rbtree_union(c, d, 1, NULL, NULL) == -1);
+	assert(rbtree_intersect(d, d, 1, NULL, NULL) == -1);
+	rbtree_clean(d);
+	rbtree_clean(c);
+	free(pooled);
+	free(kc);
+	free(kb);
+	free(ka);
+}
+
+/* linear-time merge */
+unittest()
+{
+	int64_t const cnt = 3000;
+	int64_t updates = 0;
+	rbtree_params_t const *params[3] = {
+		NULL,
+		RBTREE_PARAMS( .update = ut_sum_update, .update_ctx = (void *)&updates ),
+		RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT )
+	};
+
+	for(int64_t p = 0; p < 3; p++) {
+		rbtree_t *dst = rbtree_init(sizeof(struct ut_sum_node_s), params[p]);
+		rbtree_t *src = rbtree_init(sizeof(struct ut_sum_node_s), params[p]);
+		if(dst == NULL) { continue; }		/* no order statistics under RBTREE_COMPACT_NODE */
+
+		/* interleaving keys, the ones of dst are inserted first to come first among equal keys */
+		for(int64_t i = 0; i < 2 * cnt; i++) {
+			struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_create_node((i < cnt) ? dst : src);
+			node->h.key = (i * 7919) % cnt;
+			node->val = i;
+			rbtree_insert((i < cnt) ? dst : src, (RBTREE_NODE_T *)node);
+		}
+		RBTREE_NODE_T *first = rbtree_first(src);
+		assert(rbtree_merge(dst, src) == 0);
+		assert(rbtree_first(src) == NULL && rbtree_last(src) == NULL);
+		assert(ut_hint_check(dst) == 2 * cnt, "p(%lld)", p);
+		assert(rbtree_right(dst, rbtree_first(dst)) == first);
+		assert(rbtree_select(dst, 2 * cnt) == NULL && rbtree_select(dst, 2 * cnt - 1) == rbtree_last(dst));
+		if(p == 1) { assert(ut_sum_check(dst) == cnt * (2 * cnt - 1)); }
+		if(p == 2) { assert(ut_ostree_check(dst) == 2 * cnt); }
+
+		/* the nodes from both trees are freed into the pool of dst, and reused */
+		struct ut_sum_node_s *pair[2] = {
+			(struct ut_sum_node_s *)rbtree_first(dst),		/* from dst */
+			(struct ut_sum_node_s *)first					/* from src, of the same key */
+		};
+		int64_t vals[2] = { pair[0]->val, pair[1]->val };
+		rbtree_remove(dst, (RBTREE_NODE_T *)pair[0]);
+		rbtree_remove(dst, (RBTREE_NODE_T *)pair[1]);
+		for(int64_t i = 1; i >= 0; i--) {
+			assert(rbtree_create_node(dst) == (RBTREE_NODE_T *)pair[i], "p(%lld), i(%lld)", p, i);
+		}
+		for(int64_t i = 0; i < 2; i++) {
+			pair[i]->h.key = 0;
+			pair[i]->val = vals[i];
+			rbtree_insert(dst, (RBTREE_NODE_T *)pair[i]);
+		}
+		assert(ut_hint_check(dst) == 2 * cnt, "p(%lld)", p);
+		if(p == 1) { assert(ut_sum_check(dst) == cnt * (2 * cnt - 1)); }
+
+		/* appended keys are joined, the emptied src is reused */
+		for(int64_t i = 0; i < cnt; i++) {
+			struct ut_sum_node_s *node = (struct ut_sum_node_s *)rbtree_create_node(src);
+			node->h.key = cnt + i;
+			node->val = 2 * cnt + i;
+			rbtree_insert(src, (RBTREE_NODE_T *)node);
 		}
+		assert(rbtree_merge(dst, src) == 0);
+		assert(rbtree_merge(dst, src) == 0);
+		assert(ut_hint_check(dst) == 3 * cnt, "p(%lld)", p);
+		if(p == 1) { assert(ut_sum_check(dst) == 3 * cnt * (3 * cnt - 1) / 2); }
+		if(p == 2) { assert(ut_ostree_check(dst) == 3 * cnt); }
+
+		/* into an empty tree */
+		assert(rbtree_merge(src, dst) == 0);
+		assert(ut_hint_check(src) == 3 * cnt && rbtree_first(dst) == NULL);
+		rbtree_clean(dst);
+		rbtree_clean(src);
 	}
-	rbtree_clean(tree);
+
+	rbtree_t *c = rbtree_init(sizeof(rbtree_node_t), NULL);
+	rbtree_t *d = rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN ));
+	assert(rbtree_merge(c, d) == -1);
+	rbtree_clean(d);
+	rbtree_clean(c);
 }
 
-/* create multiple nodes with malloc */
-void unittest_free_node(RBTREE_NODE_T *node, void *ctx)
+/**
+ * @fn ut_cover_collect
+ * @brief appends the node to the array
+ */
+static
+void ut_cover_collect(
+	RBTREE_NODE_T *node,
+	int subtree,
+	void *ctx)
 {
-	free(node);
+	RBTREE_NODE_T ***p = (RBTREE_NODE_T ***)ctx;
+	*(*p)++ = node;
 	return;
 }
+
+/* range cursor */
 unittest()
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	int64_t const cnt = 3000;
+	rbtree_t *trees[3] = {
+		rbtree_init(sizeof(rbtree_node_t), NULL),
+		rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN )),
+		rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ))
+	};
+	RBTREE_NODE_T **exp = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+	RBTREE_NODE_T **out = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t t = 0; t < 3; t++) {
+		rbtree_t *tree = trees[t];
+		for(int64_t i = 0; i < cnt; i++) {
+			RBTREE_NODE_T *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = 2 * ((i * 7919) % (cnt / 2));		/* each even key twice */
+			rbtree_insert(tree, node);
+		}
 
-	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+		for(int64_t lkey = -3; lkey < cnt + 3; lkey += 37) {
+			for(int64_t w = 0; w < 400; w += 53) {
+				int64_t rkey = lkey + w;
+				int64_t n = 0;
+				RBTREE_NODE_T *node = rbtree_search_key_right(tree, lkey);
+				while(node != NULL && *rbtree_key_ptr(tree, node) < rkey) {
+					exp[n++] = node;
+					node = rbtree_right(tree, node);
+				}
+
+				/* single steps forward and reverse */
+				rbtree_iter_t *iter = rbtree_range(tree, lkey, rkey);
+				for(int64_t i = 0; i < n; i++) {
+					assert(rbtree_iter_next(iter) == exp[i], "t(%lld), lkey(%lld), rkey(%lld), i(%lld)", t, lkey, rkey, i);
+				}
+				assert(rbtree_iter_next(iter) == NULL && rbtree_iter_next(iter) == NULL);
+				rbtree_iter_clean(iter);
+
+				iter = rbtree_range_reverse(tree, lkey, rkey);
+				for(int64_t i = n - 1; i >= 0; i--) {
+					assert(rbtree_iter_next(iter) == exp[i], "t(%lld), lkey(%lld), rkey(%lld), i(%lld)", t, lkey, rkey, i);
+				}
+				assert(rbtree_iter_next(iter) == NULL);
+				rbtree_iter_clean(iter);
+
+				/* batches of various sizes */
+				iter = rbtree_range(tree, lkey, rkey);
+				int64_t m = 0, k;
+				while((k = rbtree_iter_next_batch(iter, &out[m], 1 + (m % 7))) != 0) { m += k; }
+				assert(m == n, "t(%lld), lkey(%lld), rkey(%lld)", t, lkey, rkey);
+				assert(memcmp(out, exp, sizeof(void *) * n) == 0);
+				rbtree_iter_clean(iter);
+
+				/* the layouts other than RBTREE_LAYOUT_PTR cover the range by single nodes in order */
+				if(t > 0) {
+					RBTREE_NODE_T **p = out;
+					rbtree_cover(tree, lkey, rkey, ut_cover_collect, (void *)&p);
+					assert(p - out == n && memcmp(out, exp, sizeof(void *) * n) == 0, "t(%lld), lkey(%lld), rkey(%lld)", t, lkey, rkey);
+				}
+			}
+		}
 
-	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+		/* the whole tree */
+		rbtree_iter_t *iter = rbtree_range_reverse(tree, INT64_MIN, INT64_MAX);
+		assert(rbtree_iter_next_batch(iter, out, cnt) == cnt);
+		assert(out[0] == rbtree_last(tree) && out[cnt - 1] == rbtree_first(tree));
+		rbtree_iter_clean(iter);
+		rbtree_clean(tree);
+	}
+	free(out);
+	free(exp);
+}
 
-	/* insert */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			(RBTREE_NODE_T *)malloc(sizeof(rbtree_node_t) + 8);
-		assert(n != NULL);
+/**
+ * @struct ut_visit_s
+ */
+struct ut_visit_s {
+	rbtree_t *tree;
+	int64_t cnt, lim, sum;
+	RBTREE_NODE_T **nodes;
+};
 
-		memset(n, 0, sizeof(rbtree_node_t));
-		n->h.key = _shuf(i)<<1;
-		n->val = i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+/**
+ * @fn ut_visit
+ * @brief records the nodes, skips the right subtrees of the keys divisible by 7 and stops at lim
+ */
+static
+int ut_visit(
+	RBTREE_NODE_T *node,
+	void *_ctx)
+{
+	struct ut_visit_s *ctx = (struct ut_visit_s *)_ctx;
+	ctx->nodes[ctx->cnt++] = node;
+	if(ctx->cnt == ctx->lim) { return(RBTREE_WALK_STOP); }
+	return((*rbtree_key_ptr(ctx->tree, node) % 7 == 0) ? RBTREE_WALK_SKIP : RBTREE_WALK_CONTINUE);
+}
+
+/**
+ * @fn ut_visit_ref
+ * @brief recursive reference of ut_visit, without stop
+ */
+static
+void ut_visit_ref(
+	struct ut_visit_s *ctx,
+	RBTREE_NODE_T *node)
+{
+	if(node == NULL) { return; }
+	ut_visit_ref(ctx, rbtree_child(ctx->tree, node, 0));
+	ctx->nodes[ctx->cnt++] = node;
+	if(*rbtree_key_ptr(ctx->tree, node) % 7 != 0) {
+		ut_visit_ref(ctx, rbtree_child(ctx->tree, node, 1));
 	}
+	return;
+}
 
-	/* search (1) */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i<<1);
-		assert(n != NULL);
+/**
+ * @fn ut_visit_sum
+ * @brief sums the keys from the workers, stops at the key lim
+ */
+static
+int ut_visit_sum(
+	RBTREE_NODE_T *node,
+	void *_ctx)
+{
+	struct ut_visit_s *ctx = (struct ut_visit_s *)_ctx;
+	int64_t key = *rbtree_key_ptr(ctx->tree, node);
+	__sync_fetch_and_add(&ctx->sum, key);
+	__sync_fetch_and_add(&ctx->cnt, 1);
+	return(key == ctx->lim ? RBTREE_WALK_STOP : RBTREE_WALK_CONTINUE);
+}
 
-		assert(n->h.key == i<<1, "n->h.key(%lld), key(%lld)", n->h.key, i<<1);
-		assert(n->val == _shuf(i), "n->val(%lld), val(%lld)", n->val, _shuf(i));
+/**
+ * @fn ut_walk_nested
+ * @brief walks the same tree again from inside the callback
+ */
+static
+void ut_walk_nested(
+	RBTREE_NODE_T *node,
+	void *ctx)
+{
+	struct ut_visit_s *v = (struct ut_visit_s *)ctx;
+	if(v->cnt++ == 0) {
+		int64_t n = 0;
+		rbtree_walk(v->tree, ut_rbtree_td_count, (void *)&n);
+		v->sum = n;
 	}
+	return;
+}
 
-	/* remove */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
-		rbtree_remove(tree, (RBTREE_NODE_T *)n);
-		free(n);
-	}
+/* in-order and parallel walks */
+unittest()
+{
+	int64_t const cnt = 5000;
+	rbtree_t *trees[3] = {
+		rbtree_init(sizeof(rbtree_node_t), NULL),
+		rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN )),
+		rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ))
+	};
+	RBTREE_NODE_T **nodes = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+	RBTREE_NODE_T **exp = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t t = 0; t < 3; t++) {
+		rbtree_t *tree = trees[t];
+		for(int64_t i = 0; i < cnt; i++) {
+			RBTREE_NODE_T *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = (i * 7919) % cnt;
+			rbtree_insert(tree, node);
+		}
 
-	/* search (2) */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n == NULL);
+		/* skipping right subtrees */
+		struct ut_visit_s ref = { .tree = tree, .cnt = 0, .nodes = exp };
+		ut_visit_ref(&ref, rbtree_child(tree, NULL, 0));
+		assert(ref.cnt < cnt);
+		struct ut_visit_s v = { .tree = tree, .cnt = 0, .lim = -1, .nodes = nodes };
+		assert(rbtree_walk_inorder(tree, ut_visit, (void *)&v) == RBTREE_WALK_CONTINUE);
+		assert(v.cnt == ref.cnt && memcmp(nodes, exp, sizeof(void *) * ref.cnt) == 0, "t(%lld)", t);
+
+		/* stop */
+		v = (struct ut_visit_s){ .tree = tree, .cnt = 0, .lim = ref.cnt / 2, .nodes = nodes };
+		assert(rbtree_walk_inorder(tree, ut_visit, (void *)&v) == RBTREE_WALK_STOP);
+		assert(v.cnt == ref.cnt / 2 && memcmp(nodes, exp, sizeof(void *) * v.cnt) == 0, "t(%lld)", t);
+
+		/* walks do not share the callback */
+		v = (struct ut_visit_s){ .tree = tree, .cnt = 0, .sum = 0 };
+		rbtree_walk(tree, ut_walk_nested, (void *)&v);
+		assert(v.cnt == cnt && v.sum == cnt, "t(%lld)", t);
+
+		/* parallel, with the key never found and found */
+		for(int64_t threads = 0; threads <= 16; threads += 4) {
+			v = (struct ut_visit_s){ .tree = tree, .cnt = 0, .lim = -1, .sum = 0 };
+			assert(rbtree_walk_parallel(tree, ut_visit_sum, (void *)&v, threads) == RBTREE_WALK_CONTINUE);
+			assert(v.cnt == cnt && v.sum == cnt * (cnt - 1) / 2, "t(%lld), threads(%lld)", t, threads);
+
+			v = (struct ut_visit_s){ .tree = tree, .cnt = 0, .lim = cnt / 3, .sum = 0 };
+			assert(rbtree_walk_parallel(tree, ut_visit_sum, (void *)&v, threads) == RBTREE_WALK_STOP);
+			assert(v.cnt <= cnt, "t(%lld), threads(%lld)", t, threads);
+		}
+		rbtree_clean(tree);
 	}
-	for(int64_t i = 128; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
-	}
+	/* empty tree */
+	rbtree_t *tree = rbtree_init(sizeof(rbtree_node_t), NULL);
+	struct ut_visit_s v = { .tree = tree, .cnt = 0, .lim = -1, .nodes = nodes };
+	assert(rbtree_walk_inorder(tree, ut_visit, (void *)&v) == RBTREE_WALK_CONTINUE && v.cnt == 0);
+	assert(rbtree_walk_parallel(tree, ut_visit_sum, (void *)&v, 4) == RBTREE_WALK_CONTINUE && v.cnt == 0);
+	rbtree_clean(tree);
+	free(exp);
+	free(nodes);
+}
 
-	/* add again */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			(RBTREE_NODE_T *)malloc(sizeof(rbtree_node_t) + 8);
-		assert(n != NULL);
+/* type-specialized trees */
+struct ut_gen32_s {
+	rbtree_link_t link;
+	uint32_t key;
+	uint32_t id;
+};
+struct ut_gend_s {
+	rbtree_link_t link;
+	double key;
+};
+struct ut_genkey_s {
+	uint32_t hi;
+	uint64_t lo;
+};
+struct ut_genstr_s {
+	rbtree_link_t link;
+	struct ut_genkey_s key;
+};
 
-		memset(n, 0, sizeof(rbtree_node_t));
-		n->h.key = _shuf(i)<<1;
-		n->val = 1024 - i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
-	}
+static inline
+int ut_genkey_cmp(struct ut_genkey_s a, struct ut_genkey_s b)
+{
+	int c = RBTREE_CMP(a.hi, b.hi);
+	return(c != 0 ? c : RBTREE_CMP(a.lo, b.lo));
+}
 
-	/* search (3) */
-	for(int64_t i = 0; i < 128; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
+RBTREE_GENERATE(ut_gen32, struct ut_gen32_s, key, RBTREE_CMP)
+RBTREE_GENERATE(ut_gend, struct ut_gend_s, key, RBTREE_CMP)
+RBTREE_GENERATE(ut_genstr, struct ut_genstr_s, key, ut_genkey_cmp)
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == 1024 - i, "n->val(%lld), val(%lld)", n->val, 1024 - i);
-	}
-	for(int64_t i = 128; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
+unittest()
+{
+	int64_t const cnt = 3000, range = 1000;
+	struct ut_gen32_s *nodes = (struct ut_gen32_s *)malloc(sizeof(struct ut_gen32_s) * cnt);
+	ut_gen32_t tree;
 
-		assert(n->h.key == _shuf(i)<<1, "n->h.key(%lld), key(%lld)", n->h.key, _shuf(i)<<1);
-		assert(n->val == i, "n->val(%lld), val(%lld)", n->val, i);
+	ut_gen32_init(&tree);
+	assert(ut_gen32_first(&tree) == NULL && ut_gen32_last(&tree) == NULL);
+	assert(ut_gen32_lower_bound(&tree, 0) == NULL && ut_gen32_count(&tree) == 0);
+
+	/* duplicated keys */
+	for(int64_t i = 0; i < cnt; i++) {
+		nodes[i].key = (uint32_t)((i * 7919) % range);
+		nodes[i].id = (uint32_t)i;
+		ut_gen32_insert(&tree, &nodes[i]);
+	}
+	assert(ut_gen32_count(&tree) == (uint64_t)cnt);
+
+	/* in order, equal keys in the insertion order */
+	int64_t n = 0;
+	struct ut_gen32_s *prev = NULL;
+	for(struct ut_gen32_s *node = ut_gen32_first(&tree); node != NULL; node = ut_gen32_next(&tree, node)) {
+		if(prev != NULL) {
+			assert(prev->key < node->key || (prev->key == node->key && prev->id < node->id));
+		}
+		prev = node;
+		n++;
 	}
+	assert(n == cnt && prev == ut_gen32_last(&tree));
+	n = 0;
+	for(struct ut_gen32_s *node = ut_gen32_last(&tree); node != NULL; node = ut_gen32_prev(&tree, node)) {
+		n++;
+	}
+	assert(n == cnt);
 
-	/* cleanup */
-	rbtree_walk(tree, unittest_free_node, NULL);
-	rbtree_clean(tree);
+	/* remove the odd ids, then search against brute force */
+	for(int64_t i = 1; i < cnt; i += 2) {
+		ut_gen32_remove(&tree, &nodes[i]);
+	}
+	assert(ut_gen32_count(&tree) == (uint64_t)(cnt / 2));
+	for(uint32_t key = 0; key <= range; key++) {
+		struct ut_gen32_s *lower = NULL, *upper = NULL;
+		for(int64_t i = 0; i < cnt; i += 2) {
+			if(nodes[i].key >= key && (lower == NULL || nodes[i].key < lower->key
+				|| (nodes[i].key == lower->key && nodes[i].id < lower->id))) {
+				lower = &nodes[i];
+			}
+			if(nodes[i].key > key && (upper == NULL || nodes[i].key < upper->key
+				|| (nodes[i].key == upper->key && nodes[i].id < upper->id))) {
+				upper = &nodes[i];
+			}
+		}
+		assert(ut_gen32_lower_bound(&tree, key) == lower, "key(%u)", key);
+		assert(ut_gen32_upper_bound(&tree, key) == upper, "key(%u)", key);
+		assert(ut_gen32_find(&tree, key) == ((lower != NULL && lower->key == key) ? lower : NULL), "key(%u)", key);
+	}
+	free(nodes);
+
+	/* double keys */
+	struct ut_gend_s dnodes[64];
+	ut_gend_t dtree;
+	ut_gend_init(&dtree);
+	for(int64_t i = 0; i < 64; i++) {
+		dnodes[i].key = (double)((i * 37) % 64) * 0.25 - 4.0;
+		ut_gend_insert(&dtree, &dnodes[i]);
+	}
+	assert(ut_gend_first(&dtree)->key == -4.0 && ut_gend_last(&dtree)->key == 11.75);
+	assert(ut_gend_lower_bound(&dtree, 0.1)->key == 0.25);
+	assert(ut_gend_upper_bound(&dtree, 0.25)->key == 0.5);
+	assert(ut_gend_find(&dtree, 0.1) == NULL && ut_gend_find(&dtree, 1.5)->key == 1.5);
+	assert(ut_gend_upper_bound(&dtree, 11.75) == NULL);
+
+	/* struct keys with a user comparator */
+	struct ut_genstr_s snodes[64];
+	ut_genstr_t stree;
+	ut_genstr_init(&stree);
+	for(int64_t i = 0; i < 64; i++) {
+		snodes[i].key = (struct ut_genkey_s){ .hi = (uint32_t)(i % 4), .lo = (uint64_t)(63 - i) };
+		ut_genstr_insert(&stree, &snodes[i]);
+	}
+	n = 0;
+	for(struct ut_genstr_s *node = ut_genstr_first(&stree); node != NULL; node = ut_genstr_next(&stree, node)) {
+		assert(node == &snodes[(n / 16) + 4 * (15 - n % 16)], "n(%lld)", n);
+		n++;
+	}
+	assert(n == 64);
+	assert(ut_genstr_find(&stree, (struct ut_genkey_s){ .hi = 2, .lo = 1 }) == &snodes[62]);
+	assert(ut_genstr_lower_bound(&stree, (struct ut_genkey_s){ .hi = 1, .lo = 100 }) == &snodes[62]);
+	for(int64_t i = 0; i < 64; i++) {
+		ut_genstr_remove(&stree, &snodes[i]);
+	}
+	assert(ut_genstr_count(&stree) == 0 && ut_genstr_first(&stree) == NULL);
 }
 
-/* flush, duplicated key */
+/* equal ranges and counts of duplicated keys */
+/**
+ * @struct ut_bag_s
+ */
+struct ut_bag_s {
+	rbtree_bag_node_t h;
+	int64_t seq;
+};
+
 unittest()
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	int64_t const kcnt = 64, cnt = kcnt * (kcnt + 1) / 2;
+	rbtree_t *trees[5] = {
+		rbtree_init(sizeof(struct ut_bag_s), NULL),
+		rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .flags = RBTREE_BAG )),
+		rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN )),
+		rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 )),
+		rbtree_init(sizeof(rbtree_node_t), RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT ))	/* NULL if compact */
+	};
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+	RBTREE_NODE_T **nodes = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+	int64_t cnts[2 * kcnt + 1];
 
-	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+	/* key 2k appears k + 1 times, shuffled */
+	for(int64_t k = 0, i = 0; k < kcnt; k++) {
+		for(int64_t j = 0; j <= k; j++) { keys[i++] = 2 * k; }
+	}
+	for(int64_t i = cnt - 1; i > 0; i--) {
+		int64_t j = (i * 7919 + 13) % (i + 1);
+		rbtree_key_t tmp = keys[i]; keys[i] = keys[j]; keys[j] = tmp;
+	}
 
-	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+	for(int64_t t = 0; t < 5; t++) {
+		rbtree_t *tree = trees[t];
+		if(tree == NULL) { continue; }
+
+		memset(cnts, 0, sizeof(cnts));
+		for(int64_t i = 0; i < cnt; i++) {
+			nodes[i] = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, nodes[i]) = keys[i];
+			if(t < 2) { ((struct ut_bag_s *)nodes[i])->seq = i; }
+			rbtree_insert(tree, nodes[i]);
+			cnts[keys[i]]++;
+		}
 
-	/* insert */
-	for(int64_t i = 0; i < 65536; i++) {
-		debug("insert node i(%lld)", i);
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_create_node(tree);
-		assert(n != NULL);
+		/* before and after removing every other node */
+		int64_t live = cnt;
+		for(int64_t pass = 0; pass < 2; pass++) {
+			for(int64_t key = 0; key <= 2 * kcnt; key++) {
+				RBTREE_NODE_T *last, *first = rbtree_equal_range(tree, key, &last);
+				assert(rbtree_count_key(tree, key) == (uint64_t)cnts[key], "t(%lld), key(%lld)", t, key);
+				if(cnts[key] == 0) {
+					assert(first == NULL && last == NULL, "t(%lld), key(%lld)", t, key);
+					RBTREE_NODE_T *l = rbtree_search_key_left(tree, key), *r = rbtree_search_key_right(tree, key);
+					assert(l == NULL || (*rbtree_key_ptr(tree, l) < key && rbtree_right(tree, l) == r), "t(%lld), key(%lld)", t, key);
+					assert(r == NULL || (*rbtree_key_ptr(tree, r) > key && rbtree_left(tree, r) == l), "t(%lld), key(%lld)", t, key);
+					continue;
+				}
+				assert(first == rbtree_search_key(tree, key) && first == rbtree_search_key_left(tree, key));
+
+				RBTREE_NODE_T *prev = rbtree_left(tree, first), *next = rbtree_right(tree, last);
+				assert(prev == NULL || *rbtree_key_ptr(tree, prev) < key, "t(%lld), key(%lld)", t, key);
+				assert(next == NULL || *rbtree_key_ptr(tree, next) > key, "t(%lld), key(%lld)", t, key);
+				int64_t n = 1;
+				for(RBTREE_NODE_T *node = first; node != last; n++) {
+					RBTREE_NODE_T *right = rbtree_right(tree, node);
+					assert(*rbtree_key_ptr(tree, right) == key, "t(%lld), key(%lld)", t, key);
+
+					/* the insertion order */
+					assert(t >= 2 || ((struct ut_bag_s *)node)->seq < ((struct ut_bag_s *)right)->seq);
+					node = right;
+				}
+				assert(n == cnts[key], "t(%lld), key(%lld), n(%lld)", t, key, n);
+			}
+			assert(t >= 2 || ut_rbtree_check(tree) >= 0);
+
+			/* walks and cursors */
+			int64_t n = 0;
+			rbtree_walk(tree, ut_rbtree_td_count, (void *)&n);
+			assert(n == live, "t(%lld), n(%lld)", t, n);
+			struct ut_visit_s v = { .tree = tree, .cnt = 0, .lim = -1, .sum = 0 };
+			assert(rbtree_walk_inorder(tree, ut_visit_sum, (void *)&v) == RBTREE_WALK_CONTINUE && v.cnt == live);
+			v = (struct ut_visit_s){ .tree = tree, .cnt = 0, .lim = -1, .sum = 0 };
+			assert(rbtree_walk_parallel(tree, ut_visit_sum, (void *)&v, 4) == RBTREE_WALK_CONTINUE && v.cnt == live);
+			for(int64_t rev = 0; rev < 2; rev++) {
+				rbtree_iter_t *iter = rev ? rbtree_range_reverse(tree, 0, 2 * kcnt) : rbtree_range(tree, 0, 2 * kcnt);
+				n = 0;
+				for(RBTREE_NODE_T *node = rbtree_iter_next(iter); node != NULL; node = rbtree_iter_next(iter)) { n++; }
+				rbtree_iter_clean(iter);
+				assert(n == live, "t(%lld), rev(%lld), n(%lld)", t, rev, n);
+			}
+
+			for(int64_t i = 1; pass == 0 && i < cnt; i += 2) {
+				rbtree_remove(tree, nodes[i]);
+				cnts[keys[i]]--;
+				live--;
+			}
+		}
 
-		n->h.key = _shuf(i)<<1;
-		n->val = 65536 - i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+		/* pops in the ascending order */
+		int64_t n = 0;
+		rbtree_key_t prev = RBTREE_KEY_MIN;
+		for(RBTREE_NODE_T *node = rbtree_pop_first(tree); node != NULL; node = rbtree_pop_first(tree), n++) {
+			assert(*rbtree_key_ptr(tree, node) >= prev, "t(%lld)", t);
+			prev = *rbtree_key_ptr(tree, node);
+			rbtree_free_node(tree, node);
+		}
+		assert(n == live && rbtree_first(tree) == NULL && rbtree_last(tree) == NULL, "t(%lld), n(%lld)", t, n);
+		rbtree_clean(tree);
 	}
 
-	/* flush and insert again */
-	rbtree_flush(tree);
-	for(int64_t i = 0; i < 65536; i++) {
-		debug("insert node again i(%lld)", i);
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_create_node(tree);
-		assert(n != NULL);
-
-		n->h.key = _shuf(i)<<1;
-		n->val = i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+	/* the largest key */
+	for(int64_t t = 0; t < 2; t++) {
+		rbtree_t *tree = rbtree_init(sizeof(rbtree_node_t), t ? RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT ) : NULL);
+		if(tree == NULL) { continue; }
+		for(int64_t i = 0; i < 4; i++) {
+			RBTREE_NODE_T *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = RBTREE_KEY_MAX - (i == 0);
+			rbtree_insert(tree, node);
+		}
+		RBTREE_NODE_T *last, *first = rbtree_equal_range(tree, RBTREE_KEY_MAX, &last);
+		assert(rbtree_count_key(tree, RBTREE_KEY_MAX) == 3 && rbtree_count_key(tree, RBTREE_KEY_MAX - 1) == 1);
+		assert(first == rbtree_right(tree, rbtree_first(tree)) && last == rbtree_last(tree));
+		rbtree_clean(tree);
 	}
 
-	/* search (1) */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i<<1);
-		assert(n != NULL);
+	/* a heavy key stays on a single tree node */
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .flags = RBTREE_BAG ));
+	for(int64_t i = 0; i < 100000; i++) {
+		RBTREE_NODE_T *node = rbtree_create_node(tree);
+		*rbtree_key_ptr(tree, node) = (i % 1000 == 0) ? i : 1;
+		((struct ut_bag_s *)node)->seq = i;
+		rbtree_insert(tree, node);
 	}
-	for(int64_t i = 256; i < 65536; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i<<1);
-		assert(n == NULL);
+	assert(ut_rbtree_check(tree) >= 0 && rbtree_count_key(tree, 1) == 100000 - 100);
+	int64_t h = 0;
+	for(ngx_rbtree_node_t *node = ((struct rbtree_s *)tree)->t.root; node != ((struct rbtree_s *)tree)->t.sentinel; node = node->left) { h++; }
+	assert(h <= 14, "h(%lld)", h);
+
+	/* removing the node in the tree promotes the next one of the chain */
+	for(int64_t i = 1; i <= 100000 - 100; i++) {
+		RBTREE_NODE_T *node = rbtree_search_key(tree, 1);
+		assert(((struct ut_bag_s *)node)->seq == i + (i - 1) / 999, "i(%lld)", i);
+		rbtree_remove(tree, node);
 	}
+	assert(ut_rbtree_check(tree) >= 0 && rbtree_search_key(tree, 1) == NULL);
+	assert(rbtree_count_key(tree, 0) == 1 && rbtree_count_key(tree, 99000) == 1);
 
-	/* remove */
-	for(int64_t i = 0; i < 65536; i++) {
-		debug("remove node i(%lld)", i);
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, _shuf(i)<<1);
-		assert(n != NULL);
-		rbtree_remove(tree, (RBTREE_NODE_T *)n);
+	/* split, join and the other layouts are not available */
+	rbtree_t *l, *r;
+	assert(rbtree_split(tree, 5000, &l, &r) == -1);
+	assert(rbtree_join(tree, tree) == -1);
+	rbtree_clean(tree);
+	assert(rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32, .flags = RBTREE_BAG )) == NULL);
+	assert(rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .flags = RBTREE_BAG | RBTREE_ORDER_STAT )) == NULL);
+	assert(ivtree_init(sizeof(ivtree_node_t), IVTREE_PARAMS( .flags = RBTREE_BAG )) == NULL);
+	assert(strtree_init(sizeof(strtree_node_t), STRTREE_PARAMS( .flags = RBTREE_BAG )) == NULL);
+	free(nodes);
+	free(keys);
+}
+
+/**
+ * @fn ut_layouts_init
+ * @brief one tree of each layout: plain, RBTREE_BAG, augmented by update, RBTREE_ORDER_STAT
+ * (NULL under RBTREE_COMPACT_NODE), RBTREE_LAYOUT_TOPDOWN and RBTREE_LAYOUT_IDX32
+ */
+#define UT_LAYOUT_CNT				( 6 )
+static
+void ut_layouts_init(
+	rbtree_t **trees,
+	rbtree_update_t update,
+	void *update_ctx)
+{
+	trees[0] = rbtree_init(sizeof(struct ut_bag_s), NULL);
+	trees[1] = rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .flags = RBTREE_BAG ));
+	trees[2] = rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .update = update, .update_ctx = update_ctx ));
+	trees[3] = rbtree_init(sizeof(struct ut_bag_s), RBTREE_PARAMS( .flags = RBTREE_ORDER_STAT ));
+	trees[4] = rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN ));
+	trees[5] = rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ));
+	return;
+}
+
+/**
+ * @fn ut_layouts_check
+ * @brief 0 if the t-th tree of ut_layouts_init is consistent, with the augmented sum (t == 2)
+ */
+static
+int64_t ut_layouts_check(
+	rbtree_t *tree,
+	int64_t t,
+	int64_t sum)
+{
+	switch(t) {
+		case 2: if(ut_sum_check(tree) != sum) { return(-1); } break;
+		case 3: if(ut_ostree_check(tree) < 0) { return(-1); } break;
+		case 4: return(ut_rbtree_td_check(tree) >= 0 ? 0 : -1);
+		case 5: return(ut_rbtree32_check(tree) >= 0 ? 0 : -1);
+		default: break;
 	}
+	return(ut_rbtree_check(tree) >= 0 ? 0 : -1);
+}
 
-	/* search (2) */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_search_key(tree, i<<1);
-		assert(n == NULL);
+/* unique insert and removal by key */
+unittest()
+{
+	int64_t const kcnt = 1000;
+	int64_t updates = 0;
+	rbtree_t *trees[UT_LAYOUT_CNT];
+	ut_layouts_init(trees, ut_sum_update, (void *)&updates);
+	RBTREE_NODE_T **first = (RBTREE_NODE_T **)malloc(sizeof(void *) * kcnt);
+
+	for(int64_t t = 0; t < UT_LAYOUT_CNT; t++) {
+		rbtree_t *tree = trees[t];
+		if(tree == NULL) { continue; }
+
+		/* each key three times, only the first one is linked */
+		for(int64_t i = 0; i < 3 * kcnt; i++) {
+			rbtree_key_t key = (i * 7919) % kcnt;
+			RBTREE_NODE_T *found, *node = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, node) = key;
+			if(t == 2) { ((struct ut_sum_node_s *)node)->val = key; }
+
+			int r = rbtree_insert_unique(tree, node, &found);
+			if(i < kcnt) {
+				assert(r == 0 && found == NULL, "t(%lld), i(%lld)", t, i);
+				first[key] = node;
+			} else {
+				assert(r == 1 && found == first[key], "t(%lld), i(%lld)", t, i);
+				assert(rbtree_insert_unique(tree, node, NULL) == 1);
+				rbtree_free_node(tree, node);
+			}
+		}
+		int64_t n = 0;
+		rbtree_walk(tree, ut_rbtree_td_count, (void *)&n);
+		assert(n == kcnt, "t(%lld), n(%lld)", t, n);
+		assert(rbtree_count_range(tree, RBTREE_KEY_MIN, RBTREE_KEY_MAX) == (uint64_t)kcnt, "t(%lld)", t);
+
+		/* even keys */
+		for(int64_t i = 0; i < kcnt; i++) {
+			rbtree_key_t key = (i * 7919) % kcnt;
+			if(key % 2 != 0) { continue; }
+			RBTREE_NODE_T *node = rbtree_remove_key(tree, key);
+			assert(node == first[key], "t(%lld), key(%lld)", t, key);
+			assert(rbtree_remove_key(tree, key) == NULL, "t(%lld), key(%lld)", t, key);
+			rbtree_free_node(tree, node);
+		}
+		for(int64_t key = 0; key < kcnt; key++) {
+			assert((rbtree_search_key(tree, key) != NULL) == (key % 2 != 0), "t(%lld), key(%lld)", t, key);
+		}
+		assert(*rbtree_key_ptr(tree, rbtree_first(tree)) == 1 && *rbtree_key_ptr(tree, rbtree_last(tree)) == kcnt - 1);
+		assert(rbtree_rank(tree, kcnt / 2) == (uint64_t)kcnt / 4, "t(%lld)", t);
+		assert(ut_layouts_check(tree, t, kcnt * kcnt / 4) == 0, "t(%lld)", t);
+
+		/* the rest from both ends, moving the extremes */
+		for(int64_t i = 0; i < kcnt / 2; i++) {
+			rbtree_key_t key = (i % 2 == 0) ? 1 + i : kcnt - i;
+			RBTREE_NODE_T *node = rbtree_remove_key(tree, key);
+			assert(node != NULL && *rbtree_key_ptr(tree, node) == key, "t(%lld), key(%lld)", t, key);
+			rbtree_free_node(tree, node);
+			assert(rbtree_first(tree) == rbtree_search_key_right(tree, RBTREE_KEY_MIN), "t(%lld), key(%lld)", t, key);
+			assert(rbtree_last(tree) == rbtree_search_key_left(tree, RBTREE_KEY_MAX), "t(%lld), key(%lld)", t, key);
+		}
+		assert(rbtree_first(tree) == NULL && rbtree_count_range(tree, RBTREE_KEY_MIN, RBTREE_KEY_MAX) == 0);
+		rbtree_clean(tree);
 	}
-	rbtree_clean(tree);
+	free(first);
+}
+
+/* in-place key update */
+/**
+ * @fn ut_keysum_update
+ * @brief ut_sum_update over the keys
+ */
+static
+int ut_keysum_update(
+	RBTREE_NODE_T *node,
+	RBTREE_NODE_T *left,
+	RBTREE_NODE_T *right,
+	void *ctx)
+{
+	((struct ut_sum_node_s *)node)->val = (int64_t)((struct ut_sum_node_s *)node)->h.key;
+	return(ut_sum_update(node, left, right, ctx));
 }
 
-/* search_key_left / search_key_right / left / right (NULL) */
 unittest()
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	int64_t const cnt = 2000;
+	int64_t updates = 0;
+	rbtree_t *trees[UT_LAYOUT_CNT];
+	ut_layouts_init(trees, ut_keysum_update, (void *)&updates);
+	RBTREE_NODE_T **nodes = (RBTREE_NODE_T **)malloc(sizeof(void *) * cnt);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	for(int64_t t = 0; t < UT_LAYOUT_CNT; t++) {
+		rbtree_t *tree = trees[t];
+		if(tree == NULL) { continue; }
+		for(int64_t i = 0; i < cnt; i++) {
+			keys[i] = 10 * ((i * 7919) % cnt);
+			nodes[i] = rbtree_create_node(tree);
+			*rbtree_key_ptr(tree, nodes[i]) = keys[i];
+			rbtree_insert(tree, nodes[i]);
+		}
 
-	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+		/* a small shift stays in place */
+		if(t < 4) {
+			ngx_rbtree_node_t *node = (ngx_rbtree_node_t *)rbtree_search_key(tree, 5000);
+			ngx_rbtree_node_t *parent = ngx_rbt_parent(node), *left = node->left, *right = node->right;
+			rbtree_update_key(tree, (RBTREE_NODE_T *)node, 5004);
+			assert(node->key == 5004 && ngx_rbt_parent(node) == parent && node->left == left && node->right == right);
+			for(int64_t i = 0; i < cnt; i++) {
+				if(nodes[i] == (RBTREE_NODE_T *)node) { keys[i] = 5004; }
+			}
+		}
 
-	/* search left */
-	struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-		rbtree_search_key_left(tree, 0);
-	assert(n == NULL);
+		/* mostly small shifts, some long moves */
+		uint64_t h = 1;
+		for(int64_t r = 0; r < 20; r++) {
+			for(int64_t u = 0; u < 1000; u++) {
+				h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+				int64_t i = (h>>33) % cnt;
+				int64_t d = ((h>>20) & 0x1f) - 16;
+				keys[i] = (u % 16 == 0) ? (int64_t)((h>>40) % (10 * cnt)) : keys[i] + d;
+				keys[i] = (keys[i] < 0) ? -keys[i] : keys[i];		/* the sums stay positive */
+				rbtree_update_key(tree, nodes[i], keys[i]);
+			}
+
+			/* in order, with the extremes */
+			int64_t n = 0, sum = 0;
+			rbtree_key_t prev = RBTREE_KEY_MIN, last = RBTREE_KEY_MIN;
+			for(RBTREE_NODE_T *node = rbtree_first(tree); node != NULL; node = rbtree_right(tree, node), n++) {
+				assert(*rbtree_key_ptr(tree, node) >= prev, "t(%lld), r(%lld)", t, r);
+				prev = last = *rbtree_key_ptr(tree, node);
+				sum += prev;
+			}
+			int64_t exp = 0;
+			for(int64_t i = 0; i < cnt; i++) {
+				assert(*rbtree_key_ptr(tree, nodes[i]) == keys[i]);
+				exp += keys[i];
+			}
+			assert(n == cnt && sum == exp, "t(%lld), r(%lld), n(%lld)", t, r, n);
+			assert(*rbtree_key_ptr(tree, rbtree_last(tree)) == last);
+			assert(ut_layouts_check(tree, t, exp) == 0, "t(%lld), r(%lld)", t, r);
+		}
+		rbtree_clean(tree);
+	}
+	free(keys);
+	free(nodes);
+}
 
-	n = (struct ut_rbnode_s *)rbtree_search_key_left(tree, 100);
-	assert(n == NULL);
+/* persistent versions */
+/**
+ * @struct ut_pers_s
+ */
+struct ut_pers_s {
+	rbtree_node_td_t h;
+	int64_t val;
+};
 
-	/* search right */
-	n = (struct ut_rbnode_s *)rbtree_search_key_right(tree, 0);
-	assert(n == NULL);
+/**
+ * @struct ut_td_nodes_s
+ */
+struct ut_td_nodes_s {
+	ngx_rbtree_td_node_t **nodes;
+	uint64_t n;
+};
 
-	n = (struct ut_rbnode_s *)rbtree_search_key_right(tree, 200);
-	assert(n == NULL);
+/**
+ * @fn ut_td_collect
+ */
+static
+void ut_td_collect(
+	ngx_rbtree_td_node_t *node,
+	void *ctx)
+{
+	struct ut_td_nodes_s *c = (struct ut_td_nodes_s *)ctx;
+	c->nodes[c->n++] = node;
+	return;
+}
 
-	/* left / right of sentinel */
-	n = (struct ut_rbnode_s *)rbtree_left(tree, (RBTREE_NODE_T *)&tree->sentinel);
-	assert(n == NULL);
+/**
+ * @fn ut_td_refs_check
+ * @brief the number of nodes the versions hold, -1 if a reference count differs from the links and the roots
+ */
+static
+int64_t ut_td_refs_check(
+	rbtree_t **versions,
+	int64_t vcnt)
+{
+	uint64_t cap = 1;
+	for(int64_t v = 0; v < vcnt; v++) { cap += ((struct rbtree_s *)versions[v])->cnt; }
+	struct ut_td_nodes_s c = {
+		.nodes = (ngx_rbtree_td_node_t **)malloc(sizeof(void *) * cap),
+		.n = 0
+	};
+	for(int64_t v = 0; v < vcnt; v++) {
+		ngx_rbtree_td_walk(&((struct rbtree_s *)versions[v])->td, ut_td_collect, (void *)&c);
+	}
 
-	n = (struct ut_rbnode_s *)rbtree_right(tree, (RBTREE_NODE_T *)&tree->sentinel);
-	assert(n == NULL);
+	/* distinct nodes */
+	qsort(c.nodes, c.n, sizeof(void *), ut_ptr_cmp);
+	uint64_t n = 0;
+	for(uint64_t i = 0; i < c.n; i++) {
+		if(n == 0 || c.nodes[n - 1] != c.nodes[i]) { c.nodes[n++] = c.nodes[i]; }
+	}
 
-	rbtree_clean(tree);
+	uint32_t *refs = (uint32_t *)calloc(n + 1, sizeof(uint32_t));
+	for(int64_t v = 0; v <= (int64_t)n + vcnt - 1; v++) {
+		ngx_rbtree_td_node_t *links[2] = { NULL, NULL };
+		if(v < vcnt) {
+			links[0] = ((struct rbtree_s *)versions[v])->td.root;
+		} else {
+			links[0] = c.nodes[v - vcnt]->link[0];
+			links[1] = c.nodes[v - vcnt]->link[1];
+		}
+		for(uint64_t d = 0; d < 2; d++) {
+			if(links[d] == NULL) { continue; }
+			ngx_rbtree_td_node_t **p = (ngx_rbtree_td_node_t **)bsearch(&links[d], c.nodes, n, sizeof(void *), ut_ptr_cmp);
+			refs[p - c.nodes]++;
+		}
+	}
+
+	int64_t res = n;
+	for(uint64_t i = 0; i < n; i++) {
+		if(c.nodes[i]->refs != refs[i]) { res = -1; }
+	}
+	free(refs);
+	free(c.nodes);
+	return(res);
+}
+
+/**
+ * @fn ut_pers_check
+ * @brief 0 if the version holds the keys marked in exp, with their values
+ */
+static
+int64_t ut_pers_check(
+	rbtree_t *tree,
+	uint8_t const *exp,
+	int64_t kcnt)
+{
+	rbtree_iter_t *iter = rbtree_range(tree, RBTREE_KEY_MIN, RBTREE_KEY_MAX);
+	struct ut_pers_s *node = (struct ut_pers_s *)rbtree_iter_next(iter);
+	int64_t n = 0;
+	for(int64_t k = 0; k < kcnt; k++) {
+		if(!exp[k]) { continue; }
+		if(node == NULL || node->h.key != k || node->val != k + 1) { n = -1; break; }
+		node = (struct ut_pers_s *)rbtree_iter_next(iter);
+		n++;
+	}
+	rbtree_iter_clean(iter);
+	if(node != NULL || rbtree_count_range(tree, RBTREE_KEY_MIN, RBTREE_KEY_MAX) != (uint64_t)n) { return(-1); }
+	if(n > 0 && ((struct ut_pers_s *)rbtree_last(tree))->h.key != *rbtree_key_ptr((struct rbtree_s *)tree,
+		rbtree_search_key_left(tree, RBTREE_KEY_MAX))) {
+		return(-1);
+	}
+	return(ut_rbtree_td_check(tree) >= 0 ? 0 : -1);
 }
 
-/* search_key_left / search_key_right / left / right (NULL) */
 unittest()
 {
-	rbtree_t *tree = rbtree_init(sizeof(struct ut_rbnode_s), NULL);
+	int64_t const cnt = 4096, kcnt = 2 * cnt;
+	assert(rbtree_init(sizeof(rbtree_node_t), RBTREE_PARAMS( .flags = RBTREE_PERSISTENT )) == NULL);
+	assert(rbtree_init(sizeof(rbtree_node32_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32, .flags = RBTREE_PERSISTENT )) == NULL);
+	rbtree_t *plain = rbtree_init(sizeof(rbtree_node_td_t), RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN ));
+	assert(rbtree_snapshot(plain) == NULL);
+	rbtree_clean(plain);
+
+	rbtree_t *v[6] = { 0 };
+	uint8_t *exp[6] = { 0 };
+	v[0] = rbtree_init(sizeof(struct ut_pers_s),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN, .flags = RBTREE_PERSISTENT ));
+	for(int64_t i = 0; i < 6; i++) { exp[i] = (uint8_t *)calloc(kcnt, 1); }
+
+	/* a version of the empty tree stays empty */
+	v[1] = rbtree_snapshot(v[0]);
+	assert(v[1] != NULL && rbtree_first(v[1]) == NULL);
+	for(int64_t i = 0; i < cnt; i++) {
+		struct ut_pers_s *node = (struct ut_pers_s *)rbtree_create_node(v[0]);
+		node->h.key = 2 * ((i * 7919) % cnt);
+		node->val = node->h.key + 1;
+		rbtree_insert(v[0], (RBTREE_NODE_T *)node);
+		exp[0][node->h.key] = 1;
+	}
+	assert(ut_pers_check(v[1], exp[1], kcnt) == 0);
+	assert(ut_pers_check(v[0], exp[0], kcnt) == 0);
+	assert(ut_td_refs_check(v, 2) == cnt);
+
+	/* the writes after a snapshot copy the nodes on their paths only */
+	v[2] = rbtree_snapshot(v[0]);
+	memcpy(exp[2], exp[0], kcnt);
+	struct ut_pers_s *node = (struct ut_pers_s *)rbtree_create_node(v[0]);
+	node->h.key = 1;
+	node->val = 2;
+	rbtree_insert(v[0], (RBTREE_NODE_T *)node);
+	exp[0][1] = 1;
+	int64_t held = ut_td_refs_check(v, 3);
+	assert(held > cnt + 1 && held < cnt + 1 + 64, "held(%lld)", held);
+
+	rbtree_remove(v[0], rbtree_search_key(v[0], 200));
+	exp[0][200] = 0;
+	held = ut_td_refs_check(v, 3);
+	assert(held > cnt + 1 && held < cnt + 1 + 2 * 64, "held(%lld)", held);
+	assert(ut_pers_check(v[0], exp[0], kcnt) == 0);
+	assert(ut_pers_check(v[2], exp[2], kcnt) == 0);
+
+	/* a key update relinks a copy, the version keeps the old key */
+	rbtree_update_key(v[0], rbtree_search_key(v[2], 10), 11);
+	assert(rbtree_search_key(v[0], 10) == NULL && ((struct ut_pers_s *)rbtree_search_key(v[0], 11))->val == 11);
+	assert(((struct ut_pers_s *)rbtree_search_key(v[2], 10))->val == 11 && rbtree_search_key(v[2], 11) == NULL);
+	rbtree_update_key(v[0], rbtree_search_key(v[0], 11), 10);
+	assert(ut_pers_check(v[0], exp[0], kcnt) == 0);
+
+	/* unique insertion copies nothing if the key is found */
+	held = ut_td_refs_check(v, 3);
+	node = (struct ut_pers_s *)rbtree_create_node(v[0]);
+	node->h.key = 12;
+	RBTREE_NODE_T *existing = NULL;
+	assert(rbtree_insert_unique(v[0], (RBTREE_NODE_T *)node, &existing) == 1);
+	assert(existing == rbtree_search_key(v[0], 12) && ut_td_refs_check(v, 3) == held);
+	rbtree_free_node(v[0], (RBTREE_NODE_T *)node);
+
+	/* nor does a removal of a missing key, or an update of a node removed from the tree */
+	assert(rbtree_remove_key(v[0], 200) == NULL && ut_td_refs_check(v, 3) == held);
+	rbtree_update_key(v[0], rbtree_search_key(v[2], 200), 201);
+	assert(rbtree_search_key(v[0], 201) == NULL && ut_td_refs_check(v, 3) == held);
+	assert(ut_pers_check(v[0], exp[0], kcnt) == 0 && ut_pers_check(v[2], exp[2], kcnt) == 0);
+
+	/* random writes to the tree and the versions, snapshots taken and released on the way */
+	uint64_t h = 1;
+	for(int64_t r = 0; r < 60; r++) {
+		int64_t t = (r % 3 == 2) ? 1 + (r / 3) % 5 : 0;
+		if(v[t] == NULL) { t = 0; }
+		for(int64_t u = 0; u < 300; u++) {
+			h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+			int64_t k = (h>>33) % kcnt;
+			switch((h>>20) % 5) {
+			case 0: case 1:
+				node = (struct ut_pers_s *)rbtree_create_node(v[t]);
+				node->h.key = k;
+				node->val = k + 1;
+				rbtree_insert(v[t], (RBTREE_NODE_T *)node);
+				exp[t][k] = 1;
+				break;
+			case 2:
+				node = (struct ut_pers_s *)rbtree_remove_key(v[t], k);
+				assert((node != NULL) == exp[t][k], "r(%lld), k(%lld)", r, k);
+				if(node == NULL) { break; }
+				assert(node->h.key == k && node->val == k + 1);
+				rbtree_free_node(v[t], (RBTREE_NODE_T *)node);
+				exp[t][k] = 0;
+				break;
+			case 3:
+				if(exp[t][k]) { rbtree_remove(v[t], rbtree_search_key(v[t], k)); }
+				exp[t][k] = 0;
+				break;
+			case 4:
+				node = (struct ut_pers_s *)rbtree_pop_first(v[t]);
+				if(node == NULL) { break; }
+				for(int64_t j = 0; j < node->h.key; j++) { assert(exp[t][j] == 0); }
+				assert(exp[t][node->h.key] == 1 && node->val == node->h.key + 1);
+				exp[t][node->h.key] = 0;
+				rbtree_free_node(v[t], (RBTREE_NODE_T *)node);
+				break;
+			}
+		}
 
-	#define _shuf(x)		( (0xff & ((i<<4) | (i>>4))) )
+		int64_t vcnt = 0;
+		rbtree_t *live[6];
+		for(int64_t i = 0; i < 6; i++) {
+			if(v[i] == NULL) { continue; }
+			assert(ut_pers_check(v[i], exp[i], kcnt) == 0, "r(%lld), i(%lld)", r, i);
+			live[vcnt++] = v[i];
+		}
+		assert(ut_td_refs_check(live, vcnt) >= 0, "r(%lld)", r);
+
+		/* a snapshot replaces a version every other round */
+		int64_t s = 1 + r % 5;
+		if(r % 2 == 0) {
+			rbtree_clean(v[s]);
+			v[s] = rbtree_snapshot(v[0]);
+			memcpy(exp[s], exp[0], kcnt);
+		}
+	}
 
-	debug("tree->root(%p), tree->sentinel(%p)", tree->t.root, tree->t.sentinel);
+	/* the nodes no version refers to are freed as the versions are released */
+	for(int64_t i = 1; i < 6; i++) {
+		rbtree_clean(v[i]);
+		v[i] = NULL;
+	}
+	int64_t n = 0;
+	for(int64_t k = 0; k < kcnt; k++) { n += exp[0][k]; }
+	assert(ut_td_refs_check(v, 1) == n);
+	assert(ut_pers_check(v[0], exp[0], kcnt) == 0);
+
+	/* flush drops the references only while a version is alive */
+	v[1] = rbtree_snapshot(v[0]);
+	rbtree_flush(v[0]);
+	assert(rbtree_first(v[0]) == NULL && ut_pers_check(v[1], exp[0], kcnt) == 0);
+	assert(ut_td_refs_check(&v[1], 1) == n);
+	rbtree_clean(v[0]);
+	assert(ut_pers_check(v[1], exp[0], kcnt) == 0);
+	rbtree_clean(v[1]);
+	for(int64_t i = 0; i < 6; i++) { free(exp[i]); }
+}
 
-	/* insert */
-	for(int64_t i = 0; i < 256; i++) {
-		struct ut_rbnode_s *n = (struct ut_rbnode_s *)
-			rbtree_create_node(tree);
-		assert(n != NULL);
+/* lock-free readers */
+/**
+ * @struct ut_conc_s
+ */
+struct ut_conc_s {
+	rbtree_reader_t *reader;
+	int64_t kcnt;
+	uint64_t *stop;
+	int64_t reads, fails;
+};
 
-		n->h.key = _shuf(i)<<1;
-		n->val = i;
-		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+/**
+ * @fn ut_conc_reader
+ * @brief the even keys stay while the odd ones come and go, and each version is sorted in itself
+ */
+static
+void *ut_conc_reader(
+	void *arg)
+{
+	struct ut_conc_s *c = (struct ut_conc_s *)arg;
+	uint64_t h = (uintptr_t)c;
+	while(__atomic_load_n(c->stop, __ATOMIC_RELAXED) == 0) {
+		rbtree_t *view = rbtree_read_lock(c->reader);
+		for(int64_t j = 0; j < 64; j++) {
+			h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+			int64_t k = 2 * ((h>>33) % (c->kcnt / 2));
+			struct ut_pers_s *node = (struct ut_pers_s *)rbtree_search_key(view, k);
+			c->fails += (node == NULL || node->h.key != k || node->val != k + 1);
+		}
+		if(c->reads % 64 == 0) {
+			uint64_t n = 0;
+			rbtree_key_t prev = RBTREE_KEY_MIN;
+			for(RBTREE_NODE_T *node = rbtree_first(view); node != NULL; node = rbtree_right(view, node), n++) {
+				struct ut_pers_s *p = (struct ut_pers_s *)node;
+				c->fails += (p->h.key <= prev || (p->h.key % 2 == 0 && p->val != p->h.key + 1));
+				prev = p->h.key;
+			}
+			c->fails += (n != ((struct rbtree_s *)view)->cnt || rbtree_last(view) == NULL
+				|| *rbtree_key_ptr((struct rbtree_s *)view, rbtree_last(view)) != prev);
+		}
+		rbtree_read_unlock(c->reader);
+		c->reads++;
 	}
+	return(NULL);
+}
 
-	/* search left */
-	rbtree_node_t *n1 = rbtree_search_key_left(tree, 64);
-	rbtree_node_t *n2 = rbtree_search_key_left(tree, 65);
-	assert(n1 == n2, "n1(%p), n2(%p)", n1, n2);
-	assert(n1->key == 64, "key(%lld)", n1->key);
-	assert(n2->key == 64, "key(%lld)", n2->key);
-
-	/* left and right */
-	n1 = rbtree_left(tree, n1);
-	assert(n1->key == 62, "key(%lld)", n1->key);
-	n2 = rbtree_right(tree, n2);
-	assert(n2->key == 66, "key(%lld)", n2->key);
+unittest()
+{
+	int64_t const kcnt = 4096, threads = 4;
+	assert(rbtree_init(sizeof(rbtree_node_t), RBTREE_PARAMS( .flags = RBTREE_CONCURRENT )) == NULL);
+	rbtree_t *plain = rbtree_init(sizeof(struct ut_pers_s),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN, .flags = RBTREE_PERSISTENT ));
+	assert(rbtree_reader_init(plain) == NULL);
+	rbtree_clean(plain);
+
+	rbtree_t *tree = rbtree_init(sizeof(struct ut_pers_s),
+		RBTREE_PARAMS( .layout = RBTREE_LAYOUT_TOPDOWN, .flags = RBTREE_CONCURRENT ));
+	struct rbtree_s *t = (struct rbtree_s *)tree;
+	uint8_t *exp = (uint8_t *)calloc(kcnt, 1);
+	rbtree_reader_t *reader = rbtree_reader_init(tree);
+	assert(reader != NULL && rbtree_first(rbtree_read_lock(reader)) == NULL);
+	rbtree_read_unlock(reader);
+	for(int64_t i = 0; i < kcnt / 2; i++) {
+		struct ut_pers_s *node = (struct ut_pers_s *)rbtree_create_node(tree);
+		node->h.key = 2 * ((i * 7919) % (kcnt / 2));
+		node->val = node->h.key + 1;
+		rbtree_insert(tree, (RBTREE_NODE_T *)node);
+		exp[node->h.key] = 1;
+	}
 
+	/* nothing is left retired without readers */
+	assert(lmm_kv_size(t->retired) == 0);
+	rbtree_t *vs[2] = { tree, tree };		/* the version refers to the root as well */
+	assert(ut_td_refs_check(vs, 2) == kcnt / 2);
 
-	/* search right */
-	n1 = rbtree_search_key_right(tree, 31);
-	n2 = rbtree_search_key_right(tree, 32);
-	assert(n1 == n2, "n1(%p), n2(%p)", n1, n2);
-	assert(n1->key == 32, "key(%lld)", n1->key);
-	assert(n2->key == 32, "key(%lld)", n2->key);
+	/* a version stays while read, and is freed after */
+	rbtree_t *view = rbtree_read_lock(reader);
+	rbtree_flush(tree);
+	assert(rbtree_first(tree) == NULL && ut_pers_check(view, exp, kcnt) == 0);
+	assert(lmm_kv_size(t->retired) - t->retired_head > (uint64_t)kcnt / 2);
+	rbtree_read_unlock(reader);
+	rbtree_t *empty = rbtree_read_lock(reader);
+	assert(empty == view && rbtree_first(empty) == NULL);
+	rbtree_read_unlock(reader);
+	rbtree_build_sorted(tree, (rbtree_key_t const []){ 0, 2, 4 }, 3);
+	assert(lmm_kv_size(t->retired) == 0);
+	rbtree_reader_clean(reader);
+
+	for(int64_t k = 0; k < kcnt; k += 2) {
+		struct ut_pers_s *node = (struct ut_pers_s *)rbtree_create_node(tree);
+		node->h.key = k;
+		node->val = k + 1;
+		rbtree_insert(tree, (RBTREE_NODE_T *)node);
+	}
 
-	/* left and right */
-	n1 = rbtree_left(tree, n1);
-	assert(n1->key == 30, "key(%lld)", n1->key);
-	n2 = rbtree_right(tree, n2);
-	assert(n2->key == 34, "key(%lld)", n2->key);
+	/* one writer against the readers */
+	uint64_t stop = 0;
+	struct ut_conc_s c[threads];
+	pthread_t th[threads];
+	for(int64_t i = 0; i < threads; i++) {
+		c[i] = (struct ut_conc_s){ .reader = rbtree_reader_init(tree), .kcnt = kcnt, .stop = &stop };
+		assert(pthread_create(&th[i], NULL, ut_conc_reader, (void *)&c[i]) == 0);
+	}
+	uint64_t h = 1;
+	for(int64_t u = 0; u < 100000; u++) {
+		h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+		int64_t k = (h>>33) % kcnt;
+		if(k % 2 == 0 || (h>>20) % 2 == 0) {
+			/* the even keys are replaced, never missing */
+			struct ut_pers_s *node = (struct ut_pers_s *)rbtree_create_node(tree);
+			node->h.key = k;
+			node->val = k + 1;
+			rbtree_insert(tree, (RBTREE_NODE_T *)node);
+		} else if((h>>21) % 2 == 0) {
+			RBTREE_NODE_T *node = rbtree_remove_key(tree, k);
+			if(node != NULL) { rbtree_free_node(tree, node); }
+		} else {
+			RBTREE_NODE_T *node = rbtree_search_key(tree, k);
+			if(node != NULL && (h>>22) % 2 == 0) {
+				rbtree_remove(tree, node);
+			} else if(node != NULL && rbtree_search_key(tree, k + 2 < kcnt ? k + 2 : 1) == NULL) {
+				rbtree_update_key(tree, node, k + 2 < kcnt ? k + 2 : 1);
+			}
+		}
+	}
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for(int64_t i = 0; i < threads; i++) {
+		pthread_join(th[i], NULL);
+		assert(c[i].reads > 0 && c[i].fails == 0, "i(%lld), reads(%lld), fails(%lld)", i, c[i].reads, c[i].fails);
+		rbtree_reader_clean(c[i].reader);
+	}
 
+	/* the versions are consistent with the tree after all */
+	assert(ut_rbtree_td_check(tree) >= 0);
+	int64_t n = ut_td_refs_check(vs, 2);
+	assert(n == (int64_t)t->cnt && n >= kcnt / 2, "n(%lld)", n);
 	rbtree_clean(tree);
+	free(exp);
 }
 
 /* interval tree test */
@@ -1150,6 +7074,445 @@ unittest()
 	ivtree_clean(tree);
 }
 
+/**
+ * @fn ut_ivtree_check
+ * @brief check rkey_max in addition to the red-black properties
+ */
+static
+int64_t ut_ivtree_check_intl(
+	ngx_ivtree_node_t *node,
+	ngx_ivtree_node_t *sentinel)
+{
+	if(node == sentinel) { return(1); }
+
+	int64_t rkey_max = node->rkey;
+	if(node->left->rkey_max > rkey_max) { rkey_max = node->left->rkey_max; }
+	if(node->right->rkey_max > rkey_max) { rkey_max = node->right->rkey_max; }
+	if(node->rkey_max != rkey_max) { return(0); }
+	return(ut_ivtree_check_intl(node->left, sentinel)
+		&& ut_ivtree_check_intl(node->right, sentinel));
+}
+static
+int64_t ut_ivtree_check(
+	ivtree_t *tree)
+{
+	if(ut_rbtree_check((rbtree_t *)tree) < 0) { return(-1); }
+	return(ut_ivtree_check_intl(
+		(ngx_ivtree_node_t *)tree->t.root,
+		(ngx_ivtree_node_t *)tree->t.sentinel) ? 0 : -1);
+}
+
+/* build from sorted keys */
+unittest()
+{
+	int64_t const cnt = 1000;
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * 2 * cnt);
+	for(int64_t i = 0; i < cnt; i++) {
+		keys[2 * i] = i;
+		keys[2 * i + 1] = i + 1 + (_shuf(i) & 0x1f);
+	}
+
+	ivtree_t *tree = ivtree_init(sizeof(struct ut_ivnode_s), NULL);
+	ivtree_node_t *n = ivtree_build_sorted(tree, keys, cnt);
+	assert(ut_ivtree_check(tree) >= 0);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		assert(_check_node(n, keys[2 * i], keys[2 * i + 1]), _print_node(n));
+		n = (ivtree_node_t *)rbtree_right((rbtree_t *)tree, (RBTREE_NODE_T *)n);
+	}
+	assert(n == NULL);
+
+	/* compare intersect with brute force */
+	for(int64_t q = 0; q < cnt + 50; q += 7) {
+		ivtree_iter_t *iter = ivtree_intersect(tree, q, q + 5);
+		for(int64_t i = 0; i < cnt; i++) {
+			if(keys[2 * i + 1] <= q || keys[2 * i] >= q + 5) { continue; }
+			n = ivtree_next(iter);
+			assert(_check_node(n, keys[2 * i], keys[2 * i + 1]), "q(%lld), i(%lld)", q, i);
+		}
+		n = ivtree_next(iter);
+		assert(n == NULL, "q(%lld)", q);
+		ivtree_iter_clean(iter);
+	}
+
+	ivtree_clean(tree);
+	free(keys);
+}
+
+/* batch insert */
+unittest()
+{
+	int64_t const cnt = 3000;
+	ivtree_t *tree = ivtree_init(sizeof(struct ut_ivnode_s), NULL);
+	struct ut_ivnode_s **nodes = (struct ut_ivnode_s **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t b = 0; b < 3; b++) {
+		for(int64_t i = 0; i < cnt; i++) {
+			int64_t x = ((b * cnt + i) * 7919) % 10007;
+			nodes[i] = (struct ut_ivnode_s *)ivtree_create_node(tree);
+			nodes[i]->h.lkey = x;
+			nodes[i]->h.rkey = x + 1 + (x & 0x3f);
+		}
+		ivtree_insert_batch(tree, (IVTREE_NODE_T **)nodes, (b == 2) ? 100 : cnt);
+		assert(ut_ivtree_check(tree) >= 0, "b(%lld)", b);
+	}
+
+	/* count intersections with brute force over the tree */
+	for(int64_t q = 0; q < 10100; q += 101) {
+		int64_t expected = 0, found = 0;
+		for(ngx_ivtree_node_t *n = (ngx_ivtree_node_t *)rbtree_search_key_right((rbtree_t *)tree, INT64_MIN);
+			n != NULL;
+			n = (ngx_ivtree_node_t *)rbtree_right((rbtree_t *)tree, (RBTREE_NODE_T *)n)) {
+			expected += (n->rkey > q && n->lkey < q + 10);
+		}
+		ivtree_iter_t *iter = ivtree_intersect(tree, q, q + 10);
+		while(ivtree_next(iter) != NULL) { found++; }
+		ivtree_iter_clean(iter);
+		assert(found == expected, "q(%lld), found(%lld), expected(%lld)", q, found, expected);
+	}
+
+	free(nodes);
+	ivtree_clean(tree);
+}
+
+/* intersect with sorted queries */
+unittest()
+{
+	int64_t const cnt = 2000;
+	ivtree_t *tree = ivtree_init(sizeof(struct ut_ivnode_s), NULL);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		int64_t x = (i * 7919) % 10007;
+		struct ut_ivnode_s *n = (struct ut_ivnode_s *)ivtree_create_node(tree);
+		n->h.lkey = x;
+		n->h.rkey = x + 1 + (_shuf(i) & 0xff);
+		ivtree_insert(tree, (IVTREE_NODE_T *)n);
+	}
+
+	/* the last queries go backward */
+	ivtree_iter_t *iter = NULL;
+	for(int64_t i = 0; i < 1200; i++) {
+		int64_t q = (i < 1100) ? 10 * i - 50 : 10 * (1200 - i);
+		iter = ivtree_intersect_sorted(tree, iter, q, q + 7);
+
+		ivtree_iter_t *ref = ivtree_intersect(tree, q, q + 7);
+		ivtree_node_t *n, *m;
+		do {
+			n = ivtree_next(iter);
+			m = ivtree_next(ref);
+			assert(n == m, "q(%lld)", q);
+		} while(n != NULL && m != NULL);
+		ivtree_iter_clean(ref);
+	}
+	ivtree_iter_clean(iter);
+	ivtree_clean(tree);
+}
+
+/* index-linked layout */
+unittest()
+{
+	int64_t const cnt = 3000;
+	ivtree_t *tree = ivtree_init(sizeof(ivtree_node32_t),
+		IVTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 ));
+	ivtree_node32_t **nodes = (ivtree_node32_t **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		int64_t x = (i * 7919) % 10007;
+		nodes[i] = (ivtree_node32_t *)ivtree_create_node(tree);
+		nodes[i]->lkey = x;
+		nodes[i]->rkey = x + 1 + (_shuf(i) & 0xff);
+		ivtree_insert(tree, (IVTREE_NODE_T *)nodes[i]);
+	}
+	for(int64_t i = 0; i < cnt; i += 2) {
+		ivtree_remove(tree, (IVTREE_NODE_T *)nodes[i]);
+	}
+	assert(ut_rbtree32_check((rbtree_t *)tree) > 0);
+
+	for(int64_t q = 0; q < 10300; q += 103) {
+		int64_t exp[3] = { 0 }, found[3] = { 0 };
+		for(int64_t i = 1; i < cnt; i += 2) {
+			ivtree_node32_t *n = nodes[i];
+			exp[0] += (n->lkey >= q && n->rkey < q + 50);
+			exp[1] += (n->lkey <= q && n->rkey >= q + 50);
+			exp[2] += (n->rkey > q && n->lkey < q + 50);
+		}
+
+		ivtree_iter_t *iter[3] = {
+			ivtree_contained(tree, q, q + 50),
+			ivtree_containing(tree, q, q + 50),
+			ivtree_intersect(tree, q, q + 50)
+		};
+		for(int64_t k = 0; k < 3; k++) {
+			while(ivtree_next(iter[k]) != NULL) { found[k]++; }
+			ivtree_iter_clean(iter[k]);
+			assert(found[k] == exp[k], "q(%lld), k(%lld), found(%lld), exp(%lld)", q, k, found[k], exp[k]);
+		}
+	}
+
+	free(nodes);
+	ivtree_clean(tree);
+}
+
+/* split and join */
+unittest()
+{
+	int64_t const cnt = 3000;
+	ivtree_t *tree = ivtree_init(sizeof(struct ut_ivnode_s), NULL);
+	struct ut_ivnode_s **nodes = (struct ut_ivnode_s **)malloc(sizeof(void *) * cnt);
+
+	for(int64_t i = 0; i < cnt; i++) {
+		int64_t x = (i * 7919) % 10007;
+		nodes[i] = (struct ut_ivnode_s *)ivtree_create_node(tree);
+		nodes[i]->h.lkey = x;
+		nodes[i]->h.rkey = x + 1 + (_shuf(i) & 0xff);
+		ivtree_insert(tree, (IVTREE_NODE_T *)nodes[i]);
+	}
+
+	for(int64_t q = 0; q < 10300; q += 211) {
+		ivtree_t *left = NULL, *right = NULL;
+		assert(ivtree_split(tree, q, &left, &right) == 0);
+		assert(ut_ivtree_check(left) >= 0 && ut_ivtree_check(right) >= 0, "q(%lld)", q);
+
+		/* intersections against the brute force on each side */
+		int64_t exp[2] = { 0 }, found[2] = { 0 };
+		for(int64_t i = 0; i < cnt; i++) {
+			ivtree_node_t *n = &nodes[i]->h;
+			if(n->rkey > q - 100 && n->lkey < q + 100) { exp[n->lkey >= q]++; }
+		}
+		ivtree_iter_t *iter[2] = {
+			ivtree_intersect(left, q - 100, q + 100),
+			ivtree_intersect(right, q - 100, q + 100)
+		};
+		for(int64_t k = 0; k < 2; k++) {
+			ivtree_node_t *n;
+			while((n = (ivtree_node_t *)ivtree_next(iter[k])) != NULL) {
+				assert((n->lkey >= q) == k, "q(%lld), k(%lld)", q, k);
+				found[k]++;
+			}
+			ivtree_iter_clean(iter[k]);
+			assert(found[k] == exp[k], "q(%lld), k(%lld), found(%lld), exp(%lld)", q, k, found[k], exp[k]);
+		}
+
+		assert(ivtree_join(left, right) == 0);
+		assert(ut_ivtree_check(tree) >= 0, "q(%lld)", q);
+		ivtree_clean(right);
+	}
+
+	/* rkey_max is recomputed up to the root on removal */
+	for(int64_t i = 0; i < cnt; i += 2) {
+		ivtree_remove(tree, (IVTREE_NODE_T *)nodes[i]);
+		if(i % 64 == 0) { assert(ut_ivtree_check(tree) >= 0, "i(%lld)", i); }
+	}
+	assert(ut_ivtree_check(tree) >= 0);
+
+	free(nodes);
+	ivtree_clean(tree);
+}
+
+/* linear-time merge */
+unittest()
+{
+	int64_t const cnt = 3000;
+	ivtree_t *trees[2] = {
+		ivtree_init(sizeof(struct ut_ivnode_s), NULL),
+		ivtree_init(sizeof(struct ut_ivnode_s), NULL)
+	};
+	struct ut_ivnode_s **nodes = (struct ut_ivnode_s **)malloc(sizeof(void *) * cnt);
+
+	/* the long intervals in src raise rkey_max over the nodes of dst */
+	for(int64_t i = 0; i < cnt; i++) {
+		int64_t x = (i * 7919) % 10007;
+		nodes[i] = (struct ut_ivnode_s *)ivtree_create_node(trees[i & 1]);
+		nodes[i]->h.lkey = x;
+		nodes[i]->h.rkey = x + 1 + ((i & 1) ? (_shuf(i) & 0xfff) : (_shuf(i) & 0xf));
+		ivtree_insert(trees[i & 1], (IVTREE_NODE_T *)nodes[i]);
+	}
+	assert(ivtree_merge(trees[0], trees[1]) == 0);
+	assert(ut_ivtree_check(trees[0]) >= 0);
+
+	for(int64_t q = 0; q < 10300; q += 211) {
+		int64_t exp = 0, found = 0;
+		for(int64_t i = 0; i < cnt; i++) {
+			exp += (nodes[i]->h.rkey > q && nodes[i]->h.lkey < q + 50);
+		}
+		ivtree_iter_t *iter = ivtree_intersect(trees[0], q, q + 50);
+		while(ivtree_next(iter) != NULL) { found++; }
+		ivtree_iter_clean(iter);
+		assert(found == exp, "q(%lld), found(%lld), exp(%lld)", q, found, exp);
+	}
+
+	free(nodes);
+	ivtree_clean(trees[1]);
+	ivtree_clean(trees[0]);
+}
+
+#ifdef RBTREE_KEY128
+/* 128-bit composite keys */
+unittest()
+{
+	int64_t const cnt = 4000;
+	rbtree_t *tree = rbtree_init(sizeof(rbtree_node_t), NULL);
+	ivtree_t *iv = ivtree_init(sizeof(ivtree_node_t), NULL);
+	rbtree_key_t *keys = (rbtree_key_t *)malloc(sizeof(rbtree_key_t) * cnt);
+
+	/* (contig, position), positions across the top bit of the low word */
+	for(int64_t i = 0; i < cnt; i++) {
+		keys[i] = RBTREE_KEY(i % 5 - 2, (uint64_t)((i * 7919) % 1000)<<54);
+		rbtree_node_t *n = (rbtree_node_t *)rbtree_create_node(tree);
+		n->key = keys[i];
+		rbtree_insert(tree, (RBTREE_NODE_T *)n);
+		ivtree_node_t *v = (ivtree_node_t *)ivtree_create_node(iv);
+		v->lkey = keys[i];
+		v->rkey = keys[i] + ((rbtree_key_t)(i % 7 + 1)<<56);
+		ivtree_insert(iv, (IVTREE_NODE_T *)v);
+	}
+	qsort(keys, cnt, sizeof(rbtree_key_t), ut_cmp_key);
+	assert(RBTREE_KEY(-1, UINT64_MAX) < RBTREE_KEY(0, 0) && RBTREE_KEY(0, 1ULL<<63) > RBTREE_KEY(0, 1));
+
+	/* in order */
+	rbtree_node_t *n = (rbtree_node_t *)rbtree_search_key_right(tree, RBTREE_KEY_MIN);
+	assert(n == rbtree_first(tree));
+	for(int64_t i = 0; i < cnt; i++) {
+		assert(n != NULL && n->key == keys[i], "i(%lld)", i);
+		n = (rbtree_node_t *)rbtree_right(tree, (RBTREE_NODE_T *)n);
+	}
+	assert(n == NULL && rbtree_search_key_left(tree, RBTREE_KEY_MAX) == rbtree_last(tree));
+
+	/* searches and ranges against the sorted array */
+	for(int64_t c = -3; c <= 3; c++) {
+		for(uint64_t p = 0; p < 1024; p += 37) {
+			rbtree_key_t q = RBTREE_KEY(c, p<<54), r = q + ((rbtree_key_t)100<<54);
+			int64_t j = 0, k = 0;
+			while(j < cnt && keys[j] < q) { j++; }
+			while(k < cnt && keys[k] < r) { k++; }
+
+			n = (rbtree_node_t *)rbtree_search_key_right(tree, q);
+			assert(n == NULL ? j == cnt : n->key == keys[j], "c(%lld), p(%llu)", c, p);
+			n = (rbtree_node_t *)rbtree_search_key(tree, q);
+			assert((n != NULL) == (j < cnt && keys[j] == q), "c(%lld), p(%llu)", c, p);
+
+			int64_t found = 0;
+			rbtree_iter_t *iter = rbtree_range(tree, q, r);
+			while(rbtree_iter_next(iter) != NULL) { found++; }
+			rbtree_iter_clean(iter);
+			assert(found == k - j, "c(%lld), p(%llu)", c, p);
+
+			/* intersections against the brute force */
+			int64_t exp = 0;
+			found = 0;
+			ivtree_iter_t *ivi = ivtree_intersect(iv, q, r);
+			while(ivtree_next(ivi) != NULL) { found++; }
+			ivtree_iter_clean(ivi);
+			for(ivtree_node_t *v = (ivtree_node_t *)rbtree_search_key_right((rbtree_t *)iv, RBTREE_KEY_MIN); v != NULL;
+				v = (ivtree_node_t *)rbtree_right((rbtree_t *)iv, (RBTREE_NODE_T *)v)) {
+				exp += (v->rkey > q && v->lkey < r);
+			}
+			assert(found == exp, "c(%lld), p(%llu), found(%lld), exp(%lld)", c, p, found, exp);
+		}
+	}
+
+	/* drop a whole contig */
+	assert(rbtree_remove_range(tree, RBTREE_KEY(0, 0), RBTREE_KEY(1, 0), NULL, NULL) == (uint64_t)cnt / 5);
+	assert(rbtree_search_key_right(tree, RBTREE_KEY(0, 0)) == rbtree_search_key_right(tree, RBTREE_KEY(1, 0)));
+
+	free(keys);
+	ivtree_clean(iv);
+	rbtree_clean(tree);
+}
+#endif
+
+/* byte-string tree test */
+/**
+ * @fn ut_strnode_cmp
+ */
+static
+int ut_strnode_cmp(
+	void const *a,
+	void const *b)
+{
+	strtree_node_t const *x = *(strtree_node_t const **)a, *y = *(strtree_node_t const **)b;
+	uint64_t min = x->len < y->len ? x->len : y->len;
+	int c = memcmp(x->str, y->str, min);
+	return(c != 0 ? c : (x->len > y->len) - (x->len < y->len));
+}
+
+unittest()
+{
+	int64_t const cnt = 3000;
+	strtree_t *tree = strtree_init(sizeof(strtree_node_t), NULL);
+	uint8_t *buf = (uint8_t *)malloc(cnt * 24);
+	strtree_node_t **nodes = (strtree_node_t **)malloc(sizeof(void *) * cnt);
+	strtree_node_t **sorted = (strtree_node_t **)malloc(sizeof(void *) * cnt);
+	assert(strtree_init(sizeof(strtree_node_t), STRTREE_PARAMS( .layout = RBTREE_LAYOUT_IDX32 )) == NULL);
+
+	/* common prefixes longer than 8 bytes, bytes above 0x7f, and empty strings */
+	for(int64_t i = 0; i < cnt; i++) {
+		uint8_t *str = &buf[i * 24];
+		uint64_t r = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+		uint64_t len = (r >> 32) % 21;
+		for(uint64_t j = 0; j < len; j++) {
+			str[j] = (j < 10) ? "/usr/lib/x"[j] : (uint8_t)(0x7e + ((r >> (2 * j)) & 3));
+		}
+		if((i & 7) == 0 && len > 3) { str[3] = 0xff; }
+		nodes[i] = (strtree_node_t *)strtree_create_node(tree);
+		nodes[i]->str = str;
+		nodes[i]->len = len;
+		strtree_insert(tree, (STRTREE_NODE_T *)nodes[i]);
+	}
+
+	/* in order, equal strings in the insertion order */
+	memcpy(sorted, nodes, sizeof(void *) * cnt);
+	qsort(sorted, cnt, sizeof(void *), ut_strnode_cmp);
+	strtree_node_t *node = (strtree_node_t *)rbtree_first(tree);
+	for(int64_t i = 0; i < cnt; i++) {
+		assert(node != NULL && ut_strnode_cmp(&node, &sorted[i]) == 0, "i(%lld)", i);
+		strtree_node_t *next = (strtree_node_t *)rbtree_right(tree, node);
+		if(i == cnt - 1) { assert(node == rbtree_last(tree) && next == NULL); }
+		node = next;
+	}
+
+	/* search and prefix scans against brute force */
+	for(int64_t i = 0; i < cnt; i += 7) {
+		strtree_node_t *found = (strtree_node_t *)strtree_search_key(tree, nodes[i]->str, nodes[i]->len);
+		assert(found != NULL && ut_strnode_cmp(&found, &nodes[i]) == 0, "i(%lld)", i);
+		found = (strtree_node_t *)strtree_search_key_right(tree, nodes[i]->str, nodes[i]->len);
+		assert(rbtree_left(tree, found) == NULL
+			|| ut_strnode_cmp(&(strtree_node_t *){ rbtree_left(tree, found) }, &nodes[i]) < 0);
+
+		for(uint64_t plen = 0; plen <= nodes[i]->len; plen += 3) {
+			int64_t exp = 0, n = 0;
+			for(int64_t j = 0; j < cnt; j++) {
+				exp += (nodes[j]->len >= plen && memcmp(nodes[j]->str, nodes[i]->str, plen) == 0);
+			}
+			for(STRTREE_NODE_T *p = strtree_search_prefix(tree, nodes[i]->str, plen); p != NULL;
+				p = strtree_next_prefix(tree, p, nodes[i]->str, plen)) {
+				n++;
+			}
+			assert(n == exp, "i(%lld), plen(%llu), n(%lld), exp(%lld)", i, plen, n, exp);
+		}
+	}
+	assert(strtree_search_key(tree, "/usr/lib/y", 10) == NULL);
+	assert(strtree_search_prefix(tree, "/usr/lib/y", 10) == NULL);
+
+	/* remove half, the extremes follow */
+	for(int64_t i = 0; i < cnt; i += 2) {
+		strtree_remove(tree, (STRTREE_NODE_T *)nodes[i]);
+	}
+	int64_t n = 0;
+	strtree_node_t *prev = NULL;
+	for(node = (strtree_node_t *)rbtree_first(tree); node != NULL; node = (strtree_node_t *)rbtree_right(tree, node)) {
+		assert(prev == NULL || ut_strnode_cmp(&prev, &node) <= 0);
+		prev = node;
+		n++;
+	}
+	assert(n == cnt / 2 && prev == rbtree_last(tree));
+
+	strtree_clean(tree);
+	free(sorted);
+	free(nodes);
+	free(buf);
+}
+
 /**
  * end of tree.c
  */
@@ -10,6 +10,20 @@
 #include <stdint.h>
 
 
+/**
+ * @type rbtree_key_t
+ * @brief 64-bit key, or 128-bit with RBTREE_KEY128 ordered as (signed high word, unsigned low word)
+ */
+#ifdef RBTREE_KEY128
+__extension__ typedef __int128 rbtree_key_t;
+#  define RBTREE_KEY(hi, lo)		( (rbtree_key_t)(((unsigned __int128)(uint64_t)(hi) << 64) | (uint64_t)(lo)) )
+#  define RBTREE_KEY_MAX			( (rbtree_key_t)(~(unsigned __int128)0 >> 1) )
+#else
+typedef int64_t rbtree_key_t;
+#  define RBTREE_KEY_MAX			( INT64_MAX )
+#endif
+#define RBTREE_KEY_MIN				( -RBTREE_KEY_MAX - 1 )
+
 /**
  * @type rbtree_t
  */
@@ -20,22 +34,93 @@ typedef struct rbtree_s rbtree_t;
  * @brief object must have a rbtree_node_t field at the head.
  */
 struct rbtree_node_s {
+#ifdef RBTREE_COMPACT_NODE
+	int64_t zero;				/* must be zeroed if external memory is used */
+	uint8_t pad[16];
+#else
 	uint8_t pad[24];
 	int64_t zero;				/* must be zeroed if external memory is used */
-	int64_t key;
+#endif
+	rbtree_key_t key;
 };
 typedef struct rbtree_node_s rbtree_node_t;
 #define RBTREE_NODE_T 			void
 
+/**
+ * @struct rbtree_node32_s
+ * @brief node header of RBTREE_LAYOUT_IDX32 trees, links are 32-bit indices.
+ * nodes must be created with rbtree_create_node.
+ */
+struct rbtree_node32_s {
+	uint8_t pad[16];
+	rbtree_key_t key;
+};
+typedef struct rbtree_node32_s rbtree_node32_t;
+
+/**
+ * @struct rbtree_node_td_s
+ * @brief node header of RBTREE_LAYOUT_TOPDOWN trees, without the parent link
+ */
+struct rbtree_node_td_s {
+	uint8_t pad[16];
+	int64_t zero;				/* must be zeroed if external memory is used */
+	rbtree_key_t key;
+};
+typedef struct rbtree_node_td_s rbtree_node_td_t;
+
+/**
+ * @struct rbtree_bag_node_s
+ * @brief node header of RBTREE_BAG trees (RBTREE_LAYOUT_PTR only)
+ */
+struct rbtree_bag_node_s {
+	rbtree_node_t node;
+	void *chain[2];				/* the nodes of the same key, managed by the tree */
+};
+typedef struct rbtree_bag_node_s rbtree_bag_node_t;
+
+/**
+ * @enum rbtree_layout
+ */
+enum rbtree_layout {
+	RBTREE_LAYOUT_PTR = 0,		/* pointer links, rbtree_node_t (default) */
+	RBTREE_LAYOUT_IDX32 = 1,	/* 32-bit index links, rbtree_node32_t, up to 2^31 - 1 nodes */
+	RBTREE_LAYOUT_TOPDOWN = 2	/* no parent links, rbtree_node_td_t, rbtree only */
+};
+
+/**
+ * @enum rbtree_flags
+ */
+enum rbtree_flags {
+	RBTREE_ORDER_STAT = 0x01,	/* maintain subtree sizes for rbtree_rank and rbtree_select */
+	RBTREE_BAG = 0x02,			/* chain the nodes of an equal key off one tree node, rbtree_bag_node_t */
+	RBTREE_PERSISTENT = 0x04,	/* versions by rbtree_snapshot, RBTREE_LAYOUT_TOPDOWN with unique keys only */
+	RBTREE_CONCURRENT = 0x08	/* persistent, with lock-free readers by rbtree_read_lock */
+};
+
+/**
+ * @type rbtree_update_t
+ * @brief recompute the augmented value of node from its children (NULL if absent), returns non-zero if it changed
+ */
+typedef int (*rbtree_update_t)(RBTREE_NODE_T *node, RBTREE_NODE_T *left, RBTREE_NODE_T *right, void *ctx);
+
 /**
  * @struct rbtree_params_s
  */
 struct rbtree_params_s {
 	void *lmm;
+	uint32_t layout;			/* enum rbtree_layout */
+	uint32_t flags;				/* enum rbtree_flags */
+	rbtree_update_t update;		/* augmentation, RBTREE_LAYOUT_PTR only */
+	void *update_ctx;
 };
 typedef struct rbtree_params_s rbtree_params_t;
 #define RBTREE_PARAMS(...)		( &((struct rbtree_params_s const) { __VA_ARGS__ }) )
 
+/**
+ * @type rbtree_iter_t
+ */
+typedef struct rbtree_iter_s rbtree_iter_t;
+
 /**
  * @fn rbtree_init
  */
@@ -51,6 +136,31 @@ void rbtree_clean(rbtree_t *tree);
  */
 void rbtree_flush(rbtree_t *tree);
 
+/**
+ * @fn rbtree_snapshot
+ * @brief a version of a RBTREE_PERSISTENT tree in O(1), unaffected by the later writes to either
+ */
+rbtree_t *rbtree_snapshot(rbtree_t *tree);
+
+/**
+ * @type rbtree_reader_t
+ */
+typedef struct rbtree_reader_s rbtree_reader_t;
+
+/**
+ * @fn rbtree_reader_init, rbtree_reader_clean
+ * @brief register (release) a reader thread of a RBTREE_CONCURRENT tree, serialized with the writer
+ */
+rbtree_reader_t *rbtree_reader_init(rbtree_t *tree);
+void rbtree_reader_clean(rbtree_reader_t *reader);
+
+/**
+ * @fn rbtree_read_lock, rbtree_read_unlock
+ * @brief the version published last as a read-only tree, kept from being freed until unlocked
+ */
+rbtree_t *rbtree_read_lock(rbtree_reader_t *reader);
+void rbtree_read_unlock(rbtree_reader_t *reader);
+
 /**
  * @fn rbtree_create_node
  * @brief create a new node (not inserted in the tree)
@@ -63,29 +173,143 @@ RBTREE_NODE_T *rbtree_create_node(rbtree_t *tree);
  */
 void rbtree_insert(rbtree_t *tree, RBTREE_NODE_T *node);
 
+/**
+ * @fn rbtree_insert_hint
+ * @brief insert a node, starting the descent from hint (a node in the tree or NULL) instead of the root
+ */
+void rbtree_insert_hint(rbtree_t *tree, RBTREE_NODE_T *node, RBTREE_NODE_T const *hint);
+
+/**
+ * @fn rbtree_insert_unique
+ * @brief insert a node unless the key is in the tree, returns 1 with the node found in *existing
+ */
+int rbtree_insert_unique(rbtree_t *tree, RBTREE_NODE_T *node, RBTREE_NODE_T **existing);
+
 /**
  * @fn rbtree_remove
  * @brief remove a node, automatically freed if malloc'd with rbtree_reserve_node
  */
 void rbtree_remove(rbtree_t *tree, RBTREE_NODE_T *node);
 
+/**
+ * @fn rbtree_remove_key
+ * @brief unlink the leftmost node of key and return it (not freed), NULL if none
+ */
+RBTREE_NODE_T *rbtree_remove_key(rbtree_t *tree, rbtree_key_t key);
+
+/**
+ * @fn rbtree_update_key
+ * @brief change the key of a node in the tree, in place if it stays between its neighbors
+ */
+void rbtree_update_key(rbtree_t *tree, RBTREE_NODE_T *node, rbtree_key_t key);
+
+/**
+ * @fn rbtree_free_node
+ * @brief free a node not in the tree (e.g. popped), if malloc'd with rbtree_create_node
+ */
+void rbtree_free_node(rbtree_t *tree, RBTREE_NODE_T *node);
+
+/**
+ * @fn rbtree_first
+ * @brief the leftmost node in O(1), NULL if empty
+ */
+RBTREE_NODE_T *rbtree_first(rbtree_t *tree);
+
+/**
+ * @fn rbtree_last
+ * @brief the rightmost node in O(1), NULL if empty
+ */
+RBTREE_NODE_T *rbtree_last(rbtree_t *tree);
+
+/**
+ * @fn rbtree_pop_first
+ * @brief unlink and return the leftmost node (not freed), NULL if empty
+ */
+RBTREE_NODE_T *rbtree_pop_first(rbtree_t *tree);
+
+/**
+ * @fn rbtree_pop_last
+ * @brief unlink and return the rightmost node (not freed), NULL if empty
+ */
+RBTREE_NODE_T *rbtree_pop_last(rbtree_t *tree);
+
+/**
+ * @fn rbtree_build_sorted
+ * @brief flush the tree and build a balanced tree from keys sorted in ascending order, returning the leftmost node
+ */
+RBTREE_NODE_T *rbtree_build_sorted(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt);
+
+/**
+ * @fn rbtree_insert_batch
+ * @brief insert nodes at once, the array is sorted by key on return
+ */
+void rbtree_insert_batch(rbtree_t *tree, RBTREE_NODE_T **nodes, uint64_t cnt);
+
 /**
  * @fn rbtree_search_key
  * @brief search a node by key, returning the leftmost node
  */
-RBTREE_NODE_T *rbtree_search_key(rbtree_t *tree, int64_t key);
+RBTREE_NODE_T *rbtree_search_key(rbtree_t *tree, rbtree_key_t key);
 
 /**
  * @fn rbtree_search_key_left
  * @brief search a node by key. returns the nearest node in the left half of the tree if key was not found.
  */
-RBTREE_NODE_T *rbtree_search_key_left(rbtree_t *tree, int64_t key);
+RBTREE_NODE_T *rbtree_search_key_left(rbtree_t *tree, rbtree_key_t key);
 
 /**
  * @fn rbtree_search_key_right
  * @brief search a node by key. returns the nearest node in the right half of the tree if key was not found.
  */
-RBTREE_NODE_T *rbtree_search_key_right(rbtree_t *tree, int64_t key);
+RBTREE_NODE_T *rbtree_search_key_right(rbtree_t *tree, rbtree_key_t key);
+
+/**
+ * @fn rbtree_equal_range
+ * @brief the leftmost node of key, and the rightmost one in *last. NULL (and *last) if none.
+ */
+RBTREE_NODE_T *rbtree_equal_range(rbtree_t *tree, rbtree_key_t key, RBTREE_NODE_T **last);
+
+/**
+ * @fn rbtree_count_key
+ * @brief the number of nodes of key
+ */
+uint64_t rbtree_count_key(rbtree_t *tree, rbtree_key_t key);
+
+/**
+ * @fn rbtree_search_keys
+ * @brief search cnt keys at once, interleaving the lookups. out[i] is the leftmost node of keys[i] or NULL
+ */
+void rbtree_search_keys(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
+
+/**
+ * @fn rbtree_search_keys_left
+ * @brief batched rbtree_search_key_left
+ */
+void rbtree_search_keys_left(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
+
+/**
+ * @fn rbtree_search_keys_right
+ * @brief batched rbtree_search_key_right
+ */
+void rbtree_search_keys_right(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
+
+/**
+ * @fn rbtree_search_sorted_keys
+ * @brief search ascending keys, each lookup starts from the previous result (finger search). out[i] is the leftmost node of keys[i] or NULL
+ */
+void rbtree_search_sorted_keys(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
+
+/**
+ * @fn rbtree_search_sorted_keys_left
+ * @brief finger-search version of rbtree_search_keys_left
+ */
+void rbtree_search_sorted_keys_left(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
+
+/**
+ * @fn rbtree_search_sorted_keys_right
+ * @brief finger-search version of rbtree_search_keys_right
+ */
+void rbtree_search_sorted_keys_right(rbtree_t *tree, rbtree_key_t const *keys, uint64_t cnt, RBTREE_NODE_T **out);
 
 /**
  * @fn rbtree_left
@@ -99,6 +323,79 @@ RBTREE_NODE_T *rbtree_left(rbtree_t *tree, RBTREE_NODE_T const *node);
  */
 RBTREE_NODE_T *rbtree_right(rbtree_t *tree, RBTREE_NODE_T const *node);
 
+/**
+ * @fn rbtree_range, rbtree_range_reverse
+ * @brief range cursor over [lkey, rkey) in the ascending / descending order, walking an explicit path stack
+ */
+rbtree_iter_t *rbtree_range(rbtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
+rbtree_iter_t *rbtree_range_reverse(rbtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
+
+/**
+ * @fn rbtree_iter_next
+ * @brief the next node in the range, NULL at the end
+ */
+RBTREE_NODE_T *rbtree_iter_next(rbtree_iter_t *iter);
+
+/**
+ * @fn rbtree_iter_next_batch
+ * @brief fill out with up to cnt next nodes, returns the number filled
+ */
+uint64_t rbtree_iter_next_batch(rbtree_iter_t *iter, RBTREE_NODE_T **out, uint64_t cnt);
+
+/**
+ * @fn rbtree_iter_clean
+ */
+void rbtree_iter_clean(rbtree_iter_t *iter);
+
+/**
+ * @fn rbtree_rank
+ * @brief the number of nodes with keys less than key, O(log n) with RBTREE_ORDER_STAT
+ */
+uint64_t rbtree_rank(rbtree_t *tree, rbtree_key_t key);
+
+/**
+ * @fn rbtree_select
+ * @brief the k-th (0-origin) node in the ascending order or NULL, O(log n) with RBTREE_ORDER_STAT
+ */
+RBTREE_NODE_T *rbtree_select(rbtree_t *tree, uint64_t k);
+
+/**
+ * @fn rbtree_count_range
+ * @brief the number of nodes with keys in [lkey, rkey)
+ */
+uint64_t rbtree_count_range(rbtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
+
+/**
+ * @fn rbtree_update_node
+ * @brief propagate the augmented value, must be called when the payload it depends on is modified
+ */
+void rbtree_update_node(rbtree_t *tree, RBTREE_NODE_T *node);
+
+/**
+ * @fn rbtree_cover
+ * @brief decompose [lkey, rkey) into O(log n) single nodes (subtree == 0) and whole subtrees (subtree != 0)
+ */
+typedef void (*rbtree_cover_t)(RBTREE_NODE_T *node, int subtree, void *ctx);
+void rbtree_cover(rbtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey, rbtree_cover_t fn, void *ctx);
+
+/**
+ * @fn rbtree_split
+ * @brief split at key in O(log n), *left (the tree itself) keeps the keys below key and *right (new) the rest. -1 if not RBTREE_LAYOUT_PTR
+ */
+int rbtree_split(rbtree_t *tree, rbtree_key_t key, rbtree_t **left, rbtree_t **right);
+
+/**
+ * @fn rbtree_join
+ * @brief move all the nodes of b into a in O(log n), no key in a may be above those in b. -1 if not joinable
+ */
+int rbtree_join(rbtree_t *a, rbtree_t *b);
+
+/**
+ * @fn rbtree_merge
+ * @brief move all the nodes of src into dst in O(n + m), rebuilt balanced without allocation. -1 if not joinable
+ */
+int rbtree_merge(rbtree_t *dst, rbtree_t *src);
+
 /**
  * @fn rbtree_walk
  * @breif iterate over tree
@@ -106,6 +403,45 @@ RBTREE_NODE_T *rbtree_right(rbtree_t *tree, RBTREE_NODE_T const *node);
 typedef void (*rbtree_walk_t)(RBTREE_NODE_T *node, void *ctx);
 void rbtree_walk(rbtree_t *tree, rbtree_walk_t fn, void *ctx);
 
+/**
+ * @enum rbtree_walk_e
+ * @brief return values of rbtree_visit_t
+ */
+enum rbtree_walk_e {
+	RBTREE_WALK_CONTINUE = 0,
+	RBTREE_WALK_SKIP,				/* skip the right subtree of the node */
+	RBTREE_WALK_STOP
+};
+
+/**
+ * @fn rbtree_walk_inorder
+ * @brief reentrant in-order walk, fn returns enum rbtree_walk_e. RBTREE_WALK_STOP if stopped
+ */
+typedef int (*rbtree_visit_t)(RBTREE_NODE_T *node, void *ctx);
+int rbtree_walk_inorder(rbtree_t *tree, rbtree_visit_t fn, void *ctx);
+
+/**
+ * @fn rbtree_walk_parallel
+ * @brief walk disjoint subtrees on threads threads, fn is called concurrently in no particular order
+ */
+int rbtree_walk_parallel(rbtree_t *tree, rbtree_visit_t fn, void *ctx, uint64_t threads);
+
+/**
+ * @fn rbtree_remove_range
+ * @brief remove the nodes with keys in [lkey, rkey) in O(log n + k), fn is called on those not malloc'd with rbtree_create_node
+ */
+uint64_t rbtree_remove_range(rbtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey, rbtree_walk_t fn, void *ctx);
+
+/**
+ * @fn rbtree_union, rbtree_intersect, rbtree_difference
+ * @brief set operations by key, the result is left in a and b is emptied. split and join in parallel on up to threads threads.
+ * the nodes dropped are freed if malloc'd with rbtree_create_node, or passed to fn otherwise. -1 if not joinable
+ * update of an augmented tree is called on the threads at once with the same update_ctx, and must be thread-safe if threads > 1
+ */
+int rbtree_union(rbtree_t *a, rbtree_t *b, uint64_t threads, rbtree_walk_t fn, void *ctx);
+int rbtree_intersect(rbtree_t *a, rbtree_t *b, uint64_t threads, rbtree_walk_t fn, void *ctx);
+int rbtree_difference(rbtree_t *a, rbtree_t *b, uint64_t threads, rbtree_walk_t fn, void *ctx);
+
 
 
 
@@ -121,15 +457,32 @@ typedef struct rbtree_s ivtree_t;
  * @struct ivtree_node_s
  */
 struct ivtree_node_s {
+#ifdef RBTREE_COMPACT_NODE
+	int64_t zero;				/* must be zeroed if external memory is used */
+	uint8_t pad[16];
+#else
 	uint8_t pad[24];
 	int64_t zero;				/* must be zeroed if external memory is used */
-	int64_t lkey;
-	int64_t rkey;
-	int64_t reserved;
+#endif
+	rbtree_key_t lkey;
+	rbtree_key_t rkey;
+	rbtree_key_t reserved;
 };
 typedef struct ivtree_node_s ivtree_node_t;
 #define IVTREE_NODE_T 			void
 
+/**
+ * @struct ivtree_node32_s
+ * @brief node header of RBTREE_LAYOUT_IDX32 interval trees
+ */
+struct ivtree_node32_s {
+	uint8_t pad[16];
+	rbtree_key_t lkey;
+	rbtree_key_t rkey;
+	rbtree_key_t reserved;
+};
+typedef struct ivtree_node32_s ivtree_node32_t;
+
 /**
  * @type ivtree_iter_t
  */
@@ -138,7 +491,7 @@ typedef struct ivtree_iter_s ivtree_iter_t;
 /**
  * @type ivtree_params_s
  */
-typedef struct rvtree_params_s ivtree_params_t;
+typedef struct rbtree_params_s ivtree_params_t;
 #define IVTREE_PARAMS(...)		( &((struct rbtree_params_s const) { __VA_ARGS__ }) )
 
 /**
@@ -174,23 +527,59 @@ void ivtree_insert(ivtree_t *tree, IVTREE_NODE_T *node);
  */
 void ivtree_remove(ivtree_t *tree, IVTREE_NODE_T *node);
 
+/**
+ * @fn ivtree_build_sorted
+ * @brief flush the tree and build a balanced tree from (lkey, rkey) pairs sorted by lkey, returning the leftmost node
+ */
+IVTREE_NODE_T *ivtree_build_sorted(ivtree_t *tree, rbtree_key_t const *keys, uint64_t cnt);
+
+/**
+ * @fn ivtree_insert_batch
+ * @brief insert nodes at once, the array is sorted by lkey on return
+ */
+void ivtree_insert_batch(ivtree_t *tree, IVTREE_NODE_T **nodes, uint64_t cnt);
+
+/**
+ * @fn ivtree_split
+ * @brief split at key (by lkey) in O(log n), keeping rkey_max. see rbtree_split
+ */
+int ivtree_split(ivtree_t *tree, rbtree_key_t key, ivtree_t **left, ivtree_t **right);
+
+/**
+ * @fn ivtree_join
+ * @brief move all the nodes of b into a in O(log n), keeping rkey_max. see rbtree_join
+ */
+int ivtree_join(ivtree_t *a, ivtree_t *b);
+
+/**
+ * @fn ivtree_merge
+ * @brief move all the nodes of src into dst in O(n + m), rebuilding rkey_max. see rbtree_merge
+ */
+int ivtree_merge(ivtree_t *dst, ivtree_t *src);
+
 /**
  * @fn ivtree_contained
  * @brief return a set of sections contained in [lkey, rkey)
  */
-ivtree_iter_t *ivtree_contained(ivtree_t *tree, int64_t lkey, int64_t rkey);
+ivtree_iter_t *ivtree_contained(ivtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
 
 /**
  * @fn ivtree_containing
  * @brief return a set of sections containing [lkey, rkey)
  */
-ivtree_iter_t *ivtree_containing(ivtree_t *tree, int64_t lkey, int64_t rkey);
+ivtree_iter_t *ivtree_containing(ivtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
 
 /**
  * @fn ivtree_intersect
  * @brief return a set of sections intersect with [lkey, rkey)
  */
-ivtree_iter_t *ivtree_intersect(ivtree_t *tree, int64_t lkey, int64_t rkey);
+ivtree_iter_t *ivtree_intersect(ivtree_t *tree, rbtree_key_t lkey, rbtree_key_t rkey);
+
+/**
+ * @fn ivtree_intersect_sorted
+ * @brief re-target iter (NULL to create) to [lkey, rkey), searching the start node from the previous query. lkey should be ascending over the calls
+ */
+ivtree_iter_t *ivtree_intersect_sorted(ivtree_t *tree, ivtree_iter_t *iter, rbtree_key_t lkey, rbtree_key_t rkey);
 
 /**
  * @fn ivtree_next
@@ -210,6 +599,95 @@ typedef void (*ivtree_walk_t)(IVTREE_NODE_T *node, void *ctx);
 void ivtree_walk(ivtree_t *tree, ivtree_walk_t fn, void *ctx);
 
 
+
+/* byte-string tree implementation */
+
+
+/**
+ * @type strtree_t
+ */
+typedef struct rbtree_s strtree_t;
+
+/**
+ * @struct strtree_node_s
+ * @brief nodes are ordered by the bytes of str (memcmp, then len). the first 8 bytes (16 with
+ * RBTREE_KEY128) are cached in prefix, so that str is read only when the prefixes tie.
+ */
+struct strtree_node_s {
+#ifdef RBTREE_COMPACT_NODE
+	int64_t zero;				/* must be zeroed if external memory is used */
+	uint8_t pad[16];
+#else
+	uint8_t pad[24];
+	int64_t zero;				/* must be zeroed if external memory is used */
+#endif
+	rbtree_key_t prefix;			/* set by strtree_insert */
+	uint8_t const *str;			/* not copied, must not be modified in the tree */
+	uint64_t len;
+};
+typedef struct strtree_node_s strtree_node_t;
+#define STRTREE_NODE_T 			void
+
+/**
+ * @type strtree_params_s
+ */
+typedef struct rbtree_params_s strtree_params_t;
+#define STRTREE_PARAMS(...)		( &((struct rbtree_params_s const) { __VA_ARGS__ }) )
+
+/**
+ * @fn strtree_init
+ * @brief RBTREE_LAYOUT_PTR only, without flags and augmentation
+ */
+strtree_t *strtree_init(uint64_t object_size, strtree_params_t const *params);
+
+/**
+ * @fn strtree_clean
+ */
+void strtree_clean(strtree_t *tree);
+
+/**
+ * @fn strtree_flush
+ */
+void strtree_flush(strtree_t *tree);
+
+/**
+ * @fn strtree_create_node
+ * @brief create a new node (not inserted in the tree)
+ */
+STRTREE_NODE_T *strtree_create_node(strtree_t *tree);
+
+/**
+ * @fn strtree_insert
+ * @brief insert a node by str and len
+ */
+void strtree_insert(strtree_t *tree, STRTREE_NODE_T *node);
+
+/**
+ * @fn strtree_remove
+ * @brief remove a node
+ */
+void strtree_remove(strtree_t *tree, STRTREE_NODE_T *node);
+
+/**
+ * @fn strtree_search_key
+ * @brief search a node by string, returning the leftmost node
+ */
+STRTREE_NODE_T *strtree_search_key(strtree_t *tree, void const *str, uint64_t len);
+
+/**
+ * @fn strtree_search_key_right
+ * @brief the leftmost node not below the string, NULL if none
+ */
+STRTREE_NODE_T *strtree_search_key_right(strtree_t *tree, void const *str, uint64_t len);
+
+/**
+ * @fn strtree_search_prefix, strtree_next_prefix
+ * @brief scan the nodes starting with prefix in order, NULL at the end
+ */
+STRTREE_NODE_T *strtree_search_prefix(strtree_t *tree, void const *prefix, uint64_t len);
+STRTREE_NODE_T *strtree_next_prefix(strtree_t *tree, STRTREE_NODE_T const *node, void const *prefix, uint64_t len);
+
+
 #endif
 /**
  * end of tree.h